@@ -0,0 +1,845 @@
+/* analyze.c
+ * Created October, 2026
+ *
+ * (See LICENSE.txt)
+ *
+ * Reads a pcap file of dnscat2 DNS traffic, puts the sessions back together,
+ * and reports where the bytes went:
+ *
+ * - ip/udp    - IP and UDP headers
+ * - dns       - everything in the DNS message that isn't our encoded data
+ *               (header, the question echoed in the answer, record framing,
+ *               and the domain name)
+ * - encoding  - the difference between the encoded data and the raw data
+ *               (hex doubling, periods, A/AAAA padding)
+ * - dnscat    - dnscat2 packet headers
+ * - retrans   - data that had already been sent once
+ * - duplicate - DNS messages that were exact repeats (resolver retries and
+ *               duplicate answers); these are counted here in their entirety
+ * - goodput   - new data
+ *
+ * Along with that, for each session: round-trip times (queries are matched
+ * to answers by transaction id and name), queries that never got an answer,
+ * and a timeline.
+ *
+ * Usage: analyze [-d <domain>] [-p <port>] [-i <seconds>] <file.pcap>
+ *
+ * Without a domain, names are expected to start with "dnscat.", like the
+ * client does when it's run without one.
+ */
+
+#include <ctype.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dns.h"
+#include "driver_dns.h"
+#include "log.h"
+#include "memory.h"
+#include "packet.h"
+#include "types.h"
+
+#define WILDCARD_PREFIX "dnscat."
+
+/* pcap link types we know how to take apart. */
+#define LINKTYPE_NULL      0
+#define LINKTYPE_ETHERNET  1
+#define LINKTYPE_RAW       101
+#define LINKTYPE_LINUX_SLL 113
+
+typedef enum
+{
+  DIR_UP   = 0, /* Queries (client to server) */
+  DIR_DOWN = 1, /* Answers (server to client) */
+} direction_t;
+
+static char *direction_names[] = { "up (queries)", "down (answers)" };
+
+typedef struct
+{
+  size_t messages;
+  size_t empty;
+
+  size_t wire;
+  size_t ip_udp;
+  size_t dns;
+  size_t encoding;
+  size_t dnscat;
+  size_t retrans;
+  size_t duplicate;
+  size_t goodput;
+} usage_t;
+
+/* One slice of a session's timeline. */
+typedef struct
+{
+  size_t queries;
+  size_t answered;
+  size_t lost;
+  size_t retransmits;
+  double rtt_total;
+  size_t goodput[2];
+} bucket_t;
+
+typedef struct _analyze_session_t
+{
+  uint32_t  id;
+  options_t options;
+
+  /* The next sequence number we expect in each direction, and for chunked
+   * sessions a bitmap of the chunks we've seen. */
+  NBBOOL    have_seq[2];
+  uint32_t  next_seq[2];
+  uint8_t  *chunks[2];
+  size_t    chunks_size[2];
+
+  usage_t   usage[2];
+
+  size_t    answered;
+  size_t    lost;
+  double    rtt_min;
+  double    rtt_max;
+  double    rtt_total;
+
+  double    first_seen;
+  bucket_t *buckets;
+  size_t    bucket_count;
+
+  struct _analyze_session_t *next;
+} analyze_session_t;
+
+/* A query that we're waiting to see the answer to. */
+typedef struct _query_t
+{
+  uint16_t  trn_id;
+  char     *name;
+  double    time;
+  uint32_t  session_id;
+  NBBOOL    has_session;
+  NBBOOL    answered;
+
+  struct _query_t *next;
+} query_t;
+
+static analyze_session_t *first_session = NULL;
+static query_t           *queries[0x10000];
+
+static usage_t  totals[2];
+static usage_t  not_dnscat;
+static size_t   fragments = 0;
+
+static char    *domain   = NULL;
+static uint16_t port     = 53;
+static double   interval = 1.0;
+
+static uint16_t read16(uint8_t *p, NBBOOL swap)
+{
+  return swap ? (p[1] << 8) | p[0] : (p[0] << 8) | p[1];
+}
+
+static uint32_t read32(uint8_t *p, NBBOOL swap)
+{
+  if(swap)
+    return ((uint32_t)p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+  return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static analyze_session_t *get_session(uint32_t id, double now)
+{
+  analyze_session_t *session;
+
+  for(session = first_session; session; session = session->next)
+    if(session->id == id)
+      return session;
+
+  session = (analyze_session_t*) safe_malloc(sizeof(analyze_session_t));
+  session->id         = id;
+  session->first_seen = now;
+  session->rtt_min    = -1;
+  session->next       = first_session;
+  first_session = session;
+
+  return session;
+}
+
+static bucket_t *get_bucket(analyze_session_t *session, double now)
+{
+  size_t i = (size_t)((now - session->first_seen) / interval);
+
+  if(now < session->first_seen)
+    i = 0;
+
+  if(i >= session->bucket_count)
+  {
+    size_t new_count = i + 1;
+
+    session->buckets = (bucket_t*) safe_realloc(session->buckets, new_count * sizeof(bucket_t));
+    memset(&session->buckets[session->bucket_count], 0, (new_count - session->bucket_count) * sizeof(bucket_t));
+    session->bucket_count = new_count;
+  }
+
+  return &session->buckets[i];
+}
+
+static void add_usage(usage_t *a, usage_t *b)
+{
+  a->messages  += b->messages;
+  a->empty     += b->empty;
+  a->wire      += b->wire;
+  a->ip_udp    += b->ip_udp;
+  a->dns       += b->dns;
+  a->encoding  += b->encoding;
+  a->dnscat    += b->dnscat;
+  a->retrans   += b->retrans;
+  a->duplicate += b->duplicate;
+  a->goodput   += b->goodput;
+}
+
+/* Returns TRUE if this chunk was already seen. */
+static NBBOOL chunk_seen(analyze_session_t *session, direction_t dir, uint32_t chunk)
+{
+  size_t byte = chunk / 8;
+  NBBOOL seen;
+
+  if(byte >= session->chunks_size[dir])
+  {
+    size_t new_size = byte + 1024;
+
+    session->chunks[dir] = (uint8_t*) safe_realloc(session->chunks[dir], new_size);
+    memset(session->chunks[dir] + session->chunks_size[dir], 0, new_size - session->chunks_size[dir]);
+    session->chunks_size[dir] = new_size;
+  }
+
+  seen = (session->chunks[dir][byte] & (1 << (chunk % 8))) ? TRUE : FALSE;
+  session->chunks[dir][byte] |= (1 << (chunk % 8));
+
+  return seen;
+}
+
+/* packet_parse() gives up on the whole program if a packet is bad, so make
+ * sure it's sane first. */
+static NBBOOL is_valid_packet(uint8_t *data, size_t length, options_t options)
+{
+  size_t header = 5;
+
+  if(length < header || length > MAX_PACKET_SIZE)
+    return FALSE;
+
+  if(read16(data + 3, FALSE) == WIDE_SESSION_ID)
+    header += 4;
+  if(length < header)
+    return FALSE;
+
+  switch(data[2])
+  {
+    case PACKET_TYPE_SYN:
+      return length >= header + 4;
+    case PACKET_TYPE_MSG:
+      return length >= header + ((options & OPT_WIDE_SEQ) && !(options & OPT_CHUNKED) ? 8 : 4);
+    case PACKET_TYPE_FIN:
+      return memchr(data + header, '\0', length - header) != NULL;
+    case PACKET_TYPE_PING:
+      return memchr(data + 5, '\0', length - 5) != NULL;
+    default:
+      return FALSE;
+  }
+}
+
+/* Work out how much of a dnscat packet is data, and whether it's new. */
+static void account_packet(analyze_session_t *session, direction_t dir, packet_t *packet, size_t raw_length, usage_t *usage, double now)
+{
+  size_t data_length = 0;
+  NBBOOL is_retrans  = FALSE;
+
+  if(packet->packet_type == PACKET_TYPE_SYN)
+  {
+    /* The client's SYN has the options that decide how MSGs look, except
+     * OPT_WIDE_SEQ, which the server has to agree to. */
+    if(dir == DIR_UP)
+      session->options = packet->body.syn.options;
+    else if(!(packet->body.syn.options & OPT_WIDE_SEQ))
+      session->options &= ~OPT_WIDE_SEQ;
+
+    session->have_seq[dir] = TRUE;
+    session->next_seq[dir] = packet->body.syn.seq;
+  }
+  else if(packet->packet_type == PACKET_TYPE_MSG)
+  {
+    data_length = packet->body.msg.data_length;
+
+    if(session->options & OPT_CHUNKED)
+    {
+      /* Empty chunk requests and acknowledgements don't carry data. */
+      if(data_length > 0)
+        is_retrans = chunk_seen(session, dir, packet->body.msg.options.chunked.chunk);
+    }
+    else
+    {
+      uint32_t seq = packet->body.msg.options.normal.seq;
+
+      if(!session->have_seq[dir])
+      {
+        session->have_seq[dir] = TRUE;
+        session->next_seq[dir] = seq;
+      }
+
+      if(data_length > 0)
+      {
+        if(seq == session->next_seq[dir])
+          session->next_seq[dir] = (seq + data_length) & SEQ_MASK(session->options);
+        else
+          is_retrans = TRUE;
+      }
+    }
+
+    if(data_length == 0)
+      usage->empty++;
+  }
+
+  usage->dnscat += raw_length - data_length;
+  if(is_retrans)
+  {
+    usage->retrans += data_length;
+    get_bucket(session, now)->retransmits++;
+  }
+  else
+  {
+    usage->goodput += data_length;
+    get_bucket(session, now)->goodput[dir] += data_length;
+  }
+}
+
+/* Find the query that goes with an answer. */
+static query_t *find_query(uint16_t trn_id, char *name)
+{
+  query_t *query;
+
+  for(query = queries[trn_id]; query; query = query->next)
+    if(!strcasecmp(query->name, name))
+      return query;
+
+  return NULL;
+}
+
+/* How many characters at the end (or start) of a name aren't data. */
+static size_t domain_overhead(char *name)
+{
+  size_t length = strlen(name);
+
+  if(domain)
+  {
+    size_t domain_length = strlen(domain);
+
+    if(length > domain_length && !strcasecmp(name + length - domain_length, domain) && name[length - domain_length - 1] == '.')
+      return domain_length + 1;
+  }
+  else if(!strncasecmp(name, WILDCARD_PREFIX, strlen(WILDCARD_PREFIX)))
+  {
+    return strlen(WILDCARD_PREFIX);
+  }
+
+  return (size_t)-1;
+}
+
+static void handle_dns(uint8_t *data, size_t length, size_t wire, size_t ip_udp, direction_t dir, double now)
+{
+  dns_t             *dns;
+  query_t           *query;
+  usage_t            usage;
+  uint8_t           *raw     = NULL;
+  size_t             raw_length = 0;
+  size_t             encoded = 0;
+  char              *name;
+  analyze_session_t *session = NULL;
+
+  memset(&usage, 0, sizeof(usage_t));
+  usage.messages = 1;
+  usage.wire     = wire;
+  usage.ip_udp   = ip_udp;
+
+  /* Not even a DNS header. */
+  if(length < 12)
+  {
+    usage.dns = length;
+    add_usage(&not_dnscat, &usage);
+    return;
+  }
+
+  dns = dns_create_from_packet(data, length);
+  if(dns->question_count < 1 || domain_overhead(dns->questions[0].name) == (size_t)-1)
+  {
+    usage.dns = length;
+    add_usage(&not_dnscat, &usage);
+    dns_destroy(dns);
+    return;
+  }
+  name  = dns->questions[0].name;
+  query = find_query(dns->trn_id, name);
+
+  if(dir == DIR_UP)
+  {
+    if(query && !query->answered)
+    {
+      /* The resolver (or client) asked again before getting an answer. */
+      usage.duplicate = length;
+    }
+    else
+    {
+      encoded = strlen(name) - domain_overhead(name);
+      raw = driver_dns_decode_name(name, domain, &raw_length);
+    }
+  }
+  else
+  {
+    if(query && query->answered)
+    {
+      usage.duplicate = length;
+    }
+    else if(dns->rcode == _DNS_RCODE_SUCCESS && dns->answer_count > 0)
+    {
+      dns_type_t type = dns->answers[0].type;
+
+      if(type == _DNS_TYPE_TEXT)
+        encoded = dns->answers[0].answer->TEXT.length;
+      else if(type == _DNS_TYPE_CNAME && domain_overhead(dns->answers[0].answer->CNAME.name) != (size_t)-1)
+        encoded = strlen(dns->answers[0].answer->CNAME.name) - domain_overhead(dns->answers[0].answer->CNAME.name);
+      else if(type == _DNS_TYPE_MX && domain_overhead(dns->answers[0].answer->MX.name) != (size_t)-1)
+        encoded = strlen(dns->answers[0].answer->MX.name) - domain_overhead(dns->answers[0].answer->MX.name);
+      else if(type == _DNS_TYPE_A)
+        encoded = 4 * dns->answer_count;
+#ifndef WIN32
+      else if(type == _DNS_TYPE_AAAA)
+        encoded = 16 * dns->answer_count;
+#endif
+
+      if(encoded > 0)
+        raw = driver_dns_decode_answer(dns, domain, &raw_length);
+    }
+  }
+
+  if(raw && raw_length > 0 && raw_length <= encoded)
+  {
+    options_t options = 0;
+    uint32_t  id      = 0;
+
+    /* We need the session's options to parse a MSG. */
+    if(raw_length >= 5)
+    {
+      id = read16(raw + 3, FALSE);
+      if(id == WIDE_SESSION_ID && raw_length >= 9)
+        id = read32(raw + 5, FALSE);
+      session = get_session(id, now);
+      options = session->options;
+    }
+
+    if(is_valid_packet(raw, raw_length, options))
+    {
+      packet_t *packet = packet_parse(raw, raw_length, options);
+
+      if(packet->packet_type == PACKET_TYPE_PING)
+        session = NULL;
+
+      usage.encoding = encoded - raw_length;
+      usage.dns      = length - encoded;
+      if(session)
+        account_packet(session, dir, packet, raw_length, &usage, now);
+      else
+        usage.dnscat = raw_length;
+
+      packet_destroy(packet);
+    }
+    else
+    {
+      session = NULL;
+      usage.dns = length;
+    }
+  }
+  else if(usage.duplicate == 0)
+  {
+    usage.dns = length;
+  }
+
+  if(raw)
+    safe_free(raw);
+
+  /* Match queries and answers up. */
+  if(dir == DIR_UP && !query)
+  {
+    query = (query_t*) safe_malloc(sizeof(query_t));
+    query->trn_id      = dns->trn_id;
+    query->name        = safe_strdup(name);
+    query->time        = now;
+    query->session_id  = session ? session->id : 0;
+    query->has_session = session ? TRUE : FALSE;
+    query->next        = queries[dns->trn_id];
+    queries[dns->trn_id] = query;
+
+    if(session)
+      get_bucket(session, now)->queries++;
+  }
+  else if(dir == DIR_DOWN && query && !query->answered)
+  {
+    query->answered = TRUE;
+
+    if(query->has_session)
+    {
+      double             rtt     = now - query->time;
+      analyze_session_t *s       = get_session(query->session_id, query->time);
+      bucket_t          *bucket  = get_bucket(s, query->time);
+
+      bucket->answered++;
+      bucket->rtt_total += rtt;
+
+      s->answered++;
+      s->rtt_total += rtt;
+      if(s->rtt_min < 0 || rtt < s->rtt_min)
+        s->rtt_min = rtt;
+      if(rtt > s->rtt_max)
+        s->rtt_max = rtt;
+    }
+  }
+
+  if(session)
+    add_usage(&session->usage[dir], &usage);
+  else if(usage.duplicate == 0)
+    add_usage(&not_dnscat, &usage);
+
+  if(session || usage.duplicate)
+    add_usage(&totals[dir], &usage);
+
+  dns_destroy(dns);
+}
+
+/* Take apart IP and UDP, and hand DNS traffic to handle_dns(). */
+static void handle_ip(uint8_t *data, size_t length, double now)
+{
+  size_t   ip_length;
+  size_t   header_length;
+  size_t   wire;
+  uint8_t *udp;
+  size_t   udp_length;
+  uint16_t sport, dport;
+
+  if(length < 1)
+    return;
+
+  if((data[0] >> 4) == 4)
+  {
+    if(length < 20 || data[9] != 17)
+      return;
+
+    /* Fragments are rare for DNS, and we can't reassemble them. */
+    if((read16(data + 6, FALSE) & 0x3FFF) != 0)
+    {
+      fragments++;
+      return;
+    }
+
+    header_length = (data[0] & 0x0F) * 4;
+    wire          = read16(data + 2, FALSE);
+  }
+  else if((data[0] >> 4) == 6)
+  {
+    /* No extension headers, just UDP. */
+    if(length < 40 || data[6] != 17)
+      return;
+
+    header_length = 40;
+    wire          = 40 + read16(data + 4, FALSE);
+  }
+  else
+  {
+    return;
+  }
+
+  ip_length = wire < length ? wire : length;
+  if(ip_length < header_length + 8)
+    return;
+
+  udp        = data + header_length;
+  sport      = read16(udp, FALSE);
+  dport      = read16(udp + 2, FALSE);
+  udp_length = read16(udp + 4, FALSE);
+
+  if(udp_length < 8 || header_length + udp_length > ip_length)
+    return;
+
+  if(dport == port)
+    handle_dns(udp + 8, udp_length - 8, wire, header_length + 8, DIR_UP, now);
+  else if(sport == port)
+    handle_dns(udp + 8, udp_length - 8, wire, header_length + 8, DIR_DOWN, now);
+}
+
+static void handle_frame(uint32_t linktype, uint8_t *data, size_t length, double now)
+{
+  size_t   offset;
+  uint16_t ethertype;
+
+  switch(linktype)
+  {
+    case LINKTYPE_NULL:
+      offset = 4;
+      break;
+
+    case LINKTYPE_RAW:
+      offset = 0;
+      break;
+
+    case LINKTYPE_ETHERNET:
+      if(length < 14)
+        return;
+      ethertype = read16(data + 12, FALSE);
+      offset    = 14;
+
+      /* Skip VLAN tags. */
+      while(ethertype == 0x8100 && length >= offset + 4)
+      {
+        ethertype = read16(data + offset + 2, FALSE);
+        offset += 4;
+      }
+
+      if(ethertype != 0x0800 && ethertype != 0x86DD)
+        return;
+      break;
+
+    case LINKTYPE_LINUX_SLL:
+      if(length < 16)
+        return;
+      ethertype = read16(data + 14, FALSE);
+      offset    = 16;
+
+      if(ethertype != 0x0800 && ethertype != 0x86DD)
+        return;
+      break;
+
+    default:
+      LOG_FATAL("Unsupported pcap link type: %u", linktype);
+      exit(1);
+  }
+
+  if(length > offset)
+    handle_ip(data + offset, length - offset, now);
+}
+
+static void read_pcap(char *filename)
+{
+  FILE    *f;
+  uint8_t  header[24];
+  uint8_t  record[16];
+  uint8_t *frame = NULL;
+  size_t   frame_size = 0;
+  NBBOOL   swap;
+  double   divisor;
+  uint32_t linktype;
+
+  f = fopen(filename, "rb");
+  if(!f)
+  {
+    LOG_FATAL("Couldn't open %s", filename);
+    exit(1);
+  }
+
+  if(fread(header, 1, 24, f) != 24)
+  {
+    LOG_FATAL("%s is too short to be a pcap file", filename);
+    exit(1);
+  }
+
+  /* The magic number tells us the byte order, and whether timestamps are in
+   * micro- or nanoseconds. */
+  if(read32(header, FALSE) == 0xa1b2c3d4 || read32(header, TRUE) == 0xa1b2c3d4)
+    divisor = 1000000.0;
+  else if(read32(header, FALSE) == 0xa1b23c4d || read32(header, TRUE) == 0xa1b23c4d)
+    divisor = 1000000000.0;
+  else
+  {
+    LOG_FATAL("%s isn't a pcap file (pcapng isn't supported; try 'editcap -F pcap')", filename);
+    exit(1);
+  }
+  swap     = (header[0] == 0xa1) ? FALSE : TRUE;
+  linktype = read32(header + 20, swap);
+
+  while(fread(record, 1, 16, f) == 16)
+  {
+    double now       = read32(record, swap) + (read32(record + 4, swap) / divisor);
+    size_t caplen    = read32(record + 8, swap);
+
+    if(caplen > frame_size)
+    {
+      frame = (uint8_t*) safe_realloc(frame, caplen);
+      frame_size = caplen;
+    }
+
+    if(fread(frame, 1, caplen, f) != caplen)
+    {
+      LOG_ERROR("%s is truncated", filename);
+      break;
+    }
+
+    handle_frame(linktype, frame, caplen, now);
+  }
+
+  if(frame)
+    safe_free(frame);
+  fclose(f);
+}
+
+static double percent(size_t part, size_t whole)
+{
+  return whole ? (part * 100.0) / whole : 0.0;
+}
+
+static void print_usage_line(char *title, usage_t *usage)
+{
+  printf("%-16s %8zu msgs %10zu bytes | ip/udp %5.1f%% | dns %5.1f%% | encoding %5.1f%% | dnscat %5.1f%% | retrans %5.1f%% | duplicate %5.1f%% | goodput %5.1f%%\n",
+      title, usage->messages, usage->wire,
+      percent(usage->ip_udp, usage->wire), percent(usage->dns, usage->wire), percent(usage->encoding, usage->wire), percent(usage->dnscat, usage->wire),
+      percent(usage->retrans, usage->wire), percent(usage->duplicate, usage->wire), percent(usage->goodput, usage->wire));
+}
+
+/* Queries that were never answered count as lost. */
+static void count_lost()
+{
+  size_t   i;
+  query_t *query;
+
+  for(i = 0; i < 0x10000; i++)
+  {
+    for(query = queries[i]; query; query = query->next)
+    {
+      if(!query->answered && query->has_session)
+      {
+        analyze_session_t *session = get_session(query->session_id, query->time);
+
+        session->lost++;
+        get_bucket(session, query->time)->lost++;
+      }
+    }
+  }
+}
+
+static void report()
+{
+  analyze_session_t *session;
+  usage_t            all;
+  size_t             i;
+
+  memset(&all, 0, sizeof(usage_t));
+  add_usage(&all, &totals[DIR_UP]);
+  add_usage(&all, &totals[DIR_DOWN]);
+
+  printf("Overall (goodput is %zu of %zu bytes, %.1f%%):\n", all.goodput, all.wire, percent(all.goodput, all.wire));
+  print_usage_line(direction_names[DIR_UP], &totals[DIR_UP]);
+  print_usage_line(direction_names[DIR_DOWN], &totals[DIR_DOWN]);
+  printf("%zu of %zu queries (%.1f%%) were polls that carried no data\n", totals[DIR_UP].empty, totals[DIR_UP].messages, percent(totals[DIR_UP].empty, totals[DIR_UP].messages));
+  printf("%zu DNS messages (%zu bytes) weren't dnscat2 traffic; %zu IP fragments were skipped\n", not_dnscat.messages, not_dnscat.wire, fragments);
+
+  for(session = first_session; session; session = session->next)
+  {
+    printf("\n");
+    printf("Session 0x%04x (%s):\n", session->id, (session->options & OPT_CHUNKED) ? "chunked" : "normal");
+    print_usage_line(direction_names[DIR_UP], &session->usage[DIR_UP]);
+    print_usage_line(direction_names[DIR_DOWN], &session->usage[DIR_DOWN]);
+
+    if(session->answered)
+      printf("RTT: min %.1fms, avg %.1fms, max %.1fms; ", session->rtt_min * 1000, (session->rtt_total / session->answered) * 1000, session->rtt_max * 1000);
+    printf("%zu queries answered, %zu lost (%.1f%%)\n", session->answered, session->lost, percent(session->lost, session->answered + session->lost));
+
+    printf("  %8s %8s %8s %8s %8s %10s %10s %10s\n", "time(s)", "queries", "answered", "lost", "retrans", "rtt(ms)", "up(B)", "down(B)");
+    for(i = 0; i < session->bucket_count; i++)
+    {
+      bucket_t *b = &session->buckets[i];
+
+      if(b->queries == 0 && b->answered == 0 && b->goodput[DIR_DOWN] == 0)
+        continue;
+
+      printf("  %8.1f %8zu %8zu %8zu %8zu %10.1f %10zu %10zu\n", i * interval, b->queries, b->answered, b->lost, b->retransmits,
+          b->answered ? (b->rtt_total / b->answered) * 1000 : 0.0, b->goodput[DIR_UP], b->goodput[DIR_DOWN]);
+    }
+  }
+}
+
+static void cleanup()
+{
+  analyze_session_t *session;
+  query_t           *query;
+  size_t             i;
+
+  while(first_session)
+  {
+    session = first_session;
+    first_session = session->next;
+
+    if(session->chunks[DIR_UP])
+      safe_free(session->chunks[DIR_UP]);
+    if(session->chunks[DIR_DOWN])
+      safe_free(session->chunks[DIR_DOWN]);
+    if(session->buckets)
+      safe_free(session->buckets);
+    safe_free(session);
+  }
+
+  for(i = 0; i < 0x10000; i++)
+  {
+    while(queries[i])
+    {
+      query = queries[i];
+      queries[i] = query->next;
+
+      safe_free(query->name);
+      safe_free(query);
+    }
+  }
+}
+
+static void usage(char *name, char *message)
+{
+  fprintf(stderr, "Usage: %s [-d <domain>] [-p <port>] [-i <seconds>] <file.pcap>\n", name);
+  fprintf(stderr, "\n");
+  fprintf(stderr, " -d <domain>   The dnscat2 domain (default: names start with \"%s\")\n", WILDCARD_PREFIX);
+  fprintf(stderr, " -p <port>     The DNS port (default: 53)\n");
+  fprintf(stderr, " -i <seconds>  The length of each timeline slice (default: 1)\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "ERROR: %s\n", message);
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  int c;
+
+  log_init();
+  log_set_min_console_level(LOG_LEVEL_FATAL);
+
+  while((c = getopt(argc, argv, "d:p:i:h")) != -1)
+  {
+    switch(c)
+    {
+      case 'd':
+        domain = optarg;
+        break;
+      case 'p':
+        port = atoi(optarg);
+        break;
+      case 'i':
+        interval = atof(optarg);
+        if(interval <= 0)
+          usage(argv[0], "The interval has to be positive");
+        break;
+      default:
+        usage(argv[0], "--help requested");
+    }
+  }
+
+  if(optind >= argc)
+    usage(argv[0], "No pcap file given");
+
+  read_pcap(argv[optind]);
+  count_lost();
+  report();
+  cleanup();
+
+  return 0;
+}
@@ -13,6 +13,50 @@
 #endif
 
 #include "command_packet.h"
+#include "packet.h"
+
+/* Session ids are encoded the same way as in the packet header: 16 bits, or
+ * WIDE_SESSION_ID followed by 32 bits. */
+static uint32_t read_session_id(buffer_t *buffer)
+{
+  uint32_t session_id = buffer_read_next_int16(buffer);
+
+  if(session_id == WIDE_SESSION_ID)
+    session_id = buffer_read_next_int32(buffer);
+
+  return session_id;
+}
+
+static void add_session_id(buffer_t *buffer, uint32_t session_id)
+{
+  if(session_id >= WIDE_SESSION_ID)
+  {
+    buffer_add_int16(buffer, WIDE_SESSION_ID);
+    buffer_add_int32(buffer, session_id);
+  }
+  else
+  {
+    buffer_add_int16(buffer, (uint16_t) session_id);
+  }
+}
+
+/* A (uint32_t) length followed by that many bytes. */
+static uint8_t *read_length_and_bytes(buffer_t *buffer, uint32_t *length)
+{
+  uint8_t *data;
+
+  *length = buffer_read_next_int32(buffer);
+  data = safe_malloc(*length);
+  buffer_read_next_bytes(buffer, data, *length);
+
+  return data;
+}
+
+static void add_length_and_bytes(buffer_t *buffer, uint8_t *data, uint32_t length)
+{
+  buffer_add_int32(buffer, length);
+  buffer_add_bytes(buffer, data, length);
+}
 
 /* Parse a packet from a byte stream. */
 command_packet_t *command_packet_parse(uint8_t *data, uint32_t length, NBBOOL is_request)
@@ -35,9 +79,15 @@ command_packet_t *command_packet_parse(uint8_t *data, uint32_t length, NBBOOL is
 
     case COMMAND_SHELL:
       if(is_request)
+      {
         p->r.request.body.shell.name = buffer_alloc_next_ntstring(buffer);
+
+        /* The flags are optional. */
+        if(buffer_get_remaining_bytes(buffer) >= 2)
+          p->r.request.body.shell.flags = buffer_read_next_int16(buffer);
+      }
       else
-        p->r.response.body.shell.session_id = buffer_read_next_int16(buffer);
+        p->r.response.body.shell.session_id = read_session_id(buffer);
       break;
 
     case COMMAND_EXEC:
@@ -45,10 +95,14 @@ command_packet_t *command_packet_parse(uint8_t *data, uint32_t length, NBBOOL is
       {
         p->r.request.body.exec.name    = buffer_alloc_next_ntstring(buffer);
         p->r.request.body.exec.command = buffer_alloc_next_ntstring(buffer);
+
+        /* The flags are optional. */
+        if(buffer_get_remaining_bytes(buffer) >= 2)
+          p->r.request.body.exec.flags = buffer_read_next_int16(buffer);
       }
       else
       {
-        p->r.response.body.exec.session_id = buffer_read_next_int16(buffer);
+        p->r.response.body.exec.session_id = read_session_id(buffer);
       }
       break;
 
@@ -75,6 +129,38 @@ command_packet_t *command_packet_parse(uint8_t *data, uint32_t length, NBBOOL is
       }
       break;
 
+    case COMMAND_CONFIG:
+      if(is_request)
+      {
+        /* Pairs of name/value strings, until the end of the packet. */
+        while(buffer_get_remaining_bytes(buffer) > 0 && p->r.request.body.config.count < COMMAND_CONFIG_MAX)
+        {
+          p->r.request.body.config.names[p->r.request.body.config.count]  = buffer_alloc_next_ntstring(buffer);
+          p->r.request.body.config.values[p->r.request.body.config.count] = buffer_alloc_next_ntstring(buffer);
+          p->r.request.body.config.count++;
+        }
+      }
+      else
+      {
+      }
+      break;
+
+    case COMMAND_RUN:
+      if(is_request)
+      {
+        p->r.request.body.run.command    = buffer_alloc_next_ntstring(buffer);
+        p->r.request.body.run.max_output = buffer_read_next_int32(buffer);
+        p->r.request.body.run.timeout    = buffer_read_next_int16(buffer);
+      }
+      else
+      {
+        p->r.response.body.run.flags  = buffer_read_next_int16(buffer);
+        p->r.response.body.run.status = buffer_read_next_int32(buffer);
+        p->r.response.body.run.out    = read_length_and_bytes(buffer, &p->r.response.body.run.out_length);
+        p->r.response.body.run.err    = read_length_and_bytes(buffer, &p->r.response.body.run.err_length);
+      }
+      break;
+
     case COMMAND_ERROR:
       if(is_request)
       {
@@ -143,7 +229,7 @@ command_packet_t *command_packet_create_shell_request(uint16_t request_id, char
   return packet;
 }
 
-command_packet_t *command_packet_create_shell_response(uint16_t request_id, uint16_t session_id)
+command_packet_t *command_packet_create_shell_response(uint16_t request_id, uint32_t session_id)
 {
   command_packet_t *packet = command_packet_create_response(request_id, COMMAND_SHELL);
 
@@ -162,7 +248,7 @@ command_packet_t *command_packet_create_exec_request(uint16_t request_id, char *
   return packet;
 }
 
-command_packet_t *command_packet_create_exec_response(uint16_t request_id, uint16_t session_id)
+command_packet_t *command_packet_create_exec_response(uint16_t request_id, uint32_t session_id)
 {
   command_packet_t *packet = command_packet_create_response(request_id, COMMAND_EXEC);
 
@@ -209,6 +295,40 @@ command_packet_t *command_packet_create_upload_response(uint16_t request_id)
   return packet;
 }
 
+command_packet_t *command_packet_create_config_response(uint16_t request_id)
+{
+  command_packet_t *packet = command_packet_create_response(request_id, COMMAND_CONFIG);
+
+  return packet;
+}
+
+command_packet_t *command_packet_create_run_request(uint16_t request_id, char *command, uint32_t max_output, uint16_t timeout)
+{
+  command_packet_t *packet = command_packet_create_request(request_id, COMMAND_RUN);
+
+  packet->r.request.body.run.command    = safe_strdup(command);
+  packet->r.request.body.run.max_output = max_output;
+  packet->r.request.body.run.timeout    = timeout;
+
+  return packet;
+}
+
+command_packet_t *command_packet_create_run_response(uint16_t request_id, uint16_t flags, uint32_t status, uint8_t *out, uint32_t out_length, uint8_t *err, uint32_t err_length)
+{
+  command_packet_t *packet = command_packet_create_response(request_id, COMMAND_RUN);
+
+  packet->r.response.body.run.flags      = flags;
+  packet->r.response.body.run.status     = status;
+  packet->r.response.body.run.out        = safe_malloc(out_length);
+  memcpy(packet->r.response.body.run.out, out, out_length);
+  packet->r.response.body.run.out_length = out_length;
+  packet->r.response.body.run.err        = safe_malloc(err_length);
+  memcpy(packet->r.response.body.run.err, err, err_length);
+  packet->r.response.body.run.err_length = err_length;
+
+  return packet;
+}
+
 command_packet_t *command_packet_create_error_request(uint16_t request_id, uint16_t status, char *reason)
 {
   command_packet_t *packet = command_packet_create_request(request_id, COMMAND_ERROR);
@@ -291,6 +411,34 @@ void command_packet_destroy(command_packet_t *packet)
       }
       break;
 
+    case COMMAND_CONFIG:
+      if(packet->is_request)
+      {
+        size_t i;
+
+        for(i = 0; i < packet->r.request.body.config.count; i++)
+        {
+          safe_free(packet->r.request.body.config.names[i]);
+          safe_free(packet->r.request.body.config.values[i]);
+        }
+      }
+      break;
+
+    case COMMAND_RUN:
+      if(packet->is_request)
+      {
+        if(packet->r.request.body.run.command)
+          safe_free(packet->r.request.body.run.command);
+      }
+      else
+      {
+        if(packet->r.response.body.run.out)
+          safe_free(packet->r.response.body.run.out);
+        if(packet->r.response.body.run.err)
+          safe_free(packet->r.response.body.run.err);
+      }
+      break;
+
     case COMMAND_ERROR:
       if(packet->is_request)
       {
@@ -348,6 +496,29 @@ void command_packet_print(command_packet_t *packet)
         printf("COMMAND_UPLOAD [response] :: request_id: 0x%04x\n", packet->request_id);
       break;
 
+    case COMMAND_CONFIG:
+      if(packet->is_request)
+      {
+        size_t i;
+
+        printf("COMMAND_CONFIG [request] :: request_id: 0x%04x", packet->request_id);
+        for(i = 0; i < packet->r.request.body.config.count; i++)
+          printf(" :: %s=%s", packet->r.request.body.config.names[i], packet->r.request.body.config.values[i]);
+        printf("\n");
+      }
+      else
+      {
+        printf("COMMAND_CONFIG [response] :: request_id: 0x%04x\n", packet->request_id);
+      }
+      break;
+
+    case COMMAND_RUN:
+      if(packet->is_request)
+        printf("COMMAND_RUN [request] :: request_id: 0x%04x :: command: %s :: max_output: 0x%x :: timeout: %d\n", packet->request_id, packet->r.request.body.run.command, packet->r.request.body.run.max_output, packet->r.request.body.run.timeout);
+      else
+        printf("COMMAND_RUN [response] :: request_id: 0x%04x :: flags: 0x%04x :: status: %d :: stdout: 0x%x bytes :: stderr: 0x%x bytes\n", packet->request_id, packet->r.response.body.run.flags, (int)packet->r.response.body.run.status, packet->r.response.body.run.out_length, packet->r.response.body.run.err_length);
+      break;
+
     case COMMAND_ERROR:
       if(packet->is_request)
         printf("COMMAND_ERROR [request] :: request_id: 0x%04x :: status: 0x%04x :: reason: %s\n", packet->request_id, packet->r.request.body.error.status, packet->r.request.body.error.reason);
@@ -378,9 +549,15 @@ uint8_t *command_packet_to_bytes(command_packet_t *packet, uint32_t *length)
 
     case COMMAND_SHELL:
       if(packet->is_request)
+      {
         buffer_add_ntstring(buffer, packet->r.request.body.shell.name);
+        if(packet->r.request.body.shell.flags)
+          buffer_add_int16(buffer, packet->r.request.body.shell.flags);
+      }
       else
-        buffer_add_int16(buffer, packet->r.response.body.shell.session_id);
+      {
+        add_session_id(buffer, packet->r.response.body.shell.session_id);
+      }
       break;
 
     case COMMAND_EXEC:
@@ -388,10 +565,12 @@ uint8_t *command_packet_to_bytes(command_packet_t *packet, uint32_t *length)
       {
         buffer_add_ntstring(buffer, packet->r.request.body.exec.name);
         buffer_add_ntstring(buffer, packet->r.request.body.exec.command);
+        if(packet->r.request.body.exec.flags)
+          buffer_add_int16(buffer, packet->r.request.body.exec.flags);
       }
       else
       {
-        buffer_add_int16(buffer, packet->r.response.body.exec.session_id);
+        add_session_id(buffer, packet->r.response.body.exec.session_id);
       }
       break;
 
@@ -417,6 +596,38 @@ uint8_t *command_packet_to_bytes(command_packet_t *packet, uint32_t *length)
       }
       break;
 
+    case COMMAND_CONFIG:
+      if(packet->is_request)
+      {
+        size_t i;
+
+        for(i = 0; i < packet->r.request.body.config.count; i++)
+        {
+          buffer_add_ntstring(buffer, packet->r.request.body.config.names[i]);
+          buffer_add_ntstring(buffer, packet->r.request.body.config.values[i]);
+        }
+      }
+      else
+      {
+      }
+      break;
+
+    case COMMAND_RUN:
+      if(packet->is_request)
+      {
+        buffer_add_ntstring(buffer, packet->r.request.body.run.command);
+        buffer_add_int32(buffer, packet->r.request.body.run.max_output);
+        buffer_add_int16(buffer, packet->r.request.body.run.timeout);
+      }
+      else
+      {
+        buffer_add_int16(buffer, packet->r.response.body.run.flags);
+        buffer_add_int32(buffer, packet->r.response.body.run.status);
+        add_length_and_bytes(buffer, packet->r.response.body.run.out, packet->r.response.body.run.out_length);
+        add_length_and_bytes(buffer, packet->r.response.body.run.err, packet->r.response.body.run.err_length);
+      }
+      break;
+
     case COMMAND_ERROR:
       if(packet->is_request)
       {
@@ -20,6 +20,24 @@
 /* Just make sure it doesn't overflow, basically */
 #define MAX_COMMAND_PACKET_SIZE 0x7FFFFF00
 
+/* Flags that can be appended to COMMAND_SHELL and COMMAND_EXEC requests. */
+#define SHELL_FLAG_SCREEN 0x0001 /* Send screen frames instead of raw output */
+#define SHELL_FLAG_UPLOAD 0x0002 /* Exec only: upload the output to a file named after the session */
+
+/* Flags in a COMMAND_RUN response. */
+#define RUN_FLAG_TRUNCATED 0x0001 /* Some of the output didn't fit in max_output, and was thrown away */
+#define RUN_FLAG_TIMED_OUT 0x0002 /* The command was killed for running too long */
+
+/* The status of a COMMAND_ERROR that doesn't have a more specific one. */
+#define COMMAND_STATUS_ERROR 0xFFFF
+
+/* The statuses of a COMMAND_ERROR in response to a COMMAND_CONFIG. */
+#define CONFIG_STATUS_UNKNOWN_SETTING 0x0001
+#define CONFIG_STATUS_BAD_VALUE       0x0002
+
+/* The most name=value pairs a COMMAND_CONFIG request can carry. */
+#define COMMAND_CONFIG_MAX 16
+
 typedef enum
 {
   COMMAND_PING      = 0x0000,
@@ -27,6 +45,8 @@ typedef enum
   COMMAND_EXEC      = 0x0002,
   COMMAND_DOWNLOAD  = 0x0003,
   COMMAND_UPLOAD    = 0x0004,
+  COMMAND_CONFIG    = 0x0005,
+  COMMAND_RUN       = 0x0006,
 
   COMMAND_ERROR     = 0xFFFF,
 } command_packet_type_t;
@@ -43,10 +63,12 @@ typedef struct
     {
       union {
         struct { char *data; } ping;
-        struct { char *name; } shell;
-        struct { char *name; char *command; } exec;
+        struct { char *name; uint16_t flags; } shell;
+        struct { char *name; char *command; uint16_t flags; } exec;
         struct { char *filename; } download;
         struct { char *filename; uint8_t *data; uint32_t length; } upload;
+        struct { size_t count; char *names[COMMAND_CONFIG_MAX]; char *values[COMMAND_CONFIG_MAX]; } config;
+        struct { char *command; uint32_t max_output; uint16_t timeout; } run;
         struct { uint16_t status; char *reason; } error;
       } body;
     } request;
@@ -55,10 +77,12 @@ typedef struct
     {
       union {
         struct { char *data; } ping;
-        struct { uint16_t session_id; } shell;
-        struct { uint16_t session_id; } exec;
+        struct { uint32_t session_id; } shell;
+        struct { uint32_t session_id; } exec;
         struct { uint8_t *data; uint32_t length; } download;
         struct { int dummy; } upload;
+        struct { int dummy; } config;
+        struct { uint16_t flags; uint32_t status; uint8_t *out; uint32_t out_length; uint8_t *err; uint32_t err_length; } run;
         struct { uint16_t status; char *reason; } error;
       } body;
     } response;
@@ -73,10 +97,10 @@ command_packet_t *command_packet_create_ping_request(uint16_t request_id, char *
 command_packet_t *command_packet_create_ping_response(uint16_t request_id, char *data);
 
 command_packet_t *command_packet_create_shell_request(uint16_t request_id, char *name);
-command_packet_t *command_packet_create_shell_response(uint16_t request_id, uint16_t session_id);
+command_packet_t *command_packet_create_shell_response(uint16_t request_id, uint32_t session_id);
 
 command_packet_t *command_packet_create_exec_request(uint16_t request_id, char *name, char *command);
-command_packet_t *command_packet_create_exec_response(uint16_t request_id, uint16_t session_id);
+command_packet_t *command_packet_create_exec_response(uint16_t request_id, uint32_t session_id);
 
 command_packet_t *command_packet_create_download_request(uint16_t request_id, char *filename);
 command_packet_t *command_packet_create_download_response(uint16_t request_id, uint8_t *data, uint32_t length);
@@ -84,6 +108,11 @@ command_packet_t *command_packet_create_download_response(uint16_t request_id, u
 command_packet_t *command_packet_create_upload_request(uint16_t request_id, char *filename, uint8_t *data, uint32_t length);
 command_packet_t *command_packet_create_upload_response(uint16_t request_id);
 
+command_packet_t *command_packet_create_config_response(uint16_t request_id);
+
+command_packet_t *command_packet_create_run_request(uint16_t request_id, char *command, uint32_t max_output, uint16_t timeout);
+command_packet_t *command_packet_create_run_response(uint16_t request_id, uint16_t flags, uint32_t status, uint8_t *out, uint32_t out_length, uint8_t *err, uint32_t err_length);
+
 command_packet_t *command_packet_create_error_request(uint16_t request_id, uint16_t status, char *reason);
 command_packet_t *command_packet_create_error_response(uint16_t request_id, uint16_t status, char *reason);
 
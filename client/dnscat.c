@@ -5,6 +5,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,6 +20,7 @@
 
 #include "buffer.h"
 #include "dns.h"
+#include "flight_recorder.h"
 #include "log.h"
 #include "memory.h"
 #include "message.h"
@@ -30,6 +32,7 @@
 #include "driver_command.h"
 #include "driver_dns.h"
 #include "driver_exec.h"
+#include "driver_http.h"
 #include "driver_listener.h"
 #include "driver_ping.h"
 
@@ -59,6 +62,7 @@ driver_ping_t     *driver_ping     = NULL;
 
 /* Output drivers. */
 driver_dns_t     *driver_dns     = NULL;
+driver_http_t    *driver_http    = NULL;
 
 typedef enum {
   TYPE_NOT_SET,
@@ -72,13 +76,50 @@ typedef enum {
   TYPE_DNS,
 } drivers_t;
 
+/* How long to wait for traffic before posting a heartbeat (which is also
+ * when sessions poll the server); the server can change it with the
+ * 'poll_interval' setting. */
+#define POLL_INTERVAL 1000 /* Milliseconds */
+static int poll_interval = POLL_INTERVAL;
+
+/* The timeout of the current select(); it's shorter than poll_interval when a
+ * session is holding an ACK back (see MESSAGE_FLUSH). */
+static int wait_timeout = POLL_INTERVAL;
+
 static SELECT_RESPONSE_t timeout(void *group, void *param)
 {
-  message_post_heartbeat();
+  /* Waking up for a held ACK doesn't mean the tunnel's been idle. */
+  if(wait_timeout >= poll_interval)
+    message_post_heartbeat();
 
   return SELECT_OK;
 }
 
+static void handle_message(message_t *message, void *param)
+{
+  switch(message->type)
+  {
+    case MESSAGE_CONFIG:
+      if(message->message.config.type == CONFIG_INT && !strcmp(message->message.config.name, "poll_interval"))
+      {
+        poll_interval = message->message.config.value.int_value > 0 ? message->message.config.value.int_value : POLL_INTERVAL;
+        LOG_WARNING("Poll interval is now %dms", poll_interval);
+      }
+      break;
+
+    default:
+      LOG_FATAL("dnscat received an invalid message: %d", message->type);
+      abort();
+  }
+}
+
+#ifndef WIN32
+static void handle_dump_signal(int sig)
+{
+  flight_recorder_request_dump();
+}
+#endif
+
 static void cleanup(void)
 {
   LOG_WARNING("Terminating");
@@ -97,6 +138,8 @@ static void cleanup(void)
     driver_dns_destroy(driver_dns);
   if(driver_exec)
     driver_exec_destroy(driver_exec);
+  if(driver_http)
+    driver_http_destroy(driver_http);
   if(driver_listener)
     driver_listener_destroy(driver_listener);
   if(driver_ping)
@@ -117,36 +160,66 @@ void usage(char *name, char *message)
 "                         the server list\n"
 " --download <filename>   Request the given file off the server\n"
 " --chunk <n>             start at the given chunk of the --download file\n"
+" --fountain              Fetch the --download file as fountain-coded\n"
+"                         symbols, so lost packets never need re-requesting\n"
+" --upload <filename>     With --console or --exec, send the input (or the\n"
+"                         process's output) to the server in parallel chunks,\n"
+"                         where it's saved as the given filename\n"
 " --ping                  Attempt to ping a dnscat2 server\n"
 "\n"
 "Input options:\n"
 " --console               Send/receive output to the console\n"
+" --pipe                  Like --console, but for streaming files: output is\n"
+"                         binary, stdin is only read as fast as the server\n"
+"                         takes it, and the end of stdin only ends our side\n"
+"                         (output keeps coming till the server closes it)\n"
 " --exec -e <process>     Execute the given process and link it to the stream\n"
+" --screen                With --exec, send screen updates instead of every\n"
+"                         byte of output (for top, tail -f, etc.)\n"
 " --listen -l <port>      Listen on the given port and link each connection to\n"
-"                         a new stream\n"
+"                         a new stream; with --name forward:<host>:<port>, the\n"
+"                         server connects each stream to host:port (if it was\n"
+"                         started with --relay-names)\n"
+" --socks <port>          Be a SOCKS5 proxy on the given port; each CONNECT\n"
+"                         gets its own stream, which the server connects to\n"
+"                         the requested host and port (with --relay-names)\n"
 "\n"
 "DNS-specific options:\n"
 " --dns <domain>          Enable DNS mode with the given domain\n"
 " --host <host>           The DNS server [default: %s]\n"
 " --port <port>           The DNS port [default: 53]\n"
 " --type <port>           The type of DNS record to use (" DNS_TYPES ")\n"
+" --doh <host>[:<port>][/<path>]\n"
+"                         Send the queries to a DNS-over-HTTPS (RFC 8484)\n"
+"                         resolver, pipelined over one connection, and only\n"
+"                         use UDP when it's unavailable; it's plain HTTP, so\n"
+"                         use a local TLS proxy for a real HTTPS resolver\n"
+"                         [default: port %d, path %s]\n"
+"\n"
+"HTTP-specific options:\n"
+" --http <host>[:<port>]  Talk to the server's HTTP driver instead of using\n"
+"                         DNS; packets can be much bigger, and the server\n"
+"                         can wake us up when it has data [default port: %d]\n"
 "\n"
 
 "Debug options:\n"
 " -d                      Display more debug info (can be used multiple times)\n"
 " -q                      Display less debug info (can be used multiple times)\n"
 " --packet-trace          Display incoming/outgoing dnscat2 packets\n"
+" --flight-recorder <file>\n"
+"                         Write recent packet events to the given file on\n"
+"                         SIGUSR1 or after a fatal error\n"
 "\n"
 "ERROR: %s\n"
 "\n"
-, name, dns_get_system(), message
+, name, dns_get_system(), DOH_DEFAULT_PORT, DOH_DEFAULT_PATH, HTTP_DEFAULT_PORT, message
 );
   exit(0);
 }
 
 void too_many_inputs(char *name)
 {
-  usage(name, "More than one of --exec, --console, --listen, and --ping can't be set!");
+  usage(name, "More than one of --exec, --console, --listen, --socks, and --ping can't be set!");
 }
 
 int main(int argc, char *argv[])
@@ -162,19 +235,24 @@ int main(int argc, char *argv[])
     {"download",required_argument, 0, 0}, /* Download */
     {"n",       required_argument, 0, 0},
     {"chunk",   required_argument, 0, 0}, /* Download chunk */
+    {"fountain",no_argument,       0, 0}, /* Fountain-coded download */
+    {"upload",  required_argument, 0, 0}, /* Chunked upload */
     {"ping",    no_argument,       0, 0}, /* Ping */
     {"isn",     required_argument, 0, 0}, /* Initial sequence number */
 
     /* Console options. */
     {"console", no_argument,       0, 0}, /* Enable console (default) */
+    {"pipe",    no_argument,       0, 0}, /* Binary, half-closing console */
 
     /* Execute-specific options. */
     {"exec",    required_argument, 0, 0}, /* Enable execute */
     {"e",       required_argument, 0, 0},
+    {"screen",  no_argument,       0, 0}, /* Screen mode */
 
     /* Listener options */
     {"listen",  required_argument, 0, 0}, /* Enable listener */
     {"l",       required_argument, 0, 0},
+    {"socks",   required_argument, 0, 0}, /* SOCKS5 listener */
 
     /* DNS-specific options */
 #if 0
@@ -185,11 +263,16 @@ int main(int argc, char *argv[])
     {"dnsport",    required_argument, 0, 0}, /* DNS port */
     {"port",       required_argument, 0, 0}, /* (alias) */
     {"type",       required_argument, 0, 0},
+    {"doh",        required_argument, 0, 0}, /* DNS-over-HTTPS resolver */
+
+    /* HTTP-specific options */
+    {"http",       required_argument, 0, 0}, /* Use HTTP instead of DNS */
 
     /* Debug options */
     {"d",            no_argument, 0, 0}, /* More debug */
     {"q",            no_argument, 0, 0}, /* Less debug */
     {"packet-trace", no_argument, 0, 0}, /* Trace packets */
+    {"flight-recorder", required_argument, 0, 0}, /* Flight recorder dump file */
 
     /* Sentry */
     {0,              0,                 0, 0}  /* End */
@@ -210,16 +293,23 @@ int main(int argc, char *argv[])
   char             *name     = NULL;
   char             *download = NULL;
   uint32_t          chunk    = -1;
+  NBBOOL            fountain = FALSE;
+  char             *upload   = NULL;
 
   dns_type_t        dns_type = _DNS_TYPE_TEXT; /* TODO: Is this the best default? */
+  char             *doh      = NULL;
 
   log_level_t       min_log_level = LOG_LEVEL_WARNING;
 
   drivers_t input_type = TYPE_NOT_SET;
 
   char *exec_process = NULL;
+  NBBOOL exec_screen = FALSE;
 
   int listen_port = 0;
+  NBBOOL socks = FALSE;
+
+  NBBOOL is_pipe = FALSE;
 
 
   /* Initialize the modules that need initialization. */
@@ -263,6 +353,14 @@ int main(int argc, char *argv[])
         {
           chunk = atoi(optarg);
         }
+        else if(!strcmp(option_name, "fountain"))
+        {
+          fountain = TRUE;
+        }
+        else if(!strcmp(option_name, "upload"))
+        {
+          upload = optarg;
+        }
         else if(!strcmp(option_name, "ping"))
         {
           if(input_type != TYPE_NOT_SET)
@@ -288,6 +386,10 @@ int main(int argc, char *argv[])
 
           input_type = TYPE_CONSOLE;
         }
+        else if(!strcmp(option_name, "pipe"))
+        {
+          is_pipe = TRUE;
+        }
 
         /* Execute options. */
         else if(!strcmp(option_name, "exec") || !strcmp(option_name, "e"))
@@ -298,6 +400,10 @@ int main(int argc, char *argv[])
           exec_process = optarg;
           input_type = TYPE_EXEC;
         }
+        else if(!strcmp(option_name, "screen"))
+        {
+          exec_screen = TRUE;
+        }
 
         /* Listener options. */
         else if(!strcmp(option_name, "listen") || !strcmp(option_name, "l"))
@@ -309,6 +415,16 @@ int main(int argc, char *argv[])
 
           input_type = TYPE_LISTENER;
         }
+        else if(!strcmp(option_name, "socks"))
+        {
+          if(input_type != TYPE_NOT_SET)
+            too_many_inputs(argv[0]);
+
+          listen_port = atoi(optarg);
+          socks       = TRUE;
+
+          input_type = TYPE_LISTENER;
+        }
 
         /* DNS-specific options */
 #if 0
@@ -328,22 +444,29 @@ int main(int argc, char *argv[])
         }
         else if(!strcmp(option_name, "type"))
         {
-          if(!strcmp(optarg, "TXT") || !strcmp(optarg, "txt") || !strcmp(optarg, "TEXT") || !strcmp(optarg, "text"))
-            dns_type = _DNS_TYPE_TEXT;
-          else if(!strcmp(optarg, "CNAME") || !strcmp(optarg, "cname"))
-            dns_type = _DNS_TYPE_CNAME;
-          else if(!strcmp(optarg, "MX") || !strcmp(optarg, "mx"))
-            dns_type = _DNS_TYPE_MX;
-          else if(!strcmp(optarg, "A") || !strcmp(optarg, "a"))
-            dns_type = _DNS_TYPE_A;
-#ifndef WIN32
-          else if(!strcmp(optarg, "AAAA") || !strcmp(optarg, "aaaa"))
-            dns_type = _DNS_TYPE_AAAA;
-#endif
-          else
+          if(!driver_dns_parse_type(optarg, &dns_type))
             usage(argv[0], "Unknown DNS type! Valid types are: " DNS_TYPES);
 
         }
+        else if(!strcmp(option_name, "doh"))
+        {
+          doh = optarg;
+        }
+
+        /* HTTP-specific options */
+        else if(!strcmp(option_name, "http"))
+        {
+          char *port = strrchr(optarg, ':');
+
+          if(driver_http)
+            usage(argv[0], "--http can only be used once!");
+
+          if(port)
+            *port++ = '\0';
+
+          output_set  = TRUE;
+          driver_http = driver_http_create(group, optarg, port ? atoi(port) : HTTP_DEFAULT_PORT);
+        }
 
         /* Debug options */
         else if(!strcmp(option_name, "d"))
@@ -362,6 +485,10 @@ int main(int argc, char *argv[])
         {
           session_enable_packet_trace();
         }
+        else if(!strcmp(option_name, "flight-recorder"))
+        {
+          flight_recorder_set_file(optarg);
+        }
         else
         {
           usage(argv[0], "Unknown option");
@@ -381,15 +508,43 @@ int main(int argc, char *argv[])
     exit(1);
   }
 
+  if(fountain && (!download || chunk != -1))
+  {
+    LOG_FATAL("--fountain can only be used with --download, and not with --chunk");
+    exit(1);
+  }
+
+  if(upload && download)
+  {
+    LOG_FATAL("--upload and --download can't be used together");
+    exit(1);
+  }
+
+  /* --pipe is a kind of console. */
+  if(is_pipe && input_type == TYPE_NOT_SET)
+    input_type = TYPE_CONSOLE;
+
+  if(is_pipe && (input_type != TYPE_CONSOLE || download || upload))
+  {
+    LOG_FATAL("--pipe can only be used with --console, and not with --download or --upload");
+    exit(1);
+  }
+
   /* If no input was created, default to command. */
   if(input_type == TYPE_NOT_SET)
     input_type = TYPE_COMMAND;
 
+  if(upload && input_type != TYPE_CONSOLE && input_type != TYPE_EXEC)
+  {
+    LOG_FATAL("--upload can only be used with --console or --exec");
+    exit(1);
+  }
+
   switch(input_type)
   {
     case TYPE_CONSOLE:
-      LOG_WARNING("INPUT: Console");
-      driver_console_create(group, name, download, chunk);
+      LOG_WARNING("INPUT: Console%s", is_pipe ? " (pipe)" : "");
+      driver_console_create(group, name, download, chunk, fountain, upload, is_pipe);
       break;
 
     case TYPE_COMMAND:
@@ -403,15 +558,15 @@ int main(int argc, char *argv[])
       if(exec_process == NULL)
         usage(argv[0], "--exec set without a process!");
 
-      driver_exec_create(group, exec_process, name);
+      driver_exec_create(group, exec_process, name, exec_screen, upload);
       break;
 
     case TYPE_LISTENER:
-      LOG_WARNING("INPUT: Listening on port %d", driver_listener->port);
+      LOG_WARNING("INPUT: Listening on port %d%s", listen_port, socks ? " (SOCKS5)" : "");
       if(listen_port == 0)
         usage(argv[0], "--listen set without a port!");
 
-      driver_listener = driver_listener_create(group, "0.0.0.0", listen_port, name);
+      driver_listener = driver_listener_create(group, "0.0.0.0", listen_port, name, socks);
       break;
 
     case TYPE_PING:
@@ -462,6 +617,29 @@ int main(int argc, char *argv[])
       LOG_WARNING("OUTPUT: DNS tunnel to %s via %s:%d", driver_dns->domain, driver_dns->dns_host, driver_dns->dns_port);
     else
       LOG_WARNING("OUTPUT: DNS tunnel to %s:%d (no domain set! This probably needs to be the exact server where the dnscat2 server is running!)", driver_dns->dns_host, driver_dns->dns_port);
+
+    if(doh)
+    {
+      char *path = strchr(doh, '/');
+      char *port;
+
+      driver_dns->doh_path = safe_strdup(path ? path : DOH_DEFAULT_PATH);
+      if(path)
+        *path = '\0';
+
+      port = strrchr(doh, ':');
+      if(port)
+        *port++ = '\0';
+
+      driver_dns->doh_host = safe_strdup(doh);
+      driver_dns->doh_port = port ? atoi(port) : DOH_DEFAULT_PORT;
+
+      LOG_WARNING("OUTPUT: Sending the queries to http://%s:%d%s (DoH), or %s:%d if that doesn't work", driver_dns->doh_host, driver_dns->doh_port, driver_dns->doh_path, driver_dns->dns_host, driver_dns->dns_port);
+    }
+  }
+  else if(driver_http)
+  {
+    LOG_WARNING("OUTPUT: HTTP tunnel to %s:%d", driver_http->host, driver_http->port);
   }
   else
   {
@@ -472,10 +650,26 @@ int main(int argc, char *argv[])
   /* Be sure we clean up at exit. */
   atexit(cleanup);
 
+#ifndef WIN32
+  /* Let the user ask for a flight recorder dump. */
+  signal(SIGUSR1, handle_dump_signal);
+
+  /* A server (or a --listen client) that hangs up shows up as an error from
+   * send(), instead of killing us. */
+  signal(SIGPIPE, SIG_IGN);
+#endif
+
   /* Add the timeout function */
   select_set_timeout(group, timeout, NULL);
+  message_subscribe(MESSAGE_CONFIG, handle_message, NULL);
   while(TRUE)
-    select_group_do_select(group, 1000);
+  {
+    select_group_do_select(group, wait_timeout);
+
+    /* Everything the sessions saved up while handling that goes out now. */
+    wait_timeout = message_post_flush(poll_interval);
+    flight_recorder_check();
+  }
 
   return 0;
 }
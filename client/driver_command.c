@@ -1,4 +1,6 @@
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,11 +8,16 @@
 #include <sys/stat.h>
 
 #ifndef WIN32
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #endif
 
 #include "command_packet.h"
 #include "command_packet_stream.h"
+#include "dns.h"
+#include "driver_dns.h"
 #include "driver_exec.h"
 #include "log.h"
 #include "memory.h"
@@ -21,6 +28,516 @@
 
 #include "driver_command.h"
 
+/* The settings the server is allowed to change with COMMAND_CONFIG. Each one
+ * is posted as a MESSAGE_CONFIG, and whoever owns it picks it up. The only
+ * string setting is record_type. */
+static char *config_ints[] = { "packet_length", "retransmit_delay", "upload_window", "poll_interval", "ack_delay", NULL };
+
+static NBBOOL is_one_of(char *name, char **list)
+{
+  size_t i;
+
+  for(i = 0; list[i]; i++)
+    if(!strcmp(name, list[i]))
+      return TRUE;
+
+  return FALSE;
+}
+
+/* A whole, non-negative decimal number that fits in an int. */
+static NBBOOL parse_int(char *value, int *result)
+{
+  char *end;
+  long  n;
+
+  errno = 0;
+  n = strtol(value, &end, 10);
+  if(errno || end == value || *end || n < 0 || n > INT_MAX)
+    return FALSE;
+
+  *result = (int) n;
+  return TRUE;
+}
+
+static command_packet_t *handle_config(command_packet_t *in)
+{
+  size_t     i;
+  int        n;
+  dns_type_t type;
+
+  /* Check everything first, so a bad request doesn't get half-applied. */
+  for(i = 0; i < in->r.request.body.config.count; i++)
+  {
+    char *name  = in->r.request.body.config.names[i];
+    char *value = in->r.request.body.config.values[i];
+
+    if(is_one_of(name, config_ints))
+    {
+      if(!parse_int(value, &n))
+        return command_packet_create_error_response(in->request_id, CONFIG_STATUS_BAD_VALUE, "Bad number");
+    }
+    else if(!strcmp(name, "record_type"))
+    {
+      if(!driver_dns_parse_type(value, &type))
+        return command_packet_create_error_response(in->request_id, CONFIG_STATUS_BAD_VALUE, "Unknown DNS record type");
+    }
+    else
+    {
+      return command_packet_create_error_response(in->request_id, CONFIG_STATUS_UNKNOWN_SETTING, "Unknown setting");
+    }
+  }
+
+  for(i = 0; i < in->r.request.body.config.count; i++)
+  {
+    char *name  = in->r.request.body.config.names[i];
+    char *value = in->r.request.body.config.values[i];
+
+    if(is_one_of(name, config_ints))
+    {
+      parse_int(value, &n);
+      message_post_config_int(name, n);
+    }
+    else
+    {
+      message_post_config_string(name, value);
+    }
+  }
+
+  return command_packet_create_config_response(in->request_id);
+}
+
+/* How much of each stream COMMAND_RUN keeps if the server doesn't say, and
+ * the most it keeps if it does. */
+#define RUN_DEFAULT_OUTPUT 0x10000
+#define RUN_MAX_OUTPUT     0x100000
+
+#define PIPE_READ  0
+#define PIPE_WRITE 1
+
+static void send_response(driver_command_t *driver, command_packet_t *out)
+{
+  uint8_t *data;
+  uint32_t length;
+
+  printf("Response: ");
+  command_packet_print(out);
+
+  data = command_packet_to_bytes(out, &length);
+  message_post_data_out(driver->session_id, data, length);
+  safe_free(data);
+}
+
+/* Both of the process' pipes are closed (or we gave up on them), so collect
+ * its exit status and send everything back. This doesn't wait for the
+ * process: if it hasn't exited yet, it returns FALSE and the run stays where
+ * it is, to be tried again on the next heartbeat. */
+static NBBOOL run_finish(driver_command_t *driver, command_run_t *run)
+{
+  command_run_t **prev;
+  command_packet_t *out;
+  uint32_t status;
+  uint8_t *out_data;
+  uint8_t *err_data;
+  size_t   out_length;
+  size_t   err_length;
+
+#ifdef WIN32
+  DWORD code = (DWORD)-1;
+
+  if(WaitForSingleObject(run->process, 0) == WAIT_TIMEOUT)
+    return FALSE;
+  GetExitCodeProcess(run->process, &code);
+  CloseHandle(run->process);
+  status = code;
+#else
+  int   code;
+  pid_t pid = waitpid(run->pid, &code, WNOHANG);
+
+  if(pid == 0)
+    return FALSE;
+  else if(pid == -1)
+    status = (uint32_t)-1;
+  else if(WIFEXITED(code))
+    status = WEXITSTATUS(code);
+  else if(WIFSIGNALED(code))
+    status = 128 + WTERMSIG(code); /* The same as the shell. */
+  else
+    status = (uint32_t)-1;
+#endif
+
+  out_data = buffer_read_remaining_bytes(run->out, &out_length, -1, FALSE);
+  err_data = buffer_read_remaining_bytes(run->err, &err_length, -1, FALSE);
+
+  out = command_packet_create_run_response(run->request_id, run->flags, status, out_data, (uint32_t)out_length, err_data, (uint32_t)err_length);
+  send_response(driver, out);
+  command_packet_destroy(out);
+
+  safe_free(out_data);
+  safe_free(err_data);
+
+  for(prev = &driver->runs; *prev; prev = &(*prev)->next)
+  {
+    if(*prev == run)
+    {
+      *prev = run->next;
+      break;
+    }
+  }
+
+  buffer_destroy(run->out);
+  buffer_destroy(run->err);
+  safe_free(run);
+
+  return TRUE;
+}
+
+static command_run_t *find_run(driver_command_t *driver, int s)
+{
+  command_run_t *run;
+
+  for(run = driver->runs; run; run = run->next)
+    if((run->out_open && run->out_id == s) || (run->err_open && run->err_id == s))
+      return run;
+
+  return NULL;
+}
+
+static void run_close_pipe(driver_command_t *driver, command_run_t *run, int s)
+{
+#ifdef WIN32
+  select_group_remove_socket(driver->group, s);
+  CloseHandle(s == run->out_id ? run->out_pipe : run->err_pipe);
+#else
+  select_group_remove_and_close_socket(driver->group, s);
+#endif
+
+  if(s == run->out_id)
+    run->out_open = FALSE;
+  else
+    run->err_open = FALSE;
+}
+
+/* Kill a process that ran past its deadline, and send back what it said so
+ * far (once it's been reaped). The pipes are closed right away, in case
+ * something it started is still holding them open. */
+static void run_kill(driver_command_t *driver, command_run_t *run)
+{
+  LOG_WARNING("COMMAND_RUN: killing a process that ran too long");
+
+  run->flags |= RUN_FLAG_TIMED_OUT;
+#ifdef WIN32
+  TerminateProcess(run->process, (UINT)-1);
+#else
+  kill(run->pid, SIGKILL);
+#endif
+
+  if(run->out_open)
+    run_close_pipe(driver, run, run->out_id);
+  if(run->err_open)
+    run_close_pipe(driver, run, run->err_id);
+
+  run_finish(driver, run);
+}
+
+static SELECT_RESPONSE_t run_recv_callback(void *group, int s, uint8_t *data, size_t length, char *addr, uint16_t port, void *d)
+{
+  driver_command_t *driver = (driver_command_t*) d;
+  command_run_t    *run    = find_run(driver, s);
+  buffer_t         *buffer;
+  size_t            room;
+
+  if(!run)
+    return SELECT_CLOSE_REMOVE;
+
+  /* Once a stream is full, the rest of it is read and thrown away, so the
+   * process doesn't block on a full pipe. */
+  buffer = (s == run->out_id) ? run->out : run->err;
+  room   = run->max_output - buffer_get_length(buffer);
+  if(length > room)
+  {
+    run->flags |= RUN_FLAG_TRUNCATED;
+    length = room;
+  }
+  buffer_add_bytes(buffer, data, length);
+
+  /* The heartbeat doesn't fire while a process is busy talking, so the
+   * deadline is checked here too. */
+  if(run->deadline && time(NULL) >= run->deadline)
+    run_kill(driver, run);
+
+  return SELECT_OK;
+}
+
+static SELECT_RESPONSE_t run_closed_callback(void *group, int s, void *d)
+{
+  driver_command_t *driver = (driver_command_t*) d;
+  command_run_t    *run    = find_run(driver, s);
+
+  if(run)
+  {
+    run_close_pipe(driver, run, s);
+
+    if(!run->out_open && !run->err_open)
+      run_finish(driver, run);
+  }
+
+  return SELECT_OK;
+}
+
+static SELECT_RESPONSE_t run_error_callback(void *group, int s, int err, void *d)
+{
+  return run_closed_callback(group, s, d);
+}
+
+static void run_watch(driver_command_t *driver, int s)
+{
+  select_set_recv(driver->group,   s, run_recv_callback);
+  select_set_closed(driver->group, s, run_closed_callback);
+  select_set_error(driver->group,  s, run_error_callback);
+}
+
+/* Start a COMMAND_RUN process; the response is sent when it finishes. Returns
+ * an error response if it couldn't be started. */
+static command_packet_t *handle_run(driver_command_t *driver, command_packet_t *in)
+{
+  command_run_t *run = (command_run_t*) safe_malloc(sizeof(command_run_t));
+  char *command = in->r.request.body.run.command;
+
+#ifdef WIN32
+  static int           next_id = -0x1000; /* Arbitrary identifiers for select_group_add_pipe(). */
+  STARTUPINFOA         startupInfo;
+  PROCESS_INFORMATION  processInformation;
+  SECURITY_ATTRIBUTES  sa;
+  HANDLE               out_pipe[2];
+  HANDLE               err_pipe[2];
+  char                *command_line;
+#else
+  int out_pipe[2];
+  int err_pipe[2];
+#endif
+
+  run->request_id = in->request_id;
+  run->max_output = in->r.request.body.run.max_output;
+  if(run->max_output == 0)
+    run->max_output = RUN_DEFAULT_OUTPUT;
+  if(run->max_output > RUN_MAX_OUTPUT)
+    run->max_output = RUN_MAX_OUTPUT;
+  run->deadline = in->r.request.body.run.timeout ? time(NULL) + in->r.request.body.run.timeout : 0;
+
+#ifdef WIN32
+  ZeroMemory(&sa, sizeof(SECURITY_ATTRIBUTES));
+  sa.nLength              = sizeof(SECURITY_ATTRIBUTES);
+  sa.lpSecurityDescriptor = NULL;
+  sa.bInheritHandle       = TRUE;
+
+  if(!CreatePipe(&out_pipe[PIPE_READ], &out_pipe[PIPE_WRITE], &sa, 0))
+  {
+    safe_free(run);
+    return command_packet_create_error_response(in->request_id, -1, "Couldn't create a pipe");
+  }
+  if(!CreatePipe(&err_pipe[PIPE_READ], &err_pipe[PIPE_WRITE], &sa, 0))
+  {
+    CloseHandle(out_pipe[PIPE_READ]);
+    CloseHandle(out_pipe[PIPE_WRITE]);
+    safe_free(run);
+    return command_packet_create_error_response(in->request_id, -1, "Couldn't create a pipe");
+  }
+
+  /* Our ends of the pipes shouldn't be inherited. */
+  SetHandleInformation(out_pipe[PIPE_READ], HANDLE_FLAG_INHERIT, 0);
+  SetHandleInformation(err_pipe[PIPE_READ], HANDLE_FLAG_INHERIT, 0);
+
+  ZeroMemory(&startupInfo, sizeof(STARTUPINFO));
+  startupInfo.cb         = sizeof(STARTUPINFO);
+  startupInfo.dwFlags    = STARTF_USESTDHANDLES;
+  startupInfo.hStdInput  = NULL;
+  startupInfo.hStdOutput = out_pipe[PIPE_WRITE];
+  startupInfo.hStdError  = err_pipe[PIPE_WRITE];
+
+  ZeroMemory(&processInformation, sizeof(PROCESS_INFORMATION));
+
+  command_line = safe_malloc(strlen(command) + 12);
+  sprintf(command_line, "cmd.exe /c %s", command);
+
+  if(!CreateProcessA(NULL, command_line, 0, &sa, TRUE, CREATE_NO_WINDOW, 0, NULL, &startupInfo, &processInformation))
+  {
+    safe_free(command_line);
+    CloseHandle(out_pipe[PIPE_READ]);
+    CloseHandle(out_pipe[PIPE_WRITE]);
+    CloseHandle(err_pipe[PIPE_READ]);
+    CloseHandle(err_pipe[PIPE_WRITE]);
+    safe_free(run);
+    return command_packet_create_error_response(in->request_id, -1, "Couldn't create the process");
+  }
+  safe_free(command_line);
+
+  CloseHandle(processInformation.hThread);
+  CloseHandle(out_pipe[PIPE_WRITE]);
+  CloseHandle(err_pipe[PIPE_WRITE]);
+
+  run->process  = processInformation.hProcess;
+  run->out_pipe = out_pipe[PIPE_READ];
+  run->err_pipe = err_pipe[PIPE_READ];
+  run->out_id   = next_id--;
+  run->err_id   = next_id--;
+
+  select_group_add_pipe(driver->group, run->out_id, run->out_pipe, driver);
+  select_group_add_pipe(driver->group, run->err_id, run->err_pipe, driver);
+#else
+  if(pipe(out_pipe) == -1)
+  {
+    safe_free(run);
+    return command_packet_create_error_response(in->request_id, -1, "Couldn't create a pipe");
+  }
+  if(pipe(err_pipe) == -1)
+  {
+    close(out_pipe[PIPE_READ]);
+    close(out_pipe[PIPE_WRITE]);
+    safe_free(run);
+    return command_packet_create_error_response(in->request_id, -1, "Couldn't create a pipe");
+  }
+
+  run->pid = fork();
+  if(run->pid == -1)
+  {
+    close(out_pipe[PIPE_READ]);
+    close(out_pipe[PIPE_WRITE]);
+    close(err_pipe[PIPE_READ]);
+    close(err_pipe[PIPE_WRITE]);
+    safe_free(run);
+    return command_packet_create_error_response(in->request_id, -1, "Couldn't create the process");
+  }
+
+  if(run->pid == 0)
+  {
+    /* Nothing is written to the process, so it gets an empty stdin instead of
+     * ours. */
+    int null = open("/dev/null", O_RDONLY);
+
+    if(null == -1 || dup2(null, STDIN_FILENO) == -1)
+      nbdie("run: couldn't replace STDIN");
+    if(dup2(out_pipe[PIPE_WRITE], STDOUT_FILENO) == -1)
+      nbdie("run: couldn't duplicate STDOUT handle");
+    if(dup2(err_pipe[PIPE_WRITE], STDERR_FILENO) == -1)
+      nbdie("run: couldn't duplicate STDERR handle");
+
+    execlp("/bin/sh", "sh", "-c", command, (char*) NULL);
+
+    /* If execlp returns, bad stuff happened. */
+    LOG_FATAL("run: execlp failed (%d)", errno);
+    exit(127);
+  }
+
+  close(out_pipe[PIPE_WRITE]);
+  close(err_pipe[PIPE_WRITE]);
+
+  run->out_id = out_pipe[PIPE_READ];
+  run->err_id = err_pipe[PIPE_READ];
+
+  select_group_add_socket(driver->group, run->out_id, SOCKET_TYPE_STREAM, driver);
+  select_group_add_socket(driver->group, run->err_id, SOCKET_TYPE_STREAM, driver);
+#endif
+
+  LOG_WARNING("COMMAND_RUN: started %s", command);
+
+  run->out      = buffer_create(BO_BIG_ENDIAN);
+  run->err      = buffer_create(BO_BIG_ENDIAN);
+  run->out_open = TRUE;
+  run->err_open = TRUE;
+  run_watch(driver, run->out_id);
+  run_watch(driver, run->err_id);
+
+  run->next = driver->runs;
+  driver->runs = run;
+
+  return NULL;
+}
+
+static void handle_heartbeat(driver_command_t *driver)
+{
+  command_run_t *run = driver->runs;
+  command_run_t *next;
+  time_t now = time(NULL);
+
+  while(run)
+  {
+    next = run->next;
+
+    /* A process that closed its pipes is still held to its deadline until
+     * it's reaped. */
+    if(run->deadline && now >= run->deadline && !(run->flags & RUN_FLAG_TIMED_OUT))
+      run_kill(driver, run);
+    else if(!run->out_open && !run->err_open)
+      run_finish(driver, run);
+
+    run = next;
+  }
+}
+
+/* The response to a shell or exec request names the new session, which
+ * isn't final until the server answers its SYN, so it waits until then. */
+static void add_pending(driver_command_t *driver, uint16_t request_id, uint16_t command_id, uint16_t session_id)
+{
+  command_pending_t *pending = (command_pending_t*) safe_malloc(sizeof(command_pending_t));
+
+  pending->request_id = request_id;
+  pending->command_id = command_id;
+  pending->session_id = session_id;
+  pending->next       = driver->pending;
+
+  driver->pending = pending;
+}
+
+static command_pending_t *take_pending(driver_command_t *driver, uint16_t session_id)
+{
+  command_pending_t **p;
+  command_pending_t *pending;
+
+  for(p = &driver->pending; *p; p = &(*p)->next)
+  {
+    if((*p)->session_id == session_id)
+    {
+      pending = *p;
+      *p = pending->next;
+      return pending;
+    }
+  }
+
+  return NULL;
+}
+
+static void handle_session_established(driver_command_t *driver, uint16_t session_id)
+{
+  command_pending_t *pending = take_pending(driver, session_id);
+  command_packet_t *out;
+
+  if(!pending)
+    return;
+
+  if(pending->command_id == COMMAND_SHELL)
+    out = command_packet_create_shell_response(pending->request_id, session_get_wire_id(session_id));
+  else
+    out = command_packet_create_exec_response(pending->request_id, session_get_wire_id(session_id));
+
+  send_response(driver, out);
+  command_packet_destroy(out);
+  safe_free(pending);
+}
+
+static void handle_session_closed(driver_command_t *driver, uint16_t session_id)
+{
+  command_pending_t *pending = take_pending(driver, session_id);
+  command_packet_t *out;
+
+  if(!pending)
+    return;
+
+  out = command_packet_create_error_response(pending->request_id, COMMAND_STATUS_ERROR, "The session closed before it was established");
+  send_response(driver, out);
+  command_packet_destroy(out);
+  safe_free(pending);
+}
+
 static void handle_data_in(driver_command_t *driver, uint8_t *data, size_t length)
 {
   command_packet_stream_feed(driver->stream, data, length);
@@ -41,19 +558,21 @@ static void handle_data_in(driver_command_t *driver, uint8_t *data, size_t lengt
     else if(in->command_id == COMMAND_SHELL && in->is_request == TRUE)
     {
 #ifdef WIN32
-      driver_exec_t *driver_exec = driver_exec_create(driver->group, "cmd.exe", in->r.request.body.shell.name);
+      driver_exec_t *driver_exec = driver_exec_create(driver->group, "cmd.exe", in->r.request.body.shell.name, (in->r.request.body.shell.flags & SHELL_FLAG_SCREEN) ? TRUE : FALSE, NULL);
 #else
       /* TODO: Get the 'default' shell? */
-      driver_exec_t *driver_exec = driver_exec_create(driver->group, "sh", in->r.request.body.shell.name);
+      driver_exec_t *driver_exec = driver_exec_create(driver->group, "sh", in->r.request.body.shell.name, (in->r.request.body.shell.flags & SHELL_FLAG_SCREEN) ? TRUE : FALSE, NULL);
 #endif
 
-      out = command_packet_create_shell_response(in->request_id, driver_exec->session_id);
+      add_pending(driver, in->request_id, COMMAND_SHELL, driver_exec->session_id);
     }
     else if(in->command_id == COMMAND_EXEC && in->is_request == TRUE)
     {
-      driver_exec_t *driver_exec = driver_exec_create(driver->group, in->r.request.body.exec.command, in->r.request.body.exec.name);
+      /* With SHELL_FLAG_UPLOAD, the output is uploaded to a file named after the session. */
+      char *upload = (in->r.request.body.exec.flags & SHELL_FLAG_UPLOAD) ? in->r.request.body.exec.name : NULL;
+      driver_exec_t *driver_exec = driver_exec_create(driver->group, in->r.request.body.exec.command, in->r.request.body.exec.name, (in->r.request.body.exec.flags & SHELL_FLAG_SCREEN) ? TRUE : FALSE, upload);
 
-      out = command_packet_create_exec_response(in->request_id, driver_exec->session_id);
+      add_pending(driver, in->request_id, COMMAND_EXEC, driver_exec->session_id);
     }
     else if(in->command_id == COMMAND_DOWNLOAD && in->is_request == TRUE)
     {
@@ -109,6 +628,15 @@ static void handle_data_in(driver_command_t *driver, uint8_t *data, size_t lengt
         out = command_packet_create_upload_response(in->request_id);
       }
     }
+    else if(in->command_id == COMMAND_CONFIG && in->is_request == TRUE)
+    {
+      out = handle_config(in);
+    }
+    else if(in->command_id == COMMAND_RUN && in->is_request == TRUE)
+    {
+      /* Usually NULL; the response is sent when the process is done. */
+      out = handle_run(driver, in);
+    }
     else
     {
       printf("Got a command packet that we don't know how to handle!\n");
@@ -117,17 +645,7 @@ static void handle_data_in(driver_command_t *driver, uint8_t *data, size_t lengt
     }
 
     if(out)
-    {
-      uint8_t *data;
-      uint32_t length;
-
-      printf("Response: ");
-      command_packet_print(out);
-
-      data = command_packet_to_bytes(out, &length);
-
-      message_post_data_out(driver->session_id, data, length);
-    }
+      send_response(driver, out);
   }
 }
 
@@ -142,6 +660,18 @@ static void handle_message(message_t *message, void *d)
         handle_data_in(driver, message->message.data_in.data, message->message.data_in.length);
       break;
 
+    case MESSAGE_HEARTBEAT:
+      handle_heartbeat(driver);
+      break;
+
+    case MESSAGE_SESSION_ESTABLISHED:
+      handle_session_established(driver, message->message.session_established.session_id);
+      break;
+
+    case MESSAGE_SESSION_CLOSED:
+      handle_session_closed(driver, message->message.session_closed.session_id);
+      break;
+
     default:
       LOG_FATAL("driver_command received an invalid message: %d", message->type);
       abort();
@@ -162,6 +692,9 @@ driver_command_t *driver_command_create(select_group_t *group, char *name)
 
   /* Subscribe to the messages we care about. */
   message_subscribe(MESSAGE_DATA_IN,         handle_message, driver);
+  message_subscribe(MESSAGE_HEARTBEAT,       handle_message, driver);
+  message_subscribe(MESSAGE_SESSION_ESTABLISHED, handle_message, driver);
+  message_subscribe(MESSAGE_SESSION_CLOSED,  handle_message, driver);
 
   options[0].name    = "name";
   options[0].value.s = driver->name;
@@ -178,6 +711,13 @@ driver_command_t *driver_command_create(select_group_t *group, char *name)
 
 void driver_command_destroy(driver_command_t *driver)
 {
+  command_pending_t *pending;
+
+  while((pending = driver->pending))
+  {
+    driver->pending = pending->next;
+    safe_free(pending);
+  }
   if(driver->name)
     safe_free(driver->name);
   if(driver->stream)
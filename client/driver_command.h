@@ -1,6 +1,10 @@
 #ifndef __DRIVER_command_H__
 #define __DRIVER_command_H__
 
+#include <sys/types.h>
+#include <time.h>
+
+#include "buffer.h"
 #include "command_packet.h"
 #include "command_packet_stream.h"
 #include "message.h"
@@ -8,12 +12,54 @@
 #include "session.h"
 #include "types.h"
 
+/* A COMMAND_RUN process whose output is being collected. */
+typedef struct _command_run_t
+{
+  uint16_t  request_id;
+  uint32_t  max_output;
+  time_t    deadline; /* 0 if it can run forever. */
+  uint16_t  flags;
+  buffer_t *out;
+  buffer_t *err;
+  int       out_id;
+  int       err_id;
+  NBBOOL    out_open;
+  NBBOOL    err_open;
+
+#ifdef WIN32
+  HANDLE    out_pipe;
+  HANDLE    err_pipe;
+  HANDLE    process;
+#else
+  pid_t     pid;
+#endif
+
+  struct _command_run_t *next;
+} command_run_t;
+
+/* A COMMAND_SHELL or COMMAND_EXEC response that's waiting for its session to
+ * be established, since the session's id on the wire can change until then. */
+typedef struct _command_pending_t
+{
+  uint16_t  request_id;
+  uint16_t  command_id;
+  uint16_t  session_id;
+
+  struct _command_pending_t *next;
+} command_pending_t;
+
 typedef struct
 {
   char     *name;
   uint16_t  session_id;
   command_packet_stream_t *stream;
   select_group_t *group;
+
+  /* COMMAND_RUN processes that haven't finished yet. */
+  command_run_t *runs;
+
+  /* Sessions we started that haven't been established yet. */
+  command_pending_t *pending;
 } driver_command_t;
 
 driver_command_t *driver_command_create(select_group_t *group, char *name);
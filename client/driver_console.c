@@ -3,7 +3,10 @@
 #include <stdlib.h>
 #include <string.h>
 
-#ifndef WIN32
+#ifdef WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
 #include <unistd.h>
 #endif
 
@@ -16,6 +19,17 @@
 
 #include "driver_console.h"
 
+/* The identifier stdin is added to the select_group with. */
+#ifdef WIN32
+#define CONSOLE_STDIN -1
+#else
+#define CONSOLE_STDIN STDIN_FILENO
+#endif
+
+/* In --pipe mode, stop reading stdin once this much data is waiting to be
+ * acknowledged, and start again when it drops below. */
+#define PIPE_WINDOW 0x10000
+
 /* There can only be one driver_console, so store these as global variables. */
 static SELECT_RESPONSE_t console_stdin_recv(void *group, int socket, uint8_t *data, size_t length, char *addr, uint16_t port, void *d)
 {
@@ -23,23 +37,61 @@ static SELECT_RESPONSE_t console_stdin_recv(void *group, int socket, uint8_t *da
 
   message_post_data_out(driver_console->session_id, data, length);
 
+  if(driver_console->pipe)
+  {
+    driver_console->unacked += length;
+
+    /* Don't read any more than the session can keep track of; whatever's
+     * left waits in the pipe. */
+    if(driver_console->unacked >= PIPE_WINDOW)
+    {
+      LOG_INFO("%zd bytes waiting to be acknowledged, pausing stdin", driver_console->unacked);
+      select_group_pause(driver_console->group, CONSOLE_STDIN, TRUE);
+      driver_console->is_paused = TRUE;
+    }
+  }
+
   return SELECT_OK;
 }
 
 static SELECT_RESPONSE_t console_stdin_closed(void *group, int socket, void *d)
 {
-  /* When the stdin pipe is closed, the stdin driver signals the end. */
-  message_post_shutdown();
+  driver_console_t *driver_console = (driver_console_t*) d;
+
+  if(driver_console->pipe)
+  {
+    /* In pipe mode, the end of stdin is only the end of our half; the
+     * session sends what's left, and output keeps flowing till the server
+     * closes it. */
+    message_post_data_end(driver_console->session_id);
+  }
+  else
+  {
+    /* When the stdin pipe is closed, the stdin driver signals the end. */
+    message_post_shutdown();
+  }
 
   return SELECT_CLOSE_REMOVE;
 }
 
 static void handle_data_in(driver_console_t *driver, uint8_t *data, size_t length)
 {
-  size_t i;
+  /* One write per packet (rather than one per byte), and flush it so
+   * interactive output shows up right away. */
+  fwrite(data, 1, length, stdout);
+  fflush(stdout);
+}
+
+static void handle_data_acked(driver_console_t *driver, size_t remaining)
+{
+  driver->unacked = remaining;
 
-  for(i = 0; i < length; i++)
-    fputc(data[i], stdout);
+  if(driver->is_paused && driver->unacked < PIPE_WINDOW)
+  {
+    LOG_INFO("%zd bytes waiting to be acknowledged, resuming stdin", driver->unacked);
+    select_group_pause(driver->group, CONSOLE_STDIN, FALSE);
+    driver->is_paused = FALSE;
+  }
 }
 
 static void handle_message(message_t *message, void *d)
@@ -53,39 +105,67 @@ static void handle_message(message_t *message, void *d)
         handle_data_in(driver, message->message.data_in.data, message->message.data_in.length);
       break;
 
+    case MESSAGE_DATA_ACKED:
+      if(message->message.data_acked.session_id == driver->session_id)
+        handle_data_acked(driver, message->message.data_acked.remaining);
+      break;
+
+    case MESSAGE_SESSION_CLOSED:
+      /* Once the server's done with a pipe, so are we. */
+      if(message->message.session_closed.session_id == driver->session_id)
+        message_post_shutdown();
+      break;
+
     default:
       LOG_FATAL("driver_console received an invalid message: %d", message->type);
       abort();
   }
 }
 
-driver_console_t *driver_console_create(select_group_t *group, char *name, char *download, int first_chunk)
+driver_console_t *driver_console_create(select_group_t *group, char *name, char *download, int first_chunk, NBBOOL fountain, char *upload, NBBOOL is_pipe)
 {
   driver_console_t *driver = (driver_console_t*) safe_malloc(sizeof(driver_console_t));
 
-  message_options_t options[4];
+  message_options_t options[5];
 
 #ifdef WIN32
   /* On Windows, the stdin_handle is quite complicated, and involves a sub-thread. */
   HANDLE stdin_handle = get_stdin_handle();
-  select_group_add_pipe(group, -1, stdin_handle, driver);
-  select_set_recv(group,       -1, console_stdin_recv);
-  select_set_closed(group,     -1, console_stdin_closed);
+  select_group_add_pipe(group, CONSOLE_STDIN, stdin_handle, driver);
+  select_set_recv(group,       CONSOLE_STDIN, console_stdin_recv);
+  select_set_closed(group,     CONSOLE_STDIN, console_stdin_closed);
 #else
   /* On Linux, the stdin_handle is easy. */
-  int stdin_handle = STDIN_FILENO;
-  select_group_add_socket(group, stdin_handle, SOCKET_TYPE_STREAM, driver);
-  select_set_recv(group,         stdin_handle, console_stdin_recv);
-  select_set_closed(group,       stdin_handle, console_stdin_closed);
+  select_group_add_socket(group, CONSOLE_STDIN, SOCKET_TYPE_STREAM, driver);
+  select_set_recv(group,         CONSOLE_STDIN, console_stdin_recv);
+  select_set_closed(group,       CONSOLE_STDIN, console_stdin_closed);
 #endif
 
+  driver->group       = group;
+
   driver->name        = name ? name : "[unnamed console]";
   driver->download    = download;
   driver->first_chunk = first_chunk;
+  driver->fountain    = fountain;
+  driver->upload      = upload;
+  driver->pipe        = is_pipe;
+  driver->is_paused   = FALSE;
+  driver->unacked     = 0;
 
   /* Subscribe to the messages we care about. */
   message_subscribe(MESSAGE_DATA_IN,         handle_message, driver);
 
+  if(driver->pipe)
+  {
+    message_subscribe(MESSAGE_DATA_ACKED,     handle_message, driver);
+    message_subscribe(MESSAGE_SESSION_CLOSED, handle_message, driver);
+
+#ifdef WIN32
+    /* Don't let Windows turn \n into \r\n. */
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+  }
+
   options[0].name    = "name";
   options[0].value.s = driver->name;
 
@@ -96,13 +176,33 @@ driver_console_t *driver_console_create(select_group_t *group, char *name, char
 
     options[2].name    = "first_chunk";
     options[2].value.i = driver->first_chunk;
+
+    options[3].name    = "fountain";
+    options[3].value.i = driver->fountain;
+  }
+  else if(driver->upload)
+  {
+    /* Send stdin to the server as a chunked upload. */
+    options[1].name    = "upload";
+    options[1].value.s = driver->upload;
+
+    options[2].name    = NULL;
+  }
+  else if(driver->pipe)
+  {
+    /* Let the server know that the end of stdin isn't the end of the
+     * session. */
+    options[1].name    = "half_close";
+    options[1].value.i = TRUE;
+
+    options[2].name    = NULL;
   }
   else
   {
     options[1].name = NULL;
   }
 
-  options[3].name    = NULL;
+  options[4].name    = NULL;
 
   driver->session_id = message_post_create_session(options);
 
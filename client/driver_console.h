@@ -11,9 +11,18 @@ typedef struct
   char      *name;
   char      *download;
   uint32_t   first_chunk;
+  NBBOOL     fountain;
+  char      *upload;
+
+  /* In pipe mode, stdin is only read while the session has room for it, and
+   * the end of stdin only ends our half of the session. */
+  select_group_t *group;
+  NBBOOL     pipe;
+  NBBOOL     is_paused;
+  size_t     unacked;
 } driver_console_t;
 
-driver_console_t  *driver_console_create(select_group_t *group, char *name, char *download, int first_chunk);
+driver_console_t  *driver_console_create(select_group_t *group, char *name, char *download, int first_chunk, NBBOOL fountain, char *upload, NBBOOL is_pipe);
 void               driver_console_destroy();
 
 #endif
@@ -9,9 +9,11 @@
 
 #include "buffer.h"
 #include "dns.h"
+#include "http.h"
 #include "log.h"
 #include "memory.h"
 #include "message.h"
+#include "tcp.h"
 #include "types.h"
 #include "udp.h"
 
@@ -114,14 +116,90 @@ static uint8_t *buffer_decode_hex(uint8_t *str, size_t *length)
   return buffer_create_string_and_destroy(out, length);
 }
 
-static SELECT_RESPONSE_t recv_socket_callback(void *group, int s, uint8_t *data, size_t length, char *addr, uint16_t port, void *param)
+uint8_t *driver_dns_decode_name(char *name, char *domain, size_t *length)
 {
-  /*driver_dns_t *driver_dns = param;*/
-  dns_t        *dns    = dns_create_from_packet(data, length);
-  driver_dns_t *driver = (driver_dns_t*) param;
+  uint8_t *stripped = remove_domain(name, domain);
+  uint8_t *result;
 
-  LOG_INFO("DNS response received (%d bytes)", length);
+  if(!stripped)
+    return NULL;
+
+  *length = strlen((char*)stripped);
+  result = buffer_decode_hex(stripped, length);
+  safe_free(stripped);
+
+  return result;
+}
+
+uint8_t *driver_dns_decode_answer(dns_t *dns, char *domain, size_t *length)
+{
+  size_t     i;
+  uint8_t   *answer = NULL;
+  dns_type_t type = dns->answers[0].type;
+
+  *length = 0;
+
+  if(type == _DNS_TYPE_TEXT)
+  {
+    /* Get the answer. */
+    answer  = dns->answers[0].answer->TEXT.text;
+    *length = dns->answers[0].answer->TEXT.length;
+    LOG_INFO("Received a TXT response (%zu bytes)", *length);
+
+    /* Decode it. */
+    answer = buffer_decode_hex(answer, length);
+  }
+  else if(type == _DNS_TYPE_CNAME)
+  {
+    LOG_INFO("Received a CNAME response (%zu bytes)", strlen((char*)dns->answers[0].answer->CNAME.name));
+    answer = driver_dns_decode_name((char*)dns->answers[0].answer->CNAME.name, domain, length);
+  }
+  else if(type == _DNS_TYPE_MX)
+  {
+    LOG_INFO("Received a MX response (%zu bytes)", strlen((char*)dns->answers[0].answer->MX.name));
+    answer = driver_dns_decode_name((char*)dns->answers[0].answer->MX.name, domain, length);
+  }
+  else if(type == _DNS_TYPE_A)
+  {
+    buffer_t *buf = buffer_create(BO_BIG_ENDIAN);
+
+    for(i = 0; i < dns->answer_count; i++)
+      buffer_add_bytes(buf, dns->answers[i].answer->A.bytes, 4);
 
+    *length = buffer_read_next_int8(buf);
+    LOG_INFO("Received an A response (%zu bytes)", *length);
+
+    answer = safe_malloc(*length);
+    buffer_read_bytes_at(buf, 1, answer, *length);
+    buffer_destroy(buf);
+  }
+#ifndef WIN32
+  else if(type == _DNS_TYPE_AAAA)
+  {
+    buffer_t *buf = buffer_create(BO_BIG_ENDIAN);
+
+    for(i = 0; i < dns->answer_count; i++)
+      buffer_add_bytes(buf, dns->answers[i].answer->AAAA.bytes, 16);
+
+    *length = buffer_read_next_int8(buf);
+    LOG_INFO("Received an AAAA response (%zu bytes)", *length);
+
+    answer = safe_malloc(*length);
+    buffer_read_bytes_at(buf, 1, answer, *length);
+    buffer_destroy(buf);
+  }
+#endif
+  else
+  {
+    LOG_ERROR("Unknown DNS type returned: %d", type);
+  }
+
+  return answer;
+}
+
+/* Pass the data in a response (from UDP or DoH) to the sessions. */
+static void handle_response(driver_dns_t *driver, dns_t *dns)
+{
   /* TODO */
   if(dns->rcode != _DNS_RCODE_SUCCESS)
   {
@@ -160,94 +238,220 @@ static SELECT_RESPONSE_t recv_socket_callback(void *group, int s, uint8_t *data,
   }
   else
   {
-    size_t    i;
-
-    uint8_t   *answer = NULL;
-    size_t     answer_length = 0;
-    dns_type_t type = dns->answers[0].type;
+    size_t   answer_length;
+    uint8_t *answer = driver_dns_decode_answer(dns, driver->domain, &answer_length);
 
-    if(type == _DNS_TYPE_TEXT)
+    if(answer)
     {
-      /* Get the answer. */
-      answer        = dns->answers[0].answer->TEXT.text;
-      answer_length = dns->answers[0].answer->TEXT.length;
-      LOG_INFO("Received a TXT response (%zu bytes)", answer_length);
+      /*LOG_WARNING("Received a %zu-byte DNS response: %s [0x%04x]", answer_length, answer, type);*/
 
-      /* Decode it. */
-      answer = buffer_decode_hex(answer, &answer_length);
-    }
-    else if(type == _DNS_TYPE_CNAME)
-    {
-      /* Get the answer. */
-      answer = remove_domain((char*)dns->answers[0].answer->CNAME.name, driver->domain);
-      answer_length = strlen((char*)answer);
-      LOG_INFO("Received a CNAME response (%zu bytes)", answer_length);
+      /* Pass the buffer to the caller */
+      if(answer_length > 0)
+      {
+        /* Pass the data elsewhere. */
+        message_post_packet_in(answer, answer_length);
+      }
 
-      /* Decode it. */
-      answer = buffer_decode_hex(answer, &answer_length);
+      safe_free(answer);
     }
-    else if(type == _DNS_TYPE_MX)
-    {
-      /* Get the answer. */
-      answer = remove_domain((char*)dns->answers[0].answer->MX.name, driver->domain);
-      answer_length = strlen((char*)answer);
-      LOG_INFO("Received a MX response (%zu bytes)", answer_length);
+  }
+}
 
-      /* Decode it. */
-      answer = buffer_decode_hex(answer, &answer_length);
-    }
-    else if(type == _DNS_TYPE_A)
-    {
-      buffer_t *buf = buffer_create(BO_BIG_ENDIAN);
+static SELECT_RESPONSE_t recv_socket_callback(void *group, int s, uint8_t *data, size_t length, char *addr, uint16_t port, void *param)
+{
+  dns_t        *dns    = dns_create_from_packet(data, length);
+  driver_dns_t *driver = (driver_dns_t*) param;
+
+  LOG_INFO("DNS response received (%d bytes)", length);
+
+  handle_response(driver, dns);
+  dns_destroy(dns);
+
+  return SELECT_OK;
+}
+
+/* Forget about the DoH connection; whatever queries were on it are lost, and
+ * the sessions will retransmit. */
+static void doh_close(driver_dns_t *driver)
+{
+  size_t i;
+
+  if(driver->doh_s != -1)
+    select_group_remove_and_close_socket(driver->group, driver->doh_s);
+  driver->doh_s = -1;
+
+  if(driver->doh_rx)
+    safe_free(driver->doh_rx);
+  driver->doh_rx            = NULL;
+  driver->doh_rx_length     = 0;
+
+  for(i = 0; i < driver->doh_pending_count; i++)
+    safe_free(driver->doh_pending[i].dns_bytes);
+  driver->doh_pending_count = 0;
+}
+
+/* Give up on DoH for a while; the queries that were waiting on it go out over
+ * UDP instead. */
+static void doh_fail(driver_dns_t *driver)
+{
+  size_t i;
+
+  LOG_WARNING("DoH: %s:%d isn't working; using UDP for the next %d seconds", driver->doh_host, driver->doh_port, DOH_RETRY_DELAY);
+
+  for(i = 0; i < driver->doh_pending_count; i++)
+  {
+    LOG_INFO("Resending DNS query 0x%04x to %s:%d", driver->doh_pending[i].trn_id, driver->dns_host, driver->dns_port);
+    udp_send(driver->s, driver->dns_host, driver->dns_port, driver->doh_pending[i].dns_bytes, driver->doh_pending[i].dns_length);
+  }
+
+  doh_close(driver);
+  driver->doh_retry = time(NULL) + DOH_RETRY_DELAY;
+}
+
+static SELECT_RESPONSE_t doh_recv(void *group, int s, uint8_t *data, size_t length, char *addr, uint16_t port, void *param)
+{
+  driver_dns_t *driver = (driver_dns_t*) param;
+  uint8_t      *body;
+  size_t        body_length;
+  int           status;
+  NBBOOL        failed = FALSE;
 
-      for(i = 0; i < dns->answer_count; i++)
-        buffer_add_bytes(buf, dns->answers[i].answer->A.bytes, 4);
+  driver->doh_rx = safe_realloc(driver->doh_rx, driver->doh_rx_length + length);
+  memcpy(driver->doh_rx + driver->doh_rx_length, data, length);
+  driver->doh_rx_length += length;
 
-      answer_length = buffer_read_next_int8(buf);
-      LOG_INFO("Received an A response (%zu bytes)", answer_length);
+  /* Pipelined responses come back in the order the queries went out. */
+  while((body = http_read_response(driver->doh_rx, &driver->doh_rx_length, &status, &body_length)))
+  {
+    uint16_t trn_id = 0;
+    dns_t   *dns;
 
-      answer = safe_malloc(answer_length);
-      buffer_read_bytes_at(buf, 1, answer, answer_length);
+    /* The query stays pending, so it's sent again over UDP. */
+    if(status != 200)
+    {
+      LOG_ERROR("DoH: the server responded with status %d", status);
+      safe_free(body);
+      failed = TRUE;
+      break;
     }
-#ifndef WIN32
-    else if(type == _DNS_TYPE_AAAA)
+
+    if(driver->doh_pending_count > 0)
     {
-      buffer_t *buf = buffer_create(BO_BIG_ENDIAN);
+      trn_id = driver->doh_pending[0].trn_id;
+      safe_free(driver->doh_pending[0].dns_bytes);
+      driver->doh_pending_count--;
+      memmove(driver->doh_pending, driver->doh_pending + 1, driver->doh_pending_count * sizeof(doh_query_t));
+    }
 
-      for(i = 0; i < dns->answer_count; i++)
-        buffer_add_bytes(buf, dns->answers[i].answer->AAAA.bytes, 16);
+    dns = dns_create_from_packet(body, body_length);
 
-      answer_length = buffer_read_next_int8(buf);
-      LOG_INFO("Received an AAAA response (%zu bytes)", answer_length);
+    LOG_INFO("DoH response received (%d bytes)", body_length);
 
-      answer = safe_malloc(answer_length);
-      buffer_read_bytes_at(buf, 1, answer, answer_length);
-    }
-#endif
+    if(dns->trn_id != trn_id)
+      LOG_ERROR("DoH: got a response to query 0x%04x, expected 0x%04x", dns->trn_id, trn_id);
     else
+      handle_response(driver, dns);
+
+    dns_destroy(dns);
+    safe_free(body);
+  }
+
+  if(status == HTTP_BAD_RESPONSE)
+  {
+    LOG_ERROR("DoH: the server sent a response we can't read");
+    failed = TRUE;
+  }
+
+  if(failed)
+  {
+    /* The socket is closed by returning SELECT_CLOSE_REMOVE. */
+    driver->doh_s = -1;
+    doh_fail(driver);
+    return SELECT_CLOSE_REMOVE;
+  }
+
+  return SELECT_OK;
+}
+
+static SELECT_RESPONSE_t doh_closed(void *group, int s, void *param)
+{
+  driver_dns_t *driver = (driver_dns_t*) param;
+
+  /* Servers close idle keep-alive connections, so this is only worth
+   * mentioning if queries were lost; we reconnect for the next one. */
+  if(driver->doh_pending_count > 0)
+    LOG_WARNING("DoH: the server closed the connection with %d queries outstanding", driver->doh_pending_count);
+
+  driver->doh_s = -1;
+  doh_close(driver);
+
+  return SELECT_CLOSE_REMOVE;
+}
+
+static SELECT_RESPONSE_t doh_error(void *group, int s, int err, void *param)
+{
+  LOG_ERROR("DoH: socket error %d", err);
+  return doh_closed(group, s, param);
+}
+
+/* Send a query to the DoH server, connecting first if we have to; returns
+ * FALSE if it has to go over UDP instead. */
+static NBBOOL doh_send(driver_dns_t *driver, uint16_t trn_id, uint8_t *dns_bytes, size_t dns_length)
+{
+  uint8_t *request;
+  size_t   request_length;
+  NBBOOL   success;
+
+  if(!driver->doh_host)
+    return FALSE;
+
+  /* The sessions keep sending, so this is where we notice a server that
+   * stopped answering. */
+  if(driver->doh_pending_count > 0 && time(NULL) - driver->doh_pending[0].sent > driver->doh_timeout)
+  {
+    LOG_ERROR("DoH: no response to query 0x%04x in %d seconds", driver->doh_pending[0].trn_id, driver->doh_timeout);
+    doh_fail(driver);
+  }
+
+  if(driver->doh_pending_count >= DOH_MAX_OUTSTANDING)
+    return FALSE;
+
+  if(driver->doh_s == -1)
+  {
+    if(time(NULL) < driver->doh_retry)
+      return FALSE;
+
+    driver->doh_s = tcp_connect(driver->doh_host, driver->doh_port);
+    if(driver->doh_s == -1)
     {
-      LOG_ERROR("Unknown DNS type returned: %d", type);
-      answer = NULL;
+      doh_fail(driver);
+      return FALSE;
     }
 
-    if(answer)
-    {
-      /*LOG_WARNING("Received a %zu-byte DNS response: %s [0x%04x]", answer_length, answer, type);*/
+    select_group_add_socket(driver->group, driver->doh_s, SOCKET_TYPE_STREAM, driver);
+    select_set_recv(driver->group,   driver->doh_s, doh_recv);
+    select_set_closed(driver->group, driver->doh_s, doh_closed);
+    select_set_error(driver->group,  driver->doh_s, doh_error);
+  }
 
-      /* Pass the buffer to the caller */
-      if(answer_length > 0)
-      {
-        /* Pass the data elsewhere. */
-        message_post_packet_in(answer, answer_length);
-      }
+  request = http_create_request("POST", driver->doh_host, driver->doh_port, driver->doh_path, "application/dns-message", dns_bytes, dns_length, &request_length);
+  success = http_send_all(driver->doh_s, request, request_length);
+  safe_free(request);
 
-      safe_free(answer);
-    }
+  if(!success)
+  {
+    doh_fail(driver);
+    return FALSE;
   }
 
-  dns_destroy(dns);
+  driver->doh_pending[driver->doh_pending_count].trn_id     = trn_id;
+  driver->doh_pending[driver->doh_pending_count].sent       = time(NULL);
+  driver->doh_pending[driver->doh_pending_count].dns_bytes  = safe_malloc(dns_length);
+  driver->doh_pending[driver->doh_pending_count].dns_length = dns_length;
+  memcpy(driver->doh_pending[driver->doh_pending_count].dns_bytes, dns_bytes, dns_length);
+  driver->doh_pending_count++;
 
-  return SELECT_OK;
+  return TRUE;
 }
 
 /* This function expects to receive the proper length of data. */
@@ -316,14 +520,58 @@ static void handle_packet_out(driver_dns_t *driver, uint8_t *data, size_t length
   dns_add_question(dns, (char*)encoded_bytes, driver->type, _DNS_CLASS_IN);
   dns_bytes = dns_to_packet(dns, &dns_length);
 
-  LOG_INFO("Sending DNS query for: %s to %s:%d", encoded_bytes, driver->dns_host, driver->dns_port);
-  udp_send(driver->s, driver->dns_host, driver->dns_port, dns_bytes, dns_length);
+  if(doh_send(driver, dns->trn_id, dns_bytes, dns_length))
+  {
+    LOG_INFO("Sending DNS query for: %s to %s:%d over DoH", encoded_bytes, driver->doh_host, driver->doh_port);
+  }
+  else
+  {
+    LOG_INFO("Sending DNS query for: %s to %s:%d", encoded_bytes, driver->dns_host, driver->dns_port);
+    udp_send(driver->s, driver->dns_host, driver->dns_port, dns_bytes, dns_length);
+  }
 
   safe_free(dns_bytes);
   safe_free(encoded_bytes);
   dns_destroy(dns);
 }
 
+NBBOOL driver_dns_parse_type(char *name, dns_type_t *type)
+{
+  if(!strcmp(name, "TXT") || !strcmp(name, "txt") || !strcmp(name, "TEXT") || !strcmp(name, "text"))
+    *type = _DNS_TYPE_TEXT;
+  else if(!strcmp(name, "CNAME") || !strcmp(name, "cname"))
+    *type = _DNS_TYPE_CNAME;
+  else if(!strcmp(name, "MX") || !strcmp(name, "mx"))
+    *type = _DNS_TYPE_MX;
+  else if(!strcmp(name, "A") || !strcmp(name, "a"))
+    *type = _DNS_TYPE_A;
+#ifndef WIN32
+  else if(!strcmp(name, "AAAA") || !strcmp(name, "aaaa"))
+    *type = _DNS_TYPE_AAAA;
+#endif
+  else
+    return FALSE;
+
+  return TRUE;
+}
+
+static void handle_config_string(driver_dns_t *driver, char *name, char *value)
+{
+  if(!strcmp(name, "record_type"))
+  {
+    if(driver_dns_parse_type(value, &driver->type))
+      LOG_WARNING("Now using %s records", value);
+    else
+      LOG_ERROR("Unknown DNS record type: %s", value);
+  }
+}
+
+static void handle_config_int(driver_dns_t *driver, char *name, int value)
+{
+  if(!strcmp(name, "retransmit_delay"))
+    driver->doh_timeout = value > 0 ? value : DOH_DEFAULT_TIMEOUT;
+}
+
 static void handle_message(message_t *message, void *d)
 {
   driver_dns_t *driver_dns = (driver_dns_t*) d;
@@ -334,6 +582,13 @@ static void handle_message(message_t *message, void *d)
       handle_packet_out(driver_dns, message->message.packet_out.data, message->message.packet_out.length);
       break;
 
+    case MESSAGE_CONFIG:
+      if(message->message.config.type == CONFIG_INT)
+        handle_config_int(driver_dns, message->message.config.name, message->message.config.value.int_value);
+      else if(message->message.config.type == CONFIG_STRING)
+        handle_config_string(driver_dns, message->message.config.name, message->message.config.value.string_value);
+      break;
+
     default:
       LOG_FATAL("driver_dns received an invalid message!");
       abort();
@@ -356,6 +611,9 @@ driver_dns_t *driver_dns_create(select_group_t *group, char *domain, dns_type_t
   /* Set the domain and stuff. */
   driver_dns->domain   = domain;
   driver_dns->type     = type;
+  driver_dns->group    = group;
+  driver_dns->doh_s    = -1;
+  driver_dns->doh_timeout = DOH_DEFAULT_TIMEOUT;
 
   /* If it succeeds, add it to the select_group */
   select_group_add_socket(group, driver_dns->s, SOCKET_TYPE_STREAM, driver_dns);
@@ -364,6 +622,7 @@ driver_dns_t *driver_dns_create(select_group_t *group, char *domain, dns_type_t
 
   /* Subscribe to the messages we care about. */
   message_subscribe(MESSAGE_PACKET_OUT, handle_message, driver_dns);
+  message_subscribe(MESSAGE_CONFIG,     handle_message, driver_dns);
 
   /* TODO: Do I still need this? */
   message_post_config_int("max_packet_length", MAX_DNSCAT_LENGTH(driver_dns->domain));
@@ -373,6 +632,11 @@ driver_dns_t *driver_dns_create(select_group_t *group, char *domain, dns_type_t
 
 void driver_dns_destroy(driver_dns_t *driver)
 {
+  doh_close(driver);
+  if(driver->doh_host)
+    safe_free(driver->doh_host);
+  if(driver->doh_path)
+    safe_free(driver->doh_path);
   if(driver->dns_host)
     safe_free(driver->dns_host);
   safe_free(driver);
@@ -1,9 +1,38 @@
 #ifndef __DRIVER_DNS_H__
 #define __DRIVER_DNS_H__
 
+#include <time.h>
+
 #include "select_group.h"
 #include "session.h"
 
+/* DNS-over-HTTPS (RFC 8484) defaults, for --doh. We don't have TLS, so it's
+ * plain HTTP; a TLS proxy in front of a real resolver takes care of that. */
+#define DOH_DEFAULT_PORT 80
+#define DOH_DEFAULT_PATH "/dns-query"
+
+/* The most queries that can be waiting on the DoH connection; past that,
+ * they go over UDP. */
+#define DOH_MAX_OUTSTANDING 64
+
+/* How long we stick with UDP after the DoH server can't be reached. */
+#define DOH_RETRY_DELAY 30
+
+/* How long a DoH query can go unanswered before we give up on DoH; this
+ * follows the retransmit_delay setting, and starts at the sessions' default,
+ * since by then the session has sent it again anyways. */
+#define DOH_DEFAULT_TIMEOUT 1
+
+/* A query that's waiting on the DoH connection; the bytes are kept so it can
+ * go out over UDP if DoH fails. */
+typedef struct
+{
+  uint16_t  trn_id;
+  time_t    sent;
+  uint8_t  *dns_bytes;
+  size_t    dns_length;
+} doh_query_t;
+
 typedef struct
 {
   int        s;
@@ -15,9 +44,37 @@ typedef struct
   NBBOOL     is_closed;
   dns_type_t type;
 
+  select_group_t *group;
+
+  /* If doh_host is set, queries are POSTed to it, pipelined over one
+   * keep-alive connection, and UDP is only used when that doesn't work. */
+  char      *doh_host;
+  uint16_t   doh_port;
+  char      *doh_path;
+  int        doh_s;
+  uint8_t   *doh_rx;
+  size_t     doh_rx_length;
+  time_t     doh_retry; /* Don't try to connect again till then. */
+  int        doh_timeout;
+
+  /* The queries on the connection, oldest first; the responses come back
+   * in the same order. */
+  doh_query_t doh_pending[DOH_MAX_OUTSTANDING];
+  size_t      doh_pending_count;
+
 } driver_dns_t;
 
 driver_dns_t *driver_dns_create(select_group_t *group, char *domain, dns_type_t type);
 void          driver_dns_destroy();
 
+/* Get the dnscat data out of a name (a query, or a CNAME or MX answer) or out
+ * of a whole response; these return NULL if it can't be decoded, and the
+ * result has to be freed with safe_free(). */
+uint8_t      *driver_dns_decode_name(char *name, char *domain, size_t *length);
+uint8_t      *driver_dns_decode_answer(dns_t *dns, char *domain, size_t *length);
+
+/* Turn a record type's name ("TXT", "cname", etc) into a type; returns FALSE
+ * if it isn't one we can use. */
+NBBOOL        driver_dns_parse_type(char *name, dns_type_t *type);
+
 #endif
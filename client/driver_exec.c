@@ -20,11 +20,34 @@
 #define PIPE_READ  0
 #define PIPE_WRITE 1
 
+/* Send the next screen frame, unless the last one is still on its way. */
+static void send_frame(driver_exec_t *driver)
+{
+  uint8_t *frame;
+  size_t   length;
+
+  if(driver->frame_in_flight || !screen_is_dirty(driver->screen))
+    return;
+
+  frame = screen_get_frame(driver->screen, &length);
+  driver->frame_in_flight = TRUE;
+  message_post_data_out(driver->session_id, frame, length);
+  safe_free(frame);
+}
+
 static SELECT_RESPONSE_t exec_callback(void *group, int socket, uint8_t *data, size_t length, char *addr, uint16_t port, void *param)
 {
   driver_exec_t *driver_exec = (driver_exec_t*) param;
 
-  message_post_data_out(driver_exec->session_id, data, length);
+  if(driver_exec->screen)
+  {
+    screen_feed(driver_exec->screen, data, length);
+    send_frame(driver_exec);
+  }
+  else
+  {
+    message_post_data_out(driver_exec->session_id, data, length);
+  }
 
   return SELECT_OK;
 }
@@ -60,16 +83,25 @@ static void handle_message(message_t *message, void *d)
         handle_data_in(driver, message->message.data_in.data, message->message.data_in.length);
       break;
 
+    case MESSAGE_DATA_ACKED:
+      /* Once the last frame is through, send whatever the screen looks like now. */
+      if(message->message.data_acked.session_id == driver->session_id && message->message.data_acked.remaining == 0)
+      {
+        driver->frame_in_flight = FALSE;
+        send_frame(driver);
+      }
+      break;
+
     default:
       LOG_FATAL("driver_exec received an invalid message!");
       exit(1);
   }
 }
 
-driver_exec_t *driver_exec_create(select_group_t *group, char *process, char *name)
+driver_exec_t *driver_exec_create(select_group_t *group, char *process, char *name, NBBOOL is_screen, char *upload)
 {
   driver_exec_t *driver_exec = (driver_exec_t*) safe_malloc(sizeof(driver_exec_t));
-  message_options_t options[2];
+  message_options_t options[4];
 
   /* Declare some WIN32 variables needed for starting the sub-process. */
 #ifdef WIN32
@@ -82,14 +114,26 @@ driver_exec_t *driver_exec_create(select_group_t *group, char *process, char *na
   driver_exec->group   = group;
   driver_exec->name    = name ? name : process;
 
+  driver_exec->screen          = is_screen ? screen_create(SCREEN_DEFAULT_ROWS, SCREEN_DEFAULT_COLS) : NULL;
+  driver_exec->frame_in_flight = FALSE;
+
   /* Subscribe to the messages we care about. */
   message_subscribe(MESSAGE_DATA_IN,         handle_message, driver_exec);
+  if(is_screen)
+    message_subscribe(MESSAGE_DATA_ACKED,    handle_message, driver_exec);
 
   /* Set up the session options and create the session. */
   options[0].name    = "name";
   options[0].value.s = driver_exec->name;
 
-  options[1].name    = NULL;
+  options[1].name    = "is_screen";
+  options[1].value.i = is_screen;
+
+  /* If set, the output is sent as a chunked upload and saved on the server. */
+  options[2].name    = upload ? "upload" : NULL;
+  options[2].value.s = upload;
+
+  options[3].name    = NULL;
 
   driver_exec->session_id = message_post_create_session(options);
 #ifdef WIN32
@@ -180,6 +224,20 @@ driver_exec_t *driver_exec_create(select_group_t *group, char *process, char *na
     if(dup2(driver_exec->pipe_stdout[PIPE_WRITE], STDERR_FILENO) == -1)
       nbdie("exec: couldn't duplicate STDERR handle");
 
+    /* Let curses-style programs know what they're drawing on. */
+    if(is_screen)
+    {
+      char rows[8];
+      char cols[8];
+
+      sprintf(rows, "%d", SCREEN_DEFAULT_ROWS);
+      sprintf(cols, "%d", SCREEN_DEFAULT_COLS);
+
+      setenv("TERM",    "vt100", 1);
+      setenv("LINES",   rows,    1);
+      setenv("COLUMNS", cols,    1);
+    }
+
     /* Execute the new process. */
     execlp("/bin/sh", "sh", "-c", driver_exec->process, (char*) NULL);
 
@@ -202,5 +260,7 @@ driver_exec_t *driver_exec_create(select_group_t *group, char *process, char *na
 
 void driver_exec_destroy(driver_exec_t *driver)
 {
+  if(driver->screen)
+    screen_destroy(driver->screen);
   safe_free(driver);
 }
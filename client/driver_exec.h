@@ -4,6 +4,7 @@
 #include <sys/types.h>
 
 #include "message.h"
+#include "screen.h"
 #include "select_group.h"
 #include "session.h"
 
@@ -14,6 +15,10 @@ typedef struct
   select_group_t *group;
   char           *name;
 
+  /* In screen mode, output goes into the screen and is sent as frames. */
+  screen_t       *screen;
+  NBBOOL          frame_in_flight;
+
 #ifdef WIN32
   HANDLE exec_stdin[2];  /* The stdin handle. */
   HANDLE exec_stdout[2]; /* The stdout handle. */
@@ -27,7 +32,7 @@ typedef struct
 #endif
 } driver_exec_t;
 
-driver_exec_t *driver_exec_create(select_group_t *group, char *process, char *name);
+driver_exec_t *driver_exec_create(select_group_t *group, char *process, char *name, NBBOOL is_screen, char *upload);
 void           driver_exec_destroy();
 
 /* This can be used to start the driver without sending MESSAGE_START */
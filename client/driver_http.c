@@ -0,0 +1,451 @@
+/* driver_http.c
+ * Created October, 2026
+ *
+ * See LICENSE.txt
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "http.h"
+#include "log.h"
+#include "memory.h"
+#include "message.h"
+#include "tcp.h"
+#include "types.h"
+
+#include "driver_http.h"
+
+#define HTTP_PATH      "/dnscat"
+#define HTTP_WAIT_PATH "/dnscat/wait"
+
+static SELECT_RESPONSE_t http_recv(void *group, int s, uint8_t *data, size_t length, char *addr, uint16_t port, void *param);
+static SELECT_RESPONSE_t http_closed(void *group, int s, void *param);
+static SELECT_RESPONSE_t http_error(void *group, int s, int err, void *param);
+
+static http_connection_t *find_connection(driver_http_t *driver, int s)
+{
+  if(driver->post.s == s)
+    return &driver->post;
+  if(driver->wait.s == s)
+    return &driver->wait;
+  return NULL;
+}
+
+/* Forget about the connection (the caller closes the socket). Whatever
+ * request was on it is lost; the sessions will retransmit. */
+static void connection_reset(http_connection_t *conn)
+{
+  if(conn->rx)
+    safe_free(conn->rx);
+  conn->rx        = NULL;
+  conn->rx_length = 0;
+  conn->busy      = FALSE;
+  conn->s         = -1;
+}
+
+static NBBOOL connection_open(driver_http_t *driver, http_connection_t *conn)
+{
+  if(conn->s != -1)
+    return TRUE;
+
+  conn->s = tcp_connect(driver->host, driver->port);
+  if(conn->s == -1)
+  {
+    LOG_ERROR("HTTP: couldn't connect to %s:%d", driver->host, driver->port);
+    return FALSE;
+  }
+
+  select_group_add_socket(driver->group, conn->s, SOCKET_TYPE_STREAM, driver);
+  select_set_recv(driver->group,   conn->s, http_recv);
+  select_set_closed(driver->group, conn->s, http_closed);
+  select_set_error(driver->group,  conn->s, http_error);
+
+  return TRUE;
+}
+
+static void connection_close(driver_http_t *driver, http_connection_t *conn)
+{
+  if(conn->s != -1)
+    select_group_remove_and_close_socket(driver->group, conn->s);
+  connection_reset(conn);
+}
+
+/* Send a request on the connection, connecting first if we have to. */
+static NBBOOL send_request(driver_http_t *driver, http_connection_t *conn, char *method, char *path, uint8_t *body, size_t body_length)
+{
+  uint8_t  *request;
+  size_t    request_length;
+  NBBOOL    success;
+
+  if(!connection_open(driver, conn))
+    return FALSE;
+
+  request = http_create_request(method, driver->host, driver->port, path, "application/octet-stream", body, body_length, &request_length);
+  success = http_send_all(conn->s, request, request_length);
+  safe_free(request);
+
+  if(!success)
+  {
+    LOG_ERROR("HTTP: couldn't send a request to %s:%d", driver->host, driver->port);
+    connection_close(driver, conn);
+    return FALSE;
+  }
+
+  conn->busy = TRUE;
+  conn->sent = time(NULL);
+  return TRUE;
+}
+
+/* POST everything that's queued, unless a POST is already out. */
+static void flush(driver_http_t *driver)
+{
+  buffer_t      *body;
+  http_packet_t *packet;
+  http_packet_t *next;
+  uint8_t       *data;
+  size_t         length;
+
+  if(driver->post.busy || !driver->queue)
+    return;
+
+  body = buffer_create(BO_BIG_ENDIAN);
+  for(packet = driver->queue; packet; packet = next)
+  {
+    next = packet->next;
+
+    buffer_add_int16(body, (uint16_t)packet->length);
+    buffer_add_bytes(body, packet->data, packet->length);
+
+    safe_free(packet->data);
+    safe_free(packet);
+  }
+  driver->queue = NULL;
+
+  data = buffer_create_string_and_destroy(body, &length);
+  send_request(driver, &driver->post, "POST", HTTP_PATH, data, length);
+  safe_free(data);
+}
+
+/* Ask the server to tell us when it has something for one of our sessions,
+ * unless we're already asking. */
+static void start_wait(driver_http_t *driver)
+{
+  char   path[sizeof(HTTP_WAIT_PATH) + 32 + HTTP_MAX_WAIT_SESSIONS * 11];
+  size_t i;
+
+  if(driver->wait.busy || driver->wait_disabled || driver->wait_session_count == 0)
+    return;
+
+#ifdef WIN32
+  sprintf_s(path, sizeof(path), "%s?generation=%u&sessions=", HTTP_WAIT_PATH, driver->generation);
+#else
+  snprintf(path, sizeof(path), "%s?generation=%u&sessions=", HTTP_WAIT_PATH, driver->generation);
+#endif
+
+  for(i = 0; i < driver->wait_session_count; i++)
+  {
+#ifdef WIN32
+    sprintf_s(path + strlen(path), sizeof(path) - strlen(path), i ? ",%u" : "%u", driver->wait_sessions[i]);
+#else
+    snprintf(path + strlen(path), sizeof(path) - strlen(path), i ? ",%u" : "%u", driver->wait_sessions[i]);
+#endif
+  }
+
+  send_request(driver, &driver->wait, "GET", path, NULL, 0);
+}
+
+/* The session id, from the packet header (see doc/protocol.txt). */
+static uint32_t peek_session_id(uint8_t *data, size_t length)
+{
+  uint32_t session_id;
+
+  if(length < 5)
+    return 0;
+
+  session_id = (data[3] << 8) | data[4];
+  if(session_id == 0xFFFF && length >= 9)
+    session_id = ((uint32_t)data[5] << 24) | ((uint32_t)data[6] << 16) | ((uint32_t)data[7] << 8) | data[8];
+
+  return session_id;
+}
+
+/* Keep track of which sessions the long poll should wait on, from the
+ * packets they send. */
+static void track_session(driver_http_t *driver, uint32_t session_id, uint8_t type)
+{
+  size_t i;
+  NBBOOL is_new = TRUE;
+
+  for(i = 0; i < driver->wait_session_count; i++)
+  {
+    if(driver->wait_sessions[i] == session_id)
+    {
+      driver->wait_session_count--;
+      memmove(driver->wait_sessions + i, driver->wait_sessions + i + 1, (driver->wait_session_count - i) * sizeof(uint32_t));
+      is_new = FALSE;
+      break;
+    }
+  }
+
+  if(type != PACKET_TYPE_SYN && type != PACKET_TYPE_MSG)
+    return;
+
+  if(driver->wait_session_count == HTTP_MAX_WAIT_SESSIONS)
+  {
+    driver->wait_session_count--;
+    memmove(driver->wait_sessions, driver->wait_sessions + 1, driver->wait_session_count * sizeof(uint32_t));
+  }
+  driver->wait_sessions[driver->wait_session_count++] = session_id;
+
+  /* The long poll that's out doesn't know about this one, so ask again. */
+  if(is_new && driver->wait.busy)
+  {
+    connection_close(driver, &driver->wait);
+    start_wait(driver);
+  }
+}
+
+static void handle_packet_out(driver_http_t *driver, uint8_t *data, size_t length)
+{
+  uint32_t        session_id = peek_session_id(data, length);
+  http_packet_t **tail;
+  http_packet_t  *packet;
+
+  if(length >= 3)
+    track_session(driver, session_id, data[2]);
+
+  /* Sessions only have one packet out at a time, so a newer one from the
+   * same session (usually a retransmission, since the POST is slow) replaces
+   * the one that's waiting. */
+  for(tail = &driver->queue; *tail; tail = &(*tail)->next)
+  {
+    if((*tail)->session_id == session_id)
+    {
+      safe_free((*tail)->data);
+      (*tail)->data   = safe_malloc(length);
+      (*tail)->length = length;
+      memcpy((*tail)->data, data, length);
+
+      flush(driver);
+      return;
+    }
+  }
+
+  packet = (http_packet_t*) safe_malloc(sizeof(http_packet_t));
+  packet->session_id = session_id;
+  packet->data       = safe_malloc(length);
+  packet->length     = length;
+  memcpy(packet->data, data, length);
+  *tail = packet;
+
+  flush(driver);
+}
+
+static void handle_post_response(driver_http_t *driver, int status, uint8_t *body, size_t length)
+{
+  size_t offset = 0;
+
+  if(status != 200)
+  {
+    LOG_ERROR("HTTP: the server responded with status %d", status);
+  }
+  else
+  {
+    /* The same as the request: a 16-bit length before each packet. */
+    while(offset + 2 <= length)
+    {
+      size_t packet_length = (body[offset] << 8) | body[offset + 1];
+      offset += 2;
+
+      if(offset + packet_length > length)
+      {
+        LOG_ERROR("HTTP: the response has a truncated packet");
+        break;
+      }
+
+      if(packet_length > 0)
+        message_post_packet_in(body + offset, packet_length);
+      offset += packet_length;
+    }
+  }
+
+  /* Anything the sessions sent while we were handing out the responses went
+   * into the queue; send it now. */
+  driver->post.busy = FALSE;
+  flush(driver);
+}
+
+static void handle_wait_response(driver_http_t *driver, int status, uint8_t *body, size_t length)
+{
+  uint32_t generation;
+
+  driver->wait.busy = FALSE;
+
+  if(status != 200)
+  {
+    LOG_WARNING("HTTP: the server doesn't do long polls (status %d); falling back to polling", status);
+    driver->wait_disabled = TRUE;
+    return;
+  }
+
+  /* The body is the server's generation, as text. */
+  body[length] = '\0';
+  generation = strtoul((char*)body, NULL, 10);
+  if(generation != driver->generation)
+  {
+    driver->generation = generation;
+
+    /* The server has data for somebody; have everybody poll now. */
+    message_post_heartbeat();
+  }
+
+  start_wait(driver);
+}
+
+static SELECT_RESPONSE_t http_recv(void *group, int s, uint8_t *data, size_t length, char *addr, uint16_t port, void *param)
+{
+  driver_http_t     *driver = (driver_http_t*) param;
+  http_connection_t *conn   = find_connection(driver, s);
+  uint8_t           *body;
+  size_t             body_length;
+  int                status;
+
+  if(!conn)
+    return SELECT_CLOSE_REMOVE;
+
+  conn->rx = safe_realloc(conn->rx, conn->rx_length + length);
+  memcpy(conn->rx + conn->rx_length, data, length);
+  conn->rx_length += length;
+
+  body = http_read_response(conn->rx, &conn->rx_length, &status, &body_length);
+  if(body)
+  {
+    if(conn == &driver->post)
+      handle_post_response(driver, status, body, body_length);
+    else
+      handle_wait_response(driver, status, body, body_length);
+
+    safe_free(body);
+  }
+  else if(status == HTTP_BAD_RESPONSE)
+  {
+    /* The rest of the connection can't be trusted either; start over. */
+    LOG_ERROR("HTTP: the server sent a response we can't read; reconnecting");
+    connection_reset(conn);
+    if(conn == &driver->post)
+      flush(driver);
+
+    return SELECT_CLOSE_REMOVE;
+  }
+
+  return SELECT_OK;
+}
+
+static SELECT_RESPONSE_t http_closed(void *group, int s, void *param)
+{
+  driver_http_t     *driver = (driver_http_t*) param;
+  http_connection_t *conn   = find_connection(driver, s);
+
+  if(conn)
+  {
+    if(conn->busy)
+      LOG_WARNING("HTTP: the server closed the connection before responding");
+    connection_reset(conn);
+
+    /* The long poll is restarted on the next heartbeat, so a server that
+     * keeps hanging up doesn't get hammered. */
+    if(conn == &driver->post)
+      flush(driver);
+  }
+
+  return SELECT_CLOSE_REMOVE;
+}
+
+static SELECT_RESPONSE_t http_error(void *group, int s, int err, void *param)
+{
+  LOG_ERROR("HTTP: socket error %d", err);
+  return http_closed(group, s, param);
+}
+
+/* A request the server never answered (a dropped connection that didn't
+ * close, say) would keep the connection busy forever; drop the connection
+ * and start over. What was on it is lost, and the sessions retransmit. */
+static void check_timeouts(driver_http_t *driver)
+{
+  time_t now = time(NULL);
+
+  if(driver->post.busy && now - driver->post.sent > HTTP_REQUEST_TIMEOUT)
+  {
+    LOG_WARNING("HTTP: no response to a POST in %d seconds; reconnecting", HTTP_REQUEST_TIMEOUT);
+    connection_close(driver, &driver->post);
+    flush(driver);
+  }
+
+  if(driver->wait.busy && now - driver->wait.sent > HTTP_REQUEST_TIMEOUT)
+  {
+    LOG_WARNING("HTTP: no response to a long poll in %d seconds; reconnecting", HTTP_REQUEST_TIMEOUT);
+    connection_close(driver, &driver->wait);
+  }
+}
+
+static void handle_message(message_t *message, void *d)
+{
+  driver_http_t *driver = (driver_http_t*) d;
+
+  switch(message->type)
+  {
+    case MESSAGE_PACKET_OUT:
+      handle_packet_out(driver, message->message.packet_out.data, message->message.packet_out.length);
+      break;
+
+    case MESSAGE_HEARTBEAT:
+      check_timeouts(driver);
+      start_wait(driver);
+      break;
+
+    default:
+      LOG_FATAL("driver_http received an invalid message!");
+      abort();
+  }
+}
+
+driver_http_t *driver_http_create(select_group_t *group, char *host, uint16_t port)
+{
+  driver_http_t *driver = (driver_http_t*) safe_malloc(sizeof(driver_http_t));
+
+  driver->host  = safe_strdup(host);
+  driver->port  = port;
+  driver->group = group;
+
+  connection_reset(&driver->post);
+  connection_reset(&driver->wait);
+
+  /* Subscribe to the messages we care about. */
+  message_subscribe(MESSAGE_PACKET_OUT, handle_message, driver);
+  message_subscribe(MESSAGE_HEARTBEAT,  handle_message, driver);
+
+  message_post_config_int("max_packet_length", HTTP_MAX_PACKET_LENGTH);
+
+  return driver;
+}
+
+void driver_http_destroy(driver_http_t *driver)
+{
+  http_packet_t *packet;
+  http_packet_t *next;
+
+  connection_close(driver, &driver->post);
+  connection_close(driver, &driver->wait);
+
+  for(packet = driver->queue; packet; packet = next)
+  {
+    next = packet->next;
+    safe_free(packet->data);
+    safe_free(packet);
+  }
+
+  safe_free(driver->host);
+  safe_free(driver);
+}
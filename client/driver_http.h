@@ -0,0 +1,86 @@
+/* driver_http.h
+ * Created October, 2026
+ *
+ * See LICENSE.txt
+ *
+ * An output driver that carries dnscat packets over HTTP instead of DNS.
+ * Packets are POSTed in batches over a keep-alive connection, and each
+ * response carries the server's answers; since there's no 255-byte name to
+ * squeeze them into, a packet can be up to HTTP_MAX_PACKET_LENGTH bytes.
+ *
+ * A second connection long-polls the server: the request names our sessions,
+ * the server holds it until it has data queued for one of them, and when it
+ * returns, the sessions are told to poll right away instead of waiting for
+ * the next heartbeat.
+ */
+
+#ifndef __DRIVER_HTTP_H__
+#define __DRIVER_HTTP_H__
+
+#include <time.h>
+
+#include "packet.h"
+#include "select_group.h"
+#include "types.h"
+
+#define HTTP_DEFAULT_PORT      8080
+#define HTTP_MAX_PACKET_LENGTH MAX_PACKET_SIZE
+
+/* Seconds a request can go unanswered before we give up on its connection;
+ * the server holds a long poll for up to 20 seconds, so this has some room
+ * past that. */
+#define HTTP_REQUEST_TIMEOUT   30
+
+/* The most sessions a long poll can name; past that, the one that's been
+ * quiet the longest is left out. */
+#define HTTP_MAX_WAIT_SESSIONS 32
+
+/* A packet waiting for the next POST. */
+typedef struct _http_packet_t
+{
+  uint32_t  session_id;
+  uint8_t  *data;
+  size_t    length;
+
+  struct _http_packet_t *next;
+} http_packet_t;
+
+/* One keep-alive connection, with at most one request on it at a time. */
+typedef struct
+{
+  int       s;         /* -1 when it isn't connected. */
+  NBBOOL    busy;      /* A request is out, and we're waiting for the response. */
+  time_t    sent;      /* When that request went out. */
+  uint8_t  *rx;        /* What we have of the response so far. */
+  size_t    rx_length;
+} http_connection_t;
+
+typedef struct
+{
+  char           *host;
+  uint16_t        port;
+  select_group_t *group;
+
+  http_connection_t post;
+  http_connection_t wait;
+
+  /* Packets that came in while a POST was out; they go in the next one. */
+  http_packet_t  *queue;
+
+  /* The last generation the server told us about; it changes every time
+   * the server queues data for a session. */
+  uint32_t        generation;
+
+  /* The sessions the long poll waits on (the ones we've sent a SYN or MSG
+   * for, and not a FIN), the most recently active last. */
+  uint32_t        wait_sessions[HTTP_MAX_WAIT_SESSIONS];
+  size_t          wait_session_count;
+
+  /* Set if the server doesn't do long polls, so we stop asking. */
+  NBBOOL          wait_disabled;
+} driver_http_t;
+
+driver_http_t *driver_http_create(select_group_t *group, char *host, uint16_t port);
+void           driver_http_destroy(driver_http_t *driver);
+
+#endif
@@ -7,6 +7,7 @@
 #include <unistd.h>
 #endif
 
+#include "buffer.h"
 #include "log.h"
 #include "memory.h"
 #include "message.h"
@@ -17,6 +18,27 @@
 
 #include "driver_listener.h"
 
+/* SOCKS5 (RFC 1928) constants. */
+#define SOCKS_VERSION         0x05
+#define SOCKS_AUTH_NONE       0x00
+#define SOCKS_AUTH_REFUSED    0xFF
+#define SOCKS_CMD_CONNECT     0x01
+#define SOCKS_ATYP_IPV4       0x01
+#define SOCKS_ATYP_DOMAIN     0x03
+#define SOCKS_ATYP_IPV6       0x04
+#define SOCKS_REP_SUCCESS     0x00
+#define SOCKS_REP_FAILURE     0x01
+#define SOCKS_REP_BAD_COMMAND 0x07
+#define SOCKS_REP_BAD_ATYP    0x08
+
+typedef enum
+{
+  CLIENT_STATE_SOCKS_GREETING, /* Waiting for the list of auth methods */
+  CLIENT_STATE_SOCKS_REQUEST,  /* Waiting for the CONNECT */
+  CLIENT_STATE_CONNECTED,      /* Has a session */
+  CLIENT_STATE_CLOSED,         /* The socket's gone */
+} client_state_t;
+
 typedef struct _listener_client_t
 {
   int                s;
@@ -25,15 +47,179 @@ typedef struct _listener_client_t
   uint16_t           session_id;
   driver_listener_t *driver;
 
+  client_state_t     state;
+  buffer_t          *socks_buffer; /* Handshake bytes that haven't been handled yet */
+
   struct _listener_client_t *next;
 } client_entry_t;
 
 static client_entry_t *first_client = NULL;
 
+static void create_client_session(client_entry_t *client, char *name)
+{
+  message_options_t options[2];
+
+  options[0].name    = "name";
+  options[0].value.s = name;
+  options[1].name    = NULL;
+
+  client->session_id = message_post_create_session(options);
+  client->state      = CLIENT_STATE_CONNECTED;
+
+  LOG_WARNING("Received a connection from %s:%d (created session %d: %s)", client->address, client->port, client->session_id, name);
+}
+
+static void socks_reply(client_entry_t *client, uint8_t reply)
+{
+  /* The bound address doesn't mean anything here, so it's always 0.0.0.0:0. */
+  uint8_t response[] = { SOCKS_VERSION, 0x00, 0x00, SOCKS_ATYP_IPV4, 0, 0, 0, 0, 0, 0 };
+
+  response[1] = reply;
+  tcp_send(client->s, response, sizeof(response));
+}
+
+/* Read the SOCKS5 greeting and CONNECT request, which can arrive in any
+ * number of pieces. Anything after the request is the start of the stream. */
+static SELECT_RESPONSE_t socks_negotiate(client_entry_t *client)
+{
+  buffer_t *b = client->socks_buffer;
+  size_t    length;
+  size_t    needed;
+  uint8_t   atyp;
+  char      host[256];
+  char      name[300];
+  uint8_t   i;
+
+  /* Handled bytes are consumed, so everything is relative to the position. */
+  size_t    at = buffer_get_current_offset(b);
+
+  if(client->state == CLIENT_STATE_SOCKS_GREETING)
+  {
+    uint8_t method_count;
+    uint8_t reply[] = { SOCKS_VERSION, SOCKS_AUTH_REFUSED };
+
+    if(buffer_get_remaining_bytes(b) < 2)
+      return SELECT_OK;
+    method_count = buffer_read_int8_at(b, at + 1);
+    if(buffer_get_remaining_bytes(b) < (size_t)2 + method_count)
+      return SELECT_OK;
+
+    if(buffer_read_int8_at(b, at) != SOCKS_VERSION)
+    {
+      LOG_ERROR("Connection from %s:%d isn't SOCKS5", client->address, client->port);
+      return SELECT_CLOSE_REMOVE;
+    }
+
+    /* We only do "no authentication". */
+    for(i = 0; i < method_count; i++)
+      if(buffer_read_int8_at(b, at + 2 + i) == SOCKS_AUTH_NONE)
+        reply[1] = SOCKS_AUTH_NONE;
+
+    tcp_send(client->s, reply, sizeof(reply));
+    if(reply[1] == SOCKS_AUTH_REFUSED)
+    {
+      LOG_ERROR("SOCKS client %s:%d wants authentication", client->address, client->port);
+      return SELECT_CLOSE_REMOVE;
+    }
+
+    buffer_consume(b, 2 + method_count);
+    at += 2 + method_count;
+    client->state = CLIENT_STATE_SOCKS_REQUEST;
+  }
+
+  if(client->state == CLIENT_STATE_SOCKS_REQUEST)
+  {
+    uint16_t port;
+
+    if(buffer_get_remaining_bytes(b) < 5)
+      return SELECT_OK;
+
+    atyp = buffer_read_int8_at(b, at + 3);
+    if(atyp == SOCKS_ATYP_IPV4)
+      length = 4;
+    else if(atyp == SOCKS_ATYP_IPV6)
+      length = 16;
+    else if(atyp == SOCKS_ATYP_DOMAIN)
+      length = 1 + buffer_read_int8_at(b, at + 4);
+    else
+    {
+      socks_reply(client, SOCKS_REP_BAD_ATYP);
+      return SELECT_CLOSE_REMOVE;
+    }
+
+    /* VER CMD RSV ATYP, the address, and the port */
+    needed = 4 + length + 2;
+    if(buffer_get_remaining_bytes(b) < needed)
+      return SELECT_OK;
+
+    if(buffer_read_int8_at(b, at + 1) != SOCKS_CMD_CONNECT)
+    {
+      socks_reply(client, SOCKS_REP_BAD_COMMAND);
+      return SELECT_CLOSE_REMOVE;
+    }
+
+    if(atyp == SOCKS_ATYP_IPV4)
+    {
+      sprintf(host, "%d.%d.%d.%d", buffer_read_int8_at(b, at + 4), buffer_read_int8_at(b, at + 5), buffer_read_int8_at(b, at + 6), buffer_read_int8_at(b, at + 7));
+    }
+    else if(atyp == SOCKS_ATYP_IPV6)
+    {
+      /* The server puts brackets around it. */
+      host[0] = '\0';
+      for(i = 0; i < 8; i++)
+        sprintf(host + strlen(host), i ? ":%x" : "%x", buffer_read_int16_at(b, at + 4 + (i * 2)));
+    }
+    else
+    {
+      buffer_read_bytes_at(b, at + 5, host, length - 1);
+      host[length - 1] = '\0';
+
+      /* A name with a colon or a bracket would confuse the server. */
+      if(strpbrk(host, ":[]") || length == 1)
+      {
+        socks_reply(client, SOCKS_REP_FAILURE);
+        return SELECT_CLOSE_REMOVE;
+      }
+    }
+    port = buffer_read_int16_at(b, at + 4 + length);
+
+#ifdef WIN32
+    _snprintf_s(name, sizeof(name), sizeof(name), atyp == SOCKS_ATYP_IPV6 ? "forward:[%s]:%d" : "forward:%s:%d", host, port);
+#else
+    snprintf(name, sizeof(name), atyp == SOCKS_ATYP_IPV6 ? "forward:[%s]:%d" : "forward:%s:%d", host, port);
+#endif
+
+    /* Whether the server manages to connect isn't known for a while, so say
+     * it worked; if it didn't, the session (and this connection) is closed. */
+    socks_reply(client, SOCKS_REP_SUCCESS);
+    buffer_consume(b, needed);
+    create_client_session(client, name);
+
+    /* Anything the client sent after the request goes into the session. */
+    if(buffer_get_remaining_bytes(b) > 0)
+    {
+      uint8_t *data = buffer_read_remaining_bytes(b, &length, -1, TRUE);
+      message_post_data_out(client->session_id, data, length);
+      safe_free(data);
+    }
+
+    buffer_destroy(client->socks_buffer);
+    client->socks_buffer = NULL;
+  }
+
+  return SELECT_OK;
+}
+
 static SELECT_RESPONSE_t client_recv(void *group, int socket, uint8_t *data, size_t length, char *addr, uint16_t port, void *c)
 {
   client_entry_t *client = (client_entry_t*) c;
 
+  if(client->state != CLIENT_STATE_CONNECTED)
+  {
+    buffer_add_bytes(client->socks_buffer, data, length);
+    return socks_negotiate(client);
+  }
+
   message_post_data_out(client->session_id, data, length);
 
   return SELECT_OK;
@@ -43,7 +229,10 @@ static SELECT_RESPONSE_t client_closed(void *group, int socket, void *c)
 {
   client_entry_t *client = (client_entry_t*) c;
 
-  message_post_close_session(client->session_id);
+  /* A SOCKS client that never finished the handshake has no session. */
+  if(client->state == CLIENT_STATE_CONNECTED)
+    message_post_close_session(client->session_id);
+  client->state = CLIENT_STATE_CLOSED;
 
   /* TODO: Unlink it from the entry list. */
 
@@ -61,26 +250,24 @@ static SELECT_RESPONSE_t listener_closed(void *group, int socket, void *c)
 static SELECT_RESPONSE_t listener_accept(void *group, int s, void *d)
 {
   driver_listener_t *driver = (driver_listener_t*) d;
-  message_options_t options[2];
   client_entry_t *client = safe_malloc(sizeof(client_entry_t));
 
   client->s          = tcp_accept(s, &client->address, &client->port);
 
-
-  options[0].name = "name";
-  if(driver->name)
-    options[0].value.s = driver->name;
-  else
-    options[0].value.s = "[unnamed listener]";
-  options[1].name    = NULL;
-
-  client->session_id = message_post_create_session(options);
-
   client->driver     = driver;
   client->next       = first_client;
   first_client       = client;
 
-  LOG_WARNING("Received a connection from %s:%d (created session %d)", client->address, client->port, client->session_id);
+  /* SOCKS connections don't get a session until they say where they're going. */
+  if(driver->socks)
+  {
+    client->state        = CLIENT_STATE_SOCKS_GREETING;
+    client->socks_buffer = buffer_create(BO_BIG_ENDIAN);
+  }
+  else
+  {
+    create_client_session(client, driver->name ? driver->name : "[unnamed listener]");
+  }
 
   select_group_add_socket(group, client->s, SOCKET_TYPE_STREAM, client);
   select_set_recv(group, client->s, client_recv);
@@ -95,9 +282,10 @@ static void handle_session_closed(driver_listener_t *driver, uint16_t session_id
 
   for(client = first_client; client; client = client->next)
   {
-    if(client->session_id == session_id)
+    if(client->state == CLIENT_STATE_CONNECTED && client->session_id == session_id)
     {
-      tcp_close(client->s);
+      select_group_remove_and_close_socket(driver->group, client->s);
+      client->state = CLIENT_STATE_CLOSED;
       return;
     }
   }
@@ -105,23 +293,22 @@ static void handle_session_closed(driver_listener_t *driver, uint16_t session_id
   LOG_WARNING("Couldn't find listener to close: session %d", session_id);
 }
 
-#if 0
 static void handle_data_in(driver_listener_t *driver, uint16_t session_id, uint8_t *data, size_t length)
 {
   client_entry_t *client;
 
+  /* Each connection has its own session, so only send it to the right one. */
   for(client = first_client; client; client = client->next)
   {
-    if(client->session_id == session_id)
+    if(client->state == CLIENT_STATE_CONNECTED && client->session_id == session_id)
     {
       tcp_send(client->s, data, length);
       return;
     }
   }
 
-  LOG_WARNING("Couldn't find listener to send data to: %d bytes to session %d", length, session_id);
+  LOG_WARNING("Couldn't find listener to send data to: %zd bytes to session %d", length, session_id);
 }
-#endif
 
 static void handle_shutdown()
 {
@@ -139,8 +326,7 @@ static void handle_message(message_t *message, void *d)
       break;
 
     case MESSAGE_DATA_IN:
-      /* TODO: I'm gonna have to re-think this a bit (it's gonna need a session, we can't just broadcast data from all sessions) */
-      /*handle_data_in(driver, message->message.data_in.session_id, message->message.data_in.data, message->message.data_in.length);*/
+      handle_data_in(driver, message->message.data_in.session_id, message->message.data_in.data, message->message.data_in.length);
       break;
 
     case MESSAGE_SHUTDOWN:
@@ -153,13 +339,15 @@ static void handle_message(message_t *message, void *d)
   }
 }
 
-driver_listener_t *driver_listener_create(select_group_t *group, char *host, int port, char *name)
+driver_listener_t *driver_listener_create(select_group_t *group, char *host, int port, char *name, NBBOOL socks)
 {
   driver_listener_t *driver = (driver_listener_t*) safe_malloc(sizeof(driver_listener_t));
 
   driver->group = group;
   driver->host  = host;
   driver->port  = port;
+  driver->name  = name;
+  driver->socks = socks;
 
   /* Subscribe to the messages we care about. */
   message_subscribe(MESSAGE_SESSION_CLOSED,  handle_message, driver);
@@ -12,9 +12,13 @@ typedef struct
   char           *host;
   char           *name;
   uint16_t        port;
+
+  /* In SOCKS5 mode, each connection says where it wants to go, and its
+   * session is named forward:<host>:<port> so the server can relay it. */
+  NBBOOL          socks;
 } driver_listener_t;
 
-driver_listener_t *driver_listener_create(select_group_t *group, char *host, int port, char *name);
+driver_listener_t *driver_listener_create(select_group_t *group, char *host, int port, char *name, NBBOOL socks);
 void               driver_listener_destroy();
 
 #endif
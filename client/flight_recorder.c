@@ -0,0 +1,151 @@
+/* flight_recorder.c
+ * Created October, 2026
+ *
+ * (See LICENSE.txt)
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "buffer.h"
+#include "log.h"
+#include "memory.h"
+
+#include "flight_recorder.h"
+
+#define FLIGHT_RECORDER_MAGIC   "dcfr"
+#define FLIGHT_RECORDER_VERSION 2
+#define FLIGHT_RECORDER_CLIENT  0
+
+typedef struct
+{
+  uint32_t time_ms;
+  uint8_t  type;
+  uint8_t  detail;
+  uint32_t session_id;
+  uint32_t seq;
+  uint32_t ack;
+  uint32_t length;
+} fr_event_t;
+
+static fr_event_t events[FLIGHT_RECORDER_SIZE];
+
+/* The total number of events ever recorded; the next one goes at
+ * (total % FLIGHT_RECORDER_SIZE). */
+static uint32_t total = 0;
+
+/* When the recorder started, so timestamps can be stored as offsets. */
+static NBBOOL   started       = FALSE;
+static uint32_t start_ms      = 0;
+static uint32_t start_time    = 0;
+
+static char *dump_file = NULL;
+
+/* Set from the signal handler, checked from the main loop. */
+static volatile sig_atomic_t dump_requested = 0;
+
+/* Don't recurse if dumping causes a fatal error. */
+static NBBOOL is_dumping = FALSE;
+
+void flight_recorder_record(fr_event_type_t type, uint8_t detail, uint32_t session_id, uint32_t seq, uint32_t ack, uint32_t length)
+{
+  fr_event_t *event = &events[total % FLIGHT_RECORDER_SIZE];
+
+  if(!started)
+  {
+    start_ms   = get_time_ms();
+    start_time = (uint32_t) time(NULL);
+    started    = TRUE;
+  }
+
+  event->time_ms    = get_time_ms() - start_ms;
+  event->type       = (uint8_t) type;
+  event->detail     = detail;
+  event->session_id = session_id;
+  event->seq        = seq;
+  event->ack        = ack;
+  event->length     = length;
+
+  total++;
+}
+
+void flight_recorder_set_file(char *filename)
+{
+  if(dump_file)
+    safe_free(dump_file);
+  dump_file = safe_strdup(filename);
+}
+
+void flight_recorder_dump()
+{
+  buffer_t *buffer;
+  uint8_t  *data;
+  size_t    length;
+  uint32_t  count = MIN(total, FLIGHT_RECORDER_SIZE);
+  uint32_t  i;
+  FILE     *f;
+
+  if(!dump_file || is_dumping)
+    return;
+  is_dumping = TRUE;
+
+  buffer = buffer_create(BO_BIG_ENDIAN);
+  buffer_add_string(buffer, FLIGHT_RECORDER_MAGIC);
+  buffer_add_int8(buffer, FLIGHT_RECORDER_VERSION);
+  buffer_add_int8(buffer, FLIGHT_RECORDER_CLIENT);
+  buffer_add_int16(buffer, 0);
+  buffer_add_int32(buffer, start_time);
+  buffer_add_int32(buffer, total);
+  buffer_add_int32(buffer, count);
+
+  /* Write the events oldest-first. */
+  for(i = total - count; i != total; i++)
+  {
+    fr_event_t *event = &events[i % FLIGHT_RECORDER_SIZE];
+
+    buffer_add_int32(buffer, event->time_ms);
+    buffer_add_int8(buffer,  event->type);
+    buffer_add_int8(buffer,  event->detail);
+    buffer_add_int32(buffer, event->session_id);
+    buffer_add_int32(buffer, event->seq);
+    buffer_add_int32(buffer, event->ack);
+    buffer_add_int32(buffer, event->length);
+  }
+
+  data = buffer_create_string_and_destroy(buffer, &length);
+
+#ifdef WIN32
+  fopen_s(&f, dump_file, "wb");
+#else
+  f = fopen(dump_file, "wb");
+#endif
+  if(f)
+  {
+    fwrite(data, 1, length, f);
+    fclose(f);
+    LOG_WARNING("Flight recorder: wrote %u events to %s", count, dump_file);
+  }
+  else
+  {
+    LOG_ERROR("Flight recorder: couldn't open %s for writing", dump_file);
+  }
+
+  safe_free(data);
+  is_dumping = FALSE;
+}
+
+void flight_recorder_request_dump()
+{
+  dump_requested = 1;
+}
+
+void flight_recorder_check()
+{
+  if(dump_requested)
+  {
+    dump_requested = 0;
+    flight_recorder_dump();
+  }
+}
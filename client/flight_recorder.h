@@ -0,0 +1,59 @@
+/* flight_recorder.h
+ * Created October, 2026
+ *
+ * (See LICENSE.txt)
+ *
+ * An always-on, fixed-size ring of compact binary events (packets in and out,
+ * retransmits, queue changes, and dropped packets). It costs a timestamp and a
+ * couple of stores per event, and is written to a file when a signal arrives
+ * or a fatal error is logged, so stalls can be diagnosed after the fact.
+ *
+ * The dump format is shared with the server; see doc/flight_recorder.txt.
+ */
+
+#ifndef __FLIGHT_RECORDER_H__
+#define __FLIGHT_RECORDER_H__
+
+#include "types.h"
+
+/* The number of events kept in the ring; older events are overwritten. */
+#define FLIGHT_RECORDER_SIZE 4096
+
+typedef enum
+{
+  FR_EVENT_PACKET_OUT = 0x01, /* detail = packet type */
+  FR_EVENT_PACKET_IN  = 0x02, /* detail = packet type */
+  FR_EVENT_RETRANSMIT = 0x03, /* detail = packet type */
+  FR_EVENT_WINDOW     = 0x04, /* length = bytes waiting to be ACKed */
+  FR_EVENT_DROP       = 0x05, /* detail = fr_drop_reason_t */
+} fr_event_type_t;
+
+typedef enum
+{
+  FR_DROP_NONE        = 0x00,
+  FR_DROP_BAD_SEQ     = 0x01,
+  FR_DROP_BAD_ACK     = 0x02,
+  FR_DROP_BAD_CHUNK   = 0x03,
+  FR_DROP_NO_SESSION  = 0x04,
+  FR_DROP_UNEXPECTED  = 0x05,
+  FR_DROP_PARSE_ERROR = 0x06, /* Only used by the server */
+} fr_drop_reason_t;
+
+/* Record an event. This is cheap enough to be called for every packet. */
+void flight_recorder_record(fr_event_type_t type, uint8_t detail, uint32_t session_id, uint32_t seq, uint32_t ack, uint32_t length);
+
+/* Set the file that dumps are written to (if it's never set, dumps are
+ * silently skipped). */
+void flight_recorder_set_file(char *filename);
+
+/* Write the current contents of the ring to the dump file. */
+void flight_recorder_dump();
+
+/* Ask for a dump at the next safe opportunity. Safe to call from a signal
+ * handler. */
+void flight_recorder_request_dump();
+
+/* Perform a requested dump, if there is one. Call this from the main loop. */
+void flight_recorder_check();
+
+#endif
@@ -0,0 +1,200 @@
+/* fountain.c
+ * Created October, 2026
+ *
+ * (See LICENSE.txt)
+ *
+ * Symbols are decoded as they arrive, with Gaussian elimination over GF(2):
+ * each one is reduced by the rows we already have, and if anything is left,
+ * it becomes a new row. Once there are K rows, back-substitution gives the
+ * blocks. Symbols from the first K are single blocks, so when little is lost
+ * the work is mostly copying.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+
+#include "fountain.h"
+
+#define GET_BIT(row, n) ((row)[(n) / 8] & (1 << ((n) % 8)))
+#define SET_BIT(row, n) ((row)[(n) / 8] |= (1 << ((n) % 8)))
+#define CLEAR_BIT(row, n) ((row)[(n) / 8] &= ~(1 << ((n) % 8)))
+
+void fountain_get_coefficients(uint32_t id, uint32_t block_count, uint8_t *row, size_t row_size)
+{
+  uint32_t state = id;
+  uint32_t count = 0;
+  uint32_t i;
+
+  memset(row, 0, row_size);
+
+  if(id < block_count)
+  {
+    SET_BIT(row, id);
+    return;
+  }
+
+  /* Scramble the symbol number, then use the top bit of an LCG for each
+   * block. (A generator that's linear over GF(2), like xorshift, would make
+   * every symbol a combination of the same 32 rows.) */
+  state = ((state >> 16) ^ state) * 0x45D9F3B;
+  state = ((state >> 16) ^ state) * 0x45D9F3B;
+  state = (state >> 16) ^ state;
+
+  for(i = 0; i < block_count; i++)
+  {
+    state = (state * 1664525) + 1013904223;
+
+    if(state & 0x80000000)
+    {
+      SET_BIT(row, i);
+      count++;
+    }
+  }
+
+  if(count == 0)
+    SET_BIT(row, id % block_count);
+}
+
+static void xor_bytes(uint8_t *a, uint8_t *b, size_t length)
+{
+  size_t i;
+
+  for(i = 0; i < length; i++)
+    a[i] ^= b[i];
+}
+
+fountain_t *fountain_create(uint32_t length, size_t block_size)
+{
+  fountain_t *fountain;
+  uint32_t    block_count;
+
+  if(block_size == 0)
+    return NULL;
+
+  block_count = (length + block_size - 1) / block_size;
+  if(block_count > FOUNTAIN_MAX_BLOCKS)
+    return NULL;
+
+  fountain = (fountain_t*) safe_malloc(sizeof(fountain_t));
+  fountain->length      = length;
+  fountain->block_size  = block_size;
+  fountain->block_count = block_count;
+  fountain->rank        = 0;
+  fountain->row_size    = (block_count + 7) / 8;
+  fountain->rows        = (uint8_t**) safe_malloc((block_count + 1) * sizeof(uint8_t*));
+  fountain->blocks      = (uint8_t**) safe_malloc((block_count + 1) * sizeof(uint8_t*));
+
+  return fountain;
+}
+
+void fountain_destroy(fountain_t *fountain)
+{
+  uint32_t i;
+
+  for(i = 0; i < fountain->block_count; i++)
+  {
+    if(fountain->rows[i])
+      safe_free(fountain->rows[i]);
+    if(fountain->blocks[i])
+      safe_free(fountain->blocks[i]);
+  }
+
+  safe_free(fountain->rows);
+  safe_free(fountain->blocks);
+  safe_free(fountain);
+}
+
+NBBOOL fountain_add_symbol(fountain_t *fountain, uint32_t id, uint8_t *data)
+{
+  uint8_t  *row;
+  uint8_t  *block;
+  uint32_t  i;
+
+  if(fountain_is_complete(fountain))
+    return FALSE;
+
+  row   = (uint8_t*) safe_malloc(fountain->row_size);
+  block = (uint8_t*) safe_malloc(fountain->block_size);
+  fountain_get_coefficients(id, fountain->block_count, row, fountain->row_size);
+  memcpy(block, data, fountain->block_size);
+
+  for(i = 0; i < fountain->block_count; i++)
+  {
+    /* Skip empty bytes quickly. */
+    if(i % 8 == 0 && row[i / 8] == 0)
+    {
+      i += 7;
+      continue;
+    }
+
+    if(!GET_BIT(row, i))
+      continue;
+
+    if(!fountain->rows[i])
+    {
+      fountain->rows[i]   = row;
+      fountain->blocks[i] = block;
+      fountain->rank++;
+
+      return TRUE;
+    }
+
+    /* Row i has nothing before column i, so only the rest needs changing. */
+    xor_bytes(row + (i / 8), fountain->rows[i] + (i / 8), fountain->row_size - (i / 8));
+    xor_bytes(block, fountain->blocks[i], fountain->block_size);
+  }
+
+  /* It was a combination of symbols we already had. */
+  safe_free(row);
+  safe_free(block);
+
+  return FALSE;
+}
+
+NBBOOL fountain_is_complete(fountain_t *fountain)
+{
+  return fountain->rank == fountain->block_count;
+}
+
+uint8_t *fountain_get_data(fountain_t *fountain, size_t *length)
+{
+  uint8_t  *result;
+  uint32_t  i;
+  uint32_t  j;
+
+  if(!fountain_is_complete(fountain))
+    return NULL;
+
+  /* Working backwards, every row after the current one is already a single
+   * block, so clearing a coefficient only means XORing that block in. */
+  for(i = fountain->block_count; i > 0; i--)
+  {
+    uint8_t *row = fountain->rows[i - 1];
+
+    for(j = i; j < fountain->block_count; j++)
+    {
+      if(GET_BIT(row, j))
+      {
+        xor_bytes(fountain->blocks[i - 1], fountain->blocks[j], fountain->block_size);
+        CLEAR_BIT(row, j);
+      }
+    }
+  }
+
+  result = (uint8_t*) safe_malloc(fountain->length + 1);
+  for(i = 0; i < fountain->block_count; i++)
+  {
+    size_t offset = i * fountain->block_size;
+    size_t size   = fountain->length - offset;
+
+    if(size > fountain->block_size)
+      size = fountain->block_size;
+    memcpy(result + offset, fountain->blocks[i], size);
+  }
+
+  *length = fountain->length;
+  return result;
+}
@@ -0,0 +1,58 @@
+/* fountain.h
+ * Created October, 2026
+ *
+ * (See LICENSE.txt)
+ *
+ * The decoding half of fountain-coded downloads (OPT_FOUNTAIN). The server
+ * splits the file into K blocks and can make any number of symbols out of
+ * them: symbol n (for n < K) is just block n, and every symbol after that is
+ * the XOR of a pseudo-random set of blocks. Any K symbols that are linearly
+ * independent are enough to rebuild the file, no matter which ones they are
+ * or what order they arrive in, so the client never has to ask for a
+ * particular one again.
+ *
+ * The encoding is shared with the server; see doc/protocol.txt.
+ */
+
+#ifndef __FOUNTAIN_H__
+#define __FOUNTAIN_H__
+
+#include "types.h"
+
+/* The most blocks a file can be split into; the decoder needs K^2 bits. */
+#define FOUNTAIN_MAX_BLOCKS 8192
+
+/* Each symbol starts with the length of the file. */
+#define FOUNTAIN_HEADER_SIZE 4
+
+typedef struct
+{
+  uint32_t  length;
+  size_t    block_size;
+  uint32_t  block_count;
+  uint32_t  rank;
+
+  /* Row n, if it's set, has its first coefficient at column n. */
+  size_t    row_size;
+  uint8_t **rows;
+  uint8_t **blocks;
+} fountain_t;
+
+/* Returns NULL if the file would need too many blocks. */
+fountain_t *fountain_create(uint32_t length, size_t block_size);
+void        fountain_destroy(fountain_t *fountain);
+
+/* Add a symbol (block_size bytes); returns TRUE if it told us anything new. */
+NBBOOL      fountain_add_symbol(fountain_t *fountain, uint32_t id, uint8_t *data);
+
+NBBOOL      fountain_is_complete(fountain_t *fountain);
+
+/* Rebuild the file, once it's complete; the result has to be freed. */
+uint8_t    *fountain_get_data(fountain_t *fountain, size_t *length);
+
+/* Set the bits in 'row' (row_size bytes) for the blocks that make up the
+ * given symbol. This has to match Fountain.coefficients() on the server
+ * exactly. */
+void        fountain_get_coefficients(uint32_t id, uint32_t block_count, uint8_t *row, size_t row_size);
+
+#endif
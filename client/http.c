@@ -0,0 +1,117 @@
+/* http.c
+ * Created October, 2026
+ *
+ * See LICENSE.txt
+ */
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "memory.h"
+#include "tcp.h"
+#include "types.h"
+
+#include "http.h"
+
+uint8_t *http_create_request(char *method, char *host, uint16_t port, char *path, char *content_type, uint8_t *body, size_t body_length, size_t *length)
+{
+  char      header[512];
+  buffer_t *buffer;
+
+#ifdef WIN32
+  sprintf_s(header, sizeof(header),
+#else
+  snprintf(header, sizeof(header),
+#endif
+      "%s %s HTTP/1.1\r\n"
+      "Host: %s:%d\r\n"
+      "Content-Type: %s\r\n"
+      "Content-Length: %u\r\n"
+      "Connection: keep-alive\r\n"
+      "\r\n", method, path, host, port, content_type, (unsigned int)body_length);
+
+  buffer = buffer_create(BO_BIG_ENDIAN);
+  buffer_add_bytes(buffer, header, strlen(header));
+  if(body_length)
+    buffer_add_bytes(buffer, body, body_length);
+
+  return buffer_create_string_and_destroy(buffer, length);
+}
+
+NBBOOL http_send_all(int s, uint8_t *data, size_t length)
+{
+  while(length > 0)
+  {
+    ssize_t sent = tcp_send(s, data, length);
+
+    if(sent <= 0)
+      return FALSE;
+
+    data   += sent;
+    length -= sent;
+  }
+
+  return TRUE;
+}
+
+uint8_t *http_read_response(uint8_t *rx, size_t *rx_length, int *status, size_t *length)
+{
+  size_t         header_length;
+  unsigned long  content_length = 0;
+  char          *header;
+  char          *line;
+  char          *end;
+  uint8_t       *body;
+  size_t         i;
+
+  *status = 0;
+
+  for(header_length = 0; header_length + 4 <= *rx_length; header_length++)
+    if(!memcmp(rx + header_length, "\r\n\r\n", 4))
+      break;
+  if(header_length + 4 > *rx_length)
+  {
+    if(*rx_length > HTTP_MAX_HEADER_LENGTH)
+      *status = HTTP_BAD_RESPONSE;
+    return NULL;
+  }
+
+  /* Lowercase the header, so the names can be found with strstr(). */
+  header = safe_malloc(header_length + 1);
+  for(i = 0; i < header_length; i++)
+    header[i] = tolower(rx[i]);
+
+  line = strchr(header, ' ');
+  if(line)
+    *status = atoi(line + 1);
+
+  line = strstr(header, "\r\ncontent-length:");
+  if(line)
+  {
+    content_length = strtoul(line + 17, &end, 10);
+    if(end == line + 17 || content_length > HTTP_MAX_BODY_LENGTH)
+    {
+      safe_free(header);
+      *status = HTTP_BAD_RESPONSE;
+      return NULL;
+    }
+  }
+  safe_free(header);
+
+  /* Don't add to the lengths, so nothing can wrap around. */
+  header_length += 4;
+  if(content_length > *rx_length - header_length)
+    return NULL;
+
+  /* Take the body out, and keep whatever comes after it. */
+  body = safe_malloc(content_length + 1);
+  memcpy(body, rx + header_length, content_length);
+  *length = content_length;
+
+  *rx_length -= header_length + content_length;
+  memmove(rx, rx + header_length + content_length, *rx_length);
+
+  return body;
+}
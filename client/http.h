@@ -0,0 +1,39 @@
+/* http.h
+ * Created October, 2026
+ *
+ * See LICENSE.txt
+ *
+ * Just enough HTTP/1.1 for the drivers that use it: building a request, and
+ * pulling whole responses (which have to have a Content-Length) out of what's
+ * been received so far. Keep-alive and pipelining are up to the caller.
+ */
+
+#ifndef __HTTP_H__
+#define __HTTP_H__
+
+#include "types.h"
+
+/* The longest header and body we'll take; anything bigger is treated as a
+ * broken response. A response is one batch of packets, or one DNS message. */
+#define HTTP_MAX_HEADER_LENGTH 0x2000
+#define HTTP_MAX_BODY_LENGTH   0x100000
+
+/* The status http_read_response() gives a response that can't be read, so
+ * the connection has to be dropped. */
+#define HTTP_BAD_RESPONSE      -1
+
+/* Build a request with the given body (which can be NULL if body_length is
+ * 0); the result has to be freed with safe_free(). */
+uint8_t *http_create_request(char *method, char *host, uint16_t port, char *path, char *content_type, uint8_t *body, size_t body_length, size_t *length);
+
+/* Send all of the data, or return FALSE. */
+NBBOOL   http_send_all(int s, uint8_t *data, size_t length);
+
+/* If a whole response is at the start of rx, remove it and return its body
+ * (which has to be freed with safe_free(), and has room for a terminating
+ * NUL); otherwise, return NULL. If what's there can never be a response
+ * (the header or the body is too long, or the Content-Length is garbage),
+ * the status is set to HTTP_BAD_RESPONSE. */
+uint8_t *http_read_response(uint8_t *rx, size_t *rx_length, int *status, size_t *length);
+
+#endif
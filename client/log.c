@@ -3,6 +3,7 @@
 #include <stdarg.h>
 
 #include "assert.h"
+#include "flight_recorder.h"
 #include "memory.h"
 #include "message.h"
 
@@ -88,6 +89,9 @@ void log_fatal(char *format, ...)
   va_start(args, format);
   log_internal(LOG_LEVEL_FATAL, format, args);
   va_end(args);
+
+  /* Save the recent history while we still can. */
+  flight_recorder_dump();
 }
 
 static void handle_message(message_t *message, void *d)
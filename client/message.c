@@ -143,8 +143,16 @@ uint16_t message_post_create_session(message_options_t options[])
         message->message.create_session.download = options[i].value.s;
       if(!strcmp(options[i].name, "first_chunk"))
         message->message.create_session.first_chunk = options[i].value.i;
+      if(!strcmp(options[i].name, "fountain"))
+        message->message.create_session.fountain = options[i].value.i;
+      if(!strcmp(options[i].name, "upload"))
+        message->message.create_session.upload = options[i].value.s;
       if(!strcmp(options[i].name, "is_command"))
         message->message.create_session.is_command = options[i].value.i;
+      if(!strcmp(options[i].name, "is_screen"))
+        message->message.create_session.is_screen = options[i].value.i;
+      if(!strcmp(options[i].name, "half_close"))
+        message->message.create_session.half_close = options[i].value.i;
       i++;
     }
   }
@@ -166,6 +174,14 @@ void message_post_session_created(uint16_t session_id)
   message_destroy(message);
 }
 
+void message_post_session_established(uint16_t session_id)
+{
+  message_t *message = message_create(MESSAGE_SESSION_ESTABLISHED);
+  message->message.session_established.session_id = session_id;
+  message_post(message);
+  message_destroy(message);
+}
+
 void message_post_close_session(uint16_t session_id)
 {
   message_t *message = message_create(MESSAGE_CLOSE_SESSION);
@@ -176,8 +192,8 @@ void message_post_close_session(uint16_t session_id)
 
 void message_post_session_closed(uint16_t session_id)
 {
-  message_t *message = message_create(MESSAGE_CLOSE_SESSION);
-  message->message.session_created.session_id = session_id;
+  message_t *message = message_create(MESSAGE_SESSION_CLOSED);
+  message->message.session_closed.session_id = session_id;
   message_post(message);
   message_destroy(message);
 }
@@ -220,6 +236,24 @@ void message_post_data_in(uint16_t session_id, uint8_t *data, size_t length)
   message_destroy(message);
 }
 
+void message_post_data_acked(uint16_t session_id, size_t length, size_t remaining)
+{
+  message_t *message = message_create(MESSAGE_DATA_ACKED);
+  message->message.data_acked.session_id = session_id;
+  message->message.data_acked.length = length;
+  message->message.data_acked.remaining = remaining;
+  message_post(message);
+  message_destroy(message);
+}
+
+void message_post_data_end(uint16_t session_id)
+{
+  message_t *message = message_create(MESSAGE_DATA_END);
+  message->message.data_end.session_id = session_id;
+  message_post(message);
+  message_destroy(message);
+}
+
 void message_post_heartbeat()
 {
   message_t *message = message_create(MESSAGE_HEARTBEAT);
@@ -227,6 +261,17 @@ void message_post_heartbeat()
   message_destroy(message);
 }
 
+int message_post_flush(int timeout_ms)
+{
+  message_t *message = message_create(MESSAGE_FLUSH);
+  message->message.flush.timeout_ms = timeout_ms;
+  message_post(message);
+  timeout_ms = message->message.flush.timeout_ms;
+  message_destroy(message);
+
+  return timeout_ms;
+}
+
 void message_post_ping_request(char *data)
 {
   message_t *message = message_create(MESSAGE_PING_REQUEST);
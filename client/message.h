@@ -59,10 +59,28 @@ typedef enum
   /* Used when a PING response comes back. */
   MESSAGE_PING_RESPONSE    = 0x0d,
 
+  /* Posted by the session library when the other side acknowledges some of
+   * the data that was queued with MESSAGE_DATA_OUT. */
+  MESSAGE_DATA_ACKED       = 0x0e,
+
+  /* Posted by an input driver when it has no more data for a session. If the
+   * server agreed to OPT_HALF_CLOSE, the session sends everything that's
+   * queued, tells the server, and keeps receiving; otherwise, it's the same
+   * as MESSAGE_CLOSE_SESSION. */
+  MESSAGE_DATA_END         = 0x0f,
+
+  /* Posted after every select() wakeup, once everything it woke up for has
+   * been handled; sessions send what they've been saving up. */
+  MESSAGE_FLUSH            = 0x10,
+
+  /* Posted by the session library when the server answers a session's SYN;
+   * from then on, the session's id on the wire won't change. */
+  MESSAGE_SESSION_ESTABLISHED = 0x11,
+
   /***********************************/
   /* Used to create arrays and such. */
   /***********************************/
-  MESSAGE_MAX_MESSAGE_TYPE = 0x0e,
+  MESSAGE_MAX_MESSAGE_TYPE = 0x12,
   /***********************************/
   /* Used to create arrays and such. */
   /***********************************/
@@ -110,7 +128,11 @@ typedef struct
       char *name;
       char *download;
       uint32_t first_chunk;
+      NBBOOL fountain;
+      char *upload;
       NBBOOL is_command;
+      NBBOOL is_screen;
+      NBBOOL half_close;
 
       struct
       {
@@ -123,6 +145,11 @@ typedef struct
       uint16_t session_id;
     } session_created;
 
+    struct
+    {
+      uint16_t session_id;
+    } session_established;
+
     struct
     {
       uint16_t session_id;
@@ -173,6 +200,25 @@ typedef struct
     {
       int dummy; /* WIN32 doesn't allow empty structs/unions */
     } heartbeat;
+
+    struct
+    {
+      uint16_t   session_id;
+      size_t     length;    /* The number of bytes that were just ACKed */
+      size_t     remaining; /* The number of bytes still waiting for an ACK */
+    } data_acked;
+
+    struct
+    {
+      uint16_t   session_id;
+    } data_end;
+
+    struct
+    {
+      /* How long the next select() can wait, in milliseconds; subscribers
+       * lower it if they're holding something back till a deadline. */
+      int        timeout_ms;
+    } flush;
   } message;
 } message_t;
 
@@ -198,6 +244,7 @@ void message_post_shutdown();
 /* options must either be NULL, or terminated with a NULL entry */
 uint16_t message_post_create_session(message_options_t options[]);
 void message_post_session_created(uint16_t session_id);
+void message_post_session_established(uint16_t session_id);
 void message_post_close_session(uint16_t session_id);
 void message_post_session_closed(uint16_t session_id);
 
@@ -205,8 +252,12 @@ void message_post_data_out(uint16_t session_id, uint8_t *data, size_t length);
 void message_post_packet_out(uint8_t *data, size_t length);
 void message_post_packet_in(uint8_t *data, size_t length);
 void message_post_data_in(uint16_t session_id, uint8_t *data, size_t length);
+void message_post_data_acked(uint16_t session_id, size_t length, size_t remaining);
+void message_post_data_end(uint16_t session_id);
 
 void message_post_heartbeat();
+/* Returns the timeout for the next select(), which starts as timeout_ms */
+int  message_post_flush(int timeout_ms);
 
 void message_post_ping_request(char *data);
 void message_post_ping_response(char *data);
@@ -32,6 +32,8 @@ packet_t *packet_parse(uint8_t *data, size_t length, options_t options)
   packet->packet_id    = buffer_read_next_int16(buffer);
   packet->packet_type  = buffer_read_next_int8(buffer);
   packet->session_id   = buffer_read_next_int16(buffer);
+  if(packet->session_id == WIDE_SESSION_ID)
+    packet->session_id = buffer_read_next_int32(buffer);
 
   switch(packet->packet_type)
   {
@@ -41,10 +43,15 @@ packet_t *packet_parse(uint8_t *data, size_t length, options_t options)
       break;
 
     case PACKET_TYPE_MSG:
-      if(options & OPT_CHUNKED_DOWNLOAD)
+      if(options & OPT_CHUNKED)
       {
         packet->body.msg.options.chunked.chunk = buffer_read_next_int32(buffer);
       }
+      else if(options & OPT_WIDE_SEQ)
+      {
+        packet->body.msg.options.normal.seq     = buffer_read_next_int32(buffer);
+        packet->body.msg.options.normal.ack     = buffer_read_next_int32(buffer);
+      }
       else
       {
         packet->body.msg.options.normal.seq     = buffer_read_next_int16(buffer);
@@ -73,7 +80,7 @@ packet_t *packet_parse(uint8_t *data, size_t length, options_t options)
   return packet;
 }
 
-packet_t *packet_create_syn(uint16_t session_id, uint16_t seq, options_t options)
+packet_t *packet_create_syn(uint32_t session_id, uint16_t seq, options_t options)
 {
   packet_t *packet = (packet_t*) safe_malloc(sizeof(packet_t));
   packet->packet_type      = PACKET_TYPE_SYN;
@@ -85,7 +92,7 @@ packet_t *packet_create_syn(uint16_t session_id, uint16_t seq, options_t options
   return packet;
 }
 
-packet_t *packet_create_msg_normal(uint16_t session_id, uint16_t seq, uint16_t ack, uint8_t *data, size_t data_length)
+packet_t *packet_create_msg_normal(uint32_t session_id, uint32_t seq, uint32_t ack, uint8_t *data, size_t data_length)
 {
   packet_t *packet = (packet_t*) safe_malloc(sizeof(packet_t));
 
@@ -100,7 +107,7 @@ packet_t *packet_create_msg_normal(uint16_t session_id, uint16_t seq, uint16_t a
   return packet;
 }
 
-packet_t *packet_create_msg_chunked(uint16_t session_id, uint32_t chunk)
+packet_t *packet_create_msg_chunked(uint32_t session_id, uint32_t chunk, uint8_t *data, size_t data_length)
 {
   packet_t *packet = (packet_t*) safe_malloc(sizeof(packet_t));
 
@@ -108,13 +115,13 @@ packet_t *packet_create_msg_chunked(uint16_t session_id, uint32_t chunk)
   packet->packet_id                      = rand() % 0xFFFF;
   packet->session_id                     = session_id;
   packet->body.msg.options.chunked.chunk = chunk;
-  packet->body.msg.data                  = safe_memcpy("", 0);
-  packet->body.msg.data_length           = 0;
+  packet->body.msg.data                  = safe_memcpy(data, data_length);
+  packet->body.msg.data_length           = data_length;
 
   return packet;
 }
 
-packet_t *packet_create_fin(uint16_t session_id, char *reason)
+packet_t *packet_create_fin(uint32_t session_id, char *reason)
 {
   packet_t *packet = (packet_t*) safe_malloc(sizeof(packet_t));
 
@@ -182,6 +189,55 @@ void packet_syn_set_chunked_download(packet_t *packet)
   packet->body.syn.options |= OPT_CHUNKED_DOWNLOAD;
 }
 
+void packet_syn_set_fountain(packet_t *packet)
+{
+  if(packet->packet_type != PACKET_TYPE_SYN)
+  {
+    LOG_FATAL("Attempted to set the 'fountain' field of a non-SYN message\n");
+    exit(1);
+  }
+
+  packet->body.syn.options |= OPT_FOUNTAIN;
+}
+
+void packet_syn_set_half_close(packet_t *packet)
+{
+  if(packet->packet_type != PACKET_TYPE_SYN)
+  {
+    LOG_FATAL("Attempted to set the 'half_close' field of a non-SYN message\n");
+    exit(1);
+  }
+
+  packet->body.syn.options |= OPT_HALF_CLOSE;
+}
+
+void packet_syn_set_wide_seq(packet_t *packet)
+{
+  if(packet->packet_type != PACKET_TYPE_SYN)
+  {
+    LOG_FATAL("Attempted to set the 'wide_seq' field of a non-SYN message\n");
+    exit(1);
+  }
+
+  packet->body.syn.options |= OPT_WIDE_SEQ;
+}
+
+void packet_syn_set_upload(packet_t *packet, char *filename)
+{
+  if(packet->packet_type != PACKET_TYPE_SYN)
+  {
+    LOG_FATAL("Attempted to set the 'upload' field of a non-SYN message\n");
+    exit(1);
+  }
+
+  /* Free the name if it's already set */
+  if(packet->body.syn.upload)
+    safe_free(packet->body.syn.upload);
+
+  packet->body.syn.options |= OPT_CHUNKED_UPLOAD;
+  packet->body.syn.upload = safe_strdup(filename);
+}
+
 void packet_syn_set_is_command(packet_t *packet)
 {
   if(packet->packet_type != PACKET_TYPE_SYN)
@@ -194,6 +250,18 @@ void packet_syn_set_is_command(packet_t *packet)
   packet->body.syn.options |= OPT_COMMAND;
 }
 
+void packet_syn_set_is_screen(packet_t *packet)
+{
+  if(packet->packet_type != PACKET_TYPE_SYN)
+  {
+    LOG_FATAL("Attempted to set the 'is_screen' field of a non-SYN message\n");
+    exit(1);
+  }
+
+  /* Just set the field, we don't need anything else. */
+  packet->body.syn.options |= OPT_SCREEN;
+}
+
 size_t packet_get_syn_size()
 {
   static size_t size = 0;
@@ -212,22 +280,24 @@ size_t packet_get_syn_size()
 
 size_t packet_get_msg_size(options_t options)
 {
-  static size_t size = 0;
+  /* One for each layout: normal, wide SEQ/ACK, and chunked. */
+  static size_t sizes[3] = { 0, 0, 0 };
+  size_t which = (options & OPT_CHUNKED) ? 2 : (options & OPT_WIDE_SEQ) ? 1 : 0;
 
   /* If the size isn't known yet, calculate it. */
-  if(size == 0)
+  if(sizes[which] == 0)
   {
     packet_t *p;
 
-    if(options & OPT_CHUNKED_DOWNLOAD)
-      p = packet_create_msg_chunked(0, 0);
+    if(options & OPT_CHUNKED)
+      p = packet_create_msg_chunked(0, 0, (uint8_t *)"", 0);
     else
       p = packet_create_msg_normal(0, 0, 0, (uint8_t *)"", 0);
-    safe_free(packet_to_bytes(p, &size, options));
+    safe_free(packet_to_bytes(p, &sizes[which], options));
     packet_destroy(p);
   }
 
-  return size;
+  return sizes[which];
 }
 
 size_t packet_get_fin_size(options_t options)
@@ -268,7 +338,15 @@ uint8_t *packet_to_bytes(packet_t *packet, size_t *length, options_t options)
 
   buffer_add_int16(buffer, packet->packet_id);
   buffer_add_int8(buffer, packet->packet_type);
-  buffer_add_int16(buffer, packet->session_id);
+  if(packet->session_id >= WIDE_SESSION_ID)
+  {
+    buffer_add_int16(buffer, WIDE_SESSION_ID);
+    buffer_add_int32(buffer, packet->session_id);
+  }
+  else
+  {
+    buffer_add_int16(buffer, (uint16_t) packet->session_id);
+  }
 
   switch(packet->packet_type)
   {
@@ -284,18 +362,27 @@ uint8_t *packet_to_bytes(packet_t *packet, size_t *length, options_t options)
       {
         buffer_add_ntstring(buffer, packet->body.syn.filename);
       }
+      if(packet->body.syn.options & OPT_CHUNKED_UPLOAD)
+      {
+        buffer_add_ntstring(buffer, packet->body.syn.upload);
+      }
 
       break;
 
     case PACKET_TYPE_MSG:
-      if(options & OPT_CHUNKED_DOWNLOAD)
+      if(options & OPT_CHUNKED)
       {
         buffer_add_int32(buffer, packet->body.msg.options.chunked.chunk);
       }
+      else if(options & OPT_WIDE_SEQ)
+      {
+        buffer_add_int32(buffer, packet->body.msg.options.normal.seq);
+        buffer_add_int32(buffer, packet->body.msg.options.normal.ack);
+      }
       else
       {
-        buffer_add_int16(buffer, packet->body.msg.options.normal.seq);
-        buffer_add_int16(buffer, packet->body.msg.options.normal.ack);
+        buffer_add_int16(buffer, (uint16_t) packet->body.msg.options.normal.seq);
+        buffer_add_int16(buffer, (uint16_t) packet->body.msg.options.normal.ack);
       }
       buffer_add_bytes(buffer, packet->body.msg.data, packet->body.msg.data_length);
       break;
@@ -330,7 +417,7 @@ char *packet_to_s(packet_t *packet, options_t options)
   }
   else if(packet->packet_type == PACKET_TYPE_MSG)
   {
-    if(options & OPT_CHUNKED_DOWNLOAD)
+    if(options & OPT_CHUNKED)
       _snprintf_s(ret, 1024, 1024, "Type = MSG :: [0x%04x] session = 0x%04x, chunk = 0x%04x", packet->packet_id, packet->session_id, packet->body.msg.options.chunked.chunk, packet->body.msg.data_length);
     else
       _snprintf_s(ret, 1024, 1024, "Type = MSG :: [0x%04x] session = 0x%04x, seq = 0x%04x, ack = 0x%04x", packet->packet_id, packet->session_id, packet->body.msg.options.normal.seq, packet->body.msg.options.normal.ack, packet->body.msg.data_length);
@@ -354,7 +441,7 @@ char *packet_to_s(packet_t *packet, options_t options)
   }
   else if(packet->packet_type == PACKET_TYPE_MSG)
   {
-    if(options & OPT_CHUNKED_DOWNLOAD)
+    if(options & OPT_CHUNKED)
       snprintf(ret, 1024, "Type = MSG :: [0x%04x] session = 0x%04x, chunk = 0x%04x, data = 0x%x bytes", packet->packet_id, packet->session_id, packet->body.msg.options.chunked.chunk, (unsigned int)packet->body.msg.data_length);
     else
       snprintf(ret, 1024, "Type = MSG :: [0x%04x] session = 0x%04x, seq = 0x%04x, ack = 0x%04x, data = 0x%x bytes", packet->packet_id, packet->session_id, packet->body.msg.options.normal.seq, packet->body.msg.options.normal.ack, (unsigned int)packet->body.msg.data_length);
@@ -391,6 +478,8 @@ void packet_destroy(packet_t *packet)
       safe_free(packet->body.syn.name);
     if(packet->body.syn.filename)
       safe_free(packet->body.syn.filename);
+    if(packet->body.syn.upload)
+      safe_free(packet->body.syn.upload);
   }
 
   if(packet->packet_type == PACKET_TYPE_MSG)
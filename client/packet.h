@@ -15,7 +15,21 @@
 #include <stdint.h>
 #endif
 
-#define MAX_PACKET_SIZE 1024
+/* DNS packets are far smaller than this; it's for the HTTP driver. */
+#define MAX_PACKET_SIZE 0x4000
+
+/* Session ids below this fit in the header's 16-bit field. If the field
+ * contains this value, the real id follows as a 32-bit value (which is always
+ * above 0xFFFF, so the two can't collide). */
+#define WIDE_SESSION_ID 0xFFFF
+
+/* The FIN reason a server sends when a SYN uses a session id that's already
+ * taken; the client should pick a new id and try again. */
+#define FIN_REASON_COLLISION "Session id collision"
+
+/* With OPT_HALF_CLOSE, a client sends a FIN with this reason when it has no
+ * more data; the session stays open in the other direction. */
+#define FIN_REASON_EOF "EOF"
 
 typedef enum
 {
@@ -31,6 +45,7 @@ typedef struct
   uint16_t options;
   char    *name;
   char    *filename;
+  char    *upload;
 } syn_packet_t;
 
 typedef enum
@@ -41,12 +56,26 @@ typedef enum
   OPT_DOWNLOAD         = 0x0008,
   OPT_CHUNKED_DOWNLOAD = 0x0010,
   OPT_COMMAND          = 0x0020,
+  OPT_SCREEN           = 0x0040,
+  OPT_CHUNKED_UPLOAD   = 0x0080,
+  OPT_FOUNTAIN         = 0x0100,
+  OPT_HALF_CLOSE       = 0x0200,
+  OPT_WIDE_SEQ         = 0x0400,
 } options_t;
 
+/* All the chunked modes replace the SEQ/ACK fields with a chunk number (for
+ * fountain-coded downloads, it's the symbol number). */
+#define OPT_CHUNKED (OPT_CHUNKED_DOWNLOAD | OPT_CHUNKED_UPLOAD | OPT_FOUNTAIN)
+
+/* With OPT_WIDE_SEQ, the SEQ/ACK fields are 32 bits instead of 16, so a very
+ * late answer can't be mistaken for a new one after 64k of data. The SYN's
+ * ISN stays 16 bits; the numbers just keep counting past 0xFFFF. */
+#define SEQ_MASK(options) (((options) & OPT_WIDE_SEQ) ? 0xFFFFFFFF : 0xFFFF)
+
 typedef struct
 {
-  uint16_t seq;
-  uint16_t ack;
+  uint32_t seq;
+  uint32_t ack;
 } normal_msg_t;
 
 typedef struct
@@ -57,7 +86,7 @@ typedef struct
 typedef struct
 {
   union {
-    struct { uint16_t seq; uint16_t ack; } normal;
+    struct { uint32_t seq; uint32_t ack; } normal;
     struct { uint32_t chunk; }             chunked;
   } options;
   uint8_t *data;
@@ -78,7 +107,7 @@ typedef struct
 {
   uint16_t packet_id;
   packet_type_t packet_type;
-  uint16_t session_id;
+  uint32_t session_id;
 
   union
   {
@@ -93,10 +122,10 @@ typedef struct
 packet_t *packet_parse(uint8_t *data, size_t length, options_t options);
 
 /* Create a packet with the given characteristics. */
-packet_t *packet_create_syn(uint16_t session_id, uint16_t seq, options_t options);
-packet_t *packet_create_msg_normal(uint16_t session_id, uint16_t seq, uint16_t ack, uint8_t *data, size_t data_length);
-packet_t *packet_create_msg_chunked(uint16_t session_id, uint32_t chunk);
-packet_t *packet_create_fin(uint16_t session_id, char *reason);
+packet_t *packet_create_syn(uint32_t session_id, uint16_t seq, options_t options);
+packet_t *packet_create_msg_normal(uint32_t session_id, uint32_t seq, uint32_t ack, uint8_t *data, size_t data_length);
+packet_t *packet_create_msg_chunked(uint32_t session_id, uint32_t chunk, uint8_t *data, size_t data_length);
+packet_t *packet_create_fin(uint32_t session_id, char *reason);
 packet_t *packet_create_ping(char *data);
 
 /* Set the OPT_NAME field and add a name value. */
@@ -108,9 +137,24 @@ void packet_syn_set_download(packet_t *packet, char *filename);
 /* Set the OPT_CHUNKED_DOWNLOAD field */
 void packet_syn_set_chunked_download(packet_t *packet);
 
+/* Set the OPT_FOUNTAIN field */
+void packet_syn_set_fountain(packet_t *packet);
+
+/* Set the OPT_HALF_CLOSE field */
+void packet_syn_set_half_close(packet_t *packet);
+
+/* Set the OPT_WIDE_SEQ field */
+void packet_syn_set_wide_seq(packet_t *packet);
+
+/* Set the OPT_CHUNKED_UPLOAD field and add the name to save the upload as */
+void packet_syn_set_upload(packet_t *packet, char *filename);
+
 /* Set the OPT_COMMAND flag */
 void packet_syn_set_is_command(packet_t *packet);
 
+/* Set the OPT_SCREEN flag */
+void packet_syn_set_is_screen(packet_t *packet);
+
 /* Get minimum packet sizes so we can avoid magic numbers. */
 size_t packet_get_syn_size();
 size_t packet_get_msg_size(options_t options);
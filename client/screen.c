@@ -0,0 +1,329 @@
+/* screen.c
+ * Created October, 2026
+ *
+ * (See LICENSE.txt)
+ */
+
+#include <string.h>
+
+#include "buffer.h"
+#include "memory.h"
+
+#include "screen.h"
+
+#define CELL(s, r, c) ((s)->cells[((r) * (s)->cols) + (c)])
+
+screen_t *screen_create(uint8_t rows, uint8_t cols)
+{
+  screen_t *screen = (screen_t*) safe_malloc(sizeof(screen_t));
+
+  screen->rows  = rows;
+  screen->cols  = cols;
+  screen->cells = (char*) safe_malloc(rows * cols);
+  screen->sent  = (char*) safe_malloc(rows * cols);
+
+  memset(screen->cells, ' ', rows * cols);
+  memset(screen->sent,  ' ', rows * cols);
+
+  screen->cursor_row = 0;
+  screen->cursor_col = 0;
+  screen->scrolled   = 0;
+
+  /* Always send the first frame, so the other side knows the size. */
+  screen->is_dirty   = TRUE;
+
+  screen->state       = SCREEN_PARSE_NORMAL;
+  screen->param_count = 0;
+
+  return screen;
+}
+
+void screen_destroy(screen_t *screen)
+{
+  safe_free(screen->cells);
+  safe_free(screen->sent);
+  safe_free(screen);
+}
+
+/* Move everything up a line, and blank the bottom line. */
+static void scroll_up(screen_t *screen)
+{
+  memmove(screen->cells, screen->cells + screen->cols, (screen->rows - 1) * screen->cols);
+  memset(&CELL(screen, screen->rows - 1, 0), ' ', screen->cols);
+
+  if(screen->scrolled < screen->rows)
+    screen->scrolled++;
+}
+
+static void line_feed(screen_t *screen)
+{
+  if(screen->cursor_row + 1 >= screen->rows)
+    scroll_up(screen);
+  else
+    screen->cursor_row++;
+}
+
+/* Blank the cells from (row, col) up to, but not including, (row, end). */
+static void erase(screen_t *screen, int row, int col, int end)
+{
+  if(end > col)
+    memset(&CELL(screen, row, col), ' ', end - col);
+}
+
+static int param(screen_t *screen, size_t i, int def)
+{
+  if(i >= screen->param_count || screen->params[i] == 0)
+    return def;
+  return screen->params[i];
+}
+
+static void handle_csi(screen_t *screen, uint8_t c)
+{
+  int row = screen->cursor_row;
+  int col = screen->cursor_col;
+  int i;
+
+  switch(c)
+  {
+    case 'A': /* Up */
+      row -= param(screen, 0, 1);
+      break;
+
+    case 'B': /* Down */
+      row += param(screen, 0, 1);
+      break;
+
+    case 'C': /* Right */
+      col += param(screen, 0, 1);
+      break;
+
+    case 'D': /* Left */
+      col -= param(screen, 0, 1);
+      break;
+
+    case 'H': /* Position (1-based) */
+    case 'f':
+      row = param(screen, 0, 1) - 1;
+      col = param(screen, 1, 1) - 1;
+      break;
+
+    case 'J': /* Erase in display */
+      switch(param(screen, 0, 0))
+      {
+        case 0:
+          erase(screen, row, col, screen->cols);
+          for(i = row + 1; i < screen->rows; i++)
+            erase(screen, i, 0, screen->cols);
+          break;
+        case 1:
+          for(i = 0; i < row; i++)
+            erase(screen, i, 0, screen->cols);
+          erase(screen, row, 0, MIN(col + 1, screen->cols));
+          break;
+        default:
+          memset(screen->cells, ' ', screen->rows * screen->cols);
+          break;
+      }
+      break;
+
+    case 'K': /* Erase in line */
+      switch(param(screen, 0, 0))
+      {
+        case 0:
+          erase(screen, row, col, screen->cols);
+          break;
+        case 1:
+          erase(screen, row, 0, MIN(col + 1, screen->cols));
+          break;
+        default:
+          erase(screen, row, 0, screen->cols);
+          break;
+      }
+      break;
+
+    default:
+      /* Colours, modes, etc. - we don't care. */
+      break;
+  }
+
+  /* Keep the cursor on the screen. */
+  if(row < 0)
+    row = 0;
+  if(row >= screen->rows)
+    row = screen->rows - 1;
+  if(col < 0)
+    col = 0;
+  if(col > screen->cols)
+    col = screen->cols;
+
+  screen->cursor_row = (uint8_t) row;
+  screen->cursor_col = (uint8_t) col;
+}
+
+static void put_char(screen_t *screen, uint8_t c)
+{
+  /* Wrap if the last character filled up the line. */
+  if(screen->cursor_col >= screen->cols)
+  {
+    screen->cursor_col = 0;
+    line_feed(screen);
+  }
+
+  CELL(screen, screen->cursor_row, screen->cursor_col) = (char) c;
+  screen->cursor_col++;
+}
+
+void screen_feed(screen_t *screen, uint8_t *data, size_t length)
+{
+  size_t i;
+
+  for(i = 0; i < length; i++)
+  {
+    uint8_t c = data[i];
+
+    switch(screen->state)
+    {
+      case SCREEN_PARSE_NORMAL:
+        if(c == 0x1b)
+        {
+          screen->state = SCREEN_PARSE_ESCAPE;
+        }
+        else if(c == '\r')
+        {
+          screen->cursor_col = 0;
+        }
+        else if(c == '\n')
+        {
+          /* Processes are connected to pipes, not a tty, so nobody turns "\n"
+           * into "\r\n" for us. */
+          screen->cursor_col = 0;
+          line_feed(screen);
+        }
+        else if(c == '\b')
+        {
+          if(screen->cursor_col > 0)
+            screen->cursor_col--;
+        }
+        else if(c == '\t')
+        {
+          int next_tab = (screen->cursor_col + 8) & ~7;
+
+          screen->cursor_col = (uint8_t) MIN(next_tab, screen->cols);
+        }
+        else if(c >= 0x20 && c != 0x7f)
+        {
+          put_char(screen, c);
+        }
+        break;
+
+      case SCREEN_PARSE_ESCAPE:
+        if(c == '[')
+        {
+          screen->state       = SCREEN_PARSE_CSI;
+          screen->param_count = 0;
+          memset(screen->params, 0, sizeof(screen->params));
+        }
+        else
+        {
+          /* ESC c is a full reset; anything else is ignored. */
+          if(c == 'c')
+          {
+            memset(screen->cells, ' ', screen->rows * screen->cols);
+            screen->cursor_row = 0;
+            screen->cursor_col = 0;
+          }
+          screen->state = SCREEN_PARSE_NORMAL;
+        }
+        break;
+
+      case SCREEN_PARSE_CSI:
+        if(c >= '0' && c <= '9')
+        {
+          if(screen->param_count == 0)
+            screen->param_count = 1;
+          if(screen->param_count <= SCREEN_MAX_PARAMS)
+            screen->params[screen->param_count - 1] = (screen->params[screen->param_count - 1] * 10) + (c - '0');
+        }
+        else if(c == ';')
+        {
+          if(screen->param_count == 0)
+            screen->param_count = 1;
+          screen->param_count++;
+        }
+        else if(c >= 0x40 && c <= 0x7e)
+        {
+          handle_csi(screen, c);
+          screen->state = SCREEN_PARSE_NORMAL;
+        }
+        /* Anything else ('?', spaces, etc.) is an intermediate; skip it. */
+        break;
+    }
+  }
+
+  screen->is_dirty = TRUE;
+}
+
+NBBOOL screen_is_dirty(screen_t *screen)
+{
+  return screen->is_dirty;
+}
+
+uint8_t *screen_get_frame(screen_t *screen, size_t *length)
+{
+  buffer_t *buffer = buffer_create(BO_BIG_ENDIAN);
+  size_t    count_offset;
+  uint8_t   count = 0;
+  uint8_t   row;
+
+  /* Header; the length is filled in at the end. */
+  buffer_add_int16(buffer, 0);
+  buffer_add_int8(buffer, screen->rows);
+  buffer_add_int8(buffer, screen->cols);
+  buffer_add_int8(buffer, screen->cursor_row);
+  buffer_add_int8(buffer, MIN(screen->cursor_col, screen->cols - 1));
+  buffer_add_int8(buffer, screen->scrolled);
+  count_offset = buffer_get_length(buffer);
+  buffer_add_int8(buffer, 0);
+
+  /* Apply the scroll to our copy of the other side's screen, so only the
+   * new lines have to be sent. */
+  if(screen->scrolled)
+  {
+    size_t n = screen->scrolled;
+
+    memmove(screen->sent, screen->sent + (n * screen->cols), (screen->rows - n) * screen->cols);
+    memset(screen->sent + ((screen->rows - n) * screen->cols), ' ', n * screen->cols);
+    screen->scrolled = 0;
+  }
+
+  /* For each row, send the span between the first and last changed cells. */
+  for(row = 0; row < screen->rows; row++)
+  {
+    char *now  = &CELL(screen, row, 0);
+    char *then = screen->sent + (row * screen->cols);
+    int first = 0;
+    int last  = screen->cols - 1;
+
+    while(first < screen->cols && now[first] == then[first])
+      first++;
+    if(first == screen->cols)
+      continue;
+    while(now[last] == then[last])
+      last--;
+
+    buffer_add_int8(buffer, row);
+    buffer_add_int8(buffer, first);
+    buffer_add_int8(buffer, (last - first) + 1);
+    buffer_add_bytes(buffer, now + first, (last - first) + 1);
+    count++;
+
+    memcpy(then + first, now + first, (last - first) + 1);
+  }
+
+  buffer_add_int8_at(buffer, count, count_offset);
+  buffer_add_int16_at(buffer, (uint16_t) (buffer_get_length(buffer) - 2), 0);
+
+  screen->is_dirty = FALSE;
+
+  return buffer_create_string_and_destroy(buffer, length);
+}
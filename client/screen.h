@@ -0,0 +1,73 @@
+/* screen.h
+ * Created October, 2026
+ *
+ * (See LICENSE.txt)
+ *
+ * A tiny terminal emulator. Output from a process is fed in, and instead of
+ * sending every byte across the tunnel we send "frames" - the parts of the
+ * screen that changed since the last frame. Frames are only generated when
+ * the previous one has been acknowledged, so intermediate screens are skipped
+ * when the link is slow.
+ *
+ * It understands enough of a VT100 to handle progress bars, tail -f, and
+ * simple full-screen programs: CR, LF, BS, TAB, and the CSI A, B, C, D, H, f,
+ * J, and K sequences. Everything else (colours, etc.) is ignored.
+ *
+ * The frame format is described in doc/screen_protocol.txt.
+ */
+
+#ifndef __SCREEN_H__
+#define __SCREEN_H__
+
+#include "types.h"
+
+#define SCREEN_DEFAULT_ROWS 24
+#define SCREEN_DEFAULT_COLS 80
+
+#define SCREEN_MAX_PARAMS 8
+
+typedef enum
+{
+  SCREEN_PARSE_NORMAL,
+  SCREEN_PARSE_ESCAPE,
+  SCREEN_PARSE_CSI,
+} screen_parse_state_t;
+
+typedef struct
+{
+  uint8_t  rows;
+  uint8_t  cols;
+
+  /* The current screen, and the screen as of the last frame (rows * cols). */
+  char    *cells;
+  char    *sent;
+
+  uint8_t  cursor_row;
+  uint8_t  cursor_col;
+
+  /* How many lines have scrolled off the top since the last frame. */
+  uint8_t  scrolled;
+
+  /* Set when anything changes since the last frame. */
+  NBBOOL   is_dirty;
+
+  /* Escape-sequence parser state. */
+  screen_parse_state_t state;
+  int                  params[SCREEN_MAX_PARAMS];
+  size_t               param_count;
+} screen_t;
+
+screen_t *screen_create(uint8_t rows, uint8_t cols);
+void      screen_destroy(screen_t *screen);
+
+/* Feed process output into the screen. */
+void      screen_feed(screen_t *screen, uint8_t *data, size_t length);
+
+/* Returns TRUE if a frame would contain anything. */
+NBBOOL    screen_is_dirty(screen_t *screen);
+
+/* Create a frame with everything that changed since the last one (must be
+ * freed with safe_free()). */
+uint8_t  *screen_get_frame(screen_t *screen, size_t *length);
+
+#endif
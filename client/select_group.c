@@ -6,6 +6,7 @@
  */
 
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -44,6 +45,7 @@
 #define SG_BUFFER(sg,i) sg->select_list[i]->buffer
 #define SG_BUFFERED(sg,i) sg->select_list[i]->buffered
 #define SG_IS_ACTIVE(sg,i) sg->select_list[i]->active
+#define SG_IS_PAUSED(sg,i) sg->select_list[i]->paused
 #define SG_PARAM(sg,i) sg->select_list[i]->param
 
 
@@ -429,13 +431,13 @@ void select_group_do_select(select_group_t *group, int timeout_ms)
   {
 #ifdef WIN32
     /* On Windows, don't add pipes. */
-    if(SG_IS_ACTIVE(group, i) && SG_TYPE(group, i) != SOCKET_TYPE_PIPE)
+    if(SG_IS_ACTIVE(group, i) && !SG_IS_PAUSED(group, i) && SG_TYPE(group, i) != SOCKET_TYPE_PIPE)
     {
       FD_SET(SG_SOCKET(group, i), &select_set);
       count++;
     }
 #else
-    if(SG_IS_ACTIVE(group, i))
+    if(SG_IS_ACTIVE(group, i) && !SG_IS_PAUSED(group, i))
       FD_SET(SG_SOCKET(group, i), &select_set);
 #endif
   }
@@ -452,13 +454,20 @@ void select_group_do_select(select_group_t *group, int timeout_ms)
 /*  fprintf(stderr, "Select returned %d\n", select_return); */
 
   if(select_return == -1)
+  {
+#ifndef WIN32
+    /* A signal arrived; let the caller deal with it and try again. */
+    if(errno == EINTR)
+      return;
+#endif
     nbdie("select_group: couldn't select()");
+  }
 
 #ifdef WIN32
   /* Handle pipes on every run, whether it's a timeout or data arrived. */
   for(i = 0; i < group->current_size; i++)
   {
-    if(SG_IS_ACTIVE(group, i) && SG_TYPE(group, i) == SOCKET_TYPE_PIPE)
+    if(SG_IS_ACTIVE(group, i) && !SG_IS_PAUSED(group, i) && SG_TYPE(group, i) == SOCKET_TYPE_PIPE)
     {
       /* Check if the handle is ready. */
       DWORD n;
@@ -526,8 +535,9 @@ void select_group_do_select(select_group_t *group, int timeout_ms)
     /* Loop through the sockets to find the one that had activity. */
     for(i = 0; i < group->current_size; i++)
     {
-      /* If the socket is active and it has data waiting, process it. */
-      if(SG_IS_ACTIVE(group, i) && FD_ISSET(SG_SOCKET(group, i), &select_set))
+      /* If the socket is active and it has data waiting, process it (unless
+       * an earlier callback paused it). */
+      if(SG_IS_ACTIVE(group, i) && !SG_IS_PAUSED(group, i) && FD_ISSET(SG_SOCKET(group, i), &select_set))
       {
         if(SG_TYPE(group, i) == SOCKET_TYPE_LISTEN)
         {
@@ -571,6 +581,16 @@ NBBOOL select_group_wait_for_bytes(select_group_t *group, int s, size_t bytes)
 }
 
 
+NBBOOL select_group_pause(select_group_t *group, int s, NBBOOL paused)
+{
+  select_t *socket = find_select_by_socket(group, s);
+
+  if(socket)
+    socket->paused = paused;
+
+  return (socket ? TRUE : FALSE);
+}
+
 size_t select_group_get_active_count(select_group_t *group)
 {
   size_t i;
@@ -39,7 +39,7 @@
 #define __SELECT_GROUP_H__
 
 /* Updates for dnscat2 */
-#define SELECT_GROUP_VERSION "1.01"
+#define SELECT_GROUP_VERSION "1.02"
 
 #include <stdlib.h>
 
@@ -106,6 +106,8 @@ typedef struct
 
   NBBOOL         active; /* Set to 'false' when the socket is 'deleted'. It's easier than physically removing it from
                            * the list, so until I implement something heavy weight this will work. */
+  NBBOOL         paused; /* Set to 'true' to stop reading from the socket for a while; unlike 'active', it can be
+                           * turned back off. */
 
   void           *param; /* Used to store a piece of arbitrary data that's sent to the callbacks. */
 } select_t;
@@ -178,6 +180,11 @@ void select_group_do_select(select_group_t *group, int timeout_ms);
  * Note: any data already queued up will be whacked. */
 NBBOOL select_group_wait_for_bytes(select_group_t *group, int s, size_t bytes);
 
+/* Stop reading from the socket (if paused is TRUE) or start again (if it's FALSE). Unlike removing and
+ * re-adding it, the socket keeps its place and callbacks; anything that arrives in the meantime waits in
+ * the socket (or pipe). Returns non-zero if successful. */
+NBBOOL select_group_pause(select_group_t *group, int s, NBBOOL paused);
+
 /* Check how many active sockets are left. */
 size_t select_group_get_active_count(select_group_t *group);
 
@@ -9,6 +9,8 @@
 #endif
 
 #include "buffer.h"
+#include "flight_recorder.h"
+#include "fountain.h"
 #include "log.h"
 #include "memory.h"
 #include "message.h"
@@ -18,15 +20,41 @@
 /* Set to TRUE after getting the 'shutdown' message. */
 static NBBOOL is_shutdown = FALSE;
 
-/* The maximum length of packets. */
+/* The maximum length of packets, as set by the output driver. */
 static size_t max_packet_length = 10000;
 
+/* A shorter length that the server asked for (0 = use max_packet_length);
+ * it can't go below MIN_PACKET_LENGTH, so there's always room for data. */
+static size_t packet_length = 0;
+#define MIN_PACKET_LENGTH 32
+
 /* Allow the user to override the initial sequence number. */
 static uint32_t isn = 0xFFFFFFFF;
 
 /* Enable/disable packet tracing. */
 static NBBOOL packet_trace;
 
+/* The number of upload chunks that can be waiting for an acknowledgement at
+ * once (ie, the number of parallel requests). The server can lower it with
+ * the 'upload_window' setting. */
+#define UPLOAD_WINDOW 8
+static size_t upload_window = UPLOAD_WINDOW;
+
+/* How long (in milliseconds) the ACK for received data can wait for outgoing
+ * data to ride along with it. The server can change it with the 'ack_delay'
+ * setting; 0 sends ACKs at the end of the wakeup they're for. */
+#define ACK_DELAY 20
+static int ack_delay = ACK_DELAY;
+
+typedef struct
+{
+  NBBOOL    in_use;
+  uint32_t  chunk;
+  uint8_t  *data;
+  size_t    length;
+  time_t    last_transmit;
+} upload_chunk_t;
+
 typedef enum
 {
   SESSION_STATE_NEW,
@@ -37,9 +65,16 @@ typedef struct
 {
   /* Session information */
   uint16_t        id;
+
+  /* The id the server knows us by. It's separate from 'id' (which the
+   * drivers use) because it can change if it collides with somebody else's. */
+  uint32_t        wire_id;
+  int             syn_attempts;
   session_state_t state;
-  uint16_t        their_seq;
-  uint16_t        my_seq;
+  /* These are 32 bits wide with OPT_WIDE_SEQ, and 16 otherwise (see
+   * SEQ_MASK()). */
+  uint32_t        their_seq;
+  uint32_t        my_seq;
   NBBOOL          is_closed;
   char           *name;
 
@@ -47,10 +82,49 @@ typedef struct
   uint32_t        download_first_chunk;
   uint32_t        download_current_chunk;
 
+  /* For fountain-coded downloads, every request is for a symbol we haven't
+   * asked for before; the decoder is created when the first one arrives. */
+  NBBOOL          download_fountain;
+  fountain_t     *fountain;
+  uint32_t        fountain_next_symbol;
+  size_t          fountain_in_flight;
+
+  /* For chunked uploads, the data is split into numbered chunks that are
+   * sent (and acknowledged) independently of each other. */
+  char           *upload;
+  uint32_t        upload_next_chunk;
+  upload_chunk_t  upload_window[UPLOAD_WINDOW];
+
   NBBOOL          is_command;
+  NBBOOL          is_screen;
+
+  /* With OPT_HALF_CLOSE, the driver can end its half of the session (see
+   * MESSAGE_DATA_END); once everything's acknowledged, we send a FIN with
+   * FIN_REASON_EOF, which the server acknowledges as one more byte. */
+  NBBOOL          half_close;
+  NBBOOL          is_data_end;
+  NBBOOL          data_end_acked;
 
   buffer_t       *outgoing_data;
 
+  /* How much data the last MSG carried; if it was just a poll, anything
+   * queued since then can go out as soon as the reply arrives. */
+  size_t          last_msg_length;
+
+  /* Sending waits till the end of the select() wakeup (MESSAGE_FLUSH), so
+   * everything that happens in one wakeup goes out in one query. */
+  NBBOOL          send_pending;
+
+  /* Received data has to be acknowledged. If there's nothing to send with
+   * the ACK, it's held till ack_deadline, in case something shows up (like
+   * the output of a command we were just sent). That's only done while it
+   * pays off: once a held ACK goes out bare, ack_hold is turned off till
+   * data shows up right after a bare ACK again. */
+  NBBOOL          ack_pending;
+  uint32_t        ack_deadline;
+  NBBOOL          ack_hold;
+  uint32_t        last_bare_ack;
+
   time_t          last_transmit;
 
   options_t       options;
@@ -64,6 +138,14 @@ typedef struct _session_entry_t
 static session_entry_t *first_session;
 
 #define RETRANSMIT_DELAY 1 /* Seconds */
+static int retransmit_delay = RETRANSMIT_DELAY;
+
+/* If a server doesn't answer this many SYNs with a 32-bit session id, assume
+ * it's too old to understand them and fall back to a 16-bit one. */
+#define WIDE_ID_ATTEMPTS 5
+
+/* The next local session id to hand out. */
+static uint16_t next_session_id = 1;
 
 /* Allow anything to go out. Call this at the start or after receiving legit data. */
 static void reset_counter(session_t *session)
@@ -80,7 +162,7 @@ static void update_counter(session_t *session)
 /* Decide whether or not we should transmit data yet. */
 static NBBOOL can_i_transmit_yet(session_t *session)
 {
-  if(time(NULL) - session->last_transmit > RETRANSMIT_DELAY)
+  if(time(NULL) - session->last_transmit > retransmit_delay)
     return TRUE;
   return FALSE;
 }
@@ -95,11 +177,78 @@ static session_t *sessions_get_by_id(uint16_t session_id)
   return NULL;
 }
 
+static session_t *sessions_get_by_wire_id(uint32_t wire_id)
+{
+  session_entry_t *entry;
+
+  for(entry = first_session; entry; entry = entry->next)
+    if(entry->session->wire_id == wire_id)
+      return entry->session;
+  return NULL;
+}
+
+/* Pick a random session id for the wire. 32-bit ids make collisions between
+ * clients unlikely even with huge numbers of them; they're always above
+ * WIDE_SESSION_ID so they can't be confused with 16-bit ones. */
+static uint32_t new_wire_id(NBBOOL wide)
+{
+  uint32_t id = 0;
+  int      i;
+
+  if(!wide)
+    return rand() % WIDE_SESSION_ID;
+
+  /* rand() can be as small as 15 bits, so build it a byte at a time. */
+  while(id <= WIDE_SESSION_ID)
+  {
+    for(i = 0; i < 4; i++)
+      id = (id << 8) | (rand() & 0xFF);
+  }
+
+  return id;
+}
+
+/* The size of a MSG's headers, which depends on the width of the id. */
+static size_t msg_overhead(session_t *session)
+{
+  return packet_get_msg_size(session->options) + (session->wire_id >= WIDE_SESSION_ID ? 4 : 0);
+}
+
+/* Record a packet's interesting fields in the flight recorder. */
+static void record_packet(fr_event_type_t type, uint16_t session_id, packet_t *packet, options_t options)
+{
+  uint32_t seq    = 0;
+  uint32_t ack    = 0;
+  uint32_t length = 0;
+
+  if(packet->packet_type == PACKET_TYPE_SYN)
+  {
+    seq = packet->body.syn.seq;
+  }
+  else if(packet->packet_type == PACKET_TYPE_MSG)
+  {
+    if(options & OPT_CHUNKED)
+    {
+      seq = packet->body.msg.options.chunked.chunk;
+    }
+    else
+    {
+      seq = packet->body.msg.options.normal.seq;
+      ack = packet->body.msg.options.normal.ack;
+    }
+    length = packet->body.msg.data_length;
+  }
+
+  flight_recorder_record(type, (uint8_t) packet->packet_type, session_id, seq, ack, length);
+}
+
 static void do_send_packet(session_t *session, packet_t *packet)
 {
   size_t length;
   uint8_t *data = packet_to_bytes(packet, &length, session->options);
 
+  record_packet(FR_EVENT_PACKET_OUT, session->wire_id, packet, session->options);
+
   /* Display if appropriate. */
   if(packet_trace)
   {
@@ -112,12 +261,192 @@ static void do_send_packet(session_t *session, packet_t *packet)
   safe_free(data);
 }
 
+/* The longest packet we're allowed to send right now. */
+static size_t get_packet_length()
+{
+  if(packet_length && packet_length < max_packet_length)
+    return packet_length;
+  return max_packet_length;
+}
+
+/* The number of bytes that have been split into chunks but not ACKed yet. */
+static size_t upload_in_flight(session_t *session)
+{
+  size_t total = 0;
+  size_t i;
+
+  for(i = 0; i < UPLOAD_WINDOW; i++)
+    if(session->upload_window[i].in_use)
+      total += session->upload_window[i].length;
+
+  return total;
+}
+
+/* The number of bytes that the other side hasn't acknowledged yet. */
+static size_t unacked_bytes(session_t *session)
+{
+  return buffer_get_remaining_bytes(session->outgoing_data) + upload_in_flight(session);
+}
+
+/* Fill any free slots in the upload window with new chunks, then send every
+ * chunk that's new or whose retransmit timer has expired. Unlike normal
+ * messages, any number of these can be in flight at once. */
+static void do_send_upload(session_t *session)
+{
+  size_t i;
+
+  for(i = 0; i < UPLOAD_WINDOW; i++)
+  {
+    upload_chunk_t *chunk = &session->upload_window[i];
+    packet_t       *packet;
+
+    if(!chunk->in_use)
+    {
+      /* Slots past the current window size are only allowed to drain. */
+      if(i >= upload_window || buffer_get_remaining_bytes(session->outgoing_data) == 0)
+        continue;
+
+      chunk->data          = buffer_read_remaining_bytes(session->outgoing_data, &chunk->length, get_packet_length() - msg_overhead(session), TRUE);
+      chunk->chunk         = session->upload_next_chunk++;
+      chunk->last_transmit = 0;
+      chunk->in_use        = TRUE;
+    }
+    else if(time(NULL) - chunk->last_transmit <= retransmit_delay)
+    {
+      continue;
+    }
+
+    LOG_INFO("In SESSION_STATE_ESTABLISHED, sending upload chunk %u (%zd bytes)...", chunk->chunk, chunk->length);
+    packet = packet_create_msg_chunked(session->wire_id, chunk->chunk, chunk->data, chunk->length);
+
+    if(chunk->last_transmit != 0)
+      record_packet(FR_EVENT_RETRANSMIT, session->wire_id, packet, session->options);
+
+    chunk->last_transmit = time(NULL);
+    do_send_packet(session, packet);
+
+    packet_destroy(packet);
+  }
+}
+
+/* Keep up to upload_window symbol requests in flight. Nothing is ever asked
+ * for twice: if nothing comes back before the retransmit timer expires, the
+ * requests are written off and new symbols are asked for instead. */
+static void do_send_fountain(session_t *session)
+{
+  packet_t *packet;
+  NBBOOL    sent = FALSE;
+
+  if(session->last_transmit != 0 && can_i_transmit_yet(session))
+  {
+    LOG_INFO("No symbols received, requesting new ones");
+    session->fountain_in_flight = 0;
+  }
+
+  while(session->fountain_in_flight < upload_window)
+  {
+    LOG_INFO("In SESSION_STATE_ESTABLISHED, requesting symbol %u...", session->fountain_next_symbol);
+    packet = packet_create_msg_chunked(session->wire_id, session->fountain_next_symbol++, (uint8_t *)"", 0);
+    do_send_packet(session, packet);
+    packet_destroy(packet);
+
+    session->fountain_in_flight++;
+    sent = TRUE;
+  }
+
+  if(sent)
+    update_counter(session);
+}
+
+/* Feed a symbol to the decoder, and hand over the file once it's complete. */
+static void handle_fountain_symbol(session_t *session, packet_t *packet)
+{
+  uint8_t  *data   = packet->body.msg.data;
+  size_t    length = packet->body.msg.data_length;
+  uint32_t  file_length = 0;
+
+  if(session->fountain_in_flight > 0)
+    session->fountain_in_flight--;
+
+  if(length >= FOUNTAIN_HEADER_SIZE)
+    file_length = ((uint32_t)data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+
+  /* Only an empty file can have empty symbols. */
+  if(length < FOUNTAIN_HEADER_SIZE || (length == FOUNTAIN_HEADER_SIZE && file_length > 0))
+  {
+    LOG_WARNING("Fountain symbol %u is too short", packet->body.msg.options.chunked.chunk);
+    flight_recorder_record(FR_EVENT_DROP, FR_DROP_BAD_CHUNK, session->wire_id, packet->body.msg.options.chunked.chunk, 0, length);
+    return;
+  }
+
+  data   += FOUNTAIN_HEADER_SIZE;
+  length -= FOUNTAIN_HEADER_SIZE;
+
+  /* The first symbol decides the size of every block. */
+  if(!session->fountain)
+  {
+    session->fountain = fountain_create(file_length, length ? length : 1);
+    if(!session->fountain)
+    {
+      LOG_ERROR("The download is too big to decode (%u bytes in %zd-byte blocks)", file_length, length);
+      message_post_close_session(session->id);
+      return;
+    }
+  }
+
+  if(file_length != session->fountain->length || (length != session->fountain->block_size && file_length > 0))
+  {
+    LOG_WARNING("Fountain symbol %u doesn't match the others", packet->body.msg.options.chunked.chunk);
+    flight_recorder_record(FR_EVENT_DROP, FR_DROP_BAD_CHUNK, session->wire_id, packet->body.msg.options.chunked.chunk, 0, length);
+    return;
+  }
+
+  if(file_length > 0 && !fountain_add_symbol(session->fountain, packet->body.msg.options.chunked.chunk, data))
+    LOG_INFO("Fountain symbol %u didn't tell us anything new", packet->body.msg.options.chunked.chunk);
+
+  flight_recorder_record(FR_EVENT_WINDOW, 0, session->wire_id, session->fountain->rank, packet->body.msg.options.chunked.chunk, session->fountain->block_count - session->fountain->rank);
+
+  if(fountain_is_complete(session->fountain))
+  {
+    size_t   file_size;
+    uint8_t *file = fountain_get_data(session->fountain, &file_size);
+
+    LOG_WARNING("Download complete: %zd bytes from %u symbols", file_size, session->fountain_next_symbol);
+    message_post_data_in(session->id, file, file_size);
+    safe_free(file);
+
+    message_post_close_session(session->id);
+  }
+}
+
 static void do_send_stuff(session_t *session)
 {
   packet_t *packet;
   uint8_t  *data;
   size_t    length;
 
+  /* If the counter wasn't reset, nothing came back since the last send. */
+  NBBOOL    is_retransmit;
+
+  /* Whatever we send acknowledges everything we've received. */
+  session->send_pending = FALSE;
+  session->ack_pending  = FALSE;
+  session->ack_deadline = 0;
+
+  /* Chunked uploads keep a retransmit timer for each chunk. */
+  if(session->state == SESSION_STATE_ESTABLISHED && session->upload)
+  {
+    do_send_upload(session);
+    return;
+  }
+
+  if(session->state == SESSION_STATE_ESTABLISHED && session->download_fountain)
+  {
+    if(!session->is_closed)
+      do_send_fountain(session);
+    return;
+  }
+
   /* Don't transmit too quickly without receiving anything. */
   if(!can_i_transmit_yet(session))
   {
@@ -125,19 +454,40 @@ static void do_send_stuff(session_t *session)
     return;
   }
 
+  is_retransmit = (session->last_transmit != 0);
+
   switch(session->state)
   {
     case SESSION_STATE_NEW:
+      if(is_retransmit && session->wire_id >= WIDE_SESSION_ID && ++session->syn_attempts >= WIDE_ID_ATTEMPTS)
+      {
+        session->wire_id = new_wire_id(FALSE);
+        LOG_WARNING("No response to a SYN with a 32-bit session id; trying a 16-bit id (0x%04x)", session->wire_id);
+      }
+
       LOG_INFO("In SESSION_STATE_NEW, sending a SYN packet (SEQ = 0x%04x)...", session->my_seq);
-      packet = packet_create_syn(session->id, session->my_seq, 0);
+      packet = packet_create_syn(session->wire_id, session->my_seq, 0);
       if(session->name)
         packet_syn_set_name(packet, session->name);
       if(session->download)
         packet_syn_set_download(packet, session->download);
-      if(session->download_first_chunk)
+      if(session->download_fountain)
+        packet_syn_set_fountain(packet);
+      else if(session->download_first_chunk)
         packet_syn_set_chunked_download(packet);
+      if(session->upload)
+        packet_syn_set_upload(packet, session->upload);
       if(session->is_command)
         packet_syn_set_is_command(packet);
+      if(session->is_screen)
+        packet_syn_set_is_screen(packet);
+      if(session->half_close)
+        packet_syn_set_half_close(packet);
+      if(!session->download_first_chunk && !session->download_fountain && !session->upload)
+        packet_syn_set_wide_seq(packet);
+
+      if(is_retransmit)
+        record_packet(FR_EVENT_RETRANSMIT, session->wire_id, packet, session->options);
 
       update_counter(session);
       do_send_packet(session, packet);
@@ -149,19 +499,30 @@ static void do_send_stuff(session_t *session)
       if(session->download_first_chunk)
       {
         /* We don't allow outgoing data in chunked mode */
-        packet = packet_create_msg_chunked(session->id, session->download_current_chunk);
+        packet = packet_create_msg_chunked(session->wire_id, session->download_current_chunk, (uint8_t *)"", 0);
+      }
+      else if(session->is_data_end && !session->data_end_acked && buffer_get_remaining_bytes(session->outgoing_data) == 0)
+      {
+        /* Everything we had has been acknowledged, so tell the server that's
+         * all; this is re-sent until it's acknowledged, like data would be. */
+        LOG_INFO("In SESSION_STATE_ESTABLISHED, sending an EOF (SEQ = 0x%04x)", session->my_seq);
+        packet = packet_create_fin(session->wire_id, FIN_REASON_EOF);
       }
       else
       {
         /* Read data without consuming it (ie, leave it in the buffer till it's ACKed) */
-        data = buffer_read_remaining_bytes(session->outgoing_data, &length, max_packet_length - packet_get_msg_size(session->options), FALSE);
+        data = buffer_read_remaining_bytes(session->outgoing_data, &length, get_packet_length() - msg_overhead(session), FALSE);
         LOG_INFO("In SESSION_STATE_ESTABLISHED, sending a MSG packet (SEQ = 0x%04x, ACK = 0x%04x, %zd bytes of data...", session->my_seq, session->their_seq, length);
 
-        packet = packet_create_msg_normal(session->id, session->my_seq, session->their_seq, data, length);
+        packet = packet_create_msg_normal(session->wire_id, session->my_seq, session->their_seq, data, length);
+        session->last_msg_length = length;
 
         safe_free(data);
       }
 
+      if(is_retransmit)
+        record_packet(FR_EVENT_RETRANSMIT, session->wire_id, packet, session->options);
+
       /* Send the packet */
       update_counter(session);
       do_send_packet(session, packet);
@@ -183,10 +544,20 @@ void session_recv(session_t *session, packet_t *packet)
 
 static void session_destroy(session_t *session)
 {
+  size_t i;
+
   if(session->name)
     safe_free(session->name);
   if(session->download)
     safe_free(session->download);
+  if(session->upload)
+    safe_free(session->upload);
+  if(session->fountain)
+    fountain_destroy(session->fountain);
+
+  for(i = 0; i < UPLOAD_WINDOW; i++)
+    if(session->upload_window[i].in_use)
+      safe_free(session->upload_window[i].data);
 
   buffer_destroy(session->outgoing_data);
   safe_free(session);
@@ -203,10 +574,10 @@ static void remove_completed_sessions()
     session_t *session = this->session;
     next = this->next;
 
-    if(session->is_closed && buffer_get_remaining_bytes(session->outgoing_data) == 0)
+    if(session->is_closed && unacked_bytes(session) == 0)
     {
       /* Send a final FIN */
-      packet_t *packet = packet_create_fin(session->id, "Session closed");
+      packet_t *packet = packet_create_fin(session->wire_id, "Session closed");
       LOG_WARNING("Session %d is out of data and closed, killing it!", session->id);
       do_send_packet(session, packet);
       packet_destroy(packet);
@@ -238,7 +609,40 @@ static void remove_completed_sessions()
 static void handle_config_int(char *name, int value)
 {
   if(!strcmp(name, "max_packet_length"))
+  {
     max_packet_length = value;
+  }
+  else if(!strcmp(name, "packet_length"))
+  {
+    /* This can only make packets shorter than the driver allows. */
+    if(value <= 0)
+      packet_length = 0;
+    else if(value < MIN_PACKET_LENGTH)
+      packet_length = MIN_PACKET_LENGTH;
+    else
+      packet_length = value;
+    LOG_WARNING("Packet length is now %zd bytes", get_packet_length());
+  }
+  else if(!strcmp(name, "retransmit_delay"))
+  {
+    retransmit_delay = value > 0 ? value : 0;
+    LOG_WARNING("Retransmit delay is now %d seconds", retransmit_delay);
+  }
+  else if(!strcmp(name, "upload_window"))
+  {
+    if(value < 1)
+      upload_window = 1;
+    else if(value > UPLOAD_WINDOW)
+      upload_window = UPLOAD_WINDOW;
+    else
+      upload_window = value;
+    LOG_WARNING("Upload window is now %zd chunks", upload_window);
+  }
+  else if(!strcmp(name, "ack_delay"))
+  {
+    ack_delay = value > 0 ? value : 0;
+    LOG_WARNING("ACK delay is now %dms", ack_delay);
+  }
 }
 
 static void handle_config_string(char *name, char *value)
@@ -257,12 +661,14 @@ static void handle_shutdown()
     message_post_close_session(entry->session->id);
 }
 
-static uint16_t handle_create_session(char *name, char *download, uint32_t first_chunk, NBBOOL is_command)
+static uint16_t handle_create_session(char *name, char *download, uint32_t first_chunk, NBBOOL fountain, char *upload, NBBOOL is_command, NBBOOL is_screen, NBBOOL half_close)
 {
   session_t *session     = (session_t*)safe_malloc(sizeof(session_t));
   session_entry_t *entry;
 
-  session->id            = rand() % 0xFFFF;
+  session->id            = next_session_id++;
+  session->wire_id       = new_wire_id(TRUE);
+  session->syn_attempts  = 0;
 
   /* Check if it's a 16-bit value (I set it to a bigger value to set a random isn) */
   if(isn == (isn & 0xFFFF))
@@ -294,7 +700,26 @@ static uint16_t handle_create_session(char *name, char *download, uint32_t first
 
   session->download_first_chunk   = first_chunk;
   session->download_current_chunk = first_chunk;
+  session->download_fountain      = fountain;
+  session->fountain               = NULL;
+  session->fountain_next_symbol   = 0;
+  session->fountain_in_flight     = 0;
+
+  session->upload = NULL;
+  if(upload)
+  {
+    session->upload = safe_strdup(upload);
+    LOG_INFO("Setting session->upload to %s", session->upload);
+  }
+  session->upload_next_chunk = 0;
   session->is_command = is_command;
+  session->is_screen  = is_screen;
+
+  session->half_close     = half_close;
+  session->is_data_end    = FALSE;
+  session->data_end_acked = FALSE;
+
+  session->ack_hold       = TRUE;
 
   /* Add it to the linked list. */
   entry = safe_malloc(sizeof(session_entry_t));
@@ -336,11 +761,43 @@ static void handle_data_out(uint16_t session_id, uint8_t *data, size_t length)
     return;
   }
 
+  if(session->is_data_end)
+  {
+    LOG_ERROR("Tried to send data after the end of the data (handle_data_out): %d", session_id);
+    return;
+  }
+
   /* Add the bytes to the outgoing data buffer. */
   buffer_add_bytes(session->outgoing_data, data, length);
+  flight_recorder_record(FR_EVENT_WINDOW, 0, session->wire_id, session->my_seq, session->their_seq, buffer_get_remaining_bytes(session->outgoing_data));
+
+  /* If this could have gone out with the last ACK, start holding them. */
+  if(!session->ack_hold && session->last_bare_ack && get_time_ms() - session->last_bare_ack <= (uint32_t)ack_delay)
+    session->ack_hold = TRUE;
+
+  /* Send it at the end of the wakeup. */
+  session->send_pending = TRUE;
+}
+
+static void handle_data_end(uint16_t session_id)
+{
+  session_t *session = sessions_get_by_id(session_id);
+  if(!session)
+  {
+    LOG_ERROR("Tried to access a non-existent session (handle_data_end): %d", session_id);
+    return;
+  }
+
+  /* If the server can't keep a half-closed session open, all we can do is
+   * close it (once the SYN comes back, we'll know). */
+  if(!session->half_close || (session->state == SESSION_STATE_ESTABLISHED && !(session->options & OPT_HALF_CLOSE)))
+  {
+    message_post_close_session(session_id);
+    return;
+  }
 
-  /* Trigger a send. */
-  do_send_stuff(session);
+  session->is_data_end = TRUE;
+  session->send_pending = TRUE;
 }
 
 static void handle_ping_request(char *ping_data)
@@ -362,6 +819,7 @@ static void handle_packet_in(uint8_t *data, size_t length)
   /* Parse the packet to get the session id */
   packet_t *packet = packet_parse(data, length, 0);
   session_t *session;
+  uint32_t session_id;
 
   /* Check if it's a ping packet, since those don't need a session. */
   if(packet->packet_type == PACKET_TYPE_PING)
@@ -380,17 +838,20 @@ static void handle_packet_in(uint8_t *data, size_t length)
   }
 
   /* If it's not a ping packet, find the session and handle accordingly. */
-  session = sessions_get_by_id(packet->session_id);
+  session_id = packet->session_id;
+  session = sessions_get_by_wire_id(session_id);
   packet_destroy(packet);
 
   if(!session)
   {
-    LOG_ERROR("Tried to access a non-existent session (handle_packet_in): %d", packet->session_id);
+    LOG_ERROR("Tried to access a non-existent session (handle_packet_in): %d", session_id);
+    flight_recorder_record(FR_EVENT_DROP, FR_DROP_NO_SESSION, session_id, 0, 0, length);
     return;
   }
 
   /* Now that we know the session, parse it properly */
   packet = packet_parse(data, length, session->options);
+  record_packet(FR_EVENT_PACKET_IN, session->wire_id, packet, session->options);
 
   /* Display if appropriate. */
   if(packet_trace)
@@ -408,10 +869,53 @@ static void handle_packet_in(uint8_t *data, size_t length)
         session->their_seq = packet->body.syn.seq;
         session->options   = packet->body.syn.options;
         session->state = SESSION_STATE_ESTABLISHED;
+
+        /* The server echoes the chunked options it supports; if it didn't
+         * agree to the upload, our messages wouldn't make sense to it. */
+        if(session->upload && !(session->options & OPT_CHUNKED_UPLOAD))
+        {
+          LOG_ERROR("The server doesn't support chunked uploads!");
+          buffer_clear(session->outgoing_data);
+          message_post_close_session(session->id);
+        }
+
+        if(session->download_fountain && !(session->options & OPT_FOUNTAIN))
+        {
+          LOG_ERROR("The server doesn't support fountain-coded downloads!");
+          message_post_close_session(session->id);
+        }
+
+        if(session->half_close && !(session->options & OPT_HALF_CLOSE))
+        {
+          LOG_WARNING("The server doesn't support half-closed sessions; the session will close when the input ends");
+          if(session->is_data_end)
+            message_post_close_session(session->id);
+        }
+
+        /* Without OPT_WIDE_SEQ (from an older server), the numbers wrap at
+         * 64k, like they always did. */
+        if(!(session->options & (OPT_WIDE_SEQ | OPT_CHUNKED)))
+          LOG_INFO("The server doesn't support 32-bit sequence numbers");
+
+        /* Anything that was queued while we waited can go now. */
+        reset_counter(session);
+        poll_right_away = TRUE;
+
+        message_post_session_established(session->id);
       }
       else if(packet->packet_type == PACKET_TYPE_MSG)
       {
         LOG_WARNING("In SESSION_STATE_NEW, received unexpected MSG (ignoring)");
+        flight_recorder_record(FR_EVENT_DROP, FR_DROP_UNEXPECTED, session->wire_id, 0, 0, packet->body.msg.data_length);
+      }
+      else if(packet->packet_type == PACKET_TYPE_FIN && !strcmp(packet->body.fin.reason, FIN_REASON_COLLISION))
+      {
+        /* Somebody else has our id; pick a new one and start over. */
+        session->wire_id = new_wire_id(session->wire_id >= WIDE_SESSION_ID);
+        LOG_WARNING("Session id collision; retrying as 0x%04x", session->wire_id);
+
+        reset_counter(session);
+        poll_right_away = TRUE;
       }
       else if(packet->packet_type == PACKET_TYPE_FIN)
       {
@@ -430,12 +934,48 @@ static void handle_packet_in(uint8_t *data, size_t length)
       if(packet->packet_type == PACKET_TYPE_SYN)
       {
         LOG_WARNING("In SESSION_STATE_ESTABLISHED, recieved SYN (ignoring)");
+        flight_recorder_record(FR_EVENT_DROP, FR_DROP_UNEXPECTED, session->wire_id, packet->body.syn.seq, 0, 0);
       }
       else if(packet->packet_type == PACKET_TYPE_MSG)
       {
         LOG_INFO("In SESSION_STATE_ESTABLISHED, received a MSG");
 
-        if(session->download_first_chunk)
+        if(session->upload)
+        {
+          /* The server echoes back the number of each chunk it receives. */
+          size_t i;
+
+          for(i = 0; i < UPLOAD_WINDOW; i++)
+          {
+            upload_chunk_t *chunk = &session->upload_window[i];
+
+            if(chunk->in_use && chunk->chunk == packet->body.msg.options.chunked.chunk)
+            {
+              size_t length = chunk->length;
+
+              safe_free(chunk->data);
+              chunk->data   = NULL;
+              chunk->in_use = FALSE;
+
+              flight_recorder_record(FR_EVENT_WINDOW, 0, session->wire_id, session->upload_next_chunk, packet->body.msg.options.chunked.chunk, unacked_bytes(session));
+              message_post_data_acked(session->id, length, unacked_bytes(session));
+
+              /* Fill the slot right away. */
+              poll_right_away = TRUE;
+              break;
+            }
+          }
+
+          /* Otherwise, it's the reply to a retransmission we didn't need. */
+          if(i == UPLOAD_WINDOW)
+            LOG_INFO("Duplicate acknowledgement for upload chunk %u", packet->body.msg.options.chunked.chunk);
+        }
+        else if(session->download_fountain)
+        {
+          handle_fountain_symbol(session, packet);
+          poll_right_away = TRUE;
+        }
+        else if(session->download_first_chunk)
         {
           if(packet->body.msg.options.chunked.chunk == session->download_current_chunk)
           {
@@ -452,17 +992,30 @@ static void handle_packet_in(uint8_t *data, size_t length)
           else
           {
             LOG_WARNING("Bad chunk received (%d instead of %d)", packet->body.msg.options.chunked.chunk, session->download_current_chunk);
+            flight_recorder_record(FR_EVENT_DROP, FR_DROP_BAD_CHUNK, session->wire_id, packet->body.msg.options.chunked.chunk, session->download_current_chunk, packet->body.msg.data_length);
             packet_destroy(packet);
             return;
           }
         }
+        else if(session->is_data_end && !session->data_end_acked && buffer_get_remaining_bytes(session->outgoing_data) == 0 && ((packet->body.msg.options.normal.ack - session->my_seq) & SEQ_MASK(session->options)) == 1)
+        {
+          /* The server acknowledges our EOF as if it were one more byte. A FIN
+           * doesn't acknowledge anything, so the reply has no data, and its
+           * SEQ might be behind ours. */
+          LOG_INFO("The server acknowledged our EOF");
+          session->data_end_acked = TRUE;
+          session->my_seq = (session->my_seq + 1) & SEQ_MASK(session->options);
+
+          reset_counter(session);
+          poll_right_away = TRUE;
+        }
         else
         {
           /* Validate the SEQ */
           if(packet->body.msg.options.normal.seq == session->their_seq)
           {
             /* Verify the ACK is sane */
-            uint16_t bytes_acked = packet->body.msg.options.normal.ack - session->my_seq;
+            uint32_t bytes_acked = (packet->body.msg.options.normal.ack - session->my_seq) & SEQ_MASK(session->options);
 
             if(bytes_acked <= buffer_get_remaining_bytes(session->outgoing_data))
             {
@@ -470,7 +1023,7 @@ static void handle_packet_in(uint8_t *data, size_t length)
               reset_counter(session);
 
               /* Increment their sequence number */
-              session->their_seq = (session->their_seq + packet->body.msg.data_length) & 0xFFFF;
+              session->their_seq = (session->their_seq + packet->body.msg.data_length) & SEQ_MASK(session->options);
 
               /* Remove the acknowledged data from the buffer */
               buffer_consume(session->outgoing_data, bytes_acked);
@@ -478,27 +1031,41 @@ static void handle_packet_in(uint8_t *data, size_t length)
               /* Increment my sequence number */
               if(bytes_acked != 0)
               {
-                session->my_seq = (session->my_seq + bytes_acked) & 0xFFFF;
+                session->my_seq = (session->my_seq + bytes_acked) & SEQ_MASK(session->options);
                 poll_right_away = TRUE;
+
+                flight_recorder_record(FR_EVENT_WINDOW, 0, session->wire_id, session->my_seq, session->their_seq, buffer_get_remaining_bytes(session->outgoing_data));
+
+                /* Let the drivers know, so they can pace themselves. */
+                message_post_data_acked(session->id, bytes_acked, buffer_get_remaining_bytes(session->outgoing_data));
               }
 
-              /* Print the data, if we received any, and then immediately receive more. */
+              /* Print the data, if we received any; the ACK (which also asks
+               * for more) goes out at the end of the wakeup, or a bit later
+               * if it's worth waiting for something to go with it. */
               if(packet->body.msg.data_length > 0)
               {
                 message_post_data_in(session->id, packet->body.msg.data, packet->body.msg.data_length);
-                poll_right_away = TRUE;
+                session->ack_pending = TRUE;
               }
+
+              /* Data that was queued while a poll was out (like the answer to
+               * a command) doesn't have to wait for the retransmit timer. */
+              if(session->last_msg_length == 0 && buffer_get_remaining_bytes(session->outgoing_data) > 0)
+                poll_right_away = TRUE;
             }
             else
             {
-              LOG_WARNING("Bad ACK received (%d bytes acked; %d bytes in the buffer)", bytes_acked, buffer_get_remaining_bytes(session->outgoing_data));
+              LOG_WARNING("Bad ACK received (%u bytes acked; %d bytes in the buffer)", bytes_acked, buffer_get_remaining_bytes(session->outgoing_data));
+              flight_recorder_record(FR_EVENT_DROP, FR_DROP_BAD_ACK, session->wire_id, packet->body.msg.options.normal.seq, packet->body.msg.options.normal.ack, packet->body.msg.data_length);
               packet_destroy(packet);
               return;
             }
           }
           else
           {
-            LOG_WARNING("Bad SEQ received (Expected %d, received %d)", session->their_seq, packet->body.msg.options.normal.seq);
+            LOG_WARNING("Bad SEQ received (Expected %u, received %u)", session->their_seq, packet->body.msg.options.normal.seq);
+            flight_recorder_record(FR_EVENT_DROP, FR_DROP_BAD_SEQ, session->wire_id, packet->body.msg.options.normal.seq, packet->body.msg.options.normal.ack, packet->body.msg.data_length);
             packet_destroy(packet);
             return;
           }
@@ -524,9 +1091,9 @@ static void handle_packet_in(uint8_t *data, size_t length)
   }
 
   /* If there is still outgoing data to be sent, and new data has been ACKed
-   * (ie, this isn't a retransmission), send it. */
+   * (ie, this isn't a retransmission), send it at the end of the wakeup. */
   if(poll_right_away)
-    do_send_stuff(session);
+    session->send_pending = TRUE;
 
   packet_destroy(packet);
 }
@@ -549,6 +1116,51 @@ static void handle_heartbeat()
   remove_completed_sessions();
 }
 
+/* Send what the sessions saved up during this wakeup; returns the timeout
+ * for the next select(), which is shortened if an ACK is being held. */
+static int handle_flush(int timeout_ms)
+{
+  session_entry_t *entry;
+  uint32_t         now = get_time_ms();
+
+  for(entry = first_session; entry; entry = entry->next)
+  {
+    session_t *session = entry->session;
+    NBBOOL     is_bare = buffer_get_remaining_bytes(session->outgoing_data) == 0 && !session->is_data_end;
+
+    if(session->ack_pending && !session->send_pending)
+    {
+      if(ack_delay > 0 && session->ack_hold && is_bare)
+      {
+        if(!session->ack_deadline)
+          session->ack_deadline = now + ack_delay;
+
+        if((int32_t)(session->ack_deadline - now) > 0)
+        {
+          if((int)(session->ack_deadline - now) < timeout_ms)
+            timeout_ms = session->ack_deadline - now;
+          continue;
+        }
+
+        LOG_INFO("Nothing came along with the ACK; sending them right away for now");
+        session->ack_hold = FALSE;
+      }
+
+      session->send_pending = TRUE;
+    }
+
+    if(session->send_pending)
+    {
+      if(session->ack_pending && is_bare)
+        session->last_bare_ack = now;
+
+      do_send_stuff(session);
+    }
+  }
+
+  return timeout_ms;
+}
+
 static void handle_message(message_t *message, void *param)
 {
   switch(message->type)
@@ -565,7 +1177,7 @@ static void handle_message(message_t *message, void *param)
       break;
 
     case MESSAGE_CREATE_SESSION:
-      message->message.create_session.out.session_id = handle_create_session(message->message.create_session.name, message->message.create_session.download, message->message.create_session.first_chunk, message->message.create_session.is_command);
+      message->message.create_session.out.session_id = handle_create_session(message->message.create_session.name, message->message.create_session.download, message->message.create_session.first_chunk, message->message.create_session.fountain, message->message.create_session.upload, message->message.create_session.is_command, message->message.create_session.is_screen, message->message.create_session.half_close);
       break;
 
     case MESSAGE_CLOSE_SESSION:
@@ -576,6 +1188,10 @@ static void handle_message(message_t *message, void *param)
       handle_data_out(message->message.data_out.session_id, message->message.data_out.data, message->message.data_out.length);
       break;
 
+    case MESSAGE_DATA_END:
+      handle_data_end(message->message.data_end.session_id);
+      break;
+
     case MESSAGE_PING_REQUEST:
       handle_ping_request(message->message.ping_request.data);
       break;
@@ -588,6 +1204,10 @@ static void handle_message(message_t *message, void *param)
       handle_heartbeat();
       break;
 
+    case MESSAGE_FLUSH:
+      message->message.flush.timeout_ms = handle_flush(message->message.flush.timeout_ms);
+      break;
+
     default:
       break;
   }
@@ -600,9 +1220,11 @@ void sessions_init()
   message_subscribe(MESSAGE_CREATE_SESSION, handle_message, NULL);
   message_subscribe(MESSAGE_CLOSE_SESSION,  handle_message, NULL);
   message_subscribe(MESSAGE_DATA_OUT,       handle_message, NULL);
+  message_subscribe(MESSAGE_DATA_END,       handle_message, NULL);
   message_subscribe(MESSAGE_PING_REQUEST,   handle_message, NULL);
   message_subscribe(MESSAGE_PACKET_IN,      handle_message, NULL);
   message_subscribe(MESSAGE_HEARTBEAT,      handle_message, NULL);
+  message_subscribe(MESSAGE_FLUSH,          handle_message, NULL);
 }
 
 void debug_set_isn(uint16_t value)
@@ -616,3 +1238,10 @@ void session_enable_packet_trace()
 {
   packet_trace = TRUE;
 }
+
+uint32_t session_get_wire_id(uint16_t session_id)
+{
+  session_t *session = sessions_get_by_id(session_id);
+
+  return session ? session->wire_id : 0;
+}
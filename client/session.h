@@ -10,4 +10,7 @@ void sessions_init();
 void debug_set_isn(uint16_t value);
 void session_enable_packet_trace();
 
+/* Get the id the server knows the session by (0 if it doesn't exist). */
+uint32_t session_get_wire_id(uint16_t session_id);
+
 #endif
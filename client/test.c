@@ -1,12 +1,170 @@
+#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "fountain.h"
+#include "http.h"
 #include "memory.h"
 #include "packet.h"
 #include "session.h"
 
+/* Copy a string into a buffer that http_read_response() can take responses
+ * out of. */
+static uint8_t *http_rx(char *str, size_t *length)
+{
+  uint8_t *rx = safe_malloc(strlen(str));
+
+  memcpy(rx, str, strlen(str));
+  *length = strlen(str);
+
+  return rx;
+}
+
+static void test_http()
+{
+  uint8_t *rx;
+  size_t   rx_length;
+  uint8_t *body;
+  size_t   length;
+  int      status;
+
+  /* Two pipelined responses, and the start of a third */
+  rx = http_rx("HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nAAAAA"
+               "HTTP/1.1 404 Not Found\r\nContent-Length: 3\r\n\r\nBBB"
+               "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\nCC", &rx_length);
+
+  body = http_read_response(rx, &rx_length, &status, &length);
+  assert(body && status == 200 && length == 5 && !memcmp(body, "AAAAA", 5));
+  safe_free(body);
+
+  body = http_read_response(rx, &rx_length, &status, &length);
+  assert(body && status == 404 && length == 3 && !memcmp(body, "BBB", 3));
+  safe_free(body);
+
+  /* The third is truncated, so it stays where it is */
+  body = http_read_response(rx, &rx_length, &status, &length);
+  assert(!body && status != HTTP_BAD_RESPONSE);
+  assert(rx_length == strlen("HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\nCC"));
+  safe_free(rx);
+
+  /* A truncated header */
+  rx = http_rx("HTTP/1.1 200 OK\r\nContent-Len", &rx_length);
+  body = http_read_response(rx, &rx_length, &status, &length);
+  assert(!body && status != HTTP_BAD_RESPONSE);
+  safe_free(rx);
+
+  /* A Content-Length that would wrap around when it's added to anything */
+  rx = http_rx("HTTP/1.1 200 OK\r\nContent-Length: 18446744073709551615\r\n\r\nAAAAA", &rx_length);
+  body = http_read_response(rx, &rx_length, &status, &length);
+  assert(!body && status == HTTP_BAD_RESPONSE);
+  safe_free(rx);
+
+  /* Just past the biggest body we take */
+  rx = http_rx("HTTP/1.1 200 OK\r\nContent-Length: 1048577\r\n\r\nAAAAA", &rx_length);
+  body = http_read_response(rx, &rx_length, &status, &length);
+  assert(!body && status == HTTP_BAD_RESPONSE);
+  safe_free(rx);
+
+  /* A Content-Length that isn't a number */
+  rx = http_rx("HTTP/1.1 200 OK\r\nContent-Length: lots\r\n\r\nAAAAA", &rx_length);
+  body = http_read_response(rx, &rx_length, &status, &length);
+  assert(!body && status == HTTP_BAD_RESPONSE);
+  safe_free(rx);
+
+  printf("HTTP response tests passed\n");
+}
+
+/* Rows from Fountain.coefficients() in server/fountain.rb, so the two can't
+ * drift apart; each list of blocks ends with -1. */
+static struct
+{
+  uint32_t id;
+  uint32_t block_count;
+  int      blocks[20];
+} fountain_rows[] = {
+  { 5,          10, { 5, -1 } },
+  { 10,         10, { 4, 5, 6, 7, 9, -1 } },
+  { 11,         10, { 0, 1, 2, 3, 4, 9, -1 } },
+  { 12345,      10, { 0, 2, 4, 5, 6, 8, 9, -1 } },
+  { 70000,      40, { 0, 1, 2, 4, 6, 7, 8, 9, 11, 14, 17, 19, 21, 26, 28, 31, 32, 33, 39, -1 } },
+  { 0x89ABCDEF, 12, { 2, 3, 4, 7, 8, 9, -1 } },
+  { 6,          2,  { 0, -1 } }, /* No bits from the LCG, so it's id % K */
+};
+
+/* Make a symbol the way the server does, with the same coefficients. */
+static void fountain_encode(uint8_t *data, size_t length, size_t block_size, uint32_t id, uint8_t *symbol)
+{
+  uint32_t block_count = (length + block_size - 1) / block_size;
+  uint8_t  row[FOUNTAIN_MAX_BLOCKS / 8];
+  uint32_t i;
+  size_t   j;
+
+  fountain_get_coefficients(id, block_count, row, (block_count + 7) / 8);
+  memset(symbol, 0, block_size);
+
+  for(i = 0; i < block_count; i++)
+  {
+    if(!(row[i / 8] & (1 << (i % 8))))
+      continue;
+
+    /* The last block is padded with zeroes. */
+    for(j = 0; j < block_size && i * block_size + j < length; j++)
+      symbol[j] ^= data[i * block_size + j];
+  }
+}
+
+static void test_fountain()
+{
+  uint8_t     data[150];
+  uint8_t     symbol[16];
+  uint8_t     row[8];
+  uint8_t     expected[8];
+  fountain_t *fountain;
+  uint8_t    *result;
+  size_t      length;
+  size_t      i;
+  int         j;
+
+  for(i = 0; i < sizeof(fountain_rows) / sizeof(fountain_rows[0]); i++)
+  {
+    memset(expected, 0, sizeof(expected));
+    for(j = 0; fountain_rows[i].blocks[j] != -1; j++)
+      expected[fountain_rows[i].blocks[j] / 8] |= 1 << (fountain_rows[i].blocks[j] % 8);
+
+    fountain_get_coefficients(fountain_rows[i].id, fountain_rows[i].block_count, row, (fountain_rows[i].block_count + 7) / 8);
+    assert(!memcmp(row, expected, (fountain_rows[i].block_count + 7) / 8));
+  }
+
+  for(i = 0; i < sizeof(data); i++)
+    data[i] = (uint8_t)(i * 7 + 3);
+
+  /* 10 blocks, the last one short. Symbols 0 - 29 are sent in a scrambled
+   * order, and three of the plain blocks never arrive. */
+  fountain = fountain_create(sizeof(data), sizeof(symbol));
+  assert(fountain && fountain->block_count == 10);
+
+  for(i = 0; i < 30 && !fountain_is_complete(fountain); i++)
+  {
+    uint32_t id = (i * 7) % 30;
+
+    if(id == 1 || id == 4 || id == 8)
+      continue;
+
+    fountain_encode(data, sizeof(data), sizeof(symbol), id, symbol);
+    fountain_add_symbol(fountain, id, symbol);
+  }
+  assert(fountain_is_complete(fountain));
+
+  result = fountain_get_data(fountain, &length);
+  assert(result && length == sizeof(data) && !memcmp(result, data, sizeof(data)));
+  safe_free(result);
+  fountain_destroy(fountain);
+
+  printf("Fountain tests passed\n");
+}
+
 int main(int argc, const char *argv[])
 {
   packet_t *packet;
@@ -16,45 +174,87 @@ int main(int argc, const char *argv[])
 
   /* Create a SYN */
   packet = packet_create_syn(0x1234, 0x0000, 0x0000);
-  packet_print(packet);
+  packet_print(packet, 0);
 
   /* Convert it to bytes and free the original */
-  bytes = packet_to_bytes(packet, &length);
+  bytes = packet_to_bytes(packet, &length, 0);
   packet_destroy(packet);
 
   /* Parse the bytes from the old packet to create a new one */
-  packet = packet_parse(bytes, length);
-  packet_print(packet);
+  packet = packet_parse(bytes, length, 0);
+  packet_print(packet, 0);
   packet_destroy(packet);
   safe_free(bytes);
 
   /* Create a MSG */
-  packet = packet_create_msg(0x1234, 0x0000, 0x0001, (uint8_t*)"AAAAA", 5);
-  packet_print(packet);
+  packet = packet_create_msg_normal(0x1234, 0x0000, 0x0001, (uint8_t*)"AAAAA", 5);
+  packet_print(packet, 0);
 
   /* Convert it to bytes and free the orignal */
-  bytes = packet_to_bytes(packet, &length);
+  bytes = packet_to_bytes(packet, &length, 0);
   packet_destroy(packet);
 
   /* Parse the bytes from the old packet to create a new one */
-  packet = packet_parse(bytes, length);
-  packet_print(packet);
+  packet = packet_parse(bytes, length, 0);
+  packet_print(packet, 0);
+  packet_destroy(packet);
+  safe_free(bytes);
+
+  /* Create a MSG with 32-bit SEQ/ACK (OPT_WIDE_SEQ) */
+  packet = packet_create_msg_normal(0x1234, 0x12345678, 0x9ABCDEF0, (uint8_t*)"AAAAA", 5);
+  packet_print(packet, OPT_WIDE_SEQ);
+
+  /* Convert it to bytes and free the orignal; the fields are twice as wide */
+  bytes = packet_to_bytes(packet, &length, OPT_WIDE_SEQ);
+  packet_destroy(packet);
+  assert(length == packet_get_msg_size(OPT_WIDE_SEQ) + 5);
+
+  /* Parse the bytes from the old packet to create a new one */
+  packet = packet_parse(bytes, length, OPT_WIDE_SEQ);
+  packet_print(packet, OPT_WIDE_SEQ);
+  assert(packet->body.msg.options.normal.seq == 0x12345678);
+  assert(packet->body.msg.options.normal.ack == 0x9ABCDEF0);
+  assert(packet->body.msg.data_length == 5 && !memcmp(packet->body.msg.data, "AAAAA", 5));
+  packet_destroy(packet);
+  safe_free(bytes);
+
+  /* Create a MSG with a 32-bit session id */
+  packet = packet_create_msg_normal(0x89ABCDEF, 0x0000, 0x0001, (uint8_t*)"AAAAA", 5);
+  packet_print(packet, 0);
+
+  /* Convert it to bytes and free the orignal; the 16-bit id is WIDE_SESSION_ID,
+   * and the real one comes after it */
+  bytes = packet_to_bytes(packet, &length, 0);
+  packet_destroy(packet);
+  assert(length == packet_get_msg_size(0) + 4 + 5);
+  assert(bytes[3] == 0xFF && bytes[4] == 0xFF);
+
+  /* Parse the bytes from the old packet to create a new one */
+  packet = packet_parse(bytes, length, 0);
+  packet_print(packet, 0);
+  assert(packet->session_id == 0x89ABCDEF);
+  assert(packet->body.msg.options.normal.seq == 0x0000);
+  assert(packet->body.msg.options.normal.ack == 0x0001);
+  assert(packet->body.msg.data_length == 5 && !memcmp(packet->body.msg.data, "AAAAA", 5));
   packet_destroy(packet);
   safe_free(bytes);
 
   /* Create a FIN */
-  packet = packet_create_fin(0x1234);
-  packet_print(packet);
+  packet = packet_create_fin(0x1234, "Test");
+  packet_print(packet, 0);
 
   /* Convert it to bytes and free the orignal */
-  bytes = packet_to_bytes(packet, &length);
+  bytes = packet_to_bytes(packet, &length, 0);
   packet_destroy(packet);
-  safe_free(bytes);
 
   /* Parse the bytes from the old packet to create a new one */
-  packet = packet_parse(bytes, length);
-  packet_print(packet);
+  packet = packet_parse(bytes, length, 0);
+  packet_print(packet, 0);
   packet_destroy(packet);
+  safe_free(bytes);
+
+  test_http();
+  test_fountain();
 
   print_memory();
 
@@ -15,6 +15,7 @@
 #include <winsock2.h>
 #else
 #include <pwd.h> /* Required for dropping privileges. */
+#include <sys/time.h>
 #include <unistd.h>
 #endif
 
@@ -105,3 +106,15 @@ void nbdie(char *str)
   nberror(str);
   exit(EXIT_FAILURE);
 }
+
+uint32_t get_time_ms()
+{
+#ifdef WIN32
+  return (uint32_t) GetTickCount();
+#else
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return ((uint32_t)tv.tv_sec * 1000) + (uint32_t)(tv.tv_usec / 1000);
+#endif
+}
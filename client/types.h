@@ -85,5 +85,9 @@ void nbdie(char *str);
 /* Implementation of strcasestr() for Windows. */
 char *nbstrcasestr(char *haystack, char *needle);
 
+/* Get a millisecond-resolution timestamp, independent of platform. It wraps
+ * around every ~49 days, so only compare values by subtracting them. */
+uint32_t get_time_ms();
+
 #endif
 
@@ -10,6 +10,7 @@
 require 'dnscat_exception'
 
 require 'command_packet_stream'
+require 'packet'
 
 class CommandPacket
   COMMAND_PING     = 0x0000
@@ -17,14 +18,40 @@ class CommandPacket
   COMMAND_EXEC     = 0x0002
   COMMAND_DOWNLOAD = 0x0003
   COMMAND_UPLOAD   = 0x0004
+  COMMAND_CONFIG   = 0x0005
+  COMMAND_RUN      = 0x0006
   COMMAND_ERROR    = 0xFFFF
 
+  # The settings a COMMAND_CONFIG request can change on the client
+  CONFIG_SETTINGS = {
+    "packet_length"    => "the longest packet to send, in bytes (0 = as long as the DNS driver allows)",
+    "retransmit_delay" => "seconds to wait for a response before re-sending",
+    "upload_window"    => "the number of chunked-upload packets in flight at once (1 - 8)",
+    "poll_interval"    => "milliseconds between polls when there's no traffic",
+    "ack_delay"        => "milliseconds an ACK can wait for outgoing data to go with it (0 = don't wait)",
+    "record_type"      => "the DNS record type to use (TXT, CNAME, MX, A, or AAAA)",
+  }
+
+  # Optional flags for COMMAND_SHELL and COMMAND_EXEC requests
+  SHELL_FLAG_SCREEN = 0x0001
+  SHELL_FLAG_UPLOAD = 0x0002 # Exec only; the name is the file to save the output as
+
+  # Flags in a COMMAND_RUN response
+  RUN_FLAG_TRUNCATED = 0x0001 # Some of the output didn't fit in max_output
+  RUN_FLAG_TIMED_OUT = 0x0002 # The command was killed for running too long
+
+  # Statuses of a COMMAND_ERROR answering a COMMAND_CONFIG
+  CONFIG_STATUS_UNKNOWN_SETTING = 0x0001
+  CONFIG_STATUS_BAD_VALUE       = 0x0002
+
   attr_reader :request_id, :command_id # header
   attr_reader :data # ping
-  attr_reader :name, :session_id # shell
+  attr_reader :name, :session_id, :flags # shell
   attr_reader :command # command
   attr_reader :filename, :data # download
   attr_reader :filename, :data # upload
+  attr_reader :settings # config
+  attr_reader :command, :max_output, :timeout, :flags, :exit_status, :out, :err # run
 
   attr_reader :status, :reason # errors
 
@@ -55,17 +82,45 @@ class CommandPacket
     end
   end
 
+  # Session ids are encoded the same way as in the packet header: 16 bits, or
+  # WIDE_SESSION_ID followed by 32 bits
+  def CommandPacket.parse_session_id(data)
+    session_id, data = data.unpack("na*")
+    if(session_id == Packet::WIDE_SESSION_ID)
+      if(data.length < 4)
+        raise(DnscatException, "Wide session id is truncated")
+      end
+      session_id, data = data.unpack("Na*")
+    end
+
+    return session_id, data
+  end
+
+  def CommandPacket.pack_session_id(session_id)
+    if(session_id >= Packet::WIDE_SESSION_ID)
+      return [Packet::WIDE_SESSION_ID, session_id].pack("nN")
+    end
+
+    return [session_id].pack("n")
+  end
+
   def parse_shell(data, is_request)
     if(is_request)
       if(data.index("\0").nil?)
         raise(DnscatException, "Shell packet request doesn't have a NUL byte")
       end
       @name, data = data.unpack("Z*a*")
+
+      # The flags are optional
+      @flags = 0
+      if(data.length >= 2)
+        @flags, data = data.unpack("na*")
+      end
     else
       if(data.length < 2)
         raise(DnscatException, "Shell packet response doesn't have a SessionID")
       end
-      @session_id, data = data.unpack("na*")
+      @session_id, data = CommandPacket.parse_session_id(data)
     end
 
     if(data.length > 0)
@@ -78,16 +133,22 @@ class CommandPacket
       if(data.index("\0").nil?)
         raise(DnscatException, "Exec packet request doesn't have a NUL byte after name")
       end
-      @command, data = data.unpack("Z*a*")
+      @name, data = data.unpack("Z*a*")
       if(data.index("\0").nil?)
         raise(DnscatException, "Exec packet request doesn't have a NUL byte after command")
       end
       @command, data = data.unpack("Z*a*")
+
+      # The flags are optional
+      @flags = 0
+      if(data.length >= 2)
+        @flags, data = data.unpack("na*")
+      end
     else
       if(data.length < 2)
         raise(DnscatException, "Exec packet response doesn't have a SessionID")
       end
-      @session_id, data = data.unpack("na*")
+      @session_id, data = CommandPacket.parse_session_id(data)
     end
 
     if(data.length > 0)
@@ -123,6 +184,53 @@ class CommandPacket
     end
   end
 
+  def parse_config(data, is_request)
+    if(is_request)
+      @settings = {}
+      while(data.length > 0)
+        if(data.count("\0") < 2)
+          raise(DnscatException, "Config packet request has a truncated name/value pair")
+        end
+        name, value, data = data.unpack("Z*Z*a*")
+        @settings[name] = value
+      end
+    else
+      if(data.length > 0)
+        raise(DnscatException, "Config packet response has extra data on the end")
+      end
+    end
+  end
+
+  def parse_run(data, is_request)
+    if(is_request)
+      if(data.index("\0").nil?)
+        raise(DnscatException, "Run packet request doesn't have a NUL byte after command")
+      end
+      @command, data = data.unpack("Z*a*")
+      if(data.length < 6)
+        raise(DnscatException, "Run packet request is truncated")
+      end
+      @max_output, @timeout, data = data.unpack("Nna*")
+    else
+      if(data.length < 10)
+        raise(DnscatException, "Run packet response is truncated")
+      end
+      @flags, @exit_status, length, data = data.unpack("nNNa*")
+      if(data.length < length + 4)
+        raise(DnscatException, "Run packet response's stdout is truncated")
+      end
+      @out, length, data = data.unpack("a#{length}Na*")
+      if(data.length < length)
+        raise(DnscatException, "Run packet response's stderr is truncated")
+      end
+      @err, data = data.unpack("a#{length}a*")
+    end
+
+    if(data.length > 0)
+      raise(DnscatException, "Run packet has extra data on the end")
+    end
+  end
+
   def parse_error(data, is_request)
     @status, data = data.unpack("na*")
 
@@ -161,6 +269,10 @@ class CommandPacket
       parse_download(data, is_request)
     elsif(@command_id == COMMAND_UPLOAD)
       parse_upload(data, is_request)
+    elsif(@command_id == COMMAND_CONFIG)
+      parse_config(data, is_request)
+    elsif(@command_id == COMMAND_RUN)
+      parse_run(data, is_request)
     elsif(@command_id == COMMAND_ERROR)
       parse_error(data, is_request)
     else
@@ -181,18 +293,28 @@ class CommandPacket
     return CommandPacket.add_header([data].pack('Z*'), request_id, COMMAND_PING)
   end
 
-  def CommandPacket.create_shell_request(request_id, name)
-    return CommandPacket.add_header([name].pack('Z*'), request_id, COMMAND_SHELL)
+  def CommandPacket.create_shell_request(request_id, name, flags = 0)
+    body = [name].pack('Z*')
+    if(flags != 0)
+      body += [flags].pack('n')
+    end
+
+    return CommandPacket.add_header(body, request_id, COMMAND_SHELL)
   end
   def CommandPacket.create_shell_response(request_id, session_id)
-    return CommandPacket.add_header([session_id].pack('n'), request_id, COMMAND_SHELL)
+    return CommandPacket.add_header(CommandPacket.pack_session_id(session_id), request_id, COMMAND_SHELL)
   end
 
-  def CommandPacket.create_exec_request(request_id, name, command)
-    return CommandPacket.add_header([name, command].pack('Z*Z*'), request_id, COMMAND_EXEC)
+  def CommandPacket.create_exec_request(request_id, name, command, flags = 0)
+    body = [name, command].pack('Z*Z*')
+    if(flags != 0)
+      body += [flags].pack('n')
+    end
+
+    return CommandPacket.add_header(body, request_id, COMMAND_EXEC)
   end
   def CommandPacket.create_exec_response(request_id, session_id)
-    return CommandPacket.add_header([session_id].pack('n'), request_id, COMMAND_EXEC)
+    return CommandPacket.add_header(CommandPacket.pack_session_id(session_id), request_id, COMMAND_EXEC)
   end
 
   def CommandPacket.create_download_request(request_id, filename)
@@ -203,12 +325,39 @@ class CommandPacket
   end
 
   def CommandPacket.create_upload_request(request_id, filename, data)
-    return CommandPacket.add_header([filename, data].pack('Z*a*'), request_id, COMMAND_UPLOAD)
+    return CommandPacket.create_upload_request_header(request_id, filename, data.bytesize) + data
+  end
+  # Everything but the data, so a shared Payload can be queued right after it
+  # instead of being copied into the packet
+  def CommandPacket.create_upload_request_header(request_id, filename, data_length)
+    body = [request_id, COMMAND_UPLOAD, filename].pack("nnZ*")
+
+    return [body.length + data_length, body].pack('Na*')
   end
   def CommandPacket.create_upload_response(request_id)
     return CommandPacket.add_header('', request_id, COMMAND_DOWNLOAD)
   end
 
+  # 'settings' is a hash of name => value (see doc/command_protocol.txt for
+  # the names the client knows)
+  def CommandPacket.create_config_request(request_id, settings)
+    body = settings.map { |name, value| [name.to_s, value.to_s].pack("Z*Z*") }.join()
+
+    return CommandPacket.add_header(body, request_id, COMMAND_CONFIG)
+  end
+  def CommandPacket.create_config_response(request_id)
+    return CommandPacket.add_header('', request_id, COMMAND_CONFIG)
+  end
+
+  # A max_output of 0 lets the client pick (64KB of each stream), and a
+  # timeout of 0 lets the command run forever
+  def CommandPacket.create_run_request(request_id, command, max_output = 0, timeout = 0)
+    return CommandPacket.add_header([command, max_output, timeout].pack("Z*Nn"), request_id, COMMAND_RUN)
+  end
+  def CommandPacket.create_run_response(request_id, flags, exit_status, out, err)
+    return CommandPacket.add_header([flags, exit_status, out.bytesize, out, err.bytesize, err].pack("nNNa*Na*"), request_id, COMMAND_RUN)
+  end
+
   def CommandPacket.create_error(request_id, status, reason)
     return CommandPacket.add_header([status, reason].pack("nZ*"), request_id)
   end
@@ -225,6 +374,10 @@ class CommandPacket
         return "COMMAND_DOWNLOAD  :: request_id = 0x%04x, filename = %s" % [@request_id, @filename]
       elsif(@command_id == COMMAND_UPLOAD)
         return "COMMAND_UPLOAD    :: request_id = 0x%04x, filename = %s, data = 0x%x bytes" % [@request_id, @filename, @data.length]
+      elsif(@command_id == COMMAND_CONFIG)
+        return "COMMAND_CONFIG    :: request_id = 0x%04x, settings = %s" % [@request_id, @settings.map { |name, value| "#{name}=#{value}" }.join(", ")]
+      elsif(@command_id == COMMAND_RUN)
+        return "COMMAND_RUN       :: request_id = 0x%04x, command = %s, max_output = 0x%x, timeout = %d" % [@request_id, @command, @max_output, @timeout]
       elsif(@command_id == COMMAND_ERROR)
         return "COMMAND_ERROR     :: request_id = 0x%04x, status = 0x%04x, reason = %s" % [@request_id, @status, @reason]
       else
@@ -241,6 +394,10 @@ class CommandPacket
         return "COMMAND_DOWNLOAD :: request_id = 0x%04x, data = 0x%x bytes" % [@request_id, @data.length]
       elsif(@command_id == COMMAND_UPLOAD)
         return "COMMAND_UPLOAD   :: request_id = 0x%04x" % [@request_id]
+      elsif(@command_id == COMMAND_CONFIG)
+        return "COMMAND_CONFIG   :: request_id = 0x%04x" % [@request_id]
+      elsif(@command_id == COMMAND_RUN)
+        return "COMMAND_RUN      :: request_id = 0x%04x, flags = 0x%04x, exit_status = %d, stdout = 0x%x bytes, stderr = 0x%x bytes" % [@request_id, @flags, @exit_status, @out.length, @err.length]
       elsif(@command_id == COMMAND_ERROR)
         return "COMMAND_ERROR    :: request_id = 0x%04x, status = 0x%04x, reason = %s" % [@request_id, @status, @reason]
       else
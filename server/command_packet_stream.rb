@@ -8,9 +8,13 @@
 ##
 
 require 'dnscat_exception'
+require 'memory_stats'
 
 class CommandPacketStream
-  def initialize()
+  # 'id' is the session to count the buffered data against (see
+  # memory_stats.rb)
+  def initialize(id = nil)
+    @id = id
     @data = ""
     @length = nil
   end
@@ -21,25 +25,31 @@ class CommandPacketStream
     @data += data
 
     # Process everything we can
-    loop do
-      # If we don't have enough data, return immediately
-      if(@data.length < 4)
-        return
+    begin
+      loop do
+        # If we don't have enough data, return immediately
+        if(@data.length < 4)
+          return
+        end
+
+        # Try to read a length + packet
+        length, data = @data.unpack("Na*")
+
+        # If there isn't enough data, give up
+        if(data.length < length)
+          return
+        end
+
+        # Otherwise, remove what we have from @data
+        length, data, @data = @data.unpack("Na#{length}a*")
+
+        # And that's it!
+        yield(CommandPacket.new(data, is_request))
       end
-
-      # Try to read a length + packet
-      length, data = @data.unpack("Na*")
-
-      # If there isn't enough data, give up
-      if(data.length < length)
-        return
+    ensure
+      if(!@id.nil?)
+        MemoryStats.set(@id, :commands, @data.bytesize)
       end
-
-      # Otherwise, remove what we have from @data
-      length, data, @data = @data.unpack("Na#{length}a*")
-
-      # And that's it!
-      yield(CommandPacket.new(data, is_request))
     end
   end
 end
@@ -0,0 +1,436 @@
+##
+# control.rb
+# Created October, 2026
+#
+# See: LICENSE.txt
+#
+# A control socket for scripts (--control <path>), which runs alongside the
+# UI. It's a unix domain socket, and every line in either direction is a
+# JSON object. Requests have an "op", and an optional "id" that's copied into
+# the reply; replies have "ok", and "error" if it's false. Binary data (what
+# sessions send and receive, downloads, command output) is base64.
+#
+# - {"op":"list"}
+#   Replies with "sessions", an array of {id, name, state, command, outgoing,
+#   memory}
+# - {"op":"send", "session":<id>, "data":<base64>}
+#   Queues data on a (non-command) session; it's an error if that would go
+#   over the memory limit
+# - {"op":"kill", "session":<id>}
+# - {"op":"stats"}
+#   Replies with "stages" (see stage_timer.rb), "resolvers" (see
+#   resolver_stats.rb), "memory" (see memory_stats.rb), and "prepared" (see
+#   Session.prepare()), the same counters the 'stats' command shows
+# - {"op":"subscribe"}
+#   Starts the event stream on this connection (see below)
+# - {"op":"command", "sessions":[<id>, ...], "command":<name>, ...}
+#   Sends a command protocol request to each of the given command sessions
+#   ("session":<id> works for just one). The request is encoded once, and
+#   every session gets the same request id, which is in the reply, along
+#   with the sessions that didn't get it ("rejected") because of the memory
+#   limit. The commands, and what else they need:
+#   - ping
+#   - shell    [name]
+#   - exec     command_line, [name]
+#   - run      command_line, [max_output], [timeout]
+#   - download file
+#   - upload   file, data
+#   - config   settings (an object of name => value)
+#   Each session's answer is sent as a "response" event, to this connection
+#   only, whether or not it's subscribed.
+#
+# Events look like {"event":<type>, "session":<id>, ...}:
+# - established - a session was created ("name", "command")
+# - output      - a session received "data" (not for command sessions)
+# - finished    - the client won't send any more on a session
+# - destroyed   - a session went away
+# - response    - an answer to a 'command' request ("request_id", "command",
+#                 and the fields of the response; see response_to_hash())
+#
+# Every connection has its own writer thread, so a slow script can't hold up
+# the sessions; if one falls MAX_QUEUED events behind, it's disconnected.
+##
+
+require 'json'
+require 'set'
+require 'socket'
+
+require 'command_packet'
+require 'dnscat_exception'
+require 'fleet'
+require 'log'
+require 'memory_stats'
+require 'payload'
+require 'resolver_stats'
+require 'session'
+require 'session_manager'
+require 'stage_timer'
+
+class Control
+  # The most events (or replies) that can be waiting for a connection
+  MAX_QUEUED = 10000
+
+  # The longest request we'll read
+  MAX_LINE = 0x1000000
+
+  COMMANDS = {
+    "ping"     => CommandPacket::COMMAND_PING,
+    "shell"    => CommandPacket::COMMAND_SHELL,
+    "exec"     => CommandPacket::COMMAND_EXEC,
+    "download" => CommandPacket::COMMAND_DOWNLOAD,
+    "upload"   => CommandPacket::COMMAND_UPLOAD,
+    "config"   => CommandPacket::COMMAND_CONFIG,
+    "run"      => CommandPacket::COMMAND_RUN,
+    "error"    => CommandPacket::COMMAND_ERROR,
+  }
+
+  STATES = {
+    Session::STATE_NEW         => "new",
+    Session::STATE_ESTABLISHED => "established",
+    Session::STATE_KILLED      => "killed",
+  }
+
+  @@mutex    = Mutex.new()
+  @@clients  = []
+  @@requests = {} # request_id => [Control, Set of session ids that haven't answered]
+
+  def Control.start(path)
+    # Clean up after a server that didn't exit cleanly, but don't delete
+    # anything that isn't a socket
+    if(File.socket?(path))
+      File.unlink(path)
+    end
+
+    # Create the socket owner-only, rather than fixing it up afterwards,
+    # so there's no moment when somebody else can connect
+    old_umask = File.umask(0077)
+    begin
+      server = UNIXServer.new(path)
+    ensure
+      File.umask(old_umask)
+    end
+    Log.WARNING(nil, "Listening for control connections on #{path}")
+
+    Thread.new do
+      loop do
+        Control.new(server.accept())
+      end
+    end
+
+    at_exit do
+      File.unlink(path) rescue nil
+    end
+  end
+
+  def initialize(socket)
+    @socket     = socket
+    @queue      = Queue.new()
+    @subscribed = false
+
+    @@mutex.synchronize { @@clients << self }
+
+    @writer = Thread.new do
+      begin
+        loop do
+          line = @queue.pop()
+          if(line.nil?)
+            break
+          end
+          @socket.write(line)
+        end
+      rescue IOError, SystemCallError
+        # The reader finds out too
+      end
+      @socket.close() rescue nil
+    end
+
+    Thread.new do
+      begin
+        while(line = @socket.gets("\n", MAX_LINE))
+          reply = handle_line(line)
+          if(!reply.nil?)
+            write(reply)
+          end
+        end
+      rescue IOError, SystemCallError => e
+        Log.INFO(nil, "Control connection closed: #{e}")
+      ensure
+        close()
+      end
+    end
+  end
+
+  def subscribed?()
+    return @subscribed
+  end
+
+  # Queue a message for the writer thread
+  def write(hash)
+    if(@queue.length >= MAX_QUEUED)
+      Log.ERROR(nil, "A control connection fell too far behind; disconnecting it")
+      close()
+      return
+    end
+
+    @queue << (JSON.generate(hash) + "\n")
+  end
+
+  def close()
+    @@mutex.synchronize do
+      @@clients.delete(self)
+      @@requests.delete_if { |request_id, (client, pending)| client == self }
+    end
+    @queue << nil
+  end
+
+  def Control.broadcast(hash)
+    clients = @@mutex.synchronize { @@clients.select { |c| c.subscribed?() } }
+    clients.each do |client|
+      client.write(hash)
+    end
+  end
+
+  # Strings that came from a client might not be valid UTF-8, which JSON
+  # can't take
+  def Control.text(str)
+    return str.to_s().dup().force_encoding("UTF-8").scrub("?")
+  end
+
+  def Control.binary(str)
+    return [str.to_s()].pack("m0")
+  end
+
+  def Control.session_to_hash(session)
+    return {
+      "id"       => session.id,
+      "name"     => Control.text(session.name),
+      "state"    => STATES[session.state] || session.state,
+      "command"  => session.is_command,
+      "outgoing" => session.outgoing_length(),
+      "memory"   => MemoryStats.held(session.id),
+    }
+  end
+
+  def Control.response_to_hash(packet)
+    result = {
+      "request_id" => packet.request_id,
+      "command"    => COMMANDS.key(packet.command_id) || packet.command_id,
+    }
+
+    case packet.command_id
+    when CommandPacket::COMMAND_PING
+      result["data"] = Control.text(packet.data)
+    when CommandPacket::COMMAND_SHELL, CommandPacket::COMMAND_EXEC
+      result["new_session"] = packet.session_id
+    when CommandPacket::COMMAND_DOWNLOAD
+      result["data"] = Control.binary(packet.data)
+    when CommandPacket::COMMAND_RUN
+      result["exit_status"] = packet.exit_status
+      result["truncated"]   = (packet.flags & CommandPacket::RUN_FLAG_TRUNCATED) != 0
+      result["timed_out"]   = (packet.flags & CommandPacket::RUN_FLAG_TIMED_OUT) != 0
+      result["out"]         = Control.binary(packet.out)
+      result["err"]         = Control.binary(packet.err)
+    when CommandPacket::COMMAND_ERROR
+      result["status"] = packet.status
+      result["reason"] = Control.text(packet.reason)
+    end
+
+    return result
+  end
+
+  def find_session(id)
+    session = SessionManager.find(id.to_i())
+    if(session.nil? || session.state != Session::STATE_ESTABLISHED)
+      raise(DnscatException, "No such session: #{id}")
+    end
+    return session
+  end
+
+  # Build the request for a 'command' op with the given request id; returns a
+  # String or an array of them
+  def create_request(request, request_id)
+    case request["command"]
+    when "ping"
+      return CommandPacket.create_ping_request(request_id, "control ping")
+    when "shell"
+      return CommandPacket.create_shell_request(request_id, request["name"] || "shell")
+    when "exec"
+      if(request["command_line"].nil?)
+        raise(DnscatException, "exec needs a command_line")
+      end
+      return CommandPacket.create_exec_request(request_id, request["name"] || request["command_line"], request["command_line"])
+    when "run"
+      if(request["command_line"].nil?)
+        raise(DnscatException, "run needs a command_line")
+      end
+      return CommandPacket.create_run_request(request_id, request["command_line"], request["max_output"].to_i(), request["timeout"].to_i())
+    when "download"
+      if(request["file"].nil?)
+        raise(DnscatException, "download needs a file")
+      end
+      return CommandPacket.create_download_request(request_id, request["file"])
+    when "upload"
+      if(request["file"].nil? || request["data"].nil?)
+        raise(DnscatException, "upload needs a file and data")
+      end
+      return CommandPacket.create_upload_request(request_id, request["file"], request["data"].unpack("m0").pop())
+    when "config"
+      settings = request["settings"]
+      if(!settings.is_a?(Hash) || settings.empty?() || settings.keys.any? { |name| CommandPacket::CONFIG_SETTINGS[name].nil? })
+        raise(DnscatException, "config needs settings, from: #{CommandPacket::CONFIG_SETTINGS.keys.join(", ")}")
+      end
+      return CommandPacket.create_config_request(request_id, settings)
+    else
+      raise(DnscatException, "Unknown command: #{request["command"]}")
+    end
+  end
+
+  def handle_command(request)
+    ids = request["sessions"] || [request["session"]].compact()
+    if(!ids.is_a?(Array))
+      raise(DnscatException, "'sessions' has to be an array of session ids")
+    end
+    sessions = ids.map { |id| find_session(id) }
+    if(sessions.empty?)
+      raise(DnscatException, "No sessions given")
+    end
+    sessions.each do |session|
+      if(!session.is_command)
+        raise(DnscatException, "Session #{session.id} isn't a command session")
+      end
+    end
+
+    # Fleet's request ids, so the command sessions' own requests don't
+    # collide with ours
+    request_id = Fleet.request_id()
+    payloads = [create_request(request, request_id)].flatten().map { |p| Payload.new(p) }
+
+    @@mutex.synchronize do
+      @@requests[request_id] = [self, Set.new(sessions.map { |s| s.id })]
+    end
+
+    # Sessions that are over the memory limit don't get the request
+    rejected = sessions.select { |session| !session.queue_outgoing(payloads) }.map { |s| s.id }
+    if(!rejected.empty?)
+      @@mutex.synchronize do
+        rejected.each { |id| @@requests[request_id][1].delete(id) }
+        if(@@requests[request_id][1].empty?)
+          @@requests.delete(request_id)
+        end
+      end
+    end
+
+    return { "request_id" => request_id, "sessions" => sessions.map { |s| s.id } - rejected, "rejected" => rejected }
+  end
+
+  def handle_request(request)
+    case request["op"]
+    when "list"
+      return { "sessions" => SessionManager.list().values.map { |s| Control.session_to_hash(s) } }
+    when "send"
+      session = find_session(request["session"])
+      if(session.is_command)
+        raise(DnscatException, "Session #{session.id} is a command session; use 'command'")
+      end
+      if(!session.queue_outgoing(request["data"].to_s().unpack("m0").pop()))
+        raise(DnscatException, "Session #{session.id} would go over the memory limit")
+      end
+      return {}
+    when "kill"
+      session = find_session(request["session"])
+      SessionManager.kill_session(session.id)
+      return {}
+    when "stats"
+      memory = MemoryStats.snapshot()
+      memory[:sessions] = Hash[memory[:sessions].map { |id, held| [id.nil? ? "main" : id.to_s(), held] }]
+      return { "stages" => StageTimer.snapshot(), "resolvers" => ResolverStats.snapshot(), "memory" => memory, "prepared" => Session.prepared_stats() }
+    when "subscribe"
+      @subscribed = true
+      return {}
+    when "command"
+      return handle_command(request)
+    else
+      raise(DnscatException, "Unknown op: #{request["op"]}")
+    end
+  end
+
+  def handle_line(line)
+    if(line.strip().empty?)
+      return nil
+    end
+
+    request = nil
+    begin
+      request = JSON.parse(line)
+      if(!request.is_a?(Hash))
+        raise(DnscatException, "Requests have to be JSON objects")
+      end
+
+      return { "id" => request["id"], "ok" => true }.merge(handle_request(request))
+    rescue JSON::ParserError, ArgumentError, DnscatException => e
+      return { "id" => request.is_a?(Hash) ? request["id"] : nil, "ok" => false, "error" => e.to_s() }
+    end
+  end
+
+  # Called by a command session with every response; returns true if the
+  # response was to one of our requests
+  def Control.handle_response(session_id, packet)
+    client = @@mutex.synchronize do
+      client, pending = @@requests[packet.request_id]
+      if(client.nil? || !pending.delete?(session_id))
+        nil
+      else
+        if(pending.empty?)
+          @@requests.delete(packet.request_id)
+        end
+        client
+      end
+    end
+
+    if(client.nil?)
+      return false
+    end
+
+    client.write({ "event" => "response", "session" => session_id }.merge(Control.response_to_hash(packet)))
+    return true
+  end
+
+  # SessionManager callbacks
+  def Control.session_established(id)
+    session = SessionManager.find(id)
+    if(!session.nil?)
+      Control.broadcast({ "event" => "established", "session" => id, "name" => Control.text(session.name), "command" => session.is_command })
+    end
+  end
+
+  def Control.session_data_received(id, data)
+    session = SessionManager.find(id)
+    if(!session.nil? && !session.is_command)
+      Control.broadcast({ "event" => "output", "session" => id, "data" => Control.binary(data) })
+    end
+  end
+
+  def Control.session_data_finished(id)
+    Control.broadcast({ "event" => "finished", "session" => id })
+  end
+
+  def Control.session_destroyed(id)
+    # Anybody waiting on the session won't get an answer
+    orphans = @@mutex.synchronize do
+      result = []
+      @@requests.each_pair do |request_id, (client, pending)|
+        if(pending.delete?(id))
+          result << [client, request_id]
+        end
+      end
+      @@requests.delete_if { |request_id, (client, pending)| pending.empty? }
+      result
+    end
+
+    orphans.each do |client, request_id|
+      client.write({ "event" => "response", "session" => id, "request_id" => request_id, "command" => "error", "status" => 0xFFFF, "reason" => "Session closed before responding" })
+    end
+
+    Control.broadcast({ "event" => "destroyed", "session" => id })
+  end
+end
@@ -12,12 +12,20 @@
 $LOAD_PATH << File.dirname(__FILE__) # A hack to make this work on 1.8/1.9
 
 require 'driver_dns'
+require 'driver_http'
 require 'driver_tcp'
 
+require 'control'
+require 'fleet'
+require 'flight_recorder'
 require 'log'
+require 'memory_stats'
 require 'packet'
+require 'relay'
+require 'session'
 require 'session_manager'
 require 'settings'
+require 'stage_timer'
 require 'ui'
 
 # Option parsing
@@ -47,6 +55,13 @@ opts = Trollop::options do
   opt :tcpport,    "The port to listen on",
     :type => :integer, :default => 4444
 
+  opt :http,      "Start an HTTP server (for clients started with --http)",
+    :type => :boolean, :default => false
+  opt :httphost,  "The HTTP ip address to listen on",
+    :type => :string,  :default => "0.0.0.0"
+  opt :httpport,  "The HTTP port to listen on",
+    :type => :integer, :default => 8080
+
   opt :debug,     "Min debug level [info, warning, error, fatal]",
     :type => :string,  :default => "warning"
 
@@ -58,6 +73,22 @@ opts = Trollop::options do
     :type => :boolean,  :default => false
   opt :isn,            "Set the initial sequence number",
     :type => :integer,  :default => nil
+  opt :flight_recorder, "Write recent packet events to this file on SIGUSR2 or a fatal error",
+    :type => :string,   :default => nil
+  opt :stats_interval,  "Log a line of request timing stats this often, in seconds (0 = never)",
+    :type => :integer,  :default => 0
+  opt :local_echo,      "Send keystrokes as they're typed in sessions, and echo them locally instead of waiting for the remote side",
+    :type => :boolean,  :default => false
+  opt :control,         "Listen for JSON control connections (see control.rb) on this unix socket",
+    :type => :string,   :default => nil
+  opt :memory_limit,    "Refuse to queue outgoing data past this many bytes held in total (0 = no limit; see 'stats memory')",
+    :type => :integer,  :default => 0
+  opt :relay_names,     "Relay sessions named forward:<host>:<port> to host:port (lets clients connect anywhere the server can!)",
+    :type => :boolean,  :default => false
+  opt :relay_allow,     "With --relay-names, only relay to these host:ports (comma-separated; default: anywhere)",
+    :type => :string,   :default => ""
+  opt :upload_dir,      "Save the files clients upload with 'exec --upload' in this directory",
+    :type => :string,   :default => "uploads"
 end
 
 # Note: This is no longer strictly required, but it gives the user better feedback if
@@ -75,6 +106,10 @@ if(opts[:tcpport] < 0 || opts[:tcpport] > 65535)
   Trollop::die :dnsport, "must be a valid port"
 end
 
+if(opts[:httpport] < 0 || opts[:httpport] > 65535)
+  Trollop::die :httpport, "must be a valid port"
+end
+
 DriverDNS.passthrough = opts[:passthrough]
 # Make a copy of ARGV
 domains = [].replace(ARGV)
@@ -169,12 +204,95 @@ settings.verify("auto_attach") do |value|
   end
 end
 
+settings.verify("local_echo") do |value|
+  if(value == true || value == false)
+    nil
+  else
+    "'local_echo' has to be true or false!"
+  end
+end
+
+settings.watch("flight_recorder") do |old_val, new_val|
+  FlightRecorder.file = new_val
+
+  nil
+end
+
+settings.watch("stats_interval") do |old_val, new_val|
+  if(new_val.to_s !~ /^[0-9]+$/)
+    "'stats_interval' has to be a number of seconds (0 to disable)!"
+  else
+    StageTimer.interval = new_val.to_i
+    nil
+  end
+end
+
+settings.watch("memory_limit") do |old_val, new_val|
+  if(new_val.to_s !~ /^[0-9]+$/)
+    "'memory_limit' has to be a number of bytes (0 for no limit)!"
+  else
+    MemoryStats.limit = new_val.to_i
+    nil
+  end
+end
+
+settings.watch("relay_names") do |old_val, new_val|
+  if(!(new_val == true || new_val == false || new_val.nil?))
+    "'relay_names' has to be true or false!"
+  else
+    Relay.by_name = (new_val == true)
+    nil
+  end
+end
+
+settings.watch("relay_allow") do |old_val, new_val|
+  Relay.allowed = new_val
+  nil
+end
+
+settings.watch("upload_dir") do |old_val, new_val|
+  if(!new_val.is_a?(String) || new_val == "")
+    "'upload_dir' has to be a directory name!"
+  else
+    Session.upload_dir = new_val
+    nil
+  end
+end
+
 settings.set("auto_command", opts[:auto_command])
 settings.set("auto_attach",  opts[:auto_attach])
 settings.set("passthrough",  opts[:passthrough])
 settings.set("debug",        opts[:debug])
 settings.set("packet_trace", opts[:packet_trace])
 settings.set("isn",          opts[:isn])
+settings.set("flight_recorder", opts[:flight_recorder])
+settings.set("stats_interval",  opts[:stats_interval])
+settings.set("local_echo",      opts[:local_echo])
+settings.set("memory_limit",    opts[:memory_limit])
+settings.set("relay_names",     opts[:relay_names])
+settings.set("relay_allow",     opts[:relay_allow])
+settings.set("upload_dir",      opts[:upload_dir])
+
+# Let the user ask for a flight recorder dump without the UI. Dump from a new
+# thread, since trap handlers are restricted in what they can do.
+begin
+  trap("USR2") do
+    Thread.new do
+      begin
+        count = FlightRecorder.dump()
+        if(count.nil?)
+          Log.ERROR(nil, "SIGUSR2 received, but no flight recorder file is set (use --flight-recorder)")
+        else
+          Log.PRINT(nil, "Wrote #{count} flight recorder events to #{FlightRecorder.file}")
+        end
+      rescue => e
+        Log.ERROR(nil, "Couldn't write the flight recorder: #{e}")
+      end
+    end
+  end
+rescue ArgumentError
+  # SIGUSR2 doesn't exist on Windows
+end
 
 threads = []
 if(opts[:dns])
@@ -186,9 +304,11 @@ if(opts[:dns])
     rescue DnscatException => e
       Log.FATAL(nil, "Protocol exception caught in DNS module:")
       Log.FATAL(nil, e)
+      FlightRecorder.dump() rescue nil
     rescue Exception => e
       Log.FATAL(nil, "Exception starting the driver:")
       Log.FATAL(nil, e)
+      FlightRecorder.dump() rescue nil
 
       if(e.to_s =~ /no datagram socket/)
         Log.PRINT(nil, "")
@@ -201,6 +321,22 @@ if(opts[:dns])
   end
 end
 
+if(opts[:http])
+  # Long polls find out about new data through the session notifications
+  SessionManager.subscribe(DriverHTTP)
+
+  threads << Thread.new do
+    begin
+      driver = DriverHTTP.new(opts[:httphost], opts[:httpport])
+      SessionManager.go(driver, settings)
+    rescue Exception => e
+      Log.FATAL(nil, "Exception starting the HTTP driver:")
+      Log.FATAL(nil, e)
+      FlightRecorder.dump() rescue nil
+    end
+  end
+end
+
 # This is simply to give up the thread's timeslice, allowing the driver threads
 # a small amount of time to initialize themselves
 sleep(0.01)
@@ -209,6 +345,17 @@ ui = Ui.new(settings)
 
 # Subscribe the Ui to the important notifications
 SessionManager.subscribe(ui)
+SessionManager.subscribe(Fleet)
+SessionManager.subscribe(Relay)
+SessionManager.subscribe(Control)
+
+if(!opts[:control].nil?)
+  begin
+    Control.start(opts[:control])
+  rescue SystemCallError => e
+    Trollop::die :control, "couldn't be opened: #{e}"
+  end
+end
 
 # Turn off the 'main' logger
 Log.reset()
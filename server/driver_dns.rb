@@ -12,6 +12,8 @@ require 'rubydns'
 
 require 'log'
 require 'pp' # TODO: Debug
+require 'resolver_stats'
+require 'stage_timer'
 
 class DriverDNS
   # Use upstream DNS for name resolution.
@@ -164,6 +166,10 @@ class DriverDNS
 
       # Only match proper domains with proper record types
       match(/#{domain_regex}/, RECORD_TYPES.keys) do |transaction|
+        # Note: RubyDNS has already decoded the DNS packet by the time we get
+        # here, so that isn't part of any stage
+        start = StageTimer.now()
+
         begin
           # Determine the type
           type = transaction.resource_class
@@ -173,7 +179,9 @@ class DriverDNS
           Log.INFO(nil, "Received:  #{transaction.name} (#{type})")
 
           # Determine the actual name, without the extra cruft
-          name, domain = DriverDNS.figure_out_name(transaction.name, domains)
+          name, domain = StageTimer.time(:figure_out_name) do
+            DriverDNS.figure_out_name(transaction.name, domains)
+          end
           if(name.nil? || name !~ /^[a-fA-F0-9.]*$/)
             if(DriverDNS.passthrough)
               if(!@shown_pt)
@@ -196,8 +204,11 @@ class DriverDNS
             end
 
             # Get rid of periods in the incoming name
-            name = name.gsub(/\./, '')
-            name = [name].pack("H*")
+            name = StageTimer.time(:decode) do
+              [name.gsub(/\./, '')].pack("H*")
+            end
+
+            ResolverStats.query(transaction.options[:peer], "#{type}:#{transaction.name}", name)
 
             # Figure out the length of the domain based on the record type
             if(type_info[:requires_domain])
@@ -227,6 +238,8 @@ class DriverDNS
               raise(DnscatException, "The handler returned too much data! This shouldn't happen, please report")
             end
 
+            encode_start = StageTimer.now()
+
             # Encode the response as needed
             response = type_info[:encoder].call(response)
 
@@ -249,6 +262,8 @@ class DriverDNS
               response = Name.create(response)
             end
 
+            StageTimer.add(:encode, StageTimer.now() - encode_start)
+
             # Log the response
             Log.INFO(nil, "Sending:  #{response}")
 
@@ -258,25 +273,32 @@ class DriverDNS
             end
 
             # Allow multiple response records
-            response.each do |r|
-              # MX requires a special response
-              if(type == IN::MX)
-                transaction.respond!(rand(5) * 10, r)
-              else
-                transaction.respond!(r)
+            StageTimer.time(:respond) do
+              response.each do |r|
+                # MX requires a special response
+                if(type == IN::MX)
+                  transaction.respond!(rand(5) * 10, r)
+                else
+                  transaction.respond!(r)
+                end
               end
             end
           end
         rescue DnscatException => e
           Log.ERROR(nil, "Protocol exception caught in dnscat DNS module (unable to determine session at this point to close it):")
           Log.ERROR(nil, e.inspect)
+          ResolverStats.error(transaction.options[:peer])
           transaction.fail!(:NXDomain)
         rescue Exception => e
           Log.ERROR(nil, "Error caught:")
           Log.ERROR(nil, e)
+          ResolverStats.error(transaction.options[:peer])
           transaction.fail!(:NXDomain)
         end
 
+        StageTimer.add(:total, StageTimer.now() - start)
+        StageTimer.report_if_needed()
+
         transaction # Return this, effectively
       end
 
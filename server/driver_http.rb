@@ -0,0 +1,237 @@
+##
+# driver_http.rb
+# Created October, 2026
+#
+# See: LICENSE.txt
+#
+# Carries dnscat packets over HTTP, for clients started with --http (see
+# client/driver_http.c). It understands just enough HTTP/1.1 for that, with
+# keep-alive:
+#
+# - POST /dnscat - the body is any number of dnscat packets, each with a
+#   16-bit length in front; the response is the answers, the same way
+# - GET /dnscat/wait?generation=<n>&sessions=<id>,<id>,... - a long poll;
+#   it's held until one of the client's sessions has data queued or goes
+#   away (or HOLD seconds go by), and the body is the new generation, which
+#   the client sends back next time
+#
+# Every connection gets a thread, but packets are handled one at a time.
+##
+
+require 'socket'
+
+require 'log'
+
+class DriverHTTP
+  PATH      = "/dnscat"
+  WAIT_PATH = "/dnscat/wait"
+
+  # The client's HTTP_MAX_PACKET_LENGTH
+  MAX_PACKET_LENGTH = 0x4000
+
+  # How long a long poll is held before it's answered anyway
+  HOLD = 20
+
+  # The biggest request we'll read
+  MAX_LINE = 0x2000
+  MAX_BODY = 0x100000
+
+  @@mutex      = Mutex.new()
+  @@generation = 0
+
+  # Indexed by session id: the generation it last had data queued (or went
+  # away) at, and the long polls waiting on it. Destroyed sessions are
+  # forgotten after @@destroyed says they've been gone for HOLD seconds, by
+  # which time any long poll that was asking about them has been answered.
+  @@changed   = {}
+  @@waiters   = {}
+  @@destroyed = {}
+
+  def initialize(host, port)
+    @host   = host
+    @port   = port
+    @server = TCPServer.new(host, port)
+
+    # The session code isn't thread safe
+    @handle_mutex = Mutex.new()
+  end
+
+  # Wake up the long polls waiting on the session, and nobody else
+  def DriverHTTP.wakeup(id)
+    @@mutex.synchronize do
+      @@generation = (@@generation + 1) & 0xFFFFFFFF
+      @@changed[id] = @@generation
+      (@@waiters[id] || []).each() { |cv| cv.signal() }
+
+      @@destroyed.delete_if() do |old_id, time|
+        if(time < Time.now() - HOLD)
+          @@changed.delete(old_id)
+          true
+        end
+      end
+    end
+  end
+
+  # SessionManager callbacks; the long polls waiting on the session are woken
+  # up, so they find out about new data (or a FIN) right away
+  def DriverHTTP.session_data_queued(id, data)
+    @@mutex.synchronize() { @@destroyed.delete(id) }
+    DriverHTTP.wakeup(id)
+  end
+
+  def DriverHTTP.session_destroyed(id)
+    DriverHTTP.wakeup(id)
+    @@mutex.synchronize() { @@destroyed[id] = Time.now() }
+  end
+
+  # Whether the session changed after the given generation; they're 32 bits,
+  # so this allows for wrapping around
+  def DriverHTTP.changed_since?(id, generation)
+    changed = @@changed[id]
+    return !changed.nil? && ((changed - generation) & 0xFFFFFFFF).between?(1, 0x7FFFFFFF)
+  end
+
+  # Wait until one of the sessions changes after the given generation, or
+  # HOLD seconds go by; returns the current generation
+  def DriverHTTP.wait(generation, ids)
+    deadline = Time.now() + HOLD
+    cv = ConditionVariable.new()
+
+    @@mutex.synchronize do
+      ids.each() { |id| (@@waiters[id] ||= []) << cv }
+
+      begin
+        loop do
+          left = deadline - Time.now()
+          if(ids.any?() { |id| DriverHTTP.changed_since?(id, generation) } || left <= 0)
+            return @@generation
+          end
+          cv.wait(@@mutex, left)
+        end
+      ensure
+        ids.each() do |id|
+          @@waiters[id].delete(cv)
+          if(@@waiters[id].empty?)
+            @@waiters.delete(id)
+          end
+        end
+      end
+    end
+  end
+
+  def recv(&block)
+    Log.WARNING(nil, "Starting Dnscat2 HTTP server on #{@host}:#{@port}...")
+
+    loop do
+      Thread.start(@server.accept()) do |s|
+        begin
+          serve(s, block)
+        rescue IOError, SystemCallError => e
+          Log.INFO(nil, "HTTP connection closed: #{e}")
+        ensure
+          s.close() rescue nil
+        end
+      end
+    end
+  end
+
+  def respond(s, status, reason, body)
+    body = body.dup().force_encoding("BINARY")
+    header = "HTTP/1.1 #{status} #{reason}\r\n" +
+             "Content-Type: application/octet-stream\r\n" +
+             "Content-Length: #{body.bytesize}\r\n" +
+             "Connection: keep-alive\r\n" +
+             "\r\n"
+
+    s.write(header.force_encoding("BINARY") + body)
+  end
+
+  # Run each packet in the body through the session code, and return the
+  # responses, framed the same way
+  def handle_packets(body, block)
+    responses = String.new()
+
+    while(body.bytesize >= 2)
+      length, body = body.unpack("na*")
+      if(body.bytesize < length)
+        Log.ERROR(nil, "HTTP: request has a truncated packet")
+        break
+      end
+
+      packet = body.byteslice(0, length)
+      body   = body.byteslice(length..-1)
+
+      response = @handle_mutex.synchronize do
+        begin
+          block.call(packet, MAX_PACKET_LENGTH)
+        rescue StandardError => e
+          # The session's already been cleaned up; the client finds out
+          # from its next packet
+          Log.ERROR(nil, "HTTP: error handling a packet: #{e}")
+          nil
+        end
+      end
+
+      if(!response.nil?)
+        responses << [response.bytesize].pack("n") << response.dup().force_encoding("BINARY")
+      end
+    end
+
+    return responses
+  end
+
+  # Handle requests on a connection till it closes
+  def serve(s, block)
+    loop do
+      request = s.gets("\r\n", MAX_LINE)
+      if(request.nil?)
+        return
+      end
+      method, path = request.split(" ")
+
+      headers = {}
+      loop do
+        line = s.gets("\r\n", MAX_LINE)
+        if(line.nil?)
+          return
+        end
+        line = line.chomp()
+        if(line.empty?)
+          break
+        end
+
+        name, value = line.split(":", 2)
+        headers[name.strip().downcase()] = value.to_s().strip()
+      end
+
+      length = headers["content-length"].to_i()
+      if(length < 0 || length > MAX_BODY)
+        respond(s, 413, "Request Entity Too Large", "")
+        return
+      end
+
+      body = (length > 0) ? s.read(length) : String.new()
+      if(body.nil? || body.bytesize != length)
+        return
+      end
+
+      if(method == "POST" && path == PATH)
+        respond(s, 200, "OK", handle_packets(body, block))
+      elsif(method == "GET" && path.to_s().start_with?(WAIT_PATH))
+        generation = path[/[?&]generation=(\d+)/, 1].to_i()
+        ids = path[/[?&]sessions=([\d,]+)/, 1].to_s().split(",").map() { |id| id.to_i() }.uniq()
+        respond(s, 200, "OK", DriverHTTP.wait(generation, ids).to_s())
+      else
+        respond(s, 404, "Not Found", "")
+      end
+
+      if(headers["connection"].to_s().downcase() == "close")
+        return
+      end
+    end
+  end
+
+  def close()
+    @server.close()
+  end
+end
@@ -0,0 +1,281 @@
+##
+# fleet.rb
+# Created October, 2026
+#
+# See: LICENSE.txt
+#
+# Sends one command to a bunch of command sessions at once, and collects the
+# responses as they come in. The command packet is only encoded once: every
+# session gets a reference to the same Payload (see payload.rb), with the same
+# request id.
+#
+# Results go into a directory, one file per session:
+# - <session>.error     - the error the client sent back (for any command)
+# - <session>-<file>    - a downloaded file
+# - <session>.out       - the output of an exec'd process (or stdout, for 'run')
+# - <session>.err       - stderr, for 'run'
+# - <session>.status    - the exit status, for 'run'
+#
+# Fleet is a SessionManager subscriber, so it sees the output of the sessions
+# that 'exec' creates, and finds out when sessions go away. Clients only
+# answer an exec once the new session is established, so a session named
+# EXEC_PREFIX hangs on to its output (and whether it closed) until the answer
+# says whose it is, or until no 'exec' is left to answer for it.
+#
+# A request id is forgotten once every session it went to has answered or
+# gone away.
+##
+
+require 'fileutils'
+
+require 'command_packet'
+require 'log'
+require 'memory_stats'
+require 'payload'
+
+class Fleet
+  # Fleet requests use the top half of the request id space; the command
+  # sessions keep their own requests in the bottom half
+  FIRST_REQUEST_ID = 0x8000
+
+  # The name of every session a fleet 'exec' creates starts with this
+  EXEC_PREFIX = "fleet: "
+
+  @@mutex    = Mutex.new()
+  @@jobs     = []
+  @@requests = {} # request_id => job
+  @@children = {} # id of a session created by 'exec' => [job, parent's id]
+  @@unclaimed = {} # id of an EXEC_PREFIX session nobody's answered for yet => [output, closed?]
+  @@next_request_id = FIRST_REQUEST_ID
+
+  attr_reader :id, :request_id, :command_id, :description, :dir
+
+  def initialize(id, request_id, command_id, description, dir, filename)
+    @id          = id
+    @request_id  = request_id
+    @command_id  = command_id
+    @description = description
+    @dir         = dir
+    @filename    = filename # What downloads are saved as
+    @status      = {} # session id => :pending, :running, :done, or :error
+    @last_report = 0
+  end
+
+  # Queue the packet the block creates on each of the given sessions; the
+  # block is called once, with the request id to use, and can return a String,
+  # a Payload, or an array of them
+  def Fleet.dispatch(sessions, command_id, description, dir, filename = nil)
+    job = nil
+    request_id = Fleet.request_id()
+
+    @@mutex.synchronize do
+      job = Fleet.new(@@jobs.length + 1, request_id, command_id, description, dir, filename)
+      @@jobs << job
+      @@requests[request_id] = job
+    end
+
+    FileUtils.mkdir_p(dir)
+
+    payloads = [yield(job.request_id)].flatten().map do |p|
+      p.is_a?(Payload) ? p : Payload.new(p)
+    end
+
+    # Every session is pending before any of them can fail, so the request
+    # isn't forgotten early
+    sessions.each do |session|
+      job.set_status(session.id, :pending)
+    end
+
+    sessions.each do |session|
+      if(!session.queue_outgoing(payloads))
+        job.set_status(session.id, :error)
+      end
+    end
+
+    return job
+  end
+
+  # The next request id from the top half; Control's requests come from here
+  # too, so they can't collide with ours
+  def Fleet.request_id()
+    return @@mutex.synchronize do
+      request_id = @@next_request_id
+      @@next_request_id = (@@next_request_id == 0xFFFF) ? FIRST_REQUEST_ID : @@next_request_id + 1
+      request_id
+    end
+  end
+
+  def Fleet.jobs()
+    return @@jobs
+  end
+
+  # Called by a command session with every response; returns true if the
+  # response belonged to a fleet job
+  def Fleet.handle_response(session_id, packet)
+    job = @@mutex.synchronize { @@requests[packet.request_id] }
+    if(job.nil?)
+      return false
+    end
+
+    job.handle_response(session_id, packet)
+    return true
+  end
+
+  # Whether an 'exec' is still waiting on answers, any of which could claim an
+  # EXEC_PREFIX session; called with the mutex held
+  def Fleet.exec_outstanding?()
+    return @@requests.each_value().any?() { |job| job.command_id == CommandPacket::COMMAND_EXEC }
+  end
+
+  # Drop an EXEC_PREFIX session's held output; called with the mutex held
+  def Fleet.unclaim(id)
+    @@unclaimed.delete(id)
+    MemoryStats.set(id, :fleet, 0)
+  end
+
+  # SessionManager callbacks
+  def Fleet.session_established(id)
+    session = SessionManager.find(id)
+    if(!session.nil? && session.name.start_with?(EXEC_PREFIX))
+      @@mutex.synchronize do
+        if(@@children[id].nil?)
+          @@unclaimed[id] = ["", false]
+        end
+      end
+    end
+  end
+
+  # Saved under the mutex, so output that was held on to can't be overtaken
+  def Fleet.session_data_received(id, data)
+    @@mutex.synchronize do
+      if(!@@unclaimed[id].nil?)
+        @@unclaimed[id][0] += data
+        MemoryStats.set(id, :fleet, @@unclaimed[id][0].bytesize)
+      end
+
+      job, parent = @@children[id]
+      if(!job.nil?)
+        job.save(parent, ".out", data, "ab")
+      end
+    end
+  end
+
+  def Fleet.session_destroyed(id)
+    job, parent = @@mutex.synchronize do
+      if(!@@unclaimed[id].nil?)
+        if(Fleet.exec_outstanding?())
+          @@unclaimed[id][1] = true
+        else
+          Fleet.unclaim(id)
+        end
+      end
+      @@children.delete(id)
+    end
+
+    if(!job.nil?)
+      job.set_status(parent, :done)
+    end
+
+    # A command session that goes away won't be answering
+    @@jobs.each do |j|
+      if(j.status(id) == :pending)
+        j.save(id, ".error", "Session closed before responding\n")
+        j.set_status(id, :error)
+      end
+    end
+  end
+
+  def status(session_id)
+    return @@mutex.synchronize { @status[session_id] }
+  end
+
+  def set_status(session_id, status)
+    @@mutex.synchronize do
+      if(@status[session_id].nil? && status != :pending)
+        return
+      end
+      @status[session_id] = status
+
+      # Nobody's left to answer, so the request id can go; if this was the
+      # last 'exec' waiting, the closed sessions it didn't claim can't be
+      # claimed anymore either
+      if(!@status.value?(:pending) && @@requests[@request_id].equal?(self))
+        @@requests.delete(@request_id)
+        if(!Fleet.exec_outstanding?())
+          @@unclaimed.select() { |id, (output, closed)| closed }.each_key() { |id| Fleet.unclaim(id) }
+        end
+      end
+    end
+
+    if(status == :done || status == :error)
+      report()
+    end
+  end
+
+  def save(session_id, suffix, data, mode = "wb")
+    File.open(File.join(@dir, "#{session_id}#{suffix}"), mode) do |f|
+      f.write(data)
+    end
+  end
+
+  def handle_response(session_id, packet)
+    if(packet.command_id == CommandPacket::COMMAND_ERROR)
+      save(session_id, ".error", "#{packet.status}: #{packet.reason}\n")
+      set_status(session_id, :error)
+    elsif(packet.command_id != @command_id)
+      save(session_id, ".error", "Unexpected response: #{packet}\n")
+      set_status(session_id, :error)
+    elsif(@command_id == CommandPacket::COMMAND_DOWNLOAD)
+      save(session_id, "-" + @filename, packet.data)
+      set_status(session_id, :done)
+    elsif(@command_id == CommandPacket::COMMAND_RUN)
+      save(session_id, ".out", packet.out)
+      save(session_id, ".err", packet.err)
+      save(session_id, ".status", "#{packet.exit_status}\n")
+      set_status(session_id, (packet.flags & CommandPacket::RUN_FLAG_TIMED_OUT) != 0 ? :error : :done)
+    elsif(@command_id == CommandPacket::COMMAND_EXEC)
+      # Done when the process' session closes, which might have happened
+      # already
+      closed = @@mutex.synchronize do
+        output, closed = @@unclaimed[packet.session_id] || ["", false]
+        Fleet.unclaim(packet.session_id)
+        if(output != "")
+          save(session_id, ".out", output, "ab")
+        end
+        if(!closed)
+          @@children[packet.session_id] = [self, session_id]
+        end
+        closed
+      end
+
+      set_status(session_id, closed ? :done : :running)
+    else
+      set_status(session_id, :done)
+    end
+  end
+
+  def counts()
+    return @@mutex.synchronize do
+      result = Hash.new(0)
+      @status.each_value { |s| result[s] += 1 }
+      [@status.length, result]
+    end
+  end
+
+  # Log progress every 10%, and at the end
+  def report()
+    total, counts = counts()
+    finished = counts[:done] + counts[:error]
+    tenth = (finished * 10) / [total, 1].max()
+
+    if(finished == total || tenth > @last_report)
+      @last_report = tenth
+      Log.PRINT(nil, "Fleet job #{@id} (#{@description}): #{finished}/#{total} finished, #{counts[:error]} errors")
+    end
+  end
+
+  def to_s()
+    total, counts = counts()
+    return "job %d :: %s :: %d sessions: %d pending, %d running, %d done, %d errors :: results in %s" % [@id, @description, total, counts[:pending], counts[:running], counts[:done], counts[:error], @dir]
+  end
+end
@@ -0,0 +1,102 @@
+##
+# flight_recorder.rb
+# Created October, 2026
+#
+# See: LICENSE.txt
+#
+# An always-on, fixed-size ring of compact binary events (packets in and out,
+# retransmits, queue changes, and dropped packets). Each event is packed into
+# a 22-byte string as it's recorded, so the steady-state cost is a timestamp
+# and a pack(). The ring is written to a file on SIGUSR2, on a fatal error in
+# the SessionManager, or from the 'flightrecorder' command.
+#
+# The dump format is shared with the client; see doc/flight_recorder.txt.
+##
+
+require 'log'
+require 'packet'
+
+class FlightRecorder
+  SIZE = 4096
+
+  MAGIC   = "dcfr"
+  VERSION = 2
+  SOURCE  = 1 # 0 = client, 1 = server
+
+  # Event types
+  EVENT_PACKET_OUT = 0x01 # detail = packet type
+  EVENT_PACKET_IN  = 0x02 # detail = packet type
+  EVENT_RETRANSMIT = 0x03 # detail = packet type
+  EVENT_WINDOW     = 0x04 # length = bytes waiting to be ACKed
+  EVENT_DROP       = 0x05 # detail = drop reason
+
+  # Drop reasons
+  DROP_NONE        = 0x00
+  DROP_BAD_SEQ     = 0x01
+  DROP_BAD_ACK     = 0x02
+  DROP_BAD_CHUNK   = 0x03
+  DROP_NO_SESSION  = 0x04
+  DROP_UNEXPECTED  = 0x05
+  DROP_PARSE_ERROR = 0x06
+
+  @@events = Array.new(SIZE)
+  @@total  = 0
+  @@start  = Time.now()
+  @@file   = nil
+
+  def FlightRecorder.file=(filename)
+    @@file = filename
+  end
+
+  def FlightRecorder.file()
+    return @@file
+  end
+
+  def FlightRecorder.total()
+    return @@total
+  end
+
+  def FlightRecorder.record(type, detail, session_id, seq = 0, ack = 0, length = 0)
+    ms = ((Time.now() - @@start) * 1000).to_i() & 0xFFFFFFFF
+
+    @@events[@@total % SIZE] = [ms, type, detail, session_id, seq || 0, ack || 0, length || 0].pack("NCCNNNN")
+    @@total += 1
+  end
+
+  def FlightRecorder.record_packet(type, packet)
+    seq    = 0
+    ack    = 0
+    length = 0
+
+    if(packet.type == Packet::MESSAGE_TYPE_SYN)
+      seq = packet.body.seq
+    elsif(packet.type == Packet::MESSAGE_TYPE_MSG)
+      seq    = packet.body.seq || packet.body.chunk
+      ack    = packet.body.ack
+      length = packet.body.data.length
+    end
+
+    record(type, packet.type, packet.session_id, seq, ack, length)
+  end
+
+  # Returns the number of events written
+  def FlightRecorder.dump(filename = nil)
+    filename ||= @@file
+    if(filename.nil?)
+      return nil
+    end
+
+    total  = @@total
+    count  = [total, SIZE].min()
+    events = @@events.dup()
+
+    File.open(filename, 'wb') do |f|
+      f.write([MAGIC, VERSION, SOURCE, 0, @@start.to_i(), total & 0xFFFFFFFF, count].pack("a4CCnNNN"))
+      (total - count).upto(total - 1) do |i|
+        f.write(events[i % SIZE])
+      end
+    end
+
+    return count
+  end
+end
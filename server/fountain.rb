@@ -0,0 +1,83 @@
+##
+# fountain.rb
+# Created October, 2026
+#
+# See: LICENSE.txt
+#
+# The encoding half of fountain-coded downloads (OPT_FOUNTAIN). The file is
+# split into K blocks, and the client can ask for any symbol number: symbols
+# below K are the blocks themselves, and every one after that is the XOR of a
+# pseudo-random set of blocks. The client can rebuild the file from any K
+# symbols that are linearly independent (typically K plus one or two), so a
+# lost answer is never asked for again - the client just asks for another
+# symbol.
+#
+# The decoder is client/fountain.c, and the format is in doc/protocol.txt.
+##
+
+class Fountain
+  # The most blocks a file can be split into (the client's decoder needs K^2
+  # bits of memory)
+  MAX_BLOCKS = 8192
+
+  # Each symbol starts with the length of the file
+  HEADER_SIZE = 4
+
+  attr_reader :length, :block_size, :block_count
+
+  def initialize(data, block_size)
+    data = data.dup().force_encoding("BINARY")
+
+    @length      = data.bytesize
+    @block_size  = block_size
+    @block_count = (@length + block_size - 1) / block_size
+
+    # Keeping the blocks as integers makes XORing them cheap
+    @blocks = (0...@block_count).map do |i|
+      data.byteslice(i * block_size, block_size).ljust(block_size, "\0").unpack("H*").pop.to_i(16)
+    end
+  end
+
+  # Which blocks make up the given symbol; this has to match
+  # fountain_get_coefficients() in the client exactly (client/test.c checks a
+  # few rows from here)
+  def Fountain.coefficients(id, block_count)
+    if(id < block_count)
+      return [id]
+    end
+
+    # Scramble the symbol number, then use the top bit of an LCG for each
+    # block
+    state = (((id >> 16) ^ id) * 0x45D9F3B) & 0xFFFFFFFF
+    state = (((state >> 16) ^ state) * 0x45D9F3B) & 0xFFFFFFFF
+    state = (state >> 16) ^ state
+
+    result = []
+    0.upto(block_count - 1) do |i|
+      state = ((state * 1664525) + 1013904223) & 0xFFFFFFFF
+
+      if((state & 0x80000000) != 0)
+        result << i
+      end
+    end
+
+    if(result.length == 0)
+      result << id % block_count
+    end
+
+    return result
+  end
+
+  def symbol(id)
+    header = [@length].pack("N")
+    if(@block_count == 0)
+      return header
+    end
+
+    value = Fountain.coefficients(id, @block_count).inject(0) do |v, i|
+      v ^ @blocks[i]
+    end
+
+    return header + [value.to_s(16).rjust(@block_size * 2, '0')].pack("H*")
+  end
+end
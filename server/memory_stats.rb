@@ -0,0 +1,166 @@
+##
+# memory_stats.rb
+# Created October, 2026
+#
+# See: LICENSE.txt
+#
+# Keeps track of the bytes the server is holding, by session and by
+# structure, so a growing server can be pinned on something:
+# - outgoing: queued data the client hasn't acknowledged yet
+# - upload:   upload chunks waiting for the ones in front of them
+# - history:  a window's scrollback (the main window's is under "-"); it's
+#             kept after the session dies, for as long as the window is
+# - commands: a command session's partly-received responses (downloads,
+#             mostly)
+# - fleet:    the output of a session a fleet 'exec' created, held until the
+#             answer to the exec says whose it is (see fleet.rb)
+#
+# Outgoing data is held as payloads, which any number of sessions can share
+# (see payload.rb), so the total counts each payload once instead of adding
+# up every session's outgoing bytes.
+#
+# With a limit set (the 'memory_limit' setting), new outgoing data that would
+# push the total past it is refused; see Session.queue_outgoing().
+##
+
+class MemoryStats
+  KINDS = [:outgoing, :upload, :history, :commands, :fleet]
+
+  @@mutex      = Mutex.new()
+  @@held       = {} # session id => { kind => bytes }
+  @@payloads   = 0
+  @@total      = 0
+  @@high_water = 0
+  @@limit      = 0 # Bytes; 0 = no limit
+
+  def MemoryStats.limit=(bytes)
+    @@limit = bytes.to_i()
+  end
+
+  def MemoryStats.limit()
+    return @@limit
+  end
+
+  # Under the mutex
+  def MemoryStats.add(delta)
+    @@total += delta
+    if(@@total > @@high_water)
+      @@high_water = @@total
+    end
+  end
+
+  # Say how many bytes of 'kind' a session (or nil, for the main window) is
+  # holding right now
+  def MemoryStats.set(id, kind, bytes)
+    @@mutex.synchronize do
+      held = @@held[id] || {}
+      if(kind != :outgoing)
+        add(bytes - (held[kind] || 0))
+      end
+
+      if(bytes > 0)
+        held[kind] = bytes
+        @@held[id] = held
+      else
+        held.delete(kind)
+        if(held.empty?)
+          @@held.delete(id)
+        end
+      end
+    end
+  end
+
+  # Called by Payload when its first reference is taken (with its length) and
+  # when its last one is released (with minus its length)
+  def MemoryStats.payload(delta)
+    @@mutex.synchronize do
+      @@payloads += delta
+      add(delta)
+    end
+  end
+
+  # Whether 'bytes' more can be held without going over the limit
+  def MemoryStats.room?(bytes)
+    @@mutex.synchronize do
+      return @@limit <= 0 || bytes <= 0 || @@total + bytes <= @@limit
+    end
+  end
+
+  # The bytes a session is holding, in all its structures
+  def MemoryStats.held(id)
+    @@mutex.synchronize do
+      return (@@held[id] || {}).values.inject(0, :+)
+    end
+  end
+
+  def MemoryStats.total()
+    return @@total
+  end
+
+  # Start the high-water mark over from the current total
+  def MemoryStats.reset()
+    @@mutex.synchronize do
+      @@high_water = @@total
+    end
+  end
+
+  # A copy of the counters: :total, :high_water, :limit, :payloads, and
+  # :sessions (id => { kind => bytes }), the biggest first
+  def MemoryStats.snapshot()
+    @@mutex.synchronize do
+      sessions = {}
+      @@held.each_pair do |id, held|
+        sessions[id] = held.dup()
+      end
+
+      return {
+        :total      => @@total,
+        :high_water => @@high_water,
+        :limit      => @@limit,
+        :payloads   => @@payloads,
+        :sessions   => Hash[sessions.sort_by { |id, held| -held.values.inject(0, :+) }],
+      }
+    end
+  end
+
+  def MemoryStats.format(bytes)
+    if(bytes >= 1024 * 1024)
+      return "%.1f MB" % (bytes / 1048576.0)
+    elsif(bytes >= 1024)
+      return "%.1f KB" % (bytes / 1024.0)
+    end
+
+    return "%d bytes" % bytes
+  end
+
+  # One line per session; 'live' is a list of the ids that still have a
+  # session, so the dead ones can be pointed out
+  def MemoryStats.to_s(live = nil)
+    stats = snapshot()
+
+    result = []
+    result << "Holding %s (high-water mark: %s; limit: %s); %s of that is queued payloads" % [
+      MemoryStats.format(stats[:total]),
+      MemoryStats.format(stats[:high_water]),
+      stats[:limit] > 0 ? MemoryStats.format(stats[:limit]) : "none",
+      MemoryStats.format(stats[:payloads]),
+    ]
+
+    if(stats[:sessions].empty?)
+      return result.join("\n")
+    end
+
+    result << ""
+    result << "%-10s %12s %12s %12s %12s %12s %12s" % (["session"] + KINDS.map { |k| k.to_s() } + ["total"])
+    stats[:sessions].each_pair do |id, held|
+      name = id.nil? ? "-" : id.to_s()
+      if(!id.nil? && !live.nil? && !live.include?(id))
+        name += " (dead)"
+      end
+
+      result << "%-10s %12d %12d %12d %12d %12d %12d" % ([name] + KINDS.map { |k| held[k] || 0 } + [held.values.inject(0, :+)])
+    end
+
+    return result.join("\n")
+  end
+end
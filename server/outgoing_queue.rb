@@ -0,0 +1,83 @@
+##
+# outgoing_queue.rb
+# Created October, 2026
+#
+# See: LICENSE.txt
+#
+# A session's outgoing data, as a list of payloads (see payload.rb) plus a
+# cursor into the first one. Queueing a payload only adds a reference to it;
+# bytes are only copied when they're actually put into a packet, and a
+# payload is released once every byte of it has been acknowledged.
+##
+
+require 'payload'
+
+class OutgoingQueue
+  attr_reader :length
+
+  def initialize()
+    @payloads = []
+    @offset   = 0 # How much of the first payload has been acknowledged
+    @length   = 0
+  end
+
+  # Takes either a Payload or a String
+  def push(data)
+    if(!data.is_a?(Payload))
+      data = Payload.new(data)
+    end
+
+    if(data.length == 0)
+      return
+    end
+
+    data.retain()
+    @payloads << data
+    @length += data.length
+  end
+
+  # Get up to n bytes, starting 'skip' bytes into the queue (without removing
+  # them)
+  def peek(n, skip = 0)
+    result = String.new()
+    skip += @offset
+
+    @payloads.each do |payload|
+      if(result.length >= n)
+        break
+      end
+
+      if(skip >= payload.length)
+        skip -= payload.length
+        next
+      end
+
+      result << payload.data.byteslice(skip, n - result.length)
+      skip = 0
+    end
+
+    return result
+  end
+
+  # Remove n bytes from the front, releasing any payloads that are finished
+  def consume(n)
+    n = [n, @length].min()
+    @length -= n
+    @offset += n
+
+    while(@payloads.length > 0 && @offset >= @payloads[0].length)
+      @offset -= @payloads[0].length
+      @payloads.shift().release()
+    end
+  end
+
+  def clear()
+    @payloads.each do |payload|
+      payload.release()
+    end
+
+    @payloads = []
+    @offset   = 0
+    @length   = 0
+  end
+end
@@ -31,13 +31,42 @@ class Packet
   OPT_DOWNLOAD            = 0x0008
   OPT_CHUNKED_DOWNLOAD    = 0x0010
   OPT_COMMAND             = 0x0020
+  OPT_SCREEN              = 0x0040
+  OPT_CHUNKED_UPLOAD      = 0x0080
+  OPT_FOUNTAIN            = 0x0100
+  OPT_HALF_CLOSE          = 0x0200
+  OPT_WIDE_SEQ            = 0x0400
+
+  # All the chunked modes replace the SEQ/ACK fields with a chunk number (for
+  # fountain-coded downloads, it's the symbol number)
+  OPT_CHUNKED             = OPT_CHUNKED_DOWNLOAD | OPT_CHUNKED_UPLOAD | OPT_FOUNTAIN
+
+  # With OPT_WIDE_SEQ, the SEQ/ACK fields are 32 bits instead of 16, so a very
+  # late answer can't be mistaken for a new one after 64k of data. The SYN's
+  # ISN stays 16 bits; the numbers just keep counting past 0xFFFF.
+  def Packet.seq_mask(options)
+    return ((options & OPT_WIDE_SEQ) == OPT_WIDE_SEQ) ? 0xFFFFFFFF : 0xFFFF
+  end
+
+  # Session ids below this fit in the header's 16-bit field. If the field
+  # contains this value, the real id follows as a 32-bit value (which is always
+  # above 0xFFFF, so the two can't collide)
+  WIDE_SESSION_ID         = 0xFFFF
+
+  # The FIN reason we send when a SYN uses a session id that's already taken;
+  # the client picks a new id and tries again
+  FIN_REASON_COLLISION    = "Session id collision"
+
+  # With OPT_HALF_CLOSE, the FIN reason a client sends when it has no more
+  # data; we acknowledge it as one byte, and keep sending
+  FIN_REASON_EOF          = "EOF"
 
   attr_reader :packet_id, :type, :session_id, :body
 
   class SynBody
     extend PacketHelper
 
-    attr_reader :seq, :options, :name, :download
+    attr_reader :seq, :options, :name, :download, :upload
 
     def initialize(options, params = {})
       @options = options || raise(DnscatException, "options can't be nil!")
@@ -52,6 +81,9 @@ class Packet
       if((@options & OPT_DOWNLOAD) == OPT_DOWNLOAD)
         @download = params[:download] || raise(DnscatException, "params[:download] can't be nil when OPT_DOWNLOAD is set!")
       end
+
+      # Only the client sends the upload name; the server just echoes the flag
+      @upload = params[:upload]
     end
 
     def SynBody.parse(data)
@@ -82,6 +114,16 @@ class Packet
         data = data[(download.length+1)..-1]
       end
 
+      # Parse the upload filename, if it exists
+      upload = nil
+      if((options & OPT_CHUNKED_UPLOAD) == OPT_CHUNKED_UPLOAD)
+        if(data.index("\0").nil?)
+          raise(DnscatException, "OPT_CHUNKED_UPLOAD set, but no null-terminated name given")
+        end
+        upload = data.unpack("Z*").pop
+        data = data[(upload.length+1)..-1]
+      end
+
       # Verify that that was the entire packet
       if(data.length > 0)
         raise(DnscatException, "Extra data on the end of an SYN packet :: #{data.unpack("H*")}")
@@ -91,6 +133,7 @@ class Packet
         :seq     => seq,
         :name    => name,
         :download => download,
+        :upload   => upload,
       })
     end
 
@@ -101,6 +144,10 @@ class Packet
         result += ", download = %s" % @download
       end
 
+      if((options & OPT_CHUNKED_UPLOAD) == OPT_CHUNKED_UPLOAD)
+        result += ", upload = %s" % @upload
+      end
+
       return result
     end
 
@@ -116,8 +163,8 @@ class Packet
 
     def initialize(options, params = {})
       @options = options
-      if((options & OPT_CHUNKED_DOWNLOAD) == OPT_CHUNKED_DOWNLOAD)
-        @chunk = params[:chunk] || raise(DnscatException, "params[:chunk] can't be nil when OPT_CHUNKED_DOWNLOAD is set!")
+      if((options & OPT_CHUNKED) != 0)
+        @chunk = params[:chunk] || raise(DnscatException, "params[:chunk] can't be nil when OPT_CHUNKED_DOWNLOAD or OPT_CHUNKED_UPLOAD is set!")
       else
         @seq = params[:seq] || raise(DnscatException, "params[:seq] can't be nil unless OPT_CHUNKED_DOWNLOAD is set!")
         @ack = params[:ack] || raise(DnscatException, "params[:ack] can't be nil unless OPT_CHUNKED_DOWNLOAD is set!")
@@ -126,11 +173,16 @@ class Packet
     end
 
     def MsgBody.parse(options, data)
-      if((options & OPT_CHUNKED_DOWNLOAD) == OPT_CHUNKED_DOWNLOAD)
-        at_least?(data, 4) || raise(DnscatException, "Packet is too short (MSG d/l)")
+      if((options & OPT_CHUNKED) != 0)
+        at_least?(data, 4) || raise(DnscatException, "Packet is too short (MSG chunked)")
 
         chunk = data.unpack("N").pop
         data = data[4..-1] # Remove the first eight bytes
+      elsif((options & OPT_WIDE_SEQ) != 0)
+        at_least?(data, 8) || raise(DnscatException, "Packet is too short (MSG wide)")
+
+        seq, ack = data.unpack("NN")
+        data = data[8..-1] # Remove the first eight bytes
       else
         at_least?(data, 4) || raise(DnscatException, "Packet is too short (MSG norm)")
 
@@ -171,7 +223,7 @@ class Packet
 
     def to_s()
       data = @data.gsub(/\n/, '\n')
-      if((@options & OPT_CHUNKED_DOWNLOAD) == OPT_CHUNKED_DOWNLOAD)
+      if((@options & OPT_CHUNKED) != 0)
         return "[[MSG]] :: chunk = %d, data = 0x%x bytes" % [@chunk, data.length]
       else
         return "[[MSG]] :: seq = %04x, ack = %04x, data = 0x%x bytes" % [@seq, @ack, data.length]
@@ -180,9 +232,13 @@ class Packet
 
     def to_bytes()
       result = ""
-      if((@options & OPT_CHUNKED_DOWNLOAD) == OPT_CHUNKED_DOWNLOAD)
+      if((@options & OPT_CHUNKED) != 0)
         chunk = @chunk || 0
         result += [chunk, @data].pack("NA*")
+      elsif((@options & OPT_WIDE_SEQ) != 0)
+        seq = @seq || 0
+        ack = @ack || 0
+        result += [seq, ack, @data].pack("NNA*")
       else
         seq = @seq || 0
         ack = @ack || 0
@@ -264,8 +320,8 @@ class Packet
     @body       = body
   end
 
-  def Packet.header_size(options)
-    return Packet.new(0, 0, 0, nil).to_bytes().length()
+  def Packet.header_size(options, session_id = 0)
+    return Packet.new(0, 0, session_id, nil).to_bytes().length()
   end
 
   def Packet.parse_header(data)
@@ -277,6 +333,17 @@ class Packet
     packet_id, type, session_id = data.unpack("nCn")
     data = data[5..-1]
 
+    if(session_id == WIDE_SESSION_ID)
+      at_least?(data, 4) || raise(DnscatException, "Packet is too short (wide session id)")
+
+      session_id = data.unpack("N").pop
+      data = data[4..-1]
+
+      if(session_id <= WIDE_SESSION_ID)
+        raise(DnscatException, "Wide session id is too small: 0x%x" % session_id)
+      end
+    end
+
     return packet_id, type, session_id, data
   end
 
@@ -330,14 +397,25 @@ class Packet
     return "[0x%04x] session = %04x :: %s" % [@packet_id, @session_id, @body.to_s]
   end
 
+  # Packets don't change once they're created, so they're only encoded once
+  # (a session can encode its next one ahead of time; see Session.prepare())
   def to_bytes()
-    result = [@packet_id, @type, @session_id].pack("nCn")
+    if(!@bytes.nil?)
+      return @bytes
+    end
+
+    if(@session_id >= WIDE_SESSION_ID)
+      result = [@packet_id, @type, WIDE_SESSION_ID, @session_id].pack("nCnN")
+    else
+      result = [@packet_id, @type, @session_id].pack("nCn")
+    end
 
     # If we set the body to nil, just return a header (this happens when determining the header length)
     if(!@body.nil?)
       result += @body.to_bytes()
     end
 
-    return result
+    @bytes = result.freeze()
+    return @bytes
   end
 end
@@ -0,0 +1,112 @@
+##
+# payload.rb
+# Created October, 2026
+#
+# See: LICENSE.txt
+#
+# An immutable, reference-counted piece of outgoing data. Sessions don't copy
+# a payload into their outgoing queue, they keep a reference to it and a
+# cursor (see outgoing_queue.rb), so pushing the same 10MB file to a thousand
+# sessions only costs 10MB.
+#
+# Payloads created with Payload.from_file() or Payload.intern() are shared:
+# asking for the same content again returns the same object, for as long as
+# some session still has a reference to it.
+##
+
+require 'digest'
+
+require 'memory_stats'
+
+class Payload
+  attr_reader :data, :key, :refs
+
+  @@mutex  = Mutex.new()
+  @@shared = {}
+
+  def initialize(data, key = nil)
+    # dup() doesn't copy the bytes (Ruby strings are copy-on-write), it just
+    # makes sure nobody can change them out from under us
+    @data = data.dup().force_encoding("BINARY").freeze()
+    @key  = key
+    @refs = 0
+  end
+
+  def length()
+    return @data.bytesize
+  end
+
+  # Find or create the shared payload for the given key; the block is only
+  # called (to get the data) if it doesn't exist yet
+  def Payload.shared(key)
+    @@mutex.synchronize do
+      payload = @@shared[key]
+      if(payload.nil?)
+        payload = @@shared[key] = Payload.new(yield, key)
+      end
+
+      return payload
+    end
+  end
+
+  # Share the contents of a file; if the file changes, it's read again
+  def Payload.from_file(filename)
+    stat = File.stat(filename)
+
+    return Payload.shared("file:%s:%d:%d" % [File.expand_path(filename), stat.size, stat.mtime.to_i]) do
+      IO.binread(filename)
+    end
+  end
+
+  # Share arbitrary data, by content
+  def Payload.intern(data)
+    return Payload.shared("sha256:" + Digest::SHA256.hexdigest(data)) do
+      data
+    end
+  end
+
+  # A payload's memory is counted (see memory_stats.rb) while something has a
+  # reference to it
+  def retain()
+    first = @@mutex.synchronize do
+      @refs += 1
+      @refs == 1
+    end
+
+    if(first)
+      MemoryStats.payload(length())
+    end
+  end
+
+  # When the last reference goes away, a shared payload is forgotten so it can
+  # be garbage collected
+  def release()
+    last = @@mutex.synchronize do
+      @refs -= 1
+      if(@refs <= 0 && !@key.nil? && @@shared[@key].equal?(self))
+        @@shared.delete(@key)
+      end
+      @refs == 0
+    end
+
+    if(last)
+      MemoryStats.payload(-length())
+    end
+  end
+
+  def Payload.count()
+    @@mutex.synchronize do
+      return @@shared.length
+    end
+  end
+
+  def Payload.bytes()
+    @@mutex.synchronize do
+      return @@shared.values.inject(0) { |sum, payload| sum + payload.length }
+    end
+  end
+
+  def to_s()
+    return "%d bytes, %d references%s" % [length(), @refs, @key.nil? ? "" : " (#{@key})"]
+  end
+end
@@ -0,0 +1,118 @@
+##
+# predictor.rb
+# Created October, 2026
+#
+# See: LICENSE.txt
+#
+# Speculative local echo for interactive sessions (similar to what mosh
+# does). When 'local_echo' is on, keystrokes are sent one at a time, and
+# instead of waiting a round trip (or several) for the remote shell to echo
+# them, we draw what we expect the echo to be right away. When data comes
+# back from the client, it's compared against those predictions:
+#
+# - Bytes that match were already drawn, so they're swallowed
+# - If something else shows up, the remote side isn't echoing what we
+#   guessed; if the remote side has been echoing, the guesses are erased and
+#   the real output is drawn in their place
+#
+# Shells running on pipes (the default for dnscat2) don't echo at all, so
+# until we've seen an echo the predictions are left on the screen - they're
+# the only echo the user is going to get.
+##
+
+class Predictor
+  # Save / restore the cursor, and clear to the end of the screen
+  SAVE_CURSOR    = "\e7"
+  RESTORE_CURSOR = "\e8"
+  CLEAR_TO_END   = "\e[J"
+
+  attr_reader :pending
+
+  def initialize()
+    # The bytes we're expecting the remote side to echo, which are already on
+    # the screen
+    @pending = ""
+
+    # Predictions that have been echoed since the cursor was saved; if we have
+    # to back up, these get drawn again
+    @confirmed = ""
+
+    # Whether the remote side has ever echoed one of our predictions
+    @echoes = false
+  end
+
+  # Called with a keystroke; returns what should be drawn on the screen now
+  def keystroke(c)
+    case c
+    when "\r", "\n"
+      # A tty echoes a newline as "\r\n"
+      return predict("\r\n")
+    when "\x7f", "\b"
+      # Only erase characters we drew ourselves; anything else (a prompt, for
+      # example) isn't ours to predict
+      if(@pending.length > 0 && @pending[-1] =~ /[[:print:]]/)
+        return predict("\b \b")
+      end
+    else
+      if(c =~ /\A[[:print:]]\z/)
+        return predict(c)
+      end
+    end
+
+    # Tabs, arrow keys, control characters, etc. are up to the remote side
+    return ""
+  end
+
+  def predict(str)
+    result = str
+
+    # Remember where the predictions start, in case we have to take them back
+    if(@pending == "")
+      result = SAVE_CURSOR + result
+      @confirmed = ""
+    end
+    @pending += str
+
+    return result
+  end
+
+  # Called with data from the remote side; returns what should be drawn on
+  # the screen
+  def reconcile(data)
+    if(@pending == "")
+      return data
+    end
+
+    # Skip over whatever matches our predictions
+    matched = 0
+    while(matched < data.length && matched < @pending.length && data[matched] == @pending[matched])
+      matched += 1
+    end
+
+    if(matched > 0)
+      @echoes = true
+    end
+
+    # Everything matched, so the screen is already right
+    if(matched == data.length)
+      @confirmed += @pending[0, matched]
+      @pending = @pending[matched..-1]
+      return ""
+    end
+
+    # Something different came back, so the remaining predictions are wrong
+    # (or the remote side doesn't echo and they never arrive)
+    @pending = ""
+    if(@echoes)
+      return RESTORE_CURSOR + CLEAR_TO_END + @confirmed + data
+    end
+
+    return data[matched..-1]
+  end
+
+  # Forget everything (for example, when the user detaches)
+  def reset()
+    @pending = ""
+    @confirmed = ""
+  end
+end
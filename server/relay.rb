@@ -0,0 +1,369 @@
+##
+# relay.rb
+# Created October, 2026
+#
+# See: LICENSE.txt
+#
+# Forwards sessions to real TCP connections. Normally the bytes from a
+# session (for example, one of the connections a client accepts with
+# --listen) are only shown in the UI; a relayed session is connected to
+# host:port instead, in both directions. A session is relayed by the 'forward'
+# command, or, if the 'relay_names' setting is on, if its name is
+# "forward:<host>:<port>" (so 'dnscat --listen 8080 --name forward:web:80'
+# turns the client's port 8080 into web:80). That's off by default, since it
+# lets a client connect anywhere the server can; the 'relay_allow' setting
+# can limit it to a list of host:ports.
+#
+# Every relayed connection is handled by a single thread, with IO.select()
+# and nonblocking reads and writes. Data from the destination is only read
+# while the session has less than WINDOW bytes waiting to go out (and the
+# server's memory limit has room for it), so a fast destination can't get
+# ahead of the tunnel; data from the session is
+# written as fast as the destination takes it. If the client half-closes the
+# session (see OPT_HALF_CLOSE), so does the relay, once the destination has
+# everything.
+##
+
+require 'socket'
+
+require 'log'
+require 'memory_stats'
+require 'session_manager'
+
+class Relay
+  # How much data from the destination can be waiting in a session's outgoing
+  # queue; half of the 16-bit sequence space, so the ACKs can't wrap around
+  WINDOW = 0x8000
+
+  # The most we read at once
+  READ_SIZE = 0x1000
+
+  # How often, in seconds, a relay that's held back by the memory limit looks
+  # again (memory freed by other sessions doesn't wake the thread up)
+  MEMORY_RETRY = 1
+
+  # Sessions with names like this are relayed as soon as they're established
+  NAME_PATTERN = /\Aforward:\[?([^\[\]]+)\]?:(\d+)\z/
+
+  @@by_name     = false # Whether NAME_PATTERN sessions are relayed
+  @@allowed     = []    # The host:ports they can go to; empty = anywhere
+
+  @@mutex       = Mutex.new()
+  @@relays      = {} # session id => Relay
+  @@thread      = nil
+  @@wakeup_r    = nil
+  @@wakeup_w    = nil
+
+  attr_reader :session, :host, :port, :state, :bytes_in, :bytes_out
+
+  def initialize(session, host, port)
+    @session   = session
+    @host      = host
+    @port      = port
+    @socket    = nil
+    @state     = :connecting # Then :open, :draining (waiting for the session to catch up), or :closed
+    @to_socket = String.new()
+    @eof       = nil # :pending when the session won't send any more, :sent once the destination knows
+    @bytes_in  = 0 # From the destination
+    @bytes_out = 0 # To the destination
+  end
+
+  # Connect the given session to host:port; returns the Relay
+  def Relay.forward(session, host, port)
+    relay = Relay.new(session, host, port)
+
+    @@mutex.synchronize do
+      if(!@@relays[session.id].nil?)
+        raise(DnscatException, "Session #{session.id} is already being relayed")
+      end
+      @@relays[session.id] = relay
+      start()
+    end
+
+    # Name lookups and connecting can block for a long time, so they get a
+    # thread of their own; it goes away once the socket is handed over to the
+    # reactor
+    Thread.new do
+      relay.connect()
+    end
+
+    return relay
+  end
+
+  def Relay.list()
+    return @@mutex.synchronize { @@relays.values }
+  end
+
+  def Relay.by_name=(on)
+    @@by_name = on
+  end
+
+  # A comma-separated list of host:ports (or nil)
+  def Relay.allowed=(list)
+    @@allowed = list.to_s().split(/\s*,\s*/).reject { |a| a == "" }
+  end
+
+  # SessionManager callbacks
+  def Relay.session_established(id)
+    session = SessionManager.find(id)
+    match = session.nil? ? nil : NAME_PATTERN.match(session.name)
+    if(match.nil?)
+      return
+    end
+
+    destination = "#{match[1]}:#{match[2]}"
+    if(!@@by_name)
+      Log.WARNING(id, "Not relaying session #{id} to #{destination}: relaying by name is off (see the 'relay_names' setting)")
+    elsif(!@@allowed.empty?() && !@@allowed.include?(destination))
+      Log.WARNING(id, "Not relaying session #{id} to #{destination}: it isn't in 'relay_allow'")
+    else
+      Log.PRINT(id, "Relaying session #{id} to #{destination}")
+      Relay.forward(session, match[1], match[2].to_i)
+    end
+  end
+
+  def Relay.session_data_received(id, data)
+    relay = @@mutex.synchronize { @@relays[id] }
+    if(!relay.nil?)
+      relay.queue(data)
+    end
+  end
+
+  # The session has room again, so the destination can be read from
+  def Relay.session_data_acknowledged(id, data)
+    relay = @@mutex.synchronize { @@relays[id] }
+    if(!relay.nil?)
+      relay.acknowledged()
+    end
+  end
+
+  def Relay.session_data_finished(id)
+    relay = @@mutex.synchronize { @@relays[id] }
+    if(!relay.nil?)
+      relay.finished()
+    end
+  end
+
+  def Relay.session_destroyed(id)
+    relay = @@mutex.synchronize { @@relays[id] }
+    if(!relay.nil?)
+      relay.close()
+    end
+  end
+
+  # Has to be called with @@mutex held
+  def Relay.start()
+    if(!@@thread.nil?)
+      return
+    end
+
+    @@wakeup_r, @@wakeup_w = IO.pipe()
+    @@thread = Thread.new do
+      begin
+        Relay.run()
+      rescue => e
+        Log.ERROR(nil, "The relay thread died: #{e}")
+        Log.ERROR(nil, e.backtrace.join("\n"))
+      end
+    end
+  end
+
+  def Relay.wakeup()
+    begin
+      @@wakeup_w.write_nonblock("x")
+    rescue IO::WaitWritable
+      # It's already awake
+    end
+  end
+
+  def Relay.run()
+    loop do
+      readers = { @@wakeup_r => nil }
+      writers = {}
+      timeout = nil
+
+      Relay.list().each do |relay|
+        # Sockets are only closed here, so they're never closed while
+        # select() is watching them
+        if(relay.state == :closed)
+          relay.finish()
+          @@mutex.synchronize { @@relays.delete(relay.session.id) }
+          next
+        end
+
+        if(relay.wants_read?())
+          readers[relay.socket] = relay
+        elsif(relay.state == :open)
+          timeout = MEMORY_RETRY
+        end
+        if(relay.wants_write?())
+          writers[relay.socket] = relay
+        end
+      end
+
+      r, w = IO.select(readers.keys, writers.keys, nil, timeout)
+
+      (w || []).each do |s|
+        writers[s].do_write()
+      end
+
+      (r || []).each do |s|
+        if(s == @@wakeup_r)
+          @@wakeup_r.read_nonblock(READ_SIZE, exception: false)
+        else
+          readers[s].do_read()
+        end
+      end
+    end
+  end
+
+  def socket()
+    return @socket
+  end
+
+  def connect()
+    begin
+      socket = Socket.tcp(@host, @port)
+    rescue SocketError, SystemCallError => e
+      Log.ERROR(@session.id, "Couldn't connect to #{@host}:#{@port}: #{e}")
+      SessionManager.kill_session(@session.id)
+      return
+    end
+
+    @@mutex.synchronize do
+      if(@state == :closed)
+        socket.close()
+        return
+      end
+      @socket = socket
+      @state  = :open
+    end
+
+    Log.PRINT(@session.id, "Connected to #{@host}:#{@port}")
+    Relay.wakeup()
+  end
+
+  def queue(data)
+    @@mutex.synchronize do
+      @to_socket << data.dup().force_encoding("BINARY")
+    end
+    Relay.wakeup()
+  end
+
+  def finished()
+    @@mutex.synchronize do
+      @eof = :pending
+    end
+    Relay.wakeup()
+  end
+
+  def acknowledged()
+    if(@state == :draining && @session.outgoing_length() == 0)
+      SessionManager.kill_session(@session.id)
+    else
+      Relay.wakeup()
+    end
+  end
+
+  def wants_read?()
+    return @state == :open && @session.outgoing_length() < WINDOW && MemoryStats.room?(READ_SIZE)
+  end
+
+  def wants_write?()
+    return !@socket.nil? && @state != :closed && @@mutex.synchronize { @to_socket.bytesize > 0 || @eof == :pending }
+  end
+
+  def do_read()
+    data = nil
+    begin
+      data = @socket.read_nonblock([WINDOW - @session.outgoing_length(), READ_SIZE].min(), exception: false)
+    rescue SystemCallError, IOError => e
+      Log.ERROR(@session.id, "Error reading from #{@host}:#{@port}: #{e}")
+    end
+
+    if(data == :wait_readable)
+      return
+    end
+
+    # The destination closed its side; the session goes away as soon as the
+    # client has everything
+    if(data.nil?)
+      Log.PRINT(@session.id, "Connection to #{@host}:#{@port} closed")
+      @state = :draining
+      acknowledged()
+      return
+    end
+
+    # Dropping the data would leave a hole in the stream, so if it can't be
+    # queued (the memory limit filled up since wants_read?()), give up
+    @bytes_in += data.bytesize
+    if(!@session.queue_outgoing(data))
+      Log.ERROR(@session.id, "Closing the relay to #{@host}:#{@port}: the server is out of memory for it")
+      SessionManager.kill_session(@session.id)
+    end
+  end
+
+  def do_write()
+    # Take the buffer, so more can be queued while we're writing
+    data = @@mutex.synchronize do
+      d = @to_socket
+      @to_socket = String.new()
+      d
+    end
+
+    begin
+      n = @socket.write_nonblock(data, exception: false)
+    rescue SystemCallError, IOError => e
+      Log.ERROR(@session.id, "Error writing to #{@host}:#{@port}: #{e}")
+      SessionManager.kill_session(@session.id)
+      return
+    end
+
+    if(!n.is_a?(Integer))
+      n = 0
+    end
+    @bytes_out += n
+
+    # Put back whatever didn't fit
+    shutdown = @@mutex.synchronize do
+      @to_socket = data.byteslice(n..-1) + @to_socket
+      @eof == :pending && @to_socket.bytesize == 0
+    end
+
+    # Pass the end of the session's data along, so the destination sees EOF
+    if(shutdown)
+      begin
+        @socket.shutdown(Socket::SHUT_WR)
+      rescue SystemCallError, IOError => e
+        Log.ERROR(@session.id, "Error closing the connection to #{@host}:#{@port} for writing: #{e}")
+      end
+      @@mutex.synchronize { @eof = :sent }
+    end
+  end
+
+  # Called when the session goes away; the reactor does the rest
+  def close()
+    @@mutex.synchronize do
+      @state = :closed
+    end
+    Relay.wakeup()
+  end
+
+  def finish()
+    if(!@socket.nil?)
+      # One last try at whatever the session sent before it went away
+      begin
+        @socket.write_nonblock(@to_socket, exception: false)
+      rescue SystemCallError, IOError
+      end
+      @socket.close()
+      @socket = nil
+    end
+
+    Log.PRINT(@session.id, "Stopped relaying to #{@host}:#{@port}: #{@bytes_out} bytes sent, #{@bytes_in} bytes received")
+  end
+
+  def to_s()
+    return "session %d :: %s:%d :: %s :: %d bytes sent, %d bytes received, %d bytes waiting" % [@session.id, @host, @port, @state, @bytes_out, @bytes_in, @to_socket.bytesize]
+  end
+end
@@ -0,0 +1,141 @@
+##
+# resolver_stats.rb
+# Created October, 2026
+#
+# See: LICENSE.txt
+#
+# Counters for each recursive resolver (source address) that DNS queries
+# arrive from, so a slow fleet can be pinned on a particular resolver path:
+# - queries, and how many of them were repeats of a name the same resolver
+#   sent in its last DUP_WINDOW queries (retries, since every dnscat query
+#   is different)
+# - errors (queries we answered with NXDomain)
+# - the number of sessions it's carried
+# - the gaps between its queries, as a log2 histogram (see StageTimer)
+#
+# Usage:
+# ResolverStats.query(transaction.options[:peer], transaction.name, data)
+##
+
+require 'set'
+
+require 'dnscat_exception'
+require 'packet'
+require 'stage_timer'
+
+class ResolverStats
+  # How many recent names we remember for each resolver, to spot retries
+  DUP_WINDOW = 256
+
+  # The most session ids we remember for each resolver; past that, the count
+  # is a lower bound
+  MAX_SESSIONS = 0x10000
+
+  @@mutex     = Mutex.new()
+  @@resolvers = {} # address => stats
+
+  def ResolverStats.reset()
+    @@mutex.synchronize do
+      @@resolvers = {}
+    end
+  end
+
+  def ResolverStats.get(address)
+    return (@@resolvers[address.nil? ? "unknown" : address.to_s()] ||= {
+      :queries    => 0,
+      :duplicates => 0,
+      :errors     => 0,
+      :sessions   => Set.new(),
+      :recent     => {}, # name => true, oldest first
+      :last       => nil,
+      :gaps       => { :count => 0, :total => 0, :max => 0, :buckets => Array.new(StageTimer::BUCKETS, 0) },
+    })
+  end
+
+  # Record a query for 'name', carrying the dnscat packet 'data'
+  def ResolverStats.query(address, name, data)
+    now = StageTimer.now()
+    name = name.to_s().downcase() # Some resolvers randomize the case
+
+    session_id = nil
+    begin
+      session_id = Packet.peek_session_id(data)
+    rescue DnscatException
+      # Too short to have a header; it's still a query
+    end
+
+    @@mutex.synchronize do
+      r = get(address)
+      r[:queries] += 1
+
+      if(r[:recent].delete(name))
+        r[:duplicates] += 1
+      elsif(r[:recent].length >= DUP_WINDOW)
+        r[:recent].delete(r[:recent].first[0])
+      end
+      r[:recent][name] = true
+
+      if(!session_id.nil? && r[:sessions].length < MAX_SESSIONS)
+        r[:sessions] << session_id
+      end
+
+      if(!r[:last].nil?)
+        us = ((now - r[:last]) * 1000000).to_i()
+        g = r[:gaps]
+        g[:count] += 1
+        g[:total] += us
+        g[:max]    = us if(us > g[:max])
+        g[:buckets][StageTimer.bucket(us)] += 1
+      end
+      r[:last] = now
+    end
+  end
+
+  def ResolverStats.error(address)
+    @@mutex.synchronize do
+      get(address)[:errors] += 1
+    end
+  end
+
+  # A copy of the counters, as address => { :queries, :duplicates, :errors,
+  # :sessions (a count), :gaps }, busiest first
+  def ResolverStats.snapshot()
+    result = {}
+    @@mutex.synchronize do
+      @@resolvers.each_pair do |address, r|
+        result[address] = {
+          :queries    => r[:queries],
+          :duplicates => r[:duplicates],
+          :errors     => r[:errors],
+          :sessions   => r[:sessions].length,
+          :gaps       => r[:gaps].merge({ :buckets => r[:gaps][:buckets].dup() }),
+        }
+      end
+    end
+
+    return Hash[result.sort_by { |address, r| -r[:queries] }]
+  end
+
+  # One line per resolver
+  def ResolverStats.to_s()
+    stats = snapshot()
+    if(stats.empty?)
+      return "No DNS queries have been received yet"
+    end
+
+    result = ["%-40s %10s %8s %8s %9s %12s %12s %12s" % ["resolver", "queries", "dup(%)", "errors", "sessions", "gap avg(ms)", "gap p99(ms)", "gap max(ms)"]]
+    stats.each_pair do |address, r|
+      g = r[:gaps]
+      if(g[:count] > 0)
+        gaps = ["%.1f" % (g[:total] / g[:count] / 1000.0), "<%.1f" % (StageTimer.percentile(g, 99) / 1000.0), "%.1f" % (g[:max] / 1000.0)]
+      else
+        gaps = ["-", "-", "-"]
+      end
+
+      duplicates = (r[:queries] == 0) ? 0.0 : (r[:duplicates] * 100.0) / r[:queries]
+      result << "%-40s %10d %8.1f %8d %9d %12s %12s %12s" % ([address, r[:queries], duplicates, r[:errors], r[:sessions]] + gaps)
+    end
+
+    return result.join("\n")
+  end
+end
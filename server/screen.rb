@@ -0,0 +1,110 @@
+##
+# screen.rb
+# Created October, 2026
+#
+# See: LICENSE.txt
+#
+# Keeps a copy of a client's screen for sessions with OPT_SCREEN set. The
+# client sends frames containing only what changed, and this turns them back
+# into a screen and renders it with ANSI escapes. See doc/screen_protocol.txt.
+##
+
+require 'dnscat_exception'
+
+class Screen
+  attr_reader :rows, :cols, :cursor_row
+
+  def initialize()
+    @buffer = ''
+    @lines  = nil
+    @rows   = 0
+    @cols   = 0
+    @cursor_row = 0
+    @cursor_col = 0
+  end
+
+  def blank_line()
+    return " " * @cols
+  end
+
+  # Feed in session data; returns [full_redraw, changed_rows]
+  def feed(data)
+    @buffer += data
+    full = false
+    changed = {}
+
+    loop do
+      if(@buffer.length < 2)
+        break
+      end
+
+      length = @buffer.unpack("n").pop
+      if(@buffer.length < 2 + length)
+        break
+      end
+
+      frame = @buffer[2, length]
+      @buffer = @buffer[(2 + length)..-1]
+
+      if(frame.length < 6)
+        raise(DnscatException, "Screen frame is too short")
+      end
+
+      rows, cols, @cursor_row, @cursor_col, scroll, count = frame.unpack("CCCCCC")
+      frame = frame[6..-1]
+
+      # The first frame (or a resize) sets up the screen
+      if(@lines.nil? || rows != @rows || cols != @cols)
+        @rows = rows
+        @cols = cols
+        @lines = Array.new(@rows) { blank_line() }
+        full = true
+      end
+
+      if(scroll > 0)
+        @lines.shift(scroll)
+        @lines.concat(Array.new([scroll, @rows].min) { blank_line() })
+        full = true
+      end
+
+      count.times do
+        if(frame.length < 3)
+          raise(DnscatException, "Screen frame span is truncated")
+        end
+
+        row, col, span_length = frame.unpack("CCC")
+        text = frame[3, span_length]
+        frame = frame[(3 + span_length)..-1] || ''
+
+        if(row >= @rows || col + span_length > @cols || text.length != span_length)
+          raise(DnscatException, "Screen frame span is out of bounds")
+        end
+
+        @lines[row][col, span_length] = text
+        changed[row] = true
+      end
+    end
+
+    return full, changed.keys.sort()
+  end
+
+  # Get the ANSI string to draw the given rows (or everything)
+  def render(full, rows = [])
+    if(@lines.nil?)
+      return ""
+    end
+
+    result = ""
+    if(full)
+      result += "\e[H\e[2J"
+      rows = 0.upto(@rows - 1)
+    end
+
+    rows.each do |row|
+      result += "\e[%d;1H%s\e[K" % [row + 1, @lines[row].rstrip()]
+    end
+    result += "\e[%d;%dH" % [@cursor_row + 1, @cursor_col + 1]
+
+    return result
+  end
+end
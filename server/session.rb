@@ -8,7 +8,11 @@
 ##
 
 require 'dnscat_exception'
+require 'flight_recorder'
+require 'fountain'
 require 'log'
+require 'memory_stats'
+require 'outgoing_queue'
 require 'packet'
 require 'subscribable'
 
@@ -21,21 +25,38 @@ class Session
   attr_reader :name
   attr_reader :options
   attr_reader :is_command
+  attr_reader :is_screen
+  attr_reader :their_eof
 
   # Session states
   STATE_NEW         = 0x00
   STATE_ESTABLISHED = 0x01
   STATE_KILLED      = 0xFF
 
-  # These two methods are required for test.rb to work
+  # How far past the first missing chunk an upload chunk can be (this limits
+  # how much we have to hold in memory)
+  MAX_UPLOAD_AHEAD  = 1024
+
+  # The next response for each session is built and encoded on this thread
+  # ahead of time (see prepare()), so answering a poll is usually just a
+  # check that nothing changed
+  @@prepare_mutex  = Mutex.new()
+  @@prepare_queue  = Queue.new()
+  @@preparer       = nil
+  @@prepared_used  = 0
+  @@prepared_built = 0
+
+  # Chunked uploads are only taken for the names the operator asked for (with
+  # 'exec --upload'), and are written under @@upload_dir
+  @@upload_mutex   = Mutex.new()
+  @@upload_expect  = {} # name => how many uploads by that name we asked for
+  @@upload_dir     = "uploads"
+
+  # For the 'isn' setting, when debugging
   def Session.debug_set_isn(n)
     Log.FATAL(nil, "Using debug code")
     @@isn = n
   end
-  def debug_set_seq(n)
-    Log.FATAL(@id, "Using debug code")
-    @my_seq = n
-  end
 
   def initialize(id)
     @id = id
@@ -44,11 +65,27 @@ class Session
     @my_seq    = @@isn.nil? ? rand(0xFFFF) : @@isn
     @options = 0
     @is_command = false
+    @is_screen = false
+    @their_eof = false
 
     @incoming_data = ''
-    @outgoing_data = ''
+    @outgoing_data = OutgoingQueue.new()
     @name = ''
 
+    # What prepare() needs to guess the next MSG: the bytes acknowledged so
+    # far, the bytes in the last MSG we sent (which the next one should
+    # acknowledge), the last max_length, and a count of pushes (so a short
+    # response can tell that more data has come since)
+    @mutex          = Mutex.new()
+    @acked_bytes    = 0
+    @in_flight      = 0
+    @last_max_length = nil
+    @pushes         = 0
+    @prepared       = nil
+    @prepare_queued = false
+
+    @upload_file = nil
+
     initialize_subscribables()
     notify_subscribers(:session_created, [@id])
   end
@@ -59,6 +96,16 @@ class Session
 
       @state = STATE_KILLED
     end
+
+    # Let go of any payloads we were holding on to
+    @mutex.synchronize do
+      @outgoing_data.clear()
+      @prepared = nil
+    end
+    MemoryStats.set(@id, :outgoing, 0)
+    @fountain = nil
+
+    finish_upload()
   end
 
   def syn_valid?()
@@ -74,47 +121,93 @@ class Session
   end
 
   def next_outgoing(n)
-    ret = @outgoing_data[0,n]
+    ret = @outgoing_data.peek(n)
     notify_subscribers(:session_data_sent, [@id, ret])
     return ret
   end
 
   def ack_outgoing(n)
-    # "n" is the current ACK value
-    bytes_acked = (n - @my_seq)
+    # "n" is the current ACK value (the mask handles wraparounds)
+    bytes_acked = (n - @my_seq) & Packet.seq_mask(@options)
 
-    # Handle wraparounds properly
-    if(bytes_acked < 0)
-      bytes_acked += 0x10000
+    if(bytes_acked > 0)
+      notify_subscribers(:session_data_acknowledged, [@id, @outgoing_data.peek(bytes_acked)])
     end
 
-    if(bytes_acked > 0)
-      notify_subscribers(:session_data_acknowledged, [@id, @outgoing_data[0..(bytes_acked-1)]])
+    @mutex.synchronize do
+      @outgoing_data.consume(bytes_acked)
+      @acked_bytes += bytes_acked
+      @my_seq = n
     end
 
-    @outgoing_data = @outgoing_data[bytes_acked..-1]
-    @my_seq = n
+    if(bytes_acked > 0)
+      MemoryStats.set(@id, :outgoing, @outgoing_data.length)
+      FlightRecorder.record(FlightRecorder::EVENT_WINDOW, 0, @id, @my_seq, @their_seq, @outgoing_data.length)
+    end
   end
 
   def valid_ack?(ack)
-    bytes_acked = (ack - @my_seq) & 0xFFFF
+    bytes_acked = (ack - @my_seq) & Packet.seq_mask(@options)
     return bytes_acked <= @outgoing_data.length
   end
 
+  # The number of bytes queued that haven't been acknowledged yet
+  def outgoing_length()
+    return @outgoing_data.length
+  end
+
+  # 'data' can be a String or a Payload (payloads are shared, not copied), or
+  # an Array of them to queue all or nothing. Returns false, and queues
+  # nothing, if it would go over the memory limit.
   def queue_outgoing(data)
-    @outgoing_data = @outgoing_data + data
-    notify_subscribers(:session_data_queued, [@id, data])
+    data = [data].flatten()
+
+    # A payload that's already queued somewhere doesn't cost anything more
+    needed = data.inject(0) do |sum, d|
+      sum + (!d.is_a?(Payload) ? d.bytesize : (d.refs > 0) ? 0 : d.length())
+    end
+    if(!MemoryStats.room?(needed))
+      Log.ERROR(@id, "Not queueing #{needed} bytes: that would go over the memory limit (#{MemoryStats.format(MemoryStats.limit)})")
+      return false
+    end
+
+    @mutex.synchronize do
+      data.each do |d|
+        @outgoing_data.push(d)
+      end
+      @pushes += 1
+    end
+    MemoryStats.set(@id, :outgoing, @outgoing_data.length)
+    prepare_later()
+    FlightRecorder.record(FlightRecorder::EVENT_WINDOW, 0, @id, @my_seq, @their_seq, @outgoing_data.length)
+
+    data.each do |d|
+      notify_subscribers(:session_data_queued, [@id, d.is_a?(Payload) ? d.data : d])
+    end
+
+    return true
   end
 
   def to_s()
-    return "id: 0x%04x, state: %d, their_seq: 0x%04x, my_seq: 0x%04x, incoming_data: %d bytes [%s], outgoing data: %d bytes [%s]" % [@id, @state, @their_seq, @my_seq, @incoming_data.length, @incoming_data, @outgoing_data.length, @outgoing_data]
+    return "id: 0x%04x, state: %d, their_seq: 0x%04x, my_seq: 0x%04x, incoming_data: %d bytes [%s], outgoing data: %d bytes [%s]" % [@id, @state, @their_seq, @my_seq, @incoming_data.length, @incoming_data, @outgoing_data.length, @outgoing_data.peek(@outgoing_data.length)]
   end
 
   def handle_syn(packet)
-    # Ignore errant SYNs - they are, at worst, retransmissions that we don't care about
     if(!syn_valid?())
-      notify_subscribers(:dnscat2_session_error, [@id, "SYN received in invalid state"])
-      return nil
+      # A SYN with the same ISN is a retransmission (our reply was lost), so
+      # answer it again
+      if(packet.body.seq == @their_isn)
+        return syn_reply()
+      end
+
+      # Anything else is a different client that picked the same session id;
+      # tell it to pick another one
+      FlightRecorder.record(FlightRecorder::EVENT_DROP, FlightRecorder::DROP_UNEXPECTED, @id, packet.body.seq)
+      notify_subscribers(:dnscat2_session_error, [@id, "SYN received for an existing session (session id collision)"])
+      return Packet.create_fin(0, {
+        :session_id => @id,
+        :reason     => Packet::FIN_REASON_COLLISION,
+      })
     end
 
     if(@state == STATE_KILLED)
@@ -126,6 +219,7 @@ class Session
 
     # Save some of their options
     @their_seq = packet.body.seq
+    @their_isn = packet.body.seq
     @name      = packet.body.name
     @options   = packet.body.options
 
@@ -139,17 +233,87 @@ class Session
       })
     end
 
+    if((@options & Packet::OPT_FOUNTAIN) == Packet::OPT_FOUNTAIN &&
+       (@options & (Packet::OPT_DOWNLOAD | Packet::OPT_CHUNKED_DOWNLOAD)) != Packet::OPT_DOWNLOAD)
+      notify_subscribers(:dnscat2_session_error, [@id, "Error in client options: OPT_FOUNTAIN needs OPT_DOWNLOAD (and not OPT_CHUNKED_DOWNLOAD)"])
+      return Packet.create_fin(@options, {
+        :session_id => @id,
+        :reason     => "ERROR: OPT_FOUNTAIN needs OPT_DOWNLOAD (and not OPT_CHUNKED_DOWNLOAD)",
+      })
+    end
+
+    if((@options & Packet::OPT_CHUNKED_UPLOAD) == Packet::OPT_CHUNKED_UPLOAD)
+      if((@options & (Packet::OPT_DOWNLOAD | Packet::OPT_CHUNKED_DOWNLOAD | Packet::OPT_FOUNTAIN)) != 0)
+        notify_subscribers(:dnscat2_session_error, [@id, "Error in client options: OPT_CHUNKED_UPLOAD set with a download"])
+        return Packet.create_fin(@options, {
+          :session_id => @id,
+          :reason     => "ERROR: OPT_CHUNKED_UPLOAD can't be used with a download",
+        })
+      end
+
+      if(!Session.claim_upload(packet.body.upload))
+        notify_subscribers(:dnscat2_session_error, [@id, "Client tried to upload a file we didn't ask for: #{packet.body.upload}"])
+        return Packet.create_fin(@options, {
+          :session_id => @id,
+          :reason     => "ERROR: No upload was requested with that name",
+        })
+      end
+
+      begin
+        # Never overwrite anything; an upload always makes a new file
+        if(!File.directory?(@@upload_dir))
+          Dir.mkdir(@@upload_dir, 0700)
+        end
+        @upload_filename = File.join(@@upload_dir, packet.body.upload)
+        @upload_file     = File.open(@upload_filename, File::WRONLY | File::CREAT | File::EXCL | File::BINARY, 0600)
+      rescue Exception => e
+        Log.ERROR(@id, "Couldn't open the upload file: #{packet.body.upload}")
+        Log.ERROR(@id, e.to_s())
+
+        return Packet.create_fin(@options, {
+          :session_id => @id,
+          :reason     => "ERROR: File couldn't be written: #{e.inspect}",
+        })
+      end
+
+      # Chunks that arrived before the ones in front of them, by number
+      @upload_chunks = {}
+      @upload_held   = 0 # The bytes in @upload_chunks
+      @upload_next   = 0
+      @upload_length = 0
+
+      Log.PRINT(@id, "Receiving an upload: #{@upload_filename}")
+    end
+
     if((@options & Packet::OPT_COMMAND) == Packet::OPT_COMMAND)
       @is_command = true
     end
 
+    if((@options & Packet::OPT_SCREEN) == Packet::OPT_SCREEN)
+      @is_screen = true
+    end
+
+    # Half-closing and wide sequence numbers only mean something for a normal
+    # stream
+    if((@options & Packet::OPT_CHUNKED) != 0)
+      @options &= ~(Packet::OPT_HALF_CLOSE | Packet::OPT_WIDE_SEQ)
+    end
+
     # TODO: Allowing any arbitrary file is a security risk
     if(!packet.body.download.nil?)
       begin
         @filename = packet.body.download
-        File.open(@filename, 'rb') do |f|
+        queued = File.open(@filename, 'rb') do |f|
           queue_outgoing(f.read())
         end
+
+        if(!queued)
+          notify_subscribers(:dnscat2_session_error, [@id, "Not enough memory to send #{packet.body.download}"])
+          return Packet.create_fin(@options, {
+            :session_id => @id,
+            :reason     => "ERROR: The server is out of memory (see 'stats memory')",
+          })
+        end
       rescue Exception => e
         Log.ERROR(@id, "Client requested a bad file: #{packet.body.download}")
         Log.ERROR(@id, e.to_s())
@@ -168,24 +332,35 @@ class Session
     # Notify subscribers that the syn has come (TODO: I doubt we need this)
     notify_subscribers(:dnscat2_syn_received, [@id, @my_seq, packet.body.seq])
 
-    return Packet.create_syn(0, {
+    return syn_reply()
+  end
+
+  def syn_reply()
+    # The client uses our options to parse MSGs, so echo the chunked modes we
+    # agreed to, whether we'll keep a half-closed session open, and whether
+    # SEQ/ACK are 32 bits (the other options don't matter coming from the
+    # server)
+    return Packet.create_syn(@options & (Packet::OPT_CHUNKED | Packet::OPT_HALF_CLOSE | Packet::OPT_WIDE_SEQ), {
       :session_id => @id,
       :seq        => @my_seq,
-      :options    => 0, # TODO: I haven't paid much attention to what the server puts in its options field
     })
   end
 
   def actual_msg_max_length(max_data_length)
-    return max_data_length - (Packet.header_size(@options) + Packet::MsgBody.header_size(@options))
+    # The options are settled by the time there are MSGs
+    @msg_overhead ||= Packet.header_size(@options, @id) + Packet::MsgBody.header_size(@options)
+    return max_data_length - @msg_overhead
   end
 
   def handle_msg_normal(packet, max_length)
     # Validate the sequence number
     if(@their_seq != packet.body.seq)
       notify_subscribers(:dnscat2_session_error, [@id, "Bad sequence number on incoming packet: expected 0x%04x, received 0x%04x" % [@their_seq, packet.body.seq]])
+      FlightRecorder.record(FlightRecorder::EVENT_DROP, FlightRecorder::DROP_BAD_SEQ, @id, packet.body.seq, packet.body.ack, packet.body.data.length)
 
       # Re-send the last packet
       old_data = next_outgoing(actual_msg_max_length(max_length))
+      FlightRecorder.record(FlightRecorder::EVENT_RETRANSMIT, Packet::MESSAGE_TYPE_MSG, @id, @my_seq, @their_seq, old_data.length)
       return Packet.create_msg(@options, {
         :session_id => @id,
         :data       => old_data,
@@ -196,10 +371,12 @@ class Session
 
     # Validate the acknowledgement number
     if(!valid_ack?(packet.body.ack))
-      notify_subscribers(:dnscat2_session_error, [@id, "Bad acknowledgement number: expected 0x%04x, received 0x%04x" % [@my_seq, packet.ack]])
+      notify_subscribers(:dnscat2_session_error, [@id, "Bad acknowledgement number: expected 0x%04x, received 0x%04x" % [@my_seq, packet.body.ack]])
+      FlightRecorder.record(FlightRecorder::EVENT_DROP, FlightRecorder::DROP_BAD_ACK, @id, packet.body.seq, packet.body.ack, packet.body.data.length)
 
       # Re-send the last packet
       old_data = next_outgoing(actual_msg_max_length(max_length))
+      FlightRecorder.record(FlightRecorder::EVENT_RETRANSMIT, Packet::MESSAGE_TYPE_MSG, @id, @my_seq, @their_seq, old_data.length)
       return Packet.create_msg(@options, {
         :session_id => @id,
         :data       => old_data,
@@ -214,44 +391,259 @@ class Session
 
     # Write the incoming data to the session
     # Increment the expected sequence number
-    @their_seq = (@their_seq + packet.body.data.length) & 0xFFFF;
+    @mutex.synchronize do
+      @their_seq = (@their_seq + packet.body.data.length) & Packet.seq_mask(@options)
+    end
 
     # Let everybody know that data has arrived
     if(packet.body.data.length > 0)
       notify_subscribers(:session_data_received, [@id, packet.body.data])
     end
 
-    # Read the next piece of data
-    new_data = next_outgoing(actual_msg_max_length(max_length))
+    # Use the prepared response if it's the one we'd build now
+    prepared = @prepared
+    if(!prepared.nil? && prepared[:position] == @acked_bytes && prepared[:ack] == @their_seq && prepared[:max_length] == max_length && (prepared[:full] || prepared[:pushes] == @pushes))
+      packet = prepared[:packet]
+      notify_subscribers(:session_data_sent, [@id, packet.body.data])
+      @@prepared_used += 1
+    else
+      # Read the next piece of data
+      new_data = next_outgoing(actual_msg_max_length(max_length))
 
-    # Create a packet out of it
-    packet = Packet.create_msg(@options, {
-      :session_id => @id,
-      :data       => new_data,
-      :seq        => @my_seq,
-      :ack        => @their_seq,
-    })
+      # Create a packet out of it
+      packet = Packet.create_msg(@options, {
+        :session_id => @id,
+        :data       => new_data,
+        :seq        => @my_seq,
+        :ack        => @their_seq,
+      })
+      @@prepared_built += 1
+    end
+
+    @mutex.synchronize do
+      @in_flight       = packet.body.data.bytesize
+      @last_max_length = max_length
+      @prepared        = nil
+    end
+    prepare_later()
 
     return packet
   end
 
+  # Build and encode the MSG we'd send if the client acknowledged everything
+  # in flight and sent nothing; handle_msg_normal() uses it if that's what
+  # happens. This runs on the preparer thread, so nothing it reads can change
+  # till it's done.
+  def prepare()
+    @@prepare_mutex.synchronize do
+      @prepare_queued = false
+    end
+
+    @mutex.synchronize do
+      if(@state != STATE_ESTABLISHED || (@options & Packet::OPT_CHUNKED) != 0 || @last_max_length.nil?)
+        return
+      end
+
+      n    = actual_msg_max_length(@last_max_length)
+      data = @outgoing_data.peek(n, @in_flight)
+
+      packet = Packet.create_msg(@options, {
+        :session_id => @id,
+        :data       => data,
+        :seq        => (@my_seq + @in_flight) & Packet.seq_mask(@options),
+        :ack        => @their_seq,
+      })
+      packet.to_bytes()
+
+      @prepared = {
+        :packet     => packet,
+        :position   => @acked_bytes + @in_flight,
+        :ack        => @their_seq,
+        :max_length => @last_max_length,
+        :pushes     => @pushes,
+        :full       => data.bytesize >= n,
+      }
+    end
+  end
+
+  # Have prepare() called on the preparer thread, unless it already will be
+  def prepare_later()
+    @@prepare_mutex.synchronize do
+      if(@prepare_queued)
+        return
+      end
+      @prepare_queued = true
+
+      @@preparer ||= Thread.new do
+        loop do
+          begin
+            @@prepare_queue.pop().prepare()
+          rescue StandardError => e
+            Log.ERROR(nil, "Couldn't prepare a response: #{e}")
+          end
+        end
+      end
+    end
+
+    @@prepare_queue << self
+  end
+
+  # Where chunked uploads are written
+  def Session.upload_dir=(dir)
+    @@upload_dir = dir
+  end
+
+  def Session.upload_dir()
+    return @@upload_dir
+  end
+
+  # Called when the operator asks a client for a chunked upload; returns the
+  # name the upload has to use (the last part of 'name'), or nil if there's
+  # nothing left of it
+  def Session.expect_upload(name)
+    name = File.basename(name.to_s())
+    if(name == "" || name == "." || name == ".." || name == "/")
+      return nil
+    end
+
+    @@upload_mutex.synchronize do
+      @@upload_expect[name] = (@@upload_expect[name] || 0) + 1
+    end
+
+    return name
+  end
+
+  # Takes one of the expected uploads called 'name', if there is one
+  def Session.claim_upload(name)
+    name = name.to_s()
+
+    @@upload_mutex.synchronize do
+      count = @@upload_expect[name]
+      if(count.nil?)
+        return false
+      end
+
+      if(count > 1)
+        @@upload_expect[name] = count - 1
+      else
+        @@upload_expect.delete(name)
+      end
+
+      return true
+    end
+  end
+
+  # How many responses to a MSG were prepared ahead of time, and how many had
+  # to be built when the MSG came in
+  def Session.prepared_stats()
+    return { :used => @@prepared_used, :built => @@prepared_built }
+  end
+
   def handle_msg_chunked(packet, max_length)
-    chunks = @outgoing_data.scan(/.{16}/m)
+    chunk = @outgoing_data.peek(16, packet.body.chunk * 16)
 
-    if(chunks[packet.body.chunk].nil?)
+    if(chunk == '')
+      FlightRecorder.record(FlightRecorder::EVENT_DROP, FlightRecorder::DROP_BAD_CHUNK, @id, packet.body.chunk)
       return Packet.create_fin(@options, {
         :session_id => @id,
         :reason => "Chunk doesn't exist!",
       })
     end
 
-    chunk = chunks[packet.body.chunk]
+    return Packet.create_msg(@options, {
+      :session_id => @id,
+      :chunk      => packet.body.chunk,
+      :data       => chunk,
+    })
+  end
+
+  # The client asks for symbols by number, and never asks for the same one
+  # twice; the encoder is created on the first request, since the symbol size
+  # depends on how much fits in a packet
+  def handle_msg_fountain(packet, max_length)
+    block_size = actual_msg_max_length(max_length) - Fountain::HEADER_SIZE
+
+    if(block_size < 1 || (!@fountain.nil? && block_size < @fountain.block_size))
+      return Packet.create_fin(@options, {
+        :session_id => @id,
+        :reason     => "Packets are too small for the fountain-coded download",
+      })
+    end
+
+    if(@fountain.nil?)
+      @fountain = Fountain.new(@outgoing_data.peek(@outgoing_data.length), block_size)
+
+      if(@fountain.block_count > Fountain::MAX_BLOCKS)
+        Log.ERROR(@id, "#{@filename} is too big for a fountain-coded download (#{@fountain.block_count} blocks)")
+        return Packet.create_fin(@options, {
+          :session_id => @id,
+          :reason     => "File is too big for a fountain-coded download",
+        })
+      end
+    end
+
+    return Packet.create_msg(@options, {
+      :session_id => @id,
+      :chunk      => packet.body.chunk,
+      :data       => @fountain.symbol(packet.body.chunk),
+    })
+  end
+
+  # Upload chunks can arrive in any order, and more than once. Each one is
+  # acknowledged by echoing its number, and the file is written as soon as
+  # there are no gaps in front of it.
+  def handle_msg_upload(packet, max_length)
+    chunk = packet.body.chunk
+
+    if(chunk >= @upload_next + MAX_UPLOAD_AHEAD)
+      FlightRecorder.record(FlightRecorder::EVENT_DROP, FlightRecorder::DROP_BAD_CHUNK, @id, chunk, @upload_next, packet.body.data.length)
+      return Packet.create_fin(@options, {
+        :session_id => @id,
+        :reason     => "Upload chunk is too far ahead!",
+      })
+    end
+
+    # Anything below @upload_next (or already waiting) is a retransmission
+    if(chunk >= @upload_next && @upload_chunks[chunk].nil?)
+      @upload_chunks[chunk] = packet.body.data
+      @upload_held += packet.body.data.bytesize
+
+      while(!(data = @upload_chunks.delete(@upload_next)).nil?)
+        @upload_file.write(data)
+        @upload_held   -= data.bytesize
+        @upload_length += data.length
+        @upload_next   += 1
+      end
+      MemoryStats.set(@id, :upload, @upload_held)
+
+      FlightRecorder.record(FlightRecorder::EVENT_WINDOW, 0, @id, @upload_next, chunk, @upload_chunks.length)
+    end
+
     return Packet.create_msg(@options, {
       :session_id => @id,
       :chunk      => chunk,
+      :data       => '',
     })
   end
 
+  def finish_upload()
+    if(@upload_file.nil?)
+      return
+    end
+
+    @upload_file.close()
+    @upload_file = nil
+
+    if(@upload_chunks.length > 0)
+      Log.WARNING(@id, "Upload of #{@upload_filename} was incomplete: wrote #{@upload_length} bytes, but #{@upload_chunks.length} chunks after chunk #{@upload_next} were never written")
+    else
+      Log.PRINT(@id, "Upload complete: wrote #{@upload_length} bytes to #{@upload_filename}")
+    end
+
+    @upload_chunks = {}
+    MemoryStats.set(@id, :upload, 0)
+  end
+
   def handle_msg(packet, max_length)
     if(!msg_valid?())
       notify_subscribers(:dnscat2_session_error, [@id, "MSG received in invalid state; sending FIN"])
@@ -272,7 +664,11 @@ class Session
       })
     end
 
-    if((@options & Packet::OPT_CHUNKED_DOWNLOAD) == Packet::OPT_CHUNKED_DOWNLOAD)
+    if((@options & Packet::OPT_CHUNKED_UPLOAD) == Packet::OPT_CHUNKED_UPLOAD)
+      return handle_msg_upload(packet, max_length)
+    elsif((@options & Packet::OPT_FOUNTAIN) == Packet::OPT_FOUNTAIN)
+      return handle_msg_fountain(packet, max_length)
+    elsif((@options & Packet::OPT_CHUNKED_DOWNLOAD) == Packet::OPT_CHUNKED_DOWNLOAD)
       return handle_msg_chunked(packet, max_length)
     else
       return handle_msg_normal(packet, max_length)
@@ -282,7 +678,36 @@ class Session
     #notify_subscribers(:dnscat2_msg, [packet.data, new_data])
   end
 
-  def handle_fin(packet)
+  # With OPT_HALF_CLOSE, the client is done sending but still wants our data.
+  # The FIN counts as one byte, so the client can tell when we've seen it. A
+  # FIN doesn't acknowledge any of our data, so the reply doesn't carry any;
+  # the client goes back to MSGs once it has the ACK (a retransmitted FIN gets
+  # the same reply).
+  def handle_eof(packet, max_length)
+    if(!@their_eof)
+      @their_eof = true
+      @mutex.synchronize do
+        @their_seq = (@their_seq + 1) & Packet.seq_mask(@options)
+      end
+      notify_subscribers(:session_data_finished, [@id])
+    end
+
+    # The reply doesn't carry any data
+    @mutex.synchronize do
+      @in_flight = 0
+      @prepared  = nil
+    end
+    prepare_later()
+
+    return Packet.create_msg(@options, {
+      :session_id => @id,
+      :data       => '',
+      :seq        => @my_seq,
+      :ack        => @their_seq,
+    })
+  end
+
+  def handle_fin(packet, max_length)
     # Ignore errant FINs - if we respond to a FIN with a FIN, it would cause a potential infinite loop
     if(!fin_valid?())
       notify_subscribers(:dnscat2_session_error, [@id, "FIN received in invalid state"])
@@ -293,6 +718,10 @@ class Session
       })
     end
 
+    if(@state == STATE_ESTABLISHED && (@options & Packet::OPT_HALF_CLOSE) == Packet::OPT_HALF_CLOSE && packet.body.reason == Packet::FIN_REASON_EOF)
+      return handle_eof(packet, max_length)
+    end
+
     notify_subscribers(:dnscat2_fin, [@id, packet.body.reason])
     SessionManager.kill_session(@id)
 
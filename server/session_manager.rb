@@ -9,13 +9,18 @@
 ##
 
 require 'dnscat_exception'
+require 'flight_recorder'
 require 'log'
 require 'packet'
 require 'subscribable'
 require 'session'
+require 'stage_timer'
 
 class SessionManager
   @@subscribers = []
+
+  # Indexed by session id (16- or 32-bit); killed sessions are removed, so this
+  # only grows with the number of live sessions
   @@sessions = {}
 
   def SessionManager.create_session(id)
@@ -46,6 +51,9 @@ class SessionManager
     if(!session.nil?)
       session.notify_subscribers(:session_destroyed, [id])
       session.kill()
+
+      # Any more packets for it get a FIN, and the id can be used again
+      @@sessions.delete(id)
     end
   end
 
@@ -74,6 +82,7 @@ class SessionManager
       err = "MSG received in non-existent session: %d" % packet.session_id
 
       Log.ERROR(packet.session_id, err)
+      FlightRecorder.record(FlightRecorder::EVENT_DROP, FlightRecorder::DROP_NO_SESSION, packet.session_id, 0, 0, packet.body.data.length)
       return Packet.create_fin(0, {
         :session_id => packet.session_id,
         :reason     => err,
@@ -83,7 +92,7 @@ class SessionManager
     return session.handle_msg(packet, max_length)
   end
 
-  def SessionManager.handle_fin(packet)
+  def SessionManager.handle_fin(packet, max_length)
     session = find(packet.session_id)
 
     if(session.nil?)
@@ -96,7 +105,7 @@ class SessionManager
       })
     end
 
-    return session.handle_fin(packet)
+    return session.handle_fin(packet, max_length)
   end
 
   def SessionManager.handle_ping(packet)
@@ -114,8 +123,15 @@ class SessionManager
         options = session.nil? ? 0 : session.options
 
         # Parse the packet
-        packet = Packet.parse(data, options)
-
+        begin
+          packet = StageTimer.time(:parse) do
+            Packet.parse(data, options)
+          end
+        rescue DnscatException => e
+          FlightRecorder.record(FlightRecorder::EVENT_DROP, FlightRecorder::DROP_PARSE_ERROR, session_id, 0, 0, data.length)
+          raise(e)
+        end
+        FlightRecorder.record_packet(FlightRecorder::EVENT_PACKET_IN, packet)
 
         # Poke everybody else to let the know we're still seeing packets
         # TODO: Do I care?
@@ -123,6 +139,8 @@ class SessionManager
           session.notify_subscribers(:session_heartbeat, [session_id])
         end
 
+        handle_start = StageTimer.now()
+
         response = nil
         if(packet.type == Packet::MESSAGE_TYPE_SYN)
           response = handle_syn(packet)
@@ -139,18 +157,25 @@ class SessionManager
         elsif(packet.type == Packet::MESSAGE_TYPE_MSG)
           response = handle_msg(packet, max_length)
         elsif(packet.type == Packet::MESSAGE_TYPE_FIN)
-          response = handle_fin(packet)
+          response = handle_fin(packet, max_length)
         elsif(packet.type == Packet::MESSAGE_TYPE_PING)
           response = handle_ping(packet)
         else
           raise(DnscatException, "Unknown packet type: #{packet.type}")
         end
 
+        StageTimer.add(:handle, StageTimer.now() - handle_start)
 
-        # If there's a response, validate it
+        # If there's a response, validate it (a prepared one is already
+        # encoded, so this is free)
+        bytes = nil
         if(!response.nil?)
-          if(response.to_bytes().length > max_length)
-            raise(DnscatException, "Tried to send packet of #{response.length} bytes, but max_length is #{max_length} bytes")
+          bytes = StageTimer.time(:serialize) do
+            response.to_bytes()
+          end
+
+          if(bytes.length > max_length)
+            raise(DnscatException, "Tried to send packet of #{bytes.length} bytes, but max_length is #{max_length} bytes")
           end
         end
 
@@ -162,7 +187,8 @@ class SessionManager
         if(response.nil?)
           nil
         else
-          response.to_bytes() # Return it, in a way
+          FlightRecorder.record_packet(FlightRecorder::EVENT_PACKET_OUT, response)
+          bytes # Return it, in a way
         end
 
       # Catch IOErrors, but don't destroy the session - it may continue later
@@ -175,6 +201,15 @@ class SessionManager
       rescue Exception => e
         Log.ERROR(session_id, e)
 
+        # Save the recent history for a post-mortem
+        begin
+          if(!FlightRecorder.dump().nil?)
+            Log.ERROR(session_id, "Flight recorder written to #{FlightRecorder.file}")
+          end
+        rescue => e2
+          Log.ERROR(session_id, "Couldn't write the flight recorder: #{e2}")
+        end
+
         begin
           if(!session_id.nil?)
             Log.ERROR(session_id, "DnscatException caught; closing session #{session_id}...")
@@ -0,0 +1,161 @@
+##
+# stage_timer.rb
+# Created October, 2026
+#
+# See: LICENSE.txt
+#
+# Times the stages of the request path (name parsing, decoding, packet
+# parsing, session handling, subscriber notification, encoding, and
+# responding) with the monotonic clock, and keeps a log2 histogram of each.
+#
+# Usage:
+# StageTimer.time(:parse) do
+#   packet = Packet.parse(data, options)
+# end
+##
+
+require 'log'
+
+class StageTimer
+  # The stages, in the order they happen. :total is the whole DNS request.
+  STAGES = [ :total, :figure_out_name, :decode, :parse, :handle, :notify, :serialize, :encode, :respond ]
+
+  # Bucket 0 is <1us, bucket n is [2^(n-1), 2^n) microseconds; the last bucket
+  # catches everything slower.
+  BUCKETS = 24
+
+  @@mutex       = Mutex.new()
+  @@stats       = {}
+  @@interval    = 0 # Seconds between log lines; 0 = never
+  @@last_report = nil
+
+  def StageTimer.now()
+    return Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  end
+
+  def StageTimer.reset()
+    @@mutex.synchronize do
+      @@stats = {}
+    end
+  end
+
+  def StageTimer.interval=(seconds)
+    @@interval = seconds.to_i()
+    @@last_report = now()
+  end
+
+  def StageTimer.bucket(us)
+    b = 0
+    while(us >= 1 && b < BUCKETS - 1)
+      us = us >> 1
+      b += 1
+    end
+
+    return b
+  end
+
+  def StageTimer.add(stage, seconds)
+    us = (seconds * 1000000).to_i()
+
+    @@mutex.synchronize do
+      s = (@@stats[stage] ||= { :count => 0, :total => 0, :max => 0, :buckets => Array.new(BUCKETS, 0) })
+      s[:count] += 1
+      s[:total] += us
+      s[:max]    = us if(us > s[:max])
+      s[:buckets][bucket(us)] += 1
+    end
+  end
+
+  # Time the given block as the given stage, and return the block's result
+  def StageTimer.time(stage)
+    start = now()
+    begin
+      return yield
+    ensure
+      add(stage, now() - start)
+    end
+  end
+
+  # The upper bound of the bucket containing the given percentile, in us
+  def StageTimer.percentile(s, pct)
+    target = (s[:count] * pct / 100.0).ceil()
+    seen = 0
+
+    s[:buckets].each_with_index do |n, b|
+      seen += n
+      if(seen >= target)
+        return (b == BUCKETS - 1) ? s[:max] : (1 << b)
+      end
+    end
+
+    return s[:max]
+  end
+
+  def StageTimer.snapshot()
+    result = {}
+    @@mutex.synchronize do
+      @@stats.each_pair do |stage, s|
+        result[stage] = s.merge({ :buckets => s[:buckets].dup() })
+      end
+    end
+
+    return result
+  end
+
+  # One line per stage
+  def StageTimer.to_s()
+    stats = snapshot()
+    if(stats.empty?)
+      return "No requests have been timed yet"
+    end
+
+    result = ["%-16s %10s %10s %10s %10s %10s" % ["stage", "count", "avg(us)", "p50(us)", "p99(us)", "max(us)"]]
+    STAGES.each do |stage|
+      s = stats[stage]
+      if(s.nil?)
+        next
+      end
+
+      result << "%-16s %10d %10d %10s %10s %10d" % [stage, s[:count], s[:total] / s[:count], "<#{percentile(s, 50)}", "<#{percentile(s, 99)}", s[:max]]
+    end
+
+    return result.join("\n")
+  end
+
+  def StageTimer.histogram(stage)
+    s = snapshot()[stage.to_sym]
+    if(s.nil?)
+      return "Nothing recorded for stage '#{stage}'"
+    end
+
+    biggest = s[:buckets].max()
+    result = []
+    s[:buckets].each_with_index do |n, b|
+      if(n == 0)
+        next
+      end
+
+      low  = (b == 0) ? 0 : (1 << (b - 1))
+      high = (b == BUCKETS - 1) ? "+" : (1 << b).to_s()
+      result << "%8d - %-8s us: %8d %s" % [low, high, n, "#" * ((n * 40.0) / biggest).ceil()]
+    end
+
+    return result.join("\n")
+  end
+
+  # Called from the request path; logs a one-line summary every @@interval
+  # seconds (so we don't need a thread of our own)
+  def StageTimer.report_if_needed()
+    if(@@interval <= 0 || (now() - @@last_report) < @@interval)
+      return
+    end
+    @@last_report = now()
+
+    stats = snapshot()
+    line = STAGES.select { |stage| !stats[stage].nil? }.map do |stage|
+      "#{stage}=#{stats[stage][:total] / stats[stage][:count]}us"
+    end
+
+    Log.PRINT(nil, "Stage timing (avg): #{line.join(", ")}")
+  end
+end
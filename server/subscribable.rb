@@ -6,6 +6,8 @@
 # See: LICENSE.txt
 ##
 
+require 'stage_timer'
+
 module Subscribable
   def initialize_subscribables()
     @subscribers = []
@@ -38,9 +40,11 @@ module Subscribable
   def notify_subscribers(method, args)
     @subscribers = @subscribers || []
 
-    @subscribers.each do |subscriber|
-      if(subscriber.respond_to?(method))
-        subscriber.method(method).call(*args)
+    StageTimer.time(:notify) do
+      @subscribers.each do |subscriber|
+        if(subscriber.respond_to?(method))
+          subscriber.method(method).call(*args)
+        end
       end
     end
   end
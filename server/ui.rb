@@ -251,6 +251,16 @@ class Ui
     ui.ack(data)
   end
 
+  # The client half-closed the session (OPT_HALF_CLOSE): it won't send any
+  # more, but we still can
+  def session_data_finished(id)
+    ui = @uis[id]
+    if(ui.nil?)
+      raise(DnscatException, "Couldn't find session: #{id}")
+    end
+    ui.output("(the client has finished sending; the session stays open till it's killed)")
+  end
+
   def session_destroyed(id)
     ui = @uis[id]
     if(ui.nil?)
@@ -4,8 +4,16 @@
 
 require 'readline'
 
+require 'command_packet'
+require 'fleet'
+require 'flight_recorder'
 require 'log'
+require 'memory_stats'
 require 'parser'
+require 'payload'
+require 'relay'
+require 'resolver_stats'
+require 'stage_timer'
 require 'ui_handler'
 require 'ui_interface'
 
@@ -171,6 +179,142 @@ class UiCommand < UiInterface
       end
     )
 
+    register_command("stats",
+      Trollop::Parser.new do
+        banner("Shows how long each stage of the request path takes (stats [stage] for a histogram), the traffic from each DNS resolver (stats resolvers), or the memory held by each session (stats memory)")
+        opt :reset, "Reset the statistics", :type => :boolean, :required => false
+      end,
+
+      Proc.new do |opts, optarg|
+        if(opts[:reset])
+          StageTimer.reset()
+          ResolverStats.reset()
+          MemoryStats.reset()
+          puts("Statistics reset")
+        elsif(optarg.nil? || optarg == "")
+          puts(StageTimer.to_s())
+          puts()
+          prepared = Session.prepared_stats()
+          puts("Responses to MSGs: %d prepared ahead of time, %d built when the MSG came in" % [prepared[:used], prepared[:built]])
+          puts("(notify happens inside of handle, so it's counted in both)")
+        elsif(optarg == "resolvers")
+          puts(ResolverStats.to_s())
+          puts()
+          puts("(dup is the share of queries that repeated a recent one, which means the resolver retried)")
+        elsif(optarg == "memory")
+          puts(MemoryStats.to_s(SessionManager.list().keys))
+          puts()
+          puts("(outgoing payloads can be shared between sessions, so they're counted once in the total; 'set memory_limit=<bytes>' caps new outgoing data)")
+        elsif(!StageTimer::STAGES.include?(optarg.to_sym))
+          puts("Unknown stage; known stages are: #{StageTimer::STAGES.join(", ")}")
+        else
+          puts(StageTimer.histogram(optarg))
+        end
+      end
+    )
+
+    register_command("flightrecorder",
+      Trollop::Parser.new do
+        banner("Write the recent packet events to a file (flightrecorder [filename]); see doc/flight_recorder.txt")
+      end,
+
+      Proc.new do |opts, optarg|
+        filename = (optarg.nil? || optarg == "") ? FlightRecorder.file : optarg
+
+        if(filename.nil?)
+          puts("Usage: flightrecorder <filename> (or set flight_recorder=<filename>)")
+        else
+          begin
+            count = FlightRecorder.dump(filename)
+            puts("Wrote #{count} events (of #{FlightRecorder.total} recorded) to #{filename}")
+          rescue => e
+            error("Couldn't write the flight recorder: #{e}")
+          end
+        end
+      end
+    )
+
+    register_command("fleet",
+      Trollop::Parser.new do
+        banner("Send a command to many command sessions at once, and collect the results. Usage: fleet [options] <ping | exec <command> | run <command> | download <remote> | upload <local> <remote> | config <name>=<value> ...>; with no command, lists the fleet jobs")
+        opt :sessions, "Only these sessions (comma-separated ids)", :type => :string, :required => false
+        opt :name,     "Only sessions whose name matches this regex", :type => :string, :required => false
+        opt :dir,      "Where to save the results (default: fleet-<job>)", :type => :string, :required => false
+      end,
+
+      Proc.new do |opts, optarg|
+        action, arg = optarg.split(" ", 2)
+
+        if(action.nil?)
+          if(Fleet.jobs.length == 0)
+            puts("No fleet jobs have been started")
+          end
+          Fleet.jobs.each do |job|
+            puts(job.to_s)
+          end
+          next
+        end
+
+        sessions = fleet_sessions(opts)
+        if(sessions.length == 0)
+          error("No command sessions match!")
+          next
+        end
+
+        dir = opts[:dir] || ("fleet-%d" % (Fleet.jobs.length + 1))
+
+        begin
+          job = fleet_dispatch(sessions, action, arg, dir)
+        rescue SystemCallError => e
+          error("Couldn't start the fleet job: #{e}")
+          next
+        end
+
+        if(job.nil?)
+          puts("Usage: fleet [options] <ping | exec <command> | run <command> | download <remote> | upload <local> <remote> | config <name>=<value> ...>")
+        else
+          puts("Fleet job #{job.id}: sent '#{job.description}' to #{sessions.length} sessions; results go in #{dir}")
+        end
+      end
+    )
+
+    register_command("forward",
+      Trollop::Parser.new do
+        banner("Connect a session to a TCP host:port, so its data goes there instead of the screen (forward <session_id> <host>:<port>); with no arguments, lists the relayed sessions")
+      end,
+
+      Proc.new do |opts, optarg|
+        id, dest = optarg.split(" ", 2)
+
+        if(id.nil?)
+          if(Relay.list().length == 0)
+            puts("No sessions are being relayed")
+          end
+          Relay.list().each do |relay|
+            puts(relay.to_s)
+          end
+          next
+        end
+
+        ui = @ui.get_by_id(id.to_i)
+        match = dest.nil? ? nil : dest.match(/\A\[?([^\[\]]+)\]?:(\d+)\z/)
+        if(match.nil?)
+          puts("Usage: forward <session_id> <host>:<port>")
+        elsif(ui.nil? || !ui.active?())
+          error("Session #{id} not found!")
+        elsif(ui.session.is_command)
+          error("Command sessions can't be relayed")
+        else
+          begin
+            Relay.forward(ui.session, match[1], match[2].to_i)
+            puts("Relaying session #{id} to #{dest}")
+          rescue DnscatException => e
+            error(e.to_s)
+          end
+        end
+      end
+    )
+
     register_command("kill",
       Trollop::Parser.new do
         banner("Terminate a session")
@@ -190,6 +334,74 @@ class UiCommand < UiInterface
     )
   end
 
+  # The sessions behind the active command windows that match the fleet
+  # command's filters
+  def fleet_sessions(opts)
+    ids = opts[:sessions].nil? ? nil : opts[:sessions].split(/,/).map { |id| id.to_i() }
+    name = opts[:name].nil? ? nil : Regexp.new(opts[:name])
+    sessions = []
+
+    @ui.each_ui do |ui|
+      if(!ui.is_a?(UiSessionCommand) || !ui.active?())
+        next
+      end
+      if(!ids.nil? && !ids.include?(ui.id))
+        next
+      end
+      if(!name.nil? && ui.session.name !~ name)
+        next
+      end
+
+      sessions << ui.session
+    end
+
+    return sessions
+  end
+
+  # Returns the job, or nil if the command was bad
+  def fleet_dispatch(sessions, action, arg, dir)
+    if(action == "ping")
+      return Fleet.dispatch(sessions, CommandPacket::COMMAND_PING, "ping", dir) do |request_id|
+        CommandPacket.create_ping_request(request_id, "fleet ping")
+      end
+    elsif(action == "exec" && !arg.nil?)
+      return Fleet.dispatch(sessions, CommandPacket::COMMAND_EXEC, "exec #{arg}", dir) do |request_id|
+        CommandPacket.create_exec_request(request_id, Fleet::EXEC_PREFIX + arg, arg)
+      end
+    elsif(action == "run" && !arg.nil?)
+      return Fleet.dispatch(sessions, CommandPacket::COMMAND_RUN, "run #{arg}", dir) do |request_id|
+        CommandPacket.create_run_request(request_id, arg, 0, 60)
+      end
+    elsif(action == "download" && !arg.nil?)
+      return Fleet.dispatch(sessions, CommandPacket::COMMAND_DOWNLOAD, "download #{arg}", dir, File.basename(arg)) do |request_id|
+        CommandPacket.create_download_request(request_id, arg)
+      end
+    elsif(action == "config" && !arg.nil?)
+      settings = UiSessionCommand.parse_config(arg)
+      if(settings.nil?)
+        return nil
+      end
+
+      return Fleet.dispatch(sessions, CommandPacket::COMMAND_CONFIG, "config #{arg}", dir) do |request_id|
+        CommandPacket.create_config_request(request_id, settings)
+      end
+    elsif(action == "upload" && !arg.nil?)
+      local_file, remote_file = Shellwords.shellwords(arg)
+      if(remote_file.nil?)
+        return nil
+      end
+
+      # Read it before starting the job, so a bad filename doesn't leave a job
+      # behind
+      payload = Payload.from_file(local_file)
+      return Fleet.dispatch(sessions, CommandPacket::COMMAND_UPLOAD, "upload #{arg}", dir) do |request_id|
+        [CommandPacket.create_upload_request_header(request_id, remote_file, payload.length), payload]
+      end
+    end
+
+    return nil
+  end
+
   def do_show_options()
     @ui.settings.each_pair do |name, value|
       puts("#{name} => #{value}")
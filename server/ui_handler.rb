@@ -21,6 +21,19 @@ module UiHandler
     end
   end
 
+  # For a session that was established before we found out it was ours
+  def claim_ui(ui)
+    if(!ui.parent.nil?)
+      ui.parent.release_ui(ui)
+    end
+    @uis << ui
+    ui.parent = self
+  end
+
+  def release_ui(ui)
+    @uis.delete(ui)
+  end
+
   def pending_count()
     return @pending.length
   end
@@ -6,6 +6,8 @@
 # See LICENSE.txt
 ##
 
+require 'memory_stats'
+
 class UiInterface
   attr_accessor :parent
 
@@ -48,6 +50,7 @@ class UiInterface
       @activity = true
     end
     @history += data
+    MemoryStats.set(@id, :history, @history.bytesize)
   end
 
   def puts(data = nil)
@@ -62,6 +65,7 @@ class UiInterface
     end
 
     @history += "\n"
+    MemoryStats.set(@id, :history, @history.bytesize)
   end
 
   def feed(data)
@@ -8,7 +8,12 @@
 
 require 'command_packet_stream'
 require 'command_packet'
+require 'control'
+require 'fleet'
+require 'memory_stats'
 require 'parser'
+require 'payload'
+require 'session'
 require 'ui_handler'
 require 'ui_interface_with_id'
 
@@ -96,12 +101,14 @@ class UiSessionCommand < UiInterfaceWithId
       Trollop::Parser.new do
         banner("Spawn a shell on the remote host")
         opt :name, "Name", :type => :string, :required => false, :default => nil
+        opt :screen, "Send screen updates instead of all output (for top, tail -f, etc)", :type => :boolean, :required => false, :default => false
       end,
 
       Proc.new do |opts|
         name = opts[:name] || "executing a shell"
+        flags = opts[:screen] ? CommandPacket::SHELL_FLAG_SCREEN : 0
 
-        packet = CommandPacket.create_shell_request(request_id(), name)
+        packet = CommandPacket.create_shell_request(request_id(), name, flags)
         @session.queue_outgoing(packet)
         puts("Sent request to execute a shell")
       end,
@@ -112,18 +119,73 @@ class UiSessionCommand < UiInterfaceWithId
         banner("Execute a program on the remote host")
         opt :command, "Command", :type => :string, :required => false, :default => nil
         opt :name,    "Name",    :type => :string, :required => false, :default => nil
+        opt :screen,  "Send screen updates instead of all output (for top, tail -f, etc)", :type => :boolean, :required => false, :default => false
+        opt :upload,  "Upload the output in parallel chunks, and save it to this file", :type => :string, :required => false, :default => nil
+        opt :inline,  "Run it to completion and print its output and exit status here, instead of creating a session", :type => :boolean, :required => false, :default => false
+        opt :limit,   "With --inline, the most output to keep from stdout and from stderr (0 = the client's default, 64KB)", :type => :integer, :required => false, :default => 0
+        opt :timeout, "With --inline, kill the command after this many seconds (0 = never)", :type => :integer, :required => false, :default => 30
       end,
 
       Proc.new do |opts, optarg|
         command = opts[:command] || optarg
         name    = opts[:name]    || ("executing %s" % command)
+        flags   = opts[:screen] ? CommandPacket::SHELL_FLAG_SCREEN : 0
+
+        if(opts[:inline])
+          if(command == "")
+            puts("No command given!")
+          else
+            id = request_id()
+            @runs[id] = command
+            @session.queue_outgoing(CommandPacket.create_run_request(id, command, opts[:limit], [opts[:timeout], 0xFFFF].min()))
+            puts("Sent request to run #{command}")
+          end
+          next
+        end
 
         if(command == "")
           puts("No command given!")
+          next
+        end
+
+        # The session's name doubles as the upload's filename, and the upload
+        # is only accepted under a name we're expecting
+        if(!opts[:upload].nil?)
+          name = Session.expect_upload(opts[:upload])
+          if(name.nil?)
+            puts("Bad upload name: #{opts[:upload]}")
+            next
+          end
+
+          flags |= CommandPacket::SHELL_FLAG_UPLOAD
+          puts("The output will be saved to #{File.join(Session.upload_dir, name)}")
+        end
+
+        packet = CommandPacket.create_exec_request(request_id(), name, command, flags)
+        @session.queue_outgoing(packet)
+        puts("Sent request to execute #{opts[:command]}")
+      end,
+    )
+
+    register_command("config",
+      Trollop::Parser.new do
+        banner("Change how the client talks to us, without restarting it. Usage: config <name>=<value> [<name>=<value> ...]; with no arguments, lists the settings")
+      end,
+
+      Proc.new do |opts, optarg|
+        settings = UiSessionCommand.parse_config(optarg)
+
+        if(settings.nil?)
+          puts("Usage: config <name>=<value> [<name>=<value> ...]")
+          puts()
+          puts("Settings:")
+          CommandPacket::CONFIG_SETTINGS.each_pair do |name, description|
+            puts("- #{name}: #{description}")
+          end
         else
-          packet = CommandPacket.create_exec_request(request_id(), name, command)
+          packet = CommandPacket.create_config_request(request_id(), settings)
           @session.queue_outgoing(packet)
-          puts("Sent request to execute #{opts[:command]}")
+          puts("Sent new settings to the client")
         end
       end,
     )
@@ -215,11 +277,20 @@ class UiSessionCommand < UiInterfaceWithId
         if(local_file.nil? || local_file == "" || remote_file.nil? || remote_file == "")
           puts("Usage: upload <from> <to>")
         else
-          data = IO.read(local_file)
+          # Every session uploading the same file shares one copy of it
+          begin
+            payload = Payload.from_file(local_file)
+          rescue SystemCallError => e
+            error("Couldn't read #{local_file}: #{e}")
+            next
+          end
 
-          packet = CommandPacket.create_upload_request(request_id(), remote_file, data)
-          @session.queue_outgoing(packet)
-          puts("Attempting to upload #{local_file} to #{remote_file}")
+          # The header and the file go together, or not at all
+          if(@session.queue_outgoing([CommandPacket.create_upload_request_header(request_id(), remote_file, payload.length), payload]))
+            puts("Attempting to upload #{local_file} to #{remote_file}")
+          else
+            error("Couldn't queue the upload; see 'stats memory'")
+          end
         end
       end
     )
@@ -234,10 +305,11 @@ class UiSessionCommand < UiInterfaceWithId
     @id = id
     @session = session
     @ui = ui
-    @stream = CommandPacketStream.new()
+    @stream = CommandPacketStream.new(id)
     @request_id = 0x0001
     @pings = {}
     @downloads = {}
+    @runs = {} # request_id => command, for 'exec --inline'
 
     register_commands()
 
@@ -265,10 +337,17 @@ class UiSessionCommand < UiInterfaceWithId
     end
   end
 
-  # Handles any response that contains a new session id (shell and exec, initially)
+  # Handles any response that contains a new session id (shell and exec,
+  # initially); the client answers once the session is established, so it
+  # usually exists already
   def handle_session_response(packet)
-    # Globally create the session
-    add_pending(packet.session_id)
+    ui = @ui.get_by_id(packet.session_id)
+    if(ui.nil?)
+      add_pending(packet.session_id)
+    else
+      claim_ui(ui)
+      puts("New session established: #{packet.session_id}")
+    end
   end
 
   def handle_shell_response(packet)
@@ -303,6 +382,32 @@ class UiSessionCommand < UiInterfaceWithId
     puts("File uploaded!")
   end
 
+  def handle_config_response(packet)
+    puts("The client accepted the new settings!")
+  end
+
+  def handle_run_response(packet)
+    command = @runs.delete(packet.request_id) || "(unknown)"
+
+    puts("Output of #{command}:")
+    if(packet.out.length > 0)
+      puts(packet.out)
+    end
+    if(packet.err.length > 0)
+      puts("stderr:")
+      puts(packet.err)
+    end
+
+    notes = []
+    if((packet.flags & CommandPacket::RUN_FLAG_TRUNCATED) != 0)
+      notes << "output truncated"
+    end
+    if((packet.flags & CommandPacket::RUN_FLAG_TIMED_OUT) != 0)
+      notes << "killed after timing out"
+    end
+    puts("Exit status: %d%s" % [packet.exit_status, notes.empty? ? "" : " (#{notes.join(", ")})"])
+  end
+
   def handle_error_response(packet)
     Log.ERROR(@id, "Client responded with error #{packet.status}: #{packet.reason}")
   end
@@ -310,6 +415,12 @@ class UiSessionCommand < UiInterfaceWithId
   def feed(data)
     @stream.feed(data, false) do |packet|
       if(packet.is_response?())
+        # Responses to requests sent with the 'fleet' command, or over the
+        # control socket, are collected over there
+        if(Fleet.handle_response(@id, packet) || Control.handle_response(@id, packet))
+          next
+        end
+
         if(packet.command_id == CommandPacket::COMMAND_PING)
           handle_ping_response(packet)
         elsif(packet.command_id == CommandPacket::COMMAND_SHELL)
@@ -320,6 +431,10 @@ class UiSessionCommand < UiInterfaceWithId
           handle_download_response(packet)
         elsif(packet.command_id == CommandPacket::COMMAND_UPLOAD)
           handle_upload_response(packet)
+        elsif(packet.command_id == CommandPacket::COMMAND_CONFIG)
+          handle_config_response(packet)
+        elsif(packet.command_id == CommandPacket::COMMAND_RUN)
+          handle_run_response(packet)
         elsif(packet.command_id == CommandPacket::COMMAND_ERROR)
           handle_error_response(packet)
         else
@@ -345,23 +460,48 @@ class UiSessionCommand < UiInterfaceWithId
   end
 
   def to_s()
+    # What the session's holding on to (see memory_stats.rb)
+    held = ":: [%s held]" % MemoryStats.format(MemoryStats.held(@id))
+
     if(active?())
       idle = Time.now() - @last_seen
       if(idle > 120)
-        return "%ssession %d :: %s :: [idle for over two minutes; probably dead]" % [activity_indicator(), @id, @session.name]
+        return "%ssession %d :: %s :: [idle for over two minutes; probably dead] %s" % [activity_indicator(), @id, @session.name, held]
       elsif(idle > 5)
-        return "%ssession %d :: %s :: [idle for %d seconds]" % [activity_indicator(), @id, @session.name, idle]
+        return "%ssession %d :: %s :: [idle for %d seconds] %s" % [activity_indicator(), @id, @session.name, idle, held]
       else
-        return "%ssession %d :: %s" % [activity_indicator(), @id, @session.name]
+        return "%ssession %d :: %s %s" % [activity_indicator(), @id, @session.name, held]
       end
     else
-      return "%ssession %d :: %s :: [closed]" % [activity_indicator(), @id, @session.name]
+      return "%ssession %d :: %s :: [closed] %s" % [activity_indicator(), @id, @session.name, held]
     end
   end
 
+  # Turns "name=value name=value" into a hash; returns nil if it's empty or
+  # there's anything we don't know about
+  def UiSessionCommand.parse_config(str)
+    settings = {}
+
+    Shellwords.shellwords(str).each do |arg|
+      name, value = arg.split(/=/, 2)
+      if(value.nil? || CommandPacket::CONFIG_SETTINGS[name].nil?)
+        return nil
+      end
+      settings[name] = value
+    end
+
+    return settings.empty?() ? nil : settings
+  end
+
   def request_id()
     id = @request_id
-    @request_id += 1
+
+    # The top half of the request ids belong to Fleet
+    @request_id = (@request_id + 1) % Fleet::FIRST_REQUEST_ID
+    if(@request_id == 0)
+      @request_id = 1
+    end
+
     return id
   end
 end
@@ -2,6 +2,10 @@
 # By Ron Bowes
 # Created July 4, 2013
 
+require 'io/console'
+require 'memory_stats'
+require 'predictor'
+require 'screen'
 require 'ui_interface_with_id'
 
 class UiSessionInteractive < UiInterfaceWithId
@@ -17,6 +21,13 @@ class UiSessionInteractive < UiInterfaceWithId
     @session  = session
     @ui = ui
 
+    # Sessions with OPT_SCREEN send screen frames instead of raw output
+    @screen = session.is_screen ? Screen.new() : nil
+
+    # Only set while we're attached with 'local_echo' on
+    @predictor = nil
+    @predicted_rows = {}
+
 #    auto_command = @ui.settings.get("auto_command")
 #    if(!auto_command.nil? && auto_command.length > 0)
 #      @session.queue_outgoing(auto_command + "\n")
@@ -24,23 +35,36 @@ class UiSessionInteractive < UiInterfaceWithId
   end
 
   def to_s()
+    # What the session's holding on to (see memory_stats.rb)
+    held = ":: [%s held]" % MemoryStats.format(MemoryStats.held(@id))
+
     if(active?())
       idle = Time.now() - @last_seen
       if(idle > 120)
-        return "%ssession %d :: %s :: [idle for over two minutes; probably dead]" % [activity_indicator(), @id, @session.name]
+        return "%ssession %d :: %s :: [idle for over two minutes; probably dead] %s" % [activity_indicator(), @id, @session.name, held]
       elsif(idle > 5)
-        return "%ssession %d :: %s :: [idle for %d seconds]" % [activity_indicator(), @id, @session.name, idle]
+        return "%ssession %d :: %s :: [idle for %d seconds] %s" % [activity_indicator(), @id, @session.name, idle, held]
       else
-        return "%ssession %d :: %s" % [activity_indicator(), @id, @session.name]
+        return "%ssession %d :: %s %s" % [activity_indicator(), @id, @session.name, held]
       end
     else
-      return "%ssession %d :: %s :: [closed]" % [activity_indicator(), @id, @session.name]
+      return "%ssession %d :: %s :: [closed] %s" % [activity_indicator(), @id, @session.name, held]
     end
   end
 
   def attach()
     super
 
+    # The setting is checked each time, so it can be changed on the fly
+    if(@ui.settings.get("local_echo"))
+      @predictor = Predictor.new()
+    end
+
+    # Redraw the whole screen, since the history doesn't contain it
+    if(!@screen.nil?)
+      $stdout.print(@screen.render(true))
+    end
+
     if(!active?())
       Log.WARNING(@id, "This session is closed!")
       return false
@@ -49,7 +73,22 @@ class UiSessionInteractive < UiInterfaceWithId
     return true
   end
 
+  def detach()
+    super
+
+    @predictor = nil
+  end
+
   def go
+    if(@predictor.nil?)
+      go_line()
+    else
+      go_char()
+    end
+  end
+
+  # Read a line at a time with Readline; the default
+  def go_line()
     line = Readline::readline("", true)
 
     if(line.nil?)
@@ -63,11 +102,52 @@ class UiSessionInteractive < UiInterfaceWithId
     @session.queue_outgoing(line)
   end
 
+  # Send each keystroke as it's typed, and draw a guess at the echo
+  def go_char()
+    c = $stdin.getch(:intr => true)
+    if(c.nil?)
+      return
+    end
+
+    # Enter shows up as "\r" in raw mode, but shells on pipes want "\n"
+    @session.queue_outgoing(c == "\r" ? "\n" : c)
+
+    display = @predictor.keystroke(c)
+    if(@screen.nil?)
+      print(display)
+    else
+      # Screen frames redraw whole rows, so there's nothing to reconcile; just
+      # draw the guess and redraw its row when the next frame shows up
+      if(c !~ /[\r\n]/ && display != "")
+        $stdout.print(display.sub(Predictor::SAVE_CURSOR, ''))
+        @predicted_rows[@screen.cursor_row] = true
+      end
+      @predictor.reset()
+    end
+  end
+
   def feed(data)
     seen()
 
-    print(data)
+    if(@screen.nil?)
+      # The terminal is in raw mode while we wait for a keystroke, so newlines
+      # need a carriage return
+      if(!@predictor.nil?)
+        data = @predictor.reconcile(data.gsub(/\r?\n/, "\r\n"))
+      end
+
+      print(data)
+    else
+      full, rows = @screen.feed(data)
 
+      # Don't put the frames in the history; attach() redraws the screen
+      if(attached?())
+        $stdout.print(@screen.render(full, (rows + @predicted_rows.keys()).uniq()))
+        @predicted_rows = {}
+      else
+        @activity = true
+      end
+    end
   end
 
   def output(str)